@@ -1,6 +1,10 @@
+#include "src/Game/Components/Plant.hpp"
+#include "src/Game/Components/PlayerController.hpp"
 #include "src/Game/Game.hpp"
+#include "src/Game/Scheduler.hpp"
 #include "src/Game/LevelParser.hpp"
 #include "src/InputEngine/Input.hpp"
+#include "src/JobSystem.hpp"
 #include "src/RenderEngine/GraphicsDevice.hpp"
 #include "src/RenderEngine/GraphicsInstance.hpp"
 #include "src/RenderEngine/Pipeline/Pipeline.hpp"
@@ -13,10 +17,17 @@
 int main() {
   if (!Input::initialize()) GraphicsInstance::showSDLError();
   GraphicsInstance::create({VK_EXT_DEBUG_UTILS_EXTENSION_NAME});
+  JobSystem::initialize();  // The GraphicsDevice compiles its shaders on the worker threads.
   {
     GraphicsDevice graphicsDevice{std::filesystem::canonical("../res/graphicsData.json")};
 
-    Entity::registerComponentConstructor("MeshGroup", [&graphicsDevice](std::uint64_t id, Entity& entity, yyjson_val* json){ return std::make_shared<MeshGroup>(id, entity, &graphicsDevice, json); });
+    Entity::registerComponentConstructor("MeshGroup", [&graphicsDevice](std::uint64_t id, Entity& entity, yyjson_val* json){ return ECS::emplace<MeshGroup>(id, entity, &graphicsDevice, json); });
+
+    // Declare the Systems. PlayerController touches shared state (Input), so it ticks its Components on one thread.
+    Scheduler::addSystem<ComponentSystem<PlayerController>>(std::vector{ECS::typeId<Input>()}, std::vector{ECS::typeId<TransformHierarchy>()});
+    Scheduler::addSystem<ComponentSystem<Plant>>(std::vector<ECS::TypeId>{}, std::vector<ECS::TypeId>{}, 256);
+    Scheduler::addSystem<TransformSystem>();
+    Scheduler::addSystem<MeshGroupSystem>();
 
     // Declare the window
     Window window{&graphicsDevice};
@@ -42,6 +53,7 @@ int main() {
 
     do {
       graphicsDevice.update();
+      renderGraph.bake();  // Only does anything if shaders or processes were reloaded
       // Make sure that the CPU is not getting too far ahead of the GPU
       VkSemaphore frameDataSemaphore = renderGraph.waitForNextFrameData();
       // Make sure that the GPU is appropriately waiting for the display (V-Sync)
@@ -52,6 +64,7 @@ int main() {
       // Tell the GPU to show the final image when it has finished rendering this frame
       window.present();
     } while (Game::tick());
+    Game::clear();
   }
   GraphicsInstance::destroy();
   return 0;
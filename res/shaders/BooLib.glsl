@@ -14,4 +14,16 @@
  * Per Material descriptor set bindings *
  ****************************************/
 
-#define PER_MATERIAL_SET 2
\ No newline at end of file
+#define PER_MATERIAL_SET 2
+
+/***********************
+ * Vertex data helpers *
+ ***********************/
+
+// Reverses the octahedral encoding of the normals and tangents of the Packed vertex layout.
+vec3 octahedralDecode(vec2 encoded) {
+    vec3 direction = vec3(encoded, 1 - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-direction.z, 0);
+    direction.xy += mix(vec2(fold), vec2(-fold), greaterThanEqual(direction.xy, vec2(0)));
+    return normalize(direction);
+}
\ No newline at end of file
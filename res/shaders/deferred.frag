@@ -21,6 +21,7 @@ layout (location = 0) out vec4 renderColor;
 const float maxBias = 1.0 / 1024;  // The shadowMap's resolution is 1024x1024, so 1.0 / 1024 = the width of one texel in the shadowMap's Image Space.
 const vec3 lightColor = vec3(1);  // The color of the light.
 const float ambientLight = 0.05;  // The base light factor to add unconditionally. This is not effected by lightColor, and *can* make the output of the shader go above 1.0.
+layout (constant_id = 0) const int shadowFilterRadius = 0;  // The radius in texels of the square of shadowMap texels to average. 0 takes a single sample. Set by the Material when its pipeline is created, so the loop below is unrolled.
 
 void main() {
     renderColor = subpassLoad(gBufferAlbedo);
@@ -32,7 +33,7 @@ void main() {
      *************************************************************************/
     vec4 shadowMapPosition = lightData.light_ViewProjectionMatrix * position;  // Transform the world space position of the fragment to the light's Clip Space.
     shadowMapPosition /= shadowMapPosition.w;  // Transform the fragment's light Clip Space position into the light's NDC Space using perspective division (Not actually needed when using orthographic projection when rendering the shadow map because in that case w is 1).
-    float shadowDepth = texture(shadowMap, (shadowMapPosition.xy + 1.0) / 2.0).x;  // Transform the fragment's light NDC Space position into the shadowMap's Image Space. ShadowDepth is in the light's NDC Space.
+    vec2 shadowMapCoordinates = (shadowMapPosition.xy + 1.0) / 2.0;  // Transform the fragment's light NDC Space position into the shadowMap's Image Space.
 
     /***************************
      * Compute the shadow bias *
@@ -45,13 +46,15 @@ void main() {
     /*****************************************
      * Compute the lighting on this fragment *
      *****************************************/
-    vec3 light = vec3(0);
-    if (shadowMapPosition.z < shadowDepth) {  // Both shadowMapPosition.z and shadowDepth are in the light view's NDC and the shadowMapPosition.z has already had the bias applied, so we can directly compare them.
-        /*********************************************************
-         * The fragment is in the light, so compute the lighting *
-         *********************************************************/
-        float lightIntensity = cosine_Normal_fragmentToLight;  // Decrease the light intensity with the angle at which it hits the surface.
-        light = lightColor * lightIntensity;  // The light value is the light's color times the light's intensity.
+    float lit = 0;  // The fraction of the sampled shadowMap texels that this fragment is in front of.
+    for (int x = -shadowFilterRadius; x <= shadowFilterRadius; ++x) {
+        for (int y = -shadowFilterRadius; y <= shadowFilterRadius; ++y) {
+            float shadowDepth = texture(shadowMap, shadowMapCoordinates + vec2(x, y) * maxBias).x;  // ShadowDepth is in the light's NDC Space. maxBias is also the width of one texel.
+            lit += float(shadowMapPosition.z < shadowDepth);  // Both shadowMapPosition.z and shadowDepth are in the light view's NDC and the shadowMapPosition.z has already had the bias applied, so we can directly compare them.
+        }
     }
+    lit /= float((2 * shadowFilterRadius + 1) * (2 * shadowFilterRadius + 1));
+    float lightIntensity = cosine_Normal_fragmentToLight * lit;  // Decrease the light intensity with the angle at which it hits the surface, and with how much of the fragment is in shadow.
+    vec3 light = lightColor * lightIntensity;  // The light value is the light's color times the light's intensity.
     renderColor *= vec4(light + ambientLight, 1);  // Add ambient light and multiply by albedo to compute final color.
 }
\ No newline at end of file
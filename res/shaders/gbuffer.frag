@@ -15,13 +15,22 @@ layout (location = 1) out vec3 gBufferPosition;
 layout (location = 2) out vec3 gBufferNormal;
 layout (location = 3) out float gBufferMaterialID;
 
+// Set by each Material when its pipeline is created, so the alpha test is compiled out of every pipeline that does not need it.
+layout (constant_id = 0) const uint alphaMode = 0;  // Follows fastgltf::AlphaMode: 0 = opaque, 1 = mask, 2 = blend.
+layout (constant_id = 1) const float alphaCutoff = 0.5;
+const uint ALPHA_MODE_MASK = 1;
+
 void main() {
     gBufferAlbedo = texture(albedo, inTextureCoordinates);
+    if (alphaMode == ALPHA_MODE_MASK && gBufferAlbedo.a < alphaCutoff) discard;
     gBufferPosition = inWorldSpacePosition;
     vec3 N = normalize(inNormal);
     vec3 T = normalize(inTangent);
     vec3 B = cross(N, T);
     mat3 TBN = mat3(T, B, N);
-    gBufferNormal = TBN * normalize(texture(normal, inTextureCoordinates).xyz);
+    // Normal maps may only store x and y, as BC5 does, so z is always rebuilt from them.
+    vec2 tangentNormalXY = texture(normal, inTextureCoordinates).xy * 2 - 1;
+    vec3 tangentNormal = vec3(tangentNormalXY, sqrt(max(1 - dot(tangentNormalXY, tangentNormalXY), 0)));
+    gBufferNormal = TBN * normalize(tangentNormal);
     gBufferMaterialID = inMaterialID;
 }
\ No newline at end of file
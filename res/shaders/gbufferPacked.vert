@@ -0,0 +1,29 @@
+#version 460
+#include "BooLib.glsl"
+
+// Reads the Packed vertex layout.
+layout (location = 0) in vec3 inPosition;
+layout (location = 1) in vec2 inTextureCoordinates;
+layout (location = 2) in vec2 inNormal;   // Octahedral encoded
+layout (location = 3) in vec2 inTangent;  // Octahedral encoded
+layout (location = 4) in mat4 inModelMatrix;  // Consumes locations 4, 5, 6, and 7
+layout (location = 8) in float inMaterialID;
+
+layout (set=PER_PASS_SET, binding=0) uniform PassData {
+    mat4 viewProjectionMatrix;
+} passData;
+
+layout (location = 0) out vec3 outWorldSpacePosition;
+layout (location = 1) out vec2 outTextureCoordinates;
+layout (location = 2) out vec3 outNormal;
+layout (location = 3) out vec3 outTangent;
+layout (location = 4) flat out float outMaterialID;
+
+void main() {
+    outWorldSpacePosition = (inModelMatrix * vec4(inPosition, 1)).xyz;
+    outTextureCoordinates = inTextureCoordinates;
+    outNormal = octahedralDecode(inNormal);
+    outTangent = octahedralDecode(inTangent);
+    outMaterialID = inMaterialID;
+    gl_Position = passData.viewProjectionMatrix * vec4(outWorldSpacePosition, 1);
+}
\ No newline at end of file
@@ -9,3 +9,7 @@ Component::~Component() = default;
 std::uint64_t Component::getId() const {
   return id;
 }
+
+std::uint32_t Component::getTypeId() const {
+  return typeId;
+}
\ No newline at end of file
@@ -4,9 +4,13 @@
 #include <utility>
 #include <memory>
 
+class ECS;
 class Entity;
 
 class Component {
+  std::uint32_t typeId{};
+  friend ECS;
+
 protected:
   std::uint64_t id;
   Entity& entity;
@@ -22,4 +26,5 @@ public:
   virtual void onTick() = 0;
 
   [[nodiscard]] std::uint64_t getId() const;
+  [[nodiscard]] std::uint32_t getTypeId() const;
 };
\ No newline at end of file
@@ -0,0 +1,7 @@
+#include "ECS.hpp"
+
+std::vector<std::unique_ptr<ECS::StorageBase>> ECS::storages{};
+
+void ECS::erase(Component* component) {
+  storages[component->getTypeId()]->erase(component);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Component.hpp"
+
+#include <plf_colony.h>
+
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * Owns every Component in the game. Components of the same type are stored together in a chunked <c>plf::colony</c>, so
+ * iterating over all Components of a type walks densely packed memory rather than chasing one heap allocation per Component.
+ * Pointers to Components remain valid until that Component is erased.
+ */
+class ECS {
+public:
+  using TypeId = std::uint32_t;
+
+private:
+  struct StorageBase {
+    virtual ~StorageBase() = default;
+
+    virtual void erase(Component* component) = 0;
+  };
+
+  template<typename T> struct Storage final : StorageBase {
+    plf::colony<T> components;
+
+    void erase(Component* component) override { components.erase(components.get_iterator(static_cast<T*>(component))); }
+  };
+
+  static std::vector<std::unique_ptr<StorageBase>> storages;
+  inline static std::atomic<TypeId> nextTypeId{};
+
+  template<typename T> static Storage<T>& getStorage() {
+    const TypeId id = typeId<T>();
+    if (storages.size() <= id) storages.resize(id + 1);
+    if (storages[id] == nullptr) storages[id] = std::make_unique<Storage<T>>();
+    return *static_cast<Storage<T>*>(storages[id].get());
+  }
+
+public:
+  ECS() = delete;
+
+  /**
+   * Get the dense, constant time lookup identifier of a type. Identifiers are assigned in the order that types are first used.
+   * Types that are not Components may also be given identifiers so that Systems can declare access to them.
+   * @tparam T Usually derives from Component
+   * @return The identifier of the type <c>T</c>
+   */
+  template<typename T> static TypeId typeId() {
+    static const TypeId id = nextTypeId++;
+    return id;
+  }
+
+  /**
+   * Construct a new Component in the storage for its type.
+   * @tparam T Derives from Component
+   * @param args The arguments for the Component's constructor
+   * @return A pointer to the new Component. It is valid until the Component is erased.
+   */
+  template<typename T, typename... Args> requires std::derived_from<T, Component> && std::constructible_from<T, Args...> static T* emplace(Args&&... args) {
+    T* component      = &*getStorage<T>().components.emplace(std::forward<Args>(args)...);
+    component->typeId = typeId<T>();
+    return component;
+  }
+
+  /**
+   * Destroy a Component that was created with <c>emplace</c>.
+   * @param component The Component to destroy
+   */
+  static void erase(Component* component);
+
+  /**
+   * Get every Component of a given type.
+   * @tparam T Derives from Component
+   * @return The storage for all Components of type <c>T</c>
+   */
+  template<typename T> requires std::derived_from<T, Component> static plf::colony<T>& getAll() {
+    return getStorage<T>().components;
+  }
+};
@@ -16,19 +16,37 @@ bool Entity::registerComponentConstructor(const std::string& name, const Compone
   return true;
 }
 
-Entity::Entity(const std::uint64_t id, const glm::vec3 position, const glm::quat& rotation, const glm::vec3 scale)
-    : id(id), position(position), rotation(rotation), scale(scale) {}
+Entity::Entity(const std::uint64_t id, const glm::vec3 position, const glm::quat& rotation, const glm::vec3 scale, const Entity* parent)
+    : id(id), transform(TransformHierarchy::create(this, position, rotation, scale, parent == nullptr ? TransformHierarchy::None : parent->transform)) {}
 
 Entity::Entity(const std::uint64_t id, const Entity& other)
-    : id(id), position(other.position), rotation(other.rotation), scale(other.scale) {}
+    : id(id), transform(TransformHierarchy::create(this, other.getPosition(), other.getRotation(), other.getScale(), TransformHierarchy::getParent(other.transform))) {}
+
+Entity::~Entity() {
+  for (Component* component: components) ECS::erase(component);
+  TransformHierarchy::destroy(transform);
+}
+
+void Entity::track(Component* component) {
+  components.push_back(component);
+  if (componentsByType.size() <= component->getTypeId()) componentsByType.resize(component->getTypeId() + 1);
+  componentsByType[component->getTypeId()].push_back(component);
+}
 
 Component* Entity::addComponent(yyjson_val* componentData) {
   auto it = componentConstructors.find(yyjson_get_str(yyjson_obj_get(componentData, "type")));
   if (it == componentConstructors.end()) return nullptr;
-  std::shared_ptr<Component> component = (it->second)(++nextComponentId, *this, componentData);
-  return components.emplace(component->getId(), std::move(component)).first->second.get();
+  Component* component = (it->second)(++nextComponentId, *this, componentData);
+  track(component);
+  return component;
 }
 
 void Entity::removeComponent(const uint64_t id) {
-  components.erase(id);
+  if (Component* component = getComponent<Component>(id); component != nullptr) removeComponent(component);
+}
+
+void Entity::removeComponent(Component* component) {
+  std::erase(components, component);
+  std::erase(componentsByType[component->getTypeId()], component);
+  ECS::erase(component);
 }
@@ -1,7 +1,8 @@
 #pragma once
 
 #include "Component.hpp"
-#include "Tools/ClassName.h"
+#include "ECS.hpp"
+#include "TransformHierarchy.hpp"
 
 #include <functional>
 #include <glm/glm.hpp>
@@ -9,31 +10,36 @@
 
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <ranges>
 #include <vector>
 
 struct yyjson_val;
 
+/**
+ * An Entity only references its Components. The Components themselves are owned by, and stored contiguously in, the <c>ECS</c>.
+ */
 class Entity {
-  using ComponentConstructor = std::function<std::shared_ptr<Component>(std::uint64_t, Entity&, yyjson_val*)>;
+  using ComponentConstructor = std::function<Component*(std::uint64_t, Entity&, yyjson_val*)>;
   static std::unordered_map<std::string, ComponentConstructor> componentConstructors;
 
-  std::unordered_map<uint64_t, std::shared_ptr<Component>> components;
+  std::vector<Component*> components;
+  std::vector<std::vector<Component*>> componentsByType;  // Indexed by ECS::TypeId
   uint64_t nextComponentId{UINT64_MAX};
   std::uint64_t id;
+  TransformHierarchy::Handle transform;
+
+  void track(Component* component);
 
 public:
-  glm::vec3 position;
-  glm::quat rotation;
-  glm::vec3 scale;
 
   /**
    * Registers a new Component Constructor to enable the use of <c>addComponent</c> for a new Component type.
    * If another Component Constructor of the same <c>name</c> has already been registered this function will return <c>false</c>
    * and the old Constructor will not be overridden.
    * @param name the name of the function. to be used as a parameter of <c>addComponent</c>
-   * @param function the functon to be called
+   * @param function the functon to be called. It must create the Component using <c>ECS::emplace</c>.
    * @return <c>false</c> if a pre-existing Component Constructor would have been overridden, <c>true</c> otherwise.
    */
   static bool registerComponentConstructor(const std::string& name, const ComponentConstructor& function);
@@ -43,90 +49,114 @@ public:
    * @param position the initial position of the entity
    * @param rotation the initial orientation
    * @param scale the initial scale
+   * @param parent the entity that this entity's transform is relative to, or <c>nullptr</c>
    */
-  explicit Entity(std::uint64_t id, glm::vec3 position = glm::vec3(), const glm::quat& rotation = glm::quat(), glm::vec3 scale = glm::vec3());
+  explicit Entity(std::uint64_t id, glm::vec3 position = glm::vec3(), const glm::quat& rotation = glm::quat(), glm::vec3 scale = glm::vec3(), const Entity* parent = nullptr);
 
   /**
-   * Constructs an empty Entity with the same position, rotation, and scale as the given Entity.
+   * Constructs an empty Entity with the same position, rotation, scale, and parent as the given Entity.
    * @param other the entity this is based on
    */
   explicit Entity(std::uint64_t id, const Entity& other);
-  Entity(const Entity& other)      = default;
-  Entity(Entity&& other) noexcept  = default;
-  Entity& operator=(const Entity&) = default;
-  Entity& operator=(Entity&&)      = default;
-  ~Entity()                        = default;
+  // Components hold a reference to their Entity, so an Entity may not be copied or moved.
+  Entity(const Entity& other)      = delete;
+  Entity(Entity&& other) noexcept  = delete;
+  Entity& operator=(const Entity&) = delete;
+  Entity& operator=(Entity&&)      = delete;
+  ~Entity();
+
+  [[nodiscard]] glm::vec3 getPosition() const { return TransformHierarchy::getPosition(transform); }
+  [[nodiscard]] glm::quat getRotation() const { return TransformHierarchy::getRotation(transform); }
+  [[nodiscard]] glm::vec3 getScale() const { return TransformHierarchy::getScale(transform); }
+  [[nodiscard]] TransformHierarchy::Handle getTransform() const { return transform; }
+  void setPosition(const glm::vec3 position) const { TransformHierarchy::setPosition(transform, position); }
+  void setRotation(const glm::quat& rotation) const { TransformHierarchy::setRotation(transform, rotation); }
+  void setScale(const glm::vec3 scale) const { TransformHierarchy::setScale(transform, scale); }
 
   /**
-   * Add a Component to the map of Components.
-   * @tparam T Derives from Component
-   * @param component The Component to be added
+   * Add a Component using the Component Constructor named by the <c>"type"</c> field of <c>componentData</c>.
+   * @param componentData The JSON description of the Component
+   * @return The new Component, or <c>nullptr</c> if no Component Constructor of that name has been registered.
    */
   Component* addComponent(yyjson_val* componentData);
 
   /**
-   * Add a Component to the map of Components.
+   * Add a Component to this Entity.
    * @tparam T Derives from Component
    * @param args The arguments for the Component's constructor
+   * @return The new Component
    */
-  template<typename T, typename... Args> requires std::constructible_from<T, uint64_t, const Entity&, Args...> && std::derived_from<T, Component> void addComponent(Args&& ... args) {
-    std::shared_ptr<Component> component = reinterpret_cast<std::shared_ptr<Component>(*)(std::uint64_t, const Entity&, Args...)>(componentConstructors.at(static_cast<std::string>(Tools::className<T>())))(++nextComponentId, *this, std::forward<Args>(args)...);
-    components.emplace(component->getId(), std::move(component));
+  template<typename T, typename... Args> requires std::constructible_from<T, uint64_t, Entity&, Args...> && std::derived_from<T, Component> T* addComponent(Args&&... args) {
+    T* component = ECS::emplace<T>(++nextComponentId, *this, std::forward<Args>(args)...);
+    track(component);
+    return component;
   }
 
   /**
-   * Remove a Component from the map of Components.
+   * Remove and destroy a Component of this Entity.
    * @param id The id of the Component to be removed
    */
   void removeComponent(uint64_t id);
 
   /**
-   * Remove a Component from the map of Components.
-   * @tparam T Derives from Component
-   * @param component The Component to be added
+   * Remove and destroy a Component of this Entity.
+   * @param component The Component to be removed
    */
-  template<typename T> requires std::derived_from<T, Component> void removeComponent(std::shared_ptr<T> component) {
-    components.erase(components.find(component));
-  }
+  void removeComponent(Component* component);
 
   /**
-   * Get a shared pointer to a Component object in this Entity.
+   * Get a Component of this Entity by its id.
    * @tparam T Derives from Component
-   * @return A shared pointer to the Component
+   * @return A pointer to the Component, or <c>nullptr</c> if this Entity has no such Component.
    */
-  template<typename T> requires std::derived_from<T, Component> T* getComponent(uint64_t name) {
-    auto it = components.find(name);
-    if (it == components.end()) return nullptr;
-    return *it->second;
+  template<typename T> requires std::derived_from<T, Component> T* getComponent(uint64_t componentId) {
+    for (Component* component: components)
+      if (component->getId() == componentId) return static_cast<T*>(component);
+    return nullptr;
   }
 
+  /**
+   * Get the first Component of type <c>T</c>, or of a type derived from <c>T</c>, in this Entity. Lookups of <c>final</c> types
+   * take constant time. Other types must be matched against every Component of this Entity.
+   * @tparam T Derives from Component
+   * @return A pointer to the Component, or <c>nullptr</c> if this Entity has no Component of type <c>T</c>.
+   */
   template<typename T> requires std::derived_from<T, Component> T* getComponentOfType() {
-    for (std::shared_ptr<Component>& component : std::views::values(components))
-      if (dynamic_cast<T*>(component.get()) != nullptr) return component;
-    return nullptr;
+    if constexpr (std::is_final_v<T>) {
+      const ECS::TypeId typeId = ECS::typeId<T>();
+      if (typeId >= componentsByType.size() || componentsByType[typeId].empty()) return nullptr;
+      return static_cast<T*>(componentsByType[typeId].front());
+    } else {
+      for (Component* component: components)
+        if (T* match = dynamic_cast<T*>(component); match != nullptr) return match;
+      return nullptr;
+    }
   }
 
   /**
-   * Get a vector of shared pointers of all Components of a specific type in this Entity.
+   * Get all Components of type <c>T</c>, or of a type derived from <c>T</c>, in this Entity. Lookups of <c>final</c> types take
+   * constant time. Other types must be matched against every Component of this Entity.
    * @tparam T Derives from Component
-   * @return a Vector containing shared pointers of all Components of a specific type in this Entity
+   * @return a Vector containing pointers to all Components of type <c>T</c> in this Entity
    */
   template<typename T> requires std::derived_from<T, Component> std::vector<T*> getComponentsOfType() {
-    std::vector<T*> requestedComponents;
-    for (std::shared_ptr<Component>& component : std::views::values(components))
-      if (dynamic_cast<T*>(component.get()) != nullptr) requestedComponents.push_back(component);
-    return requestedComponents;
+    if constexpr (std::is_final_v<T>) {
+      const ECS::TypeId typeId = ECS::typeId<T>();
+      if (typeId >= componentsByType.size()) return {};
+      return componentsByType[typeId] | std::views::transform([](Component* component) { return static_cast<T*>(component); }) | std::ranges::to<std::vector>();
+    } else {
+      std::vector<T*> requestedComponents;
+      for (Component* component: components)
+        if (T* match = dynamic_cast<T*>(component); match != nullptr) requestedComponents.push_back(match);
+      return requestedComponents;
+    }
   }
 
   /**
-   * Get a vector of shared pointers of all Components in this Entity.
-   * @tparam T Derives from Component
-   * @return a Vector containing shared pointers of all Components of a specific type in this Entity
+   * Get all Components in this Entity.
+   * @return The Components of this Entity in the order that they were added
    */
-  std::vector<std::shared_ptr<Component>> getComponents() {
-    std::vector<std::shared_ptr<Component>> out;
-    for (std::shared_ptr<Component>& component : std::views::values(components))
-      out.push_back(component);
-    return out;
+  [[nodiscard]] const std::vector<Component*>& getComponents() const {
+    return components;
   }
 };
\ No newline at end of file
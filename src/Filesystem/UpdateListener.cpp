@@ -2,17 +2,37 @@
 
 #include <cassert>
 
-std::unordered_map<std::filesystem::path, UpdateListener::Funcs> UpdateListener::directoryFuncMap;
+std::mutex UpdateListener::mutex;
+std::unordered_map<std::filesystem::path, UpdateListener::DirectoryFuncs> UpdateListener::directoryFuncMap;
 std::unordered_map<std::filesystem::path, UpdateListener::Funcs> UpdateListener::fileFuncMap;
+std::mutex UpdateListener::watchesMutex;
+std::unordered_map<std::filesystem::path, UpdateListener::Watch> UpdateListener::watches;
 efsw::FileWatcher UpdateListener::watcher;
 
 void UpdateListener::handleFileAction(efsw::WatchID watchid, const std::string& dir, const std::string& filename, efsw::Action action, std::string oldFilename) {
-  const Funcs funcs = directoryFuncMap.at(std::filesystem::canonical(dir));
+  const std::filesystem::path file = std::filesystem::weakly_canonical(std::filesystem::path(dir) / filename);
+  Funcs funcs;
+  {
+    const std::scoped_lock lock{mutex};
+    if (const auto it = fileFuncMap.find(file); it != fileFuncMap.end()) funcs = it->second;
+    else {
+      // Directories are watched recursively, so the file may be in a subdirectory of the one being watched.
+      auto directory = file.parent_path();
+      while (!directoryFuncMap.contains(directory)) {
+        if (directory == directory.parent_path()) return;  // Not watched
+        directory = directory.parent_path();
+      }
+      const DirectoryFuncs& directoryFuncs = directoryFuncMap.at(directory);
+      for (const std::filesystem::path& excluded: directoryFuncs.excluded)
+        if (const auto relative = file.lexically_relative(excluded); !relative.empty() && *relative.begin() != "..") return;
+      funcs = directoryFuncs.funcs;
+    }
+  }
   switch (action) {
-    case efsw::Actions::Add: if (std::get<0>(funcs)) std::get<0>(funcs)(); break;
-    case efsw::Actions::Delete: if (std::get<1>(funcs)) std::get<1>(funcs)(); break;
-    case efsw::Actions::Modified: if (std::get<2>(funcs)) std::get<2>(funcs)(); break;
-    case efsw::Actions::Moved: if (std::get<3>(funcs)) std::get<3>(funcs)(); break;
+    case efsw::Actions::Add: if (std::get<0>(funcs)) std::get<0>(funcs)(file); break;
+    case efsw::Actions::Delete: if (std::get<1>(funcs)) std::get<1>(funcs)(file); break;
+    case efsw::Actions::Modified: if (std::get<2>(funcs)) std::get<2>(funcs)(file); break;
+    case efsw::Actions::Moved: if (std::get<3>(funcs)) std::get<3>(funcs)(file); break;
     default: assert(false);
   }
 }
@@ -22,17 +42,62 @@ UpdateListener* UpdateListener::getInstance() {
   return &listener;
 }
 
-void UpdateListener::addDirectoryWatch(const std::filesystem::path& directory, const Func& onAdd, const Func& onDelete, const Func& onModify, const Func& onMove) {
-  watcher.addWatch(directory.string(), getInstance(), true);
-  directoryFuncMap.insert({std::filesystem::canonical(directory), {onAdd, onDelete, onModify, onMove}});
+void UpdateListener::acquireWatch(const std::filesystem::path& directory, const bool recursive) {
+  const std::scoped_lock lock{watchesMutex};
+  auto [it, inserted] = watches.try_emplace(directory, Watch{.id = 0, .references = 0, .recursive = recursive});
+  Watch& watch = it->second;
+  ++watch.references;
+  if (inserted) watch.id = watcher.addWatch(directory.string(), getInstance(), recursive);
+  else if (recursive && !watch.recursive) {
+    watcher.removeWatch(watch.id);
+    watch.id        = watcher.addWatch(directory.string(), getInstance(), true);
+    watch.recursive = true;
+  }
+}
+
+void UpdateListener::releaseWatch(const std::filesystem::path& directory) {
+  const std::scoped_lock lock{watchesMutex};
+  const auto it = watches.find(directory);
+  if (it == watches.end() || --it->second.references != 0) return;
+  watcher.removeWatch(it->second.id);
+  watches.erase(it);
+}
+
+void UpdateListener::addDirectoryWatch(const std::filesystem::path& directory, const Func& onAdd, const Func& onDelete, const Func& onModify, const Func& onMove, const std::vector<std::filesystem::path>& excluded) {
+  const std::filesystem::path canonicalDirectory = std::filesystem::canonical(directory);
+  DirectoryFuncs directoryFuncs{.funcs = {onAdd, onDelete, onModify, onMove}, .excluded = {}};
+  for (const std::filesystem::path& path: excluded) directoryFuncs.excluded.push_back(std::filesystem::weakly_canonical(path));
+  {
+    const std::scoped_lock lock{mutex};
+    directoryFuncMap.insert({canonicalDirectory, std::move(directoryFuncs)});
+  }
+  acquireWatch(canonicalDirectory, true);
 }
 
 void UpdateListener::addFileWatch(const std::filesystem::path& file, const Func& onAdd, const Func& onDelete, const Func& onModify, const Func& onMove) {
-  watcher.addWatch(file.string(), getInstance(), true);
-  fileFuncMap.insert({std::filesystem::canonical(file), {onAdd, onDelete, onModify, onMove}});
+  const std::filesystem::path canonicalFile = std::filesystem::weakly_canonical(file);
+  {
+    const std::scoped_lock lock{mutex};
+    fileFuncMap.insert({canonicalFile, {onAdd, onDelete, onModify, onMove}});
+  }
+  // Only directories can be watched, so watch the one that holds the file. Other files in it may share that watch.
+  acquireWatch(canonicalFile.parent_path(), false);
 }
 
 void UpdateListener::removeDirectoryWatch(const std::filesystem::path& directory) {
-  watcher.removeWatch(directory.string());
-  directoryFuncMap.erase(std::filesystem::canonical(directory));
+  const std::filesystem::path canonicalDirectory = std::filesystem::canonical(directory);
+  {
+    const std::scoped_lock lock{mutex};
+    directoryFuncMap.erase(canonicalDirectory);
+  }
+  releaseWatch(canonicalDirectory);
+}
+
+void UpdateListener::removeFileWatch(const std::filesystem::path& file) {
+  const std::filesystem::path canonicalFile = std::filesystem::weakly_canonical(file);
+  {
+    const std::scoped_lock lock{mutex};
+    fileFuncMap.erase(canonicalFile);
+  }
+  releaseWatch(canonicalFile.parent_path());
 }
\ No newline at end of file
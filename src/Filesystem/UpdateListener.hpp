@@ -2,20 +2,57 @@
 
 #include <efsw/efsw.hpp>
 #include <filesystem>
+#include <cstdint>
 #include <functional>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 class UpdateListener : public efsw::FileWatchListener {
 public:
-  using Func = std::function<void()>;
+  /**
+   * Called on the watcher's own thread with the canonical path of the file that changed.
+   */
+  using Func = std::function<void(const std::filesystem::path&)>;
 
 private:
   using Funcs = std::tuple<Func, Func, Func, Func>;
-  static std::unordered_map<std::filesystem::path, Funcs> directoryFuncMap;
+
+  struct DirectoryFuncs {
+    Funcs funcs;
+    std::vector<std::filesystem::path> excluded;  // Subdirectories whose changes are ignored
+  };
+
+  // One efsw watch, shared by every file and directory watch that needs it
+  struct Watch {
+    efsw::WatchID id;
+    std::uint32_t references;
+    bool recursive;
+  };
+
+  static std::mutex mutex;  // Guards the maps, as changes are handled on the watcher's thread
+  static std::unordered_map<std::filesystem::path, DirectoryFuncs> directoryFuncMap;
   static std::unordered_map<std::filesystem::path, Funcs> fileFuncMap;
+  static std::mutex watchesMutex;  // Guards <c>watches</c>. Never held while a change is handled, as efsw may hold its own lock then.
+  static std::unordered_map<std::filesystem::path, Watch> watches;
   static efsw::FileWatcher watcher;
 
   UpdateListener() = default;
 
+  /**
+   * Watch <c>directory</c>, or add another reference to the existing watch of it.
+   * @param directory The canonical path of the directory to watch
+   * @param recursive Whether subdirectories must be watched too. An existing watch that is not recursive is replaced.
+   */
+  static void acquireWatch(const std::filesystem::path& directory, bool recursive);
+
+  /**
+   * Remove a reference to the watch of <c>directory</c>, and stop watching it once none are left.
+   * @param directory The canonical path of the watched directory
+   */
+  static void releaseWatch(const std::filesystem::path& directory);
+
   /**
    * Call functions based on fileActions that have occurred
    * @param watchid WatchId that has detected the action
@@ -36,8 +73,9 @@ public:
    * @param onDelete Function to be called when a file is deleted from the directory
    * @param onModify Function to be called when a file is modified in the directory
    * @param onMove Function to be called when a file is moved in the directory
+   * @param excluded Subdirectories of <c>directory</c> whose changes are ignored, such as those that are written to while running
    */
-  static void addDirectoryWatch(const std::filesystem::path& directory, const Func& onAdd, const Func& onDelete, const Func& onModify, const Func& onMove);
+  static void addDirectoryWatch(const std::filesystem::path& directory, const Func& onAdd, const Func& onDelete, const Func& onModify, const Func& onMove, const std::vector<std::filesystem::path>& excluded = {});
 
   /**
    * @param file The file to watch
@@ -58,10 +96,7 @@ public:
    * Remove a file from the watch list
    * @param file The file to remove the watch for
    */
-  static void removeFileWatch(const std::filesystem::path& file) {
-    watcher.removeWatch(file.string());
-    fileFuncMap.erase(file);
-  }
+  static void removeFileWatch(const std::filesystem::path& file);
 
   /**
    * Start watching for file changes
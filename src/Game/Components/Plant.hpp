@@ -1,3 +1,5 @@
+#pragma once
+
 #include "src/Component.hpp"
 
 #include "src/Entity.hpp"
@@ -6,12 +8,12 @@
 #include <memory>
 #include <utility>
 
-class Plant : public Component {
+class Plant final : public Component {
 public:
   Plant(std::uint64_t id, Entity& entity);
   ~Plant() override = default;
 
-  static std::shared_ptr<Component> create(std::uint64_t id, Entity& entity, yyjson_val* obj);
+  static Component* create(std::uint64_t id, Entity& entity, yyjson_val* obj);
 
   void onTick() override;
 };
\ No newline at end of file
@@ -42,20 +42,22 @@ PlayerController::PlayerController(const std::uint64_t id, Entity& entity) : Com
 
 void PlayerController::onTick() {
   //move the player using keyboard
+  glm::vec3 position = entity.getPosition();
   if (Input::keyDown(SDLK_UP) > 0 || Input::keyDown(SDLK_W) > 0) {
-    entity.position.y += movementSpeed;
+    position.y += movementSpeed;
   }
   if (Input::keyDown(SDLK_DOWN) > 0 || Input::keyDown(SDLK_S) > 0) {
-    entity.position.y -= movementSpeed;
+    position.y -= movementSpeed;
   }
   if (Input::keyDown(SDLK_LEFT) > 0 || Input::keyDown(SDLK_A) > 0) {
-    entity.position.x -= movementSpeed;
+    position.x -= movementSpeed;
   }
   if (Input::keyDown(SDLK_RIGHT) > 0 || Input::keyDown(SDLK_D) > 0) {
-    entity.position.x += movementSpeed;
+    position.x += movementSpeed;
   }
+  entity.setPosition(position);
 }
 
-std::shared_ptr<Component> PlayerController::create(std::uint64_t id, Entity& entity, yyjson_val* obj) {
-  return std::make_shared<PlayerController>(id, entity);
+Component* PlayerController::create(std::uint64_t id, Entity& entity, yyjson_val* obj) {
+  return ECS::emplace<PlayerController>(id, entity);
 }
@@ -9,7 +9,7 @@ struct yyjson_val;
 /**
  * Allows the player to control an entity using keyboard input.
  */
-class PlayerController : public Component {
+class PlayerController final : public Component {
 private:
 
   float movementSpeed{1};
@@ -18,7 +18,7 @@ public:
   explicit PlayerController(std::uint64_t id, Entity& entity);
   ~PlayerController() override = default;
 
-  static std::shared_ptr<Component> create(std::uint64_t id, Entity& entity, yyjson_val* obj);
+  static Component* create(std::uint64_t id, Entity& entity, yyjson_val* obj);
 
   void onTick() override;
 };
\ No newline at end of file
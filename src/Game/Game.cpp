@@ -1,5 +1,6 @@
 #include "Game.hpp"
 
+#include "src/Game/Scheduler.hpp"
 #include "src/InputEngine/Input.hpp"
 
 std::unordered_map<std::uint64_t, Entity> Game::entities{};
@@ -9,6 +10,10 @@ std::uint64_t Game::entityId{UINT64_MAX};
 
 const std::chrono::steady_clock::time_point Game::startTime{std::chrono::steady_clock::now()};
 
+void Game::clear() {
+  entities.clear();
+}
+
 bool Game::tick() {
   bool shouldQuit{};
   SDL_Event e;
@@ -26,13 +31,7 @@ bool Game::tick() {
   time               = currentTime;
   Input::onTick();
 
-  //call onTick for every component in the game
-  //todo: move to systems?
-  for (auto& entityPair : entities) {
-    for(std::shared_ptr component : entityPair.second.getComponents()) {
-      component->onTick();
-    }
-  }
+  Scheduler::run();
   return !shouldQuit;
 }
 
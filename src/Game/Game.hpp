@@ -26,6 +26,12 @@ public:
     return entities.emplace(std::piecewise_construct, std::forward_as_tuple(entityId), std::forward_as_tuple(entityId, std::forward<Args&&>(args)...)).first->second;
   }
 
+  /**
+   * Destroy every Entity along with its Components. Components may hold resources of the GraphicsDevice, so this must be called
+   * before it is destroyed.
+   */
+  static void clear();
+
   /**
    * Move the game state forward one tick.
    */
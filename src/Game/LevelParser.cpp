@@ -12,17 +12,23 @@
 
 yyjson_doc* LevelParser::doc{nullptr};
 
-Entity& LevelParser::loadEntity(yyjson_val* entityData) {
+Entity& LevelParser::loadEntity(yyjson_val* entityData, const Entity* parent) {
   auto position = Tools::jsonGet<glm::vec3>(yyjson_obj_get(entityData, "position"));
   auto rotation = Tools::jsonGet<glm::quat>(yyjson_obj_get(entityData, "rotation"));
   auto scale    = Tools::jsonGet<glm::vec3>(yyjson_obj_get(entityData, "scale"));
-  Entity& entity = Game::addEntity(position, rotation, scale);
+  Entity& entity = Game::addEntity(position, rotation, scale, parent);
 
   yyjson_val* components = yyjson_obj_get(entityData, "components");
   for (uint32_t i = 0; i < yyjson_get_len(components); ++i) {
     entity.addComponent(yyjson_arr_get(components, i));
   }
 
+  //children are placed relative to this entity
+  yyjson_val* children = yyjson_obj_get(entityData, "children");
+  for (uint32_t i = 0; i < yyjson_get_len(children); ++i) {
+    loadEntity(yyjson_arr_get(children, i), &entity);
+  }
+
   return entity;
 }
 
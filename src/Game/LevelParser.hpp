@@ -24,12 +24,13 @@ private:
     static yyjson_doc* doc;
 public:
   /**
-   * Loads an entity from the .json file.
+   * Loads an entity, and recursively its <c>children</c>, from the .json file.
    *
-   * @param name The name of the entity in the .json file
-   * @return A pointer to the newly-loaded entity
+   * @param entityData The entity in the .json file
+   * @param parent The entity that the new entity's transform is relative to, or <c>nullptr</c>
+   * @return A reference to the newly-loaded entity
    */
-  static Entity& loadEntity(yyjson_val* entityData);
+  static Entity& loadEntity(yyjson_val* entityData, const Entity* parent = nullptr);
 
   /**
    * Loads an entire level from the .json file
@@ -0,0 +1,20 @@
+#include "Scheduler.hpp"
+
+std::vector<std::unique_ptr<Scheduler::Node>> Scheduler::nodes{};
+
+void Scheduler::runNode(Node& node, JobSystem::Counter& counter) {
+  node.system->run();
+  // Dependents are submitted before this Job finishes, so the Counter cannot reach zero while Systems remain.
+  for (const std::uint32_t dependent: node.dependents) {
+    Node& next = *nodes[dependent];
+    if (next.remainingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1) JobSystem::submit([&next, &counter] { runNode(next, counter); }, counter);
+  }
+}
+
+void Scheduler::run() {
+  for (const std::unique_ptr<Node>& node: nodes) node->remainingDependencies.store(node->dependencyCount, std::memory_order_relaxed);
+  JobSystem::Counter counter{};
+  for (const std::unique_ptr<Node>& node: nodes)
+    if (node->dependencyCount == 0) JobSystem::submit([&node = *node, &counter] { runNode(node, counter); }, counter);
+  JobSystem::wait(counter);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "System.hpp"
+
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Runs every registered System once per tick. Systems that conflict run in the order that they were added. Systems that do not
+ * conflict run concurrently on the <c>JobSystem</c>.
+ */
+class Scheduler {
+  struct Node {
+    std::unique_ptr<System> system;
+    std::vector<std::uint32_t> dependents;
+    std::uint32_t dependencyCount{};
+    std::atomic<std::uint32_t> remainingDependencies{};
+  };
+
+  static std::vector<std::unique_ptr<Node>> nodes;
+
+  static void runNode(Node& node, JobSystem::Counter& counter);
+
+public:
+  Scheduler() = delete;
+
+  /**
+   * Add a System to the dependency graph. The System depends on every previously added System that it conflicts with.
+   * @tparam T Derives from System
+   * @param args The arguments for the System's constructor
+   * @return The new System
+   */
+  template<typename T, typename... Args> requires std::derived_from<T, System> && std::constructible_from<T, Args...> static T& addSystem(Args&&... args) {
+    auto node    = std::make_unique<Node>();
+    node->system = std::make_unique<T>(std::forward<Args>(args)...);
+    const auto index = static_cast<std::uint32_t>(nodes.size());
+    for (const std::unique_ptr<Node>& other: nodes) {
+      if (!node->system->conflictsWith(*other->system)) continue;
+      other->dependents.push_back(index);
+      ++node->dependencyCount;
+    }
+    T& system = static_cast<T&>(*node->system);
+    nodes.push_back(std::move(node));
+    return system;
+  }
+
+  /**
+   * Run every System, returning once all of them have finished.
+   */
+  static void run();
+};
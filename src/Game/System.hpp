@@ -0,0 +1,65 @@
+#pragma once
+
+#include "src/ECS.hpp"
+#include "src/JobSystem.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+/**
+ * A unit of per-tick work. Each System declares which data it reads and writes so that the <c>Scheduler</c> can run Systems that
+ * do not conflict at the same time. Data is identified by <c>ECS::typeId</c>, which is usually the type of a Component, but may be
+ * any type that stands in for shared state.
+ */
+class System {
+public:
+  std::vector<ECS::TypeId> reads;
+  std::vector<ECS::TypeId> writes;
+
+  System(std::vector<ECS::TypeId> reads, std::vector<ECS::TypeId> writes) : reads(std::move(reads)), writes(std::move(writes)) {}
+  virtual ~System() = default;
+
+  virtual void run() = 0;
+
+  /**
+   * @param other The System to compare against
+   * @return <c>true</c> if either System writes data that the other System reads or writes.
+   */
+  [[nodiscard]] bool conflictsWith(const System& other) const {
+    const auto overlaps = [](const std::vector<ECS::TypeId>& a, const std::vector<ECS::TypeId>& b) { return std::ranges::any_of(a, [&b](const ECS::TypeId id) { return std::ranges::contains(b, id); }); };
+    return overlaps(writes, other.reads) || overlaps(writes, other.writes) || overlaps(reads, other.writes);
+  }
+};
+
+/**
+ * Calls <c>onTick</c> on every Component of type <c>T</c>. This System always writes <c>T</c>.
+ * @tparam T Derives from Component
+ */
+template<typename T> requires std::derived_from<T, Component> class ComponentSystem final : public System {
+  std::size_t chunkSize;
+
+public:
+  /**
+   * @param reads Additional data read by <c>T::onTick</c>
+   * @param writes Additional data written by <c>T::onTick</c>
+   * @param chunkSize The number of Components to tick per Job. Zero ticks every Component on one thread, which is required when <c>T::onTick</c> touches state shared between Components.
+   */
+  explicit ComponentSystem(std::vector<ECS::TypeId> reads = {}, std::vector<ECS::TypeId> writes = {}, const std::size_t chunkSize = 0) : System(std::move(reads), std::move(writes)), chunkSize(chunkSize) {
+    this->writes.push_back(ECS::typeId<T>());
+    static_cast<void>(ECS::getAll<T>());  // Create the storage now, as storages must not be created while Systems are running.
+  }
+
+  void run() override {
+    plf::colony<T>& components = ECS::getAll<T>();
+    // The qualified calls let the compiler devirtualize onTick, as the exact type of every Component is known here.
+    if (chunkSize == 0 || components.size() <= chunkSize) {
+      for (T& component: components) component.T::onTick();
+      return;
+    }
+    JobSystem::parallelFor(components.size(), chunkSize, [&components](const std::size_t begin, const std::size_t end) {
+      auto it = std::next(components.begin(), begin);
+      for (std::size_t i{begin}; i < end; ++i, ++it) it->T::onTick();
+    });
+  }
+};
@@ -0,0 +1,81 @@
+#include "JobSystem.hpp"
+
+std::mutex JobSystem::mutex{};
+std::condition_variable_any JobSystem::condition{};
+std::deque<std::pair<JobSystem::Job, JobSystem::Counter*>> JobSystem::jobs{};
+// Declared last so that the workers are stopped and joined before the queue that they use is destroyed.
+std::vector<std::jthread> JobSystem::workers{};
+
+bool JobSystem::tryRunJob() {
+  std::pair<Job, Counter*> job;
+  {
+    std::scoped_lock lock{mutex};
+    if (jobs.empty()) return false;
+    job = std::move(jobs.front());
+    jobs.pop_front();
+  }
+  run(job.first, *job.second);
+  return true;
+}
+
+void JobSystem::run(const Job& job, Counter& counter) {
+  try {
+    job();
+  } catch (...) { fail(counter, std::current_exception()); }
+  // The waiting thread may destroy the Counter as soon as it reaches zero, so it must not be touched after this.
+  if (counter.value.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+  // Taking the lock orders this notification after any waiter that saw a non-zero value has gone to sleep.
+  { std::scoped_lock lock{mutex}; }
+  condition.notify_all();
+}
+
+void JobSystem::fail(Counter& counter, std::exception_ptr exception) {
+  if (!counter.failed.test_and_set(std::memory_order_relaxed)) counter.exception = std::move(exception);
+}
+
+void JobSystem::work(const std::stop_token& stopToken) {
+  while (!stopToken.stop_requested()) {
+    {
+      std::unique_lock lock{mutex};
+      if (!condition.wait(lock, stopToken, [] { return !jobs.empty(); })) return;
+    }
+    while (tryRunJob()) {}
+  }
+}
+
+void JobSystem::initialize(const std::uint32_t threadCount) {
+  if (!workers.empty()) return;
+  workers.reserve(threadCount);
+  for (std::uint32_t i{}; i < threadCount; ++i) workers.emplace_back(&JobSystem::work);
+}
+
+std::uint32_t JobSystem::getConcurrency() {
+  return workers.size() + 1;
+}
+
+void JobSystem::submit(Job job, Counter& counter) {
+  counter.value.fetch_add(1, std::memory_order_relaxed);
+  if (workers.empty()) {
+    // Nothing would ever pick the Job up, so run it right away.
+    run(job, counter);
+    return;
+  }
+  {
+    std::scoped_lock lock{mutex};
+    jobs.emplace_back(std::move(job), &counter);
+  }
+  condition.notify_one();
+}
+
+void JobSystem::wait(Counter& counter) {
+  while (counter.value.load(std::memory_order_acquire) != 0) {
+    if (tryRunJob()) continue;
+    // The remaining Jobs are running on other threads, so sleep until they finish or until there is something else to help with.
+    std::unique_lock lock{mutex};
+    condition.wait(lock, [&counter] { return counter.value.load(std::memory_order_acquire) == 0 || !jobs.empty(); });
+  }
+  if (counter.exception != nullptr) {
+    counter.failed.clear(std::memory_order_relaxed);
+    std::rethrow_exception(std::exchange(counter.exception, nullptr));
+  }
+}
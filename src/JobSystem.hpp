@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * A pool of worker threads that execute Jobs. Completion is tracked with Counters: submitting a Job increments its Counter, and
+ * finishing the Job decrements it. Any thread waiting on a Counter executes queued Jobs while it waits, so Jobs may safely submit
+ * and wait on other Jobs. When there is nothing left to execute, waiting threads sleep until the Counter reaches zero or more
+ * Jobs are submitted.
+ */
+class JobSystem {
+public:
+  using Job = std::function<void()>;
+
+  /**
+   * Tracks the completion of a group of Jobs. A Job that throws still finishes, and the first exception thrown by any Job of
+   * the group is rethrown by <c>wait</c>.
+   */
+  class Counter {
+    friend class JobSystem;
+
+    std::atomic<std::uint32_t> value{};
+    std::atomic_flag failed;
+    std::exception_ptr exception;
+  };
+
+private:
+  static std::mutex mutex;
+  static std::condition_variable_any condition;
+  static std::deque<std::pair<Job, Counter*>> jobs;
+  static std::vector<std::jthread> workers;
+
+  static bool tryRunJob();
+  static void run(const Job& job, Counter& counter);
+  static void fail(Counter& counter, std::exception_ptr exception);
+  static void work(const std::stop_token& stopToken);
+
+public:
+  JobSystem() = delete;
+
+  /**
+   * Start the worker threads. Calling this more than once has no effect.
+   * @param threadCount The number of worker threads to start. The thread that calls <c>wait</c> also executes Jobs, so this defaults to one less than the number of hardware threads.
+   */
+  static void initialize(std::uint32_t threadCount = std::max(std::thread::hardware_concurrency(), 2U) - 1);
+
+  /**
+   * @return The number of threads that may execute Jobs at the same time, including the thread that is waiting.
+   */
+  [[nodiscard]] static std::uint32_t getConcurrency();
+
+  /**
+   * Queue a Job for execution.
+   * @param job The function to execute
+   * @param counter Incremented now and decremented once <c>job</c> has finished
+   */
+  static void submit(Job job, Counter& counter);
+
+  /**
+   * Execute queued Jobs until <c>counter</c> reaches zero.
+   * @param counter The Counter to wait on
+   * @throws The first exception thrown by a Job of <c>counter</c>, once all of its Jobs have finished
+   */
+  static void wait(Counter& counter);
+
+  /**
+   * Split the range <c>[0, count)</c> into chunks of at most <c>chunkSize</c> elements and call <c>function(begin, end)</c> for each chunk on the worker threads.
+   * Returns once every chunk has been processed. The calling thread processes chunks too.
+   * @param count The number of elements to process
+   * @param chunkSize The maximum number of elements given to a single call of <c>function</c>
+   * @param function A callable taking the <c>std::size_t</c> bounds of a chunk
+   */
+  template<typename Function> static void parallelFor(const std::size_t count, std::size_t chunkSize, Function&& function) {
+    if (count == 0) return;
+    chunkSize = std::max<std::size_t>(chunkSize, 1);
+    Counter counter{};
+    std::size_t begin = chunkSize;
+    for (; begin < count; begin += chunkSize) submit([&function, begin, end = std::min(begin + chunkSize, count)] { function(begin, end); }, counter);
+    // The submitted chunks reference this stack frame, so they must finish before an exception may leave it.
+    try {
+      function(0, std::min(chunkSize, count));
+    } catch (...) { fail(counter, std::current_exception()); }
+    wait(counter);
+  }
+};
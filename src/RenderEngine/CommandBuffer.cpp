@@ -11,14 +11,25 @@
 
 #include <volk/volk.h>
 #include <vulkan/utility/vk_format_utils.h>
+#include <vulkan/vk_enum_string_helper.h>
 
 #include <algorithm>
+#include <map>
 #include <ranges>
+#include <unordered_map>
 #include <utility>
 
-CommandBuffer::Command::Command(std::vector<ResourceAccess> accesses, const Type type) : accesses(std::move(accesses)), type(type)
+thread_local Tools::Arena* CommandBuffer::recordingArena{nullptr};
+
+CommandBuffer::Command::Command(const std::initializer_list<ResourceAccess> accesses, const Type type) : accesses(accesses, allocator()), type(type)
+#if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
+, trace(cpptrace::generate_raw_trace(5))  // Skipping 5 layers brings us to either the first of two calls to `record`, or the place that record was initially called.
+#endif
+{}
+
+CommandBuffer::Command::Command(std::pmr::vector<ResourceAccess> accesses, const Type type) : accesses(std::move(accesses)), type(type)
 #if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
-, trace(cpptrace::generate_raw_trace(4))  // Skipping 4 layers brings us to either the first of two calls to `record`, or the place that record was initially called.
+, trace(cpptrace::generate_raw_trace(5))
 #endif
 {}
 
@@ -34,11 +45,6 @@ void CommandBuffer::BeginRenderPass::preprocess(State& state, PreprocessingFlags
   };
 
   state.renderPass = renderPass;
-  for (const auto& [id, access]: renderPass->getImageAccesses()) {
-    ResourceState& resourceState = state.resourceStates[renderPass->getGraph().getImage(id).image.get()];
-    resourceState.layout = access.layout;
-    resourceState.access = access.access;
-  }
 }
 void CommandBuffer::BeginRenderPass::bake(VkCommandBuffer commandBuffer) {
 #if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
@@ -151,8 +157,8 @@ std::string CommandBuffer::BindVertexBuffers::toString(bool includeArguments) {
 }
 
 void CommandBuffer::BlitImageToImage::preprocess(State& state, PreprocessingFlags flags) {
-  srcImageLayout = state.resourceStates.at(src).layout;
-  dstImageLayout = state.resourceStates.at(dst).layout;
+  srcImageLayout = state.resourceStates.at(src).getLayout(accesses[0].range);
+  dstImageLayout = state.resourceStates.at(dst).getLayout(accesses[1].range);
 }
 void CommandBuffer::BlitImageToImage::bake(VkCommandBuffer commandBuffer) {
 #if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
@@ -168,7 +174,7 @@ std::string CommandBuffer::BlitImageToImage::toString(bool includeArguments) {
 }
 
 void CommandBuffer::ClearColorImage::preprocess(State& state, PreprocessingFlags flags) {
-  layout = state.resourceStates.at(image).layout;
+  layout = state.resourceStates.at(image).getLayout(accesses[0].range);
 }
 void CommandBuffer::ClearColorImage::bake(VkCommandBuffer commandBuffer) {
 #if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
@@ -184,7 +190,7 @@ std::string CommandBuffer::ClearColorImage::toString(bool includeArguments) {
 }
 
 void CommandBuffer::ClearDepthStencilImage::preprocess(State& state, PreprocessingFlags flags) {
-  layout = state.resourceStates.at(image).layout;
+  layout = state.resourceStates.at(image).getLayout(accesses[0].range);
 }
 void CommandBuffer::ClearDepthStencilImage::bake(VkCommandBuffer commandBuffer) {
 #if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
@@ -214,7 +220,7 @@ std::string CommandBuffer::CopyBufferToBuffer::toString(bool includeArguments) {
 }
 
 void CommandBuffer::CopyBufferToImage::preprocess(State& state, PreprocessingFlags flags) {
-  layout = state.resourceStates.at(dst).layout;
+  layout = state.resourceStates.at(dst).getLayout(accesses[1].range);
 }
 void CommandBuffer::CopyBufferToImage::bake(VkCommandBuffer commandBuffer) {
 #if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
@@ -230,7 +236,7 @@ std::string CommandBuffer::CopyBufferToImage::toString(bool includeArguments) {
 }
 
 void CommandBuffer::CopyImageToBuffer::preprocess(State& state, PreprocessingFlags flags) {
-  layout = state.resourceStates.at(src).layout;
+  layout = state.resourceStates.at(src).getLayout(accesses[0].range);
 }
 void CommandBuffer::CopyImageToBuffer::bake(VkCommandBuffer commandBuffer) {
 #if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
@@ -246,8 +252,8 @@ std::string CommandBuffer::CopyImageToBuffer::toString(bool includeArguments) {
 }
 
 void CommandBuffer::CopyImageToImage::preprocess(State& state, PreprocessingFlags flags) {
-  srcLayout = state.resourceStates.at(src).layout;
-  dstLayout = state.resourceStates.at(dst).layout;
+  srcLayout = state.resourceStates.at(src).getLayout(accesses[0].range);
+  dstLayout = state.resourceStates.at(dst).getLayout(accesses[1].range);
 }
 void CommandBuffer::CopyImageToImage::bake(VkCommandBuffer commandBuffer) {
 #if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
@@ -282,19 +288,19 @@ std::string CommandBuffer::Draw::toString(bool includeArguments) {
   return "vkCmdDraw";
 }
 
-CommandBuffer::DrawIndexed::DrawIndexed(const uint32_t instanceCount) : Command({}, Draw), instanceCount(instanceCount) {}
+CommandBuffer::DrawIndexed::DrawIndexed(const uint32_t instanceCount, const uint32_t indexCount, const uint32_t firstIndex, const int32_t vertexOffset) : Command({}, Draw), instanceCount(instanceCount), indexCount(indexCount), firstIndex(firstIndex), vertexOffset(vertexOffset) {}
 void CommandBuffer::DrawIndexed::preprocess(State& state, PreprocessingFlags flags) {
   if (state.renderPass == nullptr) GraphicsInstance::showError("must call BeginRenderPass before DrawIndexed");
   if (state.pipeline == nullptr) GraphicsInstance::showError("must call BindPipeline before DrawIndexed");
   if (state.vertexBuffers.empty()) GraphicsInstance::showError("must call BindIndexBuffer before DrawIndexed");
-  indexCount = state.indexBuffer->getSize() / sizeof(uint32_t);
+  if (indexCount == std::numeric_limits<uint32_t>::max()) indexCount = state.indexBuffer->getSize() / sizeof(uint32_t) - firstIndex;
   if (state.vertexBuffers.empty() || state.vertexBuffers.at(0) == nullptr) GraphicsInstance::showError("must call BindVertexBuffers before DrawIndexed");
 }
 void CommandBuffer::DrawIndexed::bake(VkCommandBuffer commandBuffer) {
 #if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
   GraphicsInstance::setDebugDataCommand(this);
 #endif
-  vkCmdDrawIndexed(commandBuffer, indexCount, instanceCount, 0, 0, 0);
+  vkCmdDrawIndexed(commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, 0);
 #if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
   GraphicsInstance::setDebugDataCommand(nullptr);
 #endif
@@ -342,36 +348,104 @@ std::string CommandBuffer::EndRenderPass::toString(bool includeArguments) {
 }
 
 void CommandBuffer::PipelineBarrier::preprocess(State& state, const PreprocessingFlags flags) {
-    for (auto& imageMemoryBarrier: imageMemoryBarriers) {
-      ResourceState& resourceState = state.resourceStates[imageMemoryBarrier.image];
-      if (flags & ModifyPipelineBarriers) {
-        imageMemoryBarrier.oldLayout = resourceState.layout;
-        if (resourceState.access != VK_ACCESS_FLAG_BITS_MAX_ENUM) imageMemoryBarrier.srcAccessMask = resourceState.access;
+  // Recorded barriers are kept unless they provably do nothing: no layout change, no queue family ownership transfer, and no earlier access to order against.
+  const auto hasPendingAccesses = [](const SubresourceState& subresource) { return subresource.layout == SubresourceState::UnknownLayout || subresource.writeStages != VK_PIPELINE_STAGE_2_NONE || subresource.readStages != VK_PIPELINE_STAGE_2_NONE; };
+  std::erase_if(imageMemoryBarriers, [&](ImageMemoryBarrier& barrier) {
+    ResourceState& resourceState        = state.resourceStates.at(barrier.image);
+    const VkImageSubresourceRange range = resolveRange(barrier.subresourceRange, barrier.image);
+    const auto forEachSubresource = [&](auto&& function) {
+      for (uint32_t layer{range.baseArrayLayer}; layer < range.baseArrayLayer + range.layerCount; ++layer)
+        for (uint32_t mip{range.baseMipLevel}; mip < range.baseMipLevel + range.levelCount; ++mip) function(resourceState.get(mip, layer));
+    };
+    // A recorded barrier at the start of a CommandBuffer with deferred entry barriers is trusted as it was recorded.
+    if (flags & ModifyPipelineBarriers && resourceState.getLayout(range) != SubresourceState::UnknownLayout) {
+      barrier.oldLayout     = resourceState.getLayout(range);
+      barrier.srcStageMask  = VK_PIPELINE_STAGE_2_NONE;
+      barrier.srcAccessMask = VK_ACCESS_2_NONE;
+      forEachSubresource([&barrier](const SubresourceState& subresource) {
+        barrier.srcStageMask  |= subresource.writeStages | subresource.readStages;
+        barrier.srcAccessMask |= subresource.writeAccess;
+      });
+    }
+    bool pending = false;
+    forEachSubresource([&](const SubresourceState& subresource) { pending |= hasPendingAccesses(subresource); });
+    if (flags & RemovePipelineBarriers && barrier.oldLayout == barrier.newLayout && barrier.srcQueueFamilyIndex == barrier.dstQueueFamilyIndex && !pending) return true;
+    forEachSubresource([&barrier](SubresourceState& subresource) {
+      if (barrier.oldLayout != barrier.newLayout) subresource = {barrier.newLayout, barrier.dstStageMask, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_NONE, barrier.dstStageMask, barrier.dstAccessMask};
+      else {
+        subresource.visibleStages |= barrier.dstStageMask;
+        subresource.visibleAccess |= barrier.dstAccessMask;
       }
-      resourceState.layout = imageMemoryBarrier.newLayout;
-      resourceState.access = imageMemoryBarrier.dstAccessMask;
+    });
+    return false;
+  });
+  std::erase_if(bufferMemoryBarriers, [&](BufferMemoryBarrier& barrier) {
+    SubresourceState& subresource = state.resourceStates.at(barrier.buffer).get();
+    if (flags & ModifyPipelineBarriers && subresource.layout != SubresourceState::UnknownLayout) {
+      barrier.srcStageMask  = subresource.writeStages | subresource.readStages;
+      barrier.srcAccessMask = subresource.writeAccess;
     }
+    if (flags & RemovePipelineBarriers && barrier.srcQueueFamilyIndex == barrier.dstQueueFamilyIndex && !hasPendingAccesses(subresource)) return true;
+    subresource.visibleStages |= barrier.dstStageMask;
+    subresource.visibleAccess |= barrier.dstAccessMask;
+    return false;
+  });
 }
 void CommandBuffer::PipelineBarrier::bake(VkCommandBuffer commandBuffer) {
 #if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
   GraphicsInstance::setDebugDataCommand(this);
 #endif
-  auto* memoryBarrierData       = static_cast<VkMemoryBarrier*>(      alloca(memoryBarriers.size()       * sizeof(VkMemoryBarrier)      ));
-  auto* bufferMemoryBarrierData = static_cast<VkBufferMemoryBarrier*>(alloca(bufferMemoryBarriers.size() * sizeof(VkBufferMemoryBarrier)));
-  auto* imageMemoryBarrierData  = static_cast<VkImageMemoryBarrier*>( alloca(imageMemoryBarriers.size()  * sizeof(VkImageMemoryBarrier) ));
+  auto* memoryBarrierData       = static_cast<VkMemoryBarrier2*>(      alloca(memoryBarriers.size()       * sizeof(VkMemoryBarrier2)      ));
+  auto* bufferMemoryBarrierData = static_cast<VkBufferMemoryBarrier2*>(alloca(bufferMemoryBarriers.size() * sizeof(VkBufferMemoryBarrier2)));
+  auto* imageMemoryBarrierData  = static_cast<VkImageMemoryBarrier2*>( alloca(imageMemoryBarriers.size()  * sizeof(VkImageMemoryBarrier2) ));
   size_t i = std::numeric_limits<size_t>::max();
-  for (const MemoryBarrier& barrier : memoryBarriers) memoryBarrierData [++i] = static_cast<VkMemoryBarrier>(barrier);
+  for (const MemoryBarrier& barrier : memoryBarriers) memoryBarrierData [++i] = static_cast<VkMemoryBarrier2>(barrier);
   i = std::numeric_limits<size_t>::max();
-  for (const BufferMemoryBarrier& barrier : bufferMemoryBarriers) bufferMemoryBarrierData[++i] = static_cast<VkBufferMemoryBarrier>(barrier);
+  for (const BufferMemoryBarrier& barrier : bufferMemoryBarriers) bufferMemoryBarrierData[++i] = static_cast<VkBufferMemoryBarrier2>(barrier);
   i = std::numeric_limits<size_t>::max();
-  for (const ImageMemoryBarrier& barrier : imageMemoryBarriers) imageMemoryBarrierData [++i] = static_cast<VkImageMemoryBarrier>(barrier);
-  vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, dependencyFlags, memoryBarriers.size(), memoryBarrierData, bufferMemoryBarriers.size(), bufferMemoryBarrierData, imageMemoryBarriers.size(), imageMemoryBarrierData);
+  for (const ImageMemoryBarrier& barrier : imageMemoryBarriers) imageMemoryBarrierData [++i] = static_cast<VkImageMemoryBarrier2>(barrier);
+  const VkDependencyInfo dependencyInfo {
+    .sType                    = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+    .pNext                    = nullptr,
+    .dependencyFlags          = dependencyFlags,
+    .memoryBarrierCount       = static_cast<uint32_t>(memoryBarriers.size()),
+    .pMemoryBarriers          = memoryBarrierData,
+    .bufferMemoryBarrierCount = static_cast<uint32_t>(bufferMemoryBarriers.size()),
+    .pBufferMemoryBarriers    = bufferMemoryBarrierData,
+    .imageMemoryBarrierCount  = static_cast<uint32_t>(imageMemoryBarriers.size()),
+    .pImageMemoryBarriers     = imageMemoryBarrierData
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
 #if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
   GraphicsInstance::setDebugDataCommand(nullptr);
 #endif
 }
-std::string CommandBuffer::PipelineBarrier::toString(bool includeArguments) {
-  return "vkCmdPipelineBarrier";
+std::string CommandBuffer::PipelineBarrier::toString(const bool includeArguments) {
+  if (!includeArguments) return "vkCmdPipelineBarrier2";
+  std::string string = "vkCmdPipelineBarrier2";
+  const auto masks = [](const auto& barrier) {
+    return "\t\tstages: " + string_VkPipelineStageFlags2(barrier.srcStageMask) + " -> " + string_VkPipelineStageFlags2(barrier.dstStageMask) + "\n"
+    "\t\taccess: " + string_VkAccessFlags2(barrier.srcAccessMask) + " -> " + string_VkAccessFlags2(barrier.dstAccessMask);
+  };
+  uint64_t index{};
+  for (const MemoryBarrier& barrier: memoryBarriers) string += "\n\tMemory Barrier #" + std::to_string(index++) + ":\n" + masks(barrier);
+  index = 0;
+  for (const BufferMemoryBarrier& barrier: bufferMemoryBarriers) {
+    string += "\n\tBuffer Memory Barrier #" + std::to_string(index++) + ":\n"
+    "\t\tbuffer: " + std::to_string(reinterpret_cast<uint64_t>(barrier.buffer)) + "\n"
+    "\t\trange: " + std::to_string(barrier.offset) + ", " + (barrier.size == VK_WHOLE_SIZE ? "VK_WHOLE_SIZE" : std::to_string(barrier.size)) + "\n"
+    "\t\tqueue families: " + std::to_string(barrier.srcQueueFamilyIndex) + " -> " + std::to_string(barrier.dstQueueFamilyIndex) + "\n" + masks(barrier);
+  }
+  index = 0;
+  for (const ImageMemoryBarrier& barrier: imageMemoryBarriers) {
+    string += "\n\tImage Memory Barrier #" + std::to_string(index++) + ":\n"
+    "\t\timage: " + std::to_string(reinterpret_cast<uint64_t>(barrier.image)) + "\n"
+    "\t\tmip levels: " + std::to_string(barrier.subresourceRange.baseMipLevel) + ", " + std::to_string(barrier.subresourceRange.levelCount) + "\n"
+    "\t\tarray layers: " + std::to_string(barrier.subresourceRange.baseArrayLayer) + ", " + std::to_string(barrier.subresourceRange.layerCount) + "\n"
+    "\t\tlayout: " + string_VkImageLayout(barrier.oldLayout) + " -> " + string_VkImageLayout(barrier.newLayout) + "\n"
+    "\t\tqueue families: " + std::to_string(barrier.srcQueueFamilyIndex) + " -> " + std::to_string(barrier.dstQueueFamilyIndex) + "\n" + masks(barrier);
+  }
+  return string;
 }
 
 void CommandBuffer::PushConstants::preprocess(State& state, PreprocessingFlags flags) {
@@ -396,94 +470,465 @@ void CommandBuffer::addCleanupResource(Resource* resource) {
   resources.insert(resource);
 }
 
+void CommandBuffer::addCleanupFunction(std::function<void()> function) {
+  cleanupFunctions.push_back(std::move(function));
+}
+
 CommandBuffer::State CommandBuffer::preprocess(State state, const PreprocessingFlags flags, const bool apply) {
   /**@todo: Make this able to change Blits to Copies where possible for speed.*/
-  /**@todo: Make this able to add buffer and global memory barriers.*/
+  /**@todo: Make this able to add global memory barriers.*/
   /**@todo: Think about VK_DEPENDENCY_BY_REGION_BIT. This should only really affect tiled GPUs.*/
-  /**@todo: Optimize PipelineBarrier commands. (Not necessarily in order)
-   *    - Acknowledge pre-existing PipelineBarrier commands.
-   *    - AGGRESSIVELY merge PipelineBarrier commands.
-   *    - Support promoting PipelineBarriers to SetEvent / WaitEvents.
-   *    - Rearrange commands to reduce synchronization needs.
-   */
+  /**@todo: Support promoting PipelineBarriers to SetEvent / WaitEvents, and rearranging commands to reduce synchronization needs.*/
+  if (apply && flags & MergePipelineBinds) mergePipelineBinds();
   getDefaultState(state);
-  std::unordered_map<const Resource*, Command::ResourceAccess> previousAccesses;
-  for (auto it = commands.begin(); it != commands.end(); ++it) {
+  // Commands are written to a second stream rather than having barriers inserted in place, so adding barriers never shifts the commands that follow them.
+  preprocessedCommands.clear();
+  preprocessedCommands.reserve(commands.size());
+  for (Command* const command: commands) {
+    // Recorded barriers are kept apart from generated ones, as whoever recorded them may rely on their exact position.
+    if (command->kind == kindOf<PipelineBarrier>()) {
+      auto* const barrier = static_cast<PipelineBarrier*>(command);
+      barrier->preprocess(state, flags);
+      if (!(flags & RemovePipelineBarriers) || !barrier->empty()) preprocessedCommands.push_back(barrier);
+      continue;
+    }
     if (flags & AddPipelineBarriers) {
-      for (const Command::ResourceAccess& access: (*it)->accesses) {
-        ResourceState& resourceState            = state.resourceStates[access.resource];
-        Command::ResourceAccess& previousAccess = previousAccesses[access.resource];
-        std::vector<PipelineBarrier::ImageMemoryBarrier> imageMemoryBarriers;
-        std::vector<PipelineBarrier::BufferMemoryBarrier> bufferMemoryBarriers;
-        if (access.resource->type == Resource::Image && (!std::ranges::contains(access.allowedLayouts, resourceState.layout) || (access.mask & resourceState.access) == access.mask)) {
-          const auto* const image = dynamic_cast<const Image* const>(access.resource);
-          imageMemoryBarriers.push_back({
-            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-            .pNext               = nullptr,
-            .srcAccessMask       = previousAccess.mask,
-            .dstAccessMask       = access.mask,
-            .oldLayout           = resourceState.layout,
-            .newLayout           = access.allowedLayouts[0],  // We always prefer the layout listed first. @todo: Choose a layout that reduces the number of memory barriers / transitions needed most if one exists.
-            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-            .image               = image,
-            .subresourceRange    = image->getWholeRange()
-          });
-        }
-        if (access.resource->type == Resource::Buffer) {
-          const auto* const buffer = dynamic_cast<const Buffer* const>(access.resource);
-          bufferMemoryBarriers.push_back({
-            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-            .pNext = nullptr,
-            .srcAccessMask = previousAccess.mask,
-            .dstAccessMask = access.mask,
-            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-            .buffer = buffer,
-            .offset = 0,
-            .size = VK_WHOLE_SIZE
-          });
-        }
-        if (apply && !imageMemoryBarriers.empty() || !bufferMemoryBarriers.empty())
-          (*record<PipelineBarrier>(it, previousAccess.stage, access.stage, 0, std::span<PipelineBarrier::MemoryBarrier>{}, bufferMemoryBarriers, imageMemoryBarriers))->preprocess(state, flags);
-        previousAccess = access;
+      touchedResources.clear();
+      deferredResources.clear();
+      for (const Command::ResourceAccess& access: command->accesses) {
+        synchronize(state, access, flags, touchedResources);
+        touchedResources.push_back(access.resource);
+      }
+      if (apply) flushBarriers(flags);
+      else {
+        pendingImageBarriers.clear();
+        pendingBufferBarriers.clear();
       }
     }
-    (*it)->preprocess(state, flags);
+    visit(*command, [&state, flags](auto& concreteCommand) { concreteCommand.preprocess(state, flags); });
+    preprocessedCommands.push_back(command);
   }
+  if (apply) std::swap(commands, preprocessedCommands);
   return state;
 }
 
-std::string CommandBuffer::toString() const {
+std::string CommandBuffer::toString(const bool includeArguments) const {
   std::string view;
   uint64_t commandIndex = 0;
-  for (const auto& command : commands) {
-    view += "#" + std::to_string(commandIndex++) + ": " + command->toString() + "\n";
+  for (Command* const command : commands) {
+    visit(*command, [&](auto& concreteCommand) { view += "#" + std::to_string(commandIndex++) + ": " + concreteCommand.toString(includeArguments) + "\n"; });
   }
   return view;
 }
 
 void CommandBuffer::bake(VkCommandBuffer commandBuffer) const {
-  for (const std::unique_ptr<Command>& command: commands) command->bake(commandBuffer);
+  for (Command* const command: commands) visit(*command, [commandBuffer](auto& concreteCommand) { concreteCommand.bake(commandBuffer); });
+}
+
+void CommandBuffer::recordSeam(State& state, const State& other, const PreprocessingFlags flags) {
+  preprocessedCommands.clear();
+  for (const auto& [resource, entryState]: other.entryStates) {
+    ResourceState& resourceState = state.resourceStates.try_emplace(resource, makeResourceState(resource, VK_IMAGE_LAYOUT_UNDEFINED)).first->second;
+    for (uint32_t layer{}; layer < entryState.subresources.size() / entryState.mipLevels; ++layer) {
+      for (uint32_t mip{}; mip < entryState.mipLevels; ++mip) {
+        const SubresourceState& entry = entryState.subresources[layer * entryState.mipLevels + mip];
+        if (entry.layout == SubresourceState::UnknownLayout) continue;
+        // Each subresource is synchronized as if the first command of the other CommandBuffer accessed only it. Adjacent subresources are still merged into one barrier.
+        synchronize(state, {
+          .type           = entry.writeAccess != VK_ACCESS_2_NONE ? Command::ResourceAccess::Write : Command::ResourceAccess::Read,
+          .resource       = resource,
+          .stage          = static_cast<VkPipelineStageFlags>(entry.visibleStages),
+          .mask           = static_cast<VkAccessFlags>(entry.visibleAccess),
+          .allowedLayouts = std::span{&entry.layout, 1},
+          .range          = {VK_IMAGE_ASPECT_NONE, mip, 1, layer, 1}
+        }, flags, {});
+      }
+    }
+  }
+  flushBarriers(flags);
+  commands.insert(commands.end(), preprocessedCommands.begin(), preprocessedCommands.end());
+  preprocessedCommands.clear();
+
+  for (const auto& [resource, exitState]: other.resourceStates) {
+    ResourceState& resourceState = state.resourceStates.try_emplace(resource, makeResourceState(resource, VK_IMAGE_LAYOUT_UNDEFINED)).first->second;
+    for (std::size_t i{}; i < exitState.subresources.size(); ++i)
+      if (exitState.subresources[i].layout != SubresourceState::UnknownLayout) resourceState.subresources[i] = exitState.subresources[i];
+  }
+}
+
+void CommandBuffer::bakeSecondary(const std::span<const VkCommandBuffer> commandBuffers) const {
+  auto commandBuffer = commandBuffers.begin();
+  bool insideRenderPass = false;
+  for (Command* const command: commands) {
+    if (command->kind == kindOf<BeginRenderPass>()) {
+      const VkRenderPassBeginInfo& renderPassBeginInfo = static_cast<const BeginRenderPass*>(command)->renderPassBeginInfo;
+      const VkCommandBufferInheritanceInfo inheritanceInfo {
+        .sType                = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext                = nullptr,
+        .renderPass           = renderPassBeginInfo.renderPass,
+        .subpass              = 0,
+        .framebuffer          = renderPassBeginInfo.framebuffer,
+        .occlusionQueryEnable = VK_FALSE,
+        .queryFlags           = 0,
+        .pipelineStatistics   = 0
+      };
+      const VkCommandBufferBeginInfo beginInfo {
+        .sType            = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext            = nullptr,
+        .flags            = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritanceInfo
+      };
+      if (const VkResult result = vkBeginCommandBuffer(*commandBuffer, &beginInfo); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to begin secondary command buffer");
+      insideRenderPass = true;
+    } else if (command->kind == kindOf<EndRenderPass>()) {
+      if (const VkResult result = vkEndCommandBuffer(*commandBuffer++); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to end secondary command buffer");
+      insideRenderPass = false;
+    } else if (insideRenderPass) visit(*command, [commandBuffer](auto& concreteCommand) { concreteCommand.bake(*commandBuffer); });
+  }
+}
+
+void CommandBuffer::bakePrimary(VkCommandBuffer commandBuffer, const std::span<const VkCommandBuffer> secondaryCommandBuffers) const {
+  auto secondaryCommandBuffer = secondaryCommandBuffers.begin();
+  bool insideRenderPass = false;
+  for (Command* const command: commands) {
+    if (command->kind == kindOf<BeginRenderPass>()) {
+      vkCmdBeginRenderPass(commandBuffer, &static_cast<const BeginRenderPass*>(command)->renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+      vkCmdExecuteCommands(commandBuffer, 1, &*secondaryCommandBuffer++);
+      insideRenderPass = true;
+      continue;
+    }
+    if (command->kind == kindOf<EndRenderPass>()) insideRenderPass = false;
+    if (!insideRenderPass) visit(*command, [commandBuffer](auto& concreteCommand) { concreteCommand.bake(commandBuffer); });
+  }
+}
+
+std::size_t CommandBuffer::getRenderPassCount() const {
+  return std::ranges::count(commands, kindOf<BeginRenderPass>(), &Command::kind);
 }
 
 void CommandBuffer::clear() {
   for (Resource* const& resource: resources) delete resource;
   resources.clear();
+  for (const std::function<void()>& function: cleanupFunctions) function();
+  cleanupFunctions.clear();
+#if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
+  // Traces own memory outside the arena, so they are the only part of a command that must be destroyed.
+  for (Command* const command: createdCommands) std::destroy_at(&command->trace);
+  createdCommands.clear();
+#endif
   commands.clear();
+  preprocessedCommands.clear();
+  arena.reset();
 }
 
 void CommandBuffer::getDefaultState(State& state) {
-  for (auto commandIterator{commands.begin()}; commandIterator != commands.end(); ++commandIterator) {
-    for (const Command::ResourceAccess& access : (*commandIterator)->accesses) {
-      switch (access.resource->type) {
-        case Resource::Image: state.resourceStates.emplace(access.resource, VK_IMAGE_LAYOUT_UNDEFINED); break;
-        case Resource::Buffer: state.resourceStates.emplace(access.resource, VK_IMAGE_LAYOUT_MAX_ENUM); break;
+  const auto initialState = [layout = state.deferEntryBarriers ? SubresourceState::UnknownLayout : VK_IMAGE_LAYOUT_UNDEFINED](const Resource* resource) { return makeResourceState(resource, layout); };
+  for (Command* const command: commands) {
+    for (const Command::ResourceAccess& access : command->accesses) state.resourceStates.try_emplace(access.resource, initialState(access.resource));
+    // Recorded barriers do not declare accesses, but still need to know the state of the resources that they synchronize.
+    if (command->kind != kindOf<PipelineBarrier>()) continue;
+    const auto* const barrier = static_cast<const PipelineBarrier*>(command);
+    for (const PipelineBarrier::BufferMemoryBarrier& bufferBarrier: barrier->bufferMemoryBarriers) state.resourceStates.try_emplace(bufferBarrier.buffer, initialState(bufferBarrier.buffer));
+    for (const PipelineBarrier::ImageMemoryBarrier& imageBarrier: barrier->imageMemoryBarriers) state.resourceStates.try_emplace(imageBarrier.image, initialState(imageBarrier.image));
+  }
+}
+
+CommandBuffer::ResourceState CommandBuffer::makeResourceState(const Resource* resource, const VkImageLayout layout) {
+  if (resource->type != Resource::Image) return {1, std::vector<SubresourceState>(1, {.layout=layout})};
+  const auto* const image = dynamic_cast<const Image*>(resource);
+  return {image->getMipLevels(), std::vector<SubresourceState>(image->getMipLevels() * image->getLayerCount(), {.layout=layout})};
+}
+
+VkImageSubresourceRange CommandBuffer::resolveRange(VkImageSubresourceRange range, const Image* image) {
+  if (range.aspectMask == VK_IMAGE_ASPECT_NONE) range.aspectMask = image->getAspect();
+  if (range.levelCount == VK_REMAINING_MIP_LEVELS) range.levelCount = image->getMipLevels() - range.baseMipLevel;
+  if (range.layerCount == VK_REMAINING_ARRAY_LAYERS) range.layerCount = image->getLayerCount() - range.baseArrayLayer;
+  return range;
+}
+
+void CommandBuffer::synchronize(State& state, const Command::ResourceAccess& access, const PreprocessingFlags flags, const std::span<const Resource* const> touched) {
+  ResourceState& resourceState = state.resourceStates.at(access.resource);
+  const auto* const image      = access.resource->type == Resource::Image ? dynamic_cast<const Image*>(access.resource) : nullptr;
+  const VkImageSubresourceRange range = image == nullptr ? VkImageSubresourceRange{VK_IMAGE_ASPECT_NONE, 0, 1, 0, 1} : resolveRange(access.range, image);
+  const bool write  = access.type & Command::ResourceAccess::Write;
+  const bool narrow = flags & ModifyPipelineBarriers;
+  const VkPipelineStageFlags2 dstStage = narrow ? access.stage : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+  const VkAccessFlags2 dstAccess       = narrow ? access.mask : VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+  // A command cannot be split by a barrier, so a resource that it accesses more than once is synchronized for all of those accesses by the barriers made for the first.
+  if (std::ranges::contains(touched, access.resource)) {
+    for (PipelineBarrier::ImageMemoryBarrier& barrier: pendingImageBarriers | std::views::filter([&](const auto& barrier) { return barrier.image == access.resource; })) {
+      barrier.dstStageMask  |= dstStage;
+      barrier.dstAccessMask |= dstAccess;
+    }
+    for (PipelineBarrier::BufferMemoryBarrier& barrier: pendingBufferBarriers | std::views::filter([&](const auto& barrier) { return barrier.buffer == access.resource; })) {
+      barrier.dstStageMask  |= dstStage;
+      barrier.dstAccessMask |= dstAccess;
+    }
+    const auto widen = [&](SubresourceState& subresource) {
+      if (write) {
+        subresource.writeStages |= access.stage;
+        subresource.writeAccess |= access.mask;
+      } else subresource.readStages |= access.stage;
+      subresource.visibleStages |= access.stage;
+      subresource.visibleAccess |= access.mask;
+    };
+    ResourceState* const entryState = std::ranges::contains(deferredResources, access.resource) ? &state.entryStates.at(access.resource) : nullptr;
+    for (uint32_t layer{range.baseArrayLayer}; layer < range.baseArrayLayer + range.layerCount; ++layer) {
+      for (uint32_t mip{range.baseMipLevel}; mip < range.baseMipLevel + range.levelCount; ++mip) {
+        widen(resourceState.get(mip, layer));
+        if (entryState != nullptr && entryState->get(mip, layer).layout != SubresourceState::UnknownLayout) widen(entryState->get(mip, layer));
+      }
+    }
+    return;
+  }
+
+  // The first use of an image that shares its memory with others overwrites their contents, so it must wait for everything that
+  // last used them. Those images then start over from an undefined layout, and their next use waits for this one in turn.
+  const auto isFresh = [](const SubresourceState& subresource) { return subresource.layout == VK_IMAGE_LAYOUT_UNDEFINED && subresource.writeStages == VK_PIPELINE_STAGE_2_NONE && subresource.readStages == VK_PIPELINE_STAGE_2_NONE; };
+  if (image != nullptr && image->isAliased() && std::ranges::all_of(resourceState.subresources, isFresh)) {
+    VkPipelineStageFlags2 aliasStages{VK_PIPELINE_STAGE_2_NONE};
+    VkAccessFlags2 aliasAccess{VK_ACCESS_2_NONE};
+    for (auto& [resource, otherState]: state.resourceStates) {
+      if (resource == image || resource->type != Resource::Image || !image->aliases(*dynamic_cast<const Image*>(resource))) continue;
+      for (SubresourceState& subresource: otherState.subresources) {
+        if (subresource.layout == SubresourceState::UnknownLayout || isFresh(subresource)) continue;
+        aliasStages |= subresource.writeStages | subresource.readStages;
+        aliasAccess |= subresource.writeAccess;
+        subresource  = {VK_IMAGE_LAYOUT_UNDEFINED, access.stage, access.mask, VK_PIPELINE_STAGE_2_NONE, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE};
+      }
+    }
+    // Every subresource inherits the aliases' last use as its own, so that the first access to each one waits for it, including
+    // those that this access does not touch and those that <c>recordSeam</c> synchronizes one at a time.
+    if (aliasStages != VK_PIPELINE_STAGE_2_NONE)
+      for (SubresourceState& subresource: resourceState.subresources) subresource = {VK_IMAGE_LAYOUT_UNDEFINED, aliasStages, aliasAccess, VK_PIPELINE_STAGE_2_NONE, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE};
+  }
+
+  VkPipelineStageFlags2 srcStage;
+  VkAccessFlags2 srcAccess;
+  VkImageLayout oldLayout;
+  VkImageLayout newLayout;
+  // Decides whether a subresource must be synchronized before this access, then moves it to the state that this access leaves it in.
+  const auto advance = [&](const uint32_t mip, const uint32_t layer) {
+    SubresourceState& subresource = resourceState.get(mip, layer);
+    oldLayout = subresource.layout;
+    newLayout = image == nullptr || std::ranges::contains(access.allowedLayouts, oldLayout) ? oldLayout : access.allowedLayouts[0];  // We always prefer the layout listed first. @todo: Choose a layout that reduces the number of memory barriers / transitions needed most if one exists.
+    if (oldLayout == SubresourceState::UnknownLayout) {
+      // Whatever comes before this CommandBuffer is not known yet, so the barrier is left to <c>recordSeam</c>.
+      if (image == nullptr) newLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      state.entryStates.try_emplace(access.resource, makeResourceState(access.resource, SubresourceState::UnknownLayout)).first->second.get(mip, layer) = write ? SubresourceState{newLayout, access.stage, access.mask, VK_PIPELINE_STAGE_2_NONE, access.stage, access.mask} : SubresourceState{newLayout, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, access.stage, access.stage, access.mask};
+      deferredResources.push_back(access.resource);
+      subresource = {newLayout, access.stage, write ? access.mask : VK_ACCESS_2_NONE, write ? VK_PIPELINE_STAGE_2_NONE : access.stage, access.stage, access.mask};
+      return false;
+    }
+    const bool transition = oldLayout != newLayout;
+    bool needed;
+    if (transition || write) needed = subresource.writeStages != VK_PIPELINE_STAGE_2_NONE || subresource.readStages != VK_PIPELINE_STAGE_2_NONE || transition;  // Transitions are writes too.
+    else needed = subresource.writeStages != VK_PIPELINE_STAGE_2_NONE && ((access.stage & ~subresource.visibleStages) != 0 || (access.mask & ~subresource.visibleAccess) != 0);
+    needed   |= !(flags & RemovePipelineBarriers);
+    srcStage  = narrow ? (write || transition ? subresource.writeStages | subresource.readStages : subresource.writeStages) : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    srcAccess = narrow ? subresource.writeAccess : VK_ACCESS_2_MEMORY_WRITE_BIT;
+    if (write) subresource = {newLayout, access.stage, access.mask, VK_PIPELINE_STAGE_2_NONE, access.stage, access.mask};
+    else if (transition) subresource = {newLayout, access.stage, VK_ACCESS_2_NONE, access.stage, access.stage, access.mask};
+    else {
+      subresource.readStages |= access.stage;
+      if (needed) {
+        subresource.visibleStages |= access.stage;
+        subresource.visibleAccess |= access.mask;
       }
     }
+    return needed;
+  };
+
+  if (image == nullptr) {
+    if (!advance(0, 0)) return;
+    pendingBufferBarriers.push_back({
+      .sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+      .pNext               = nullptr,
+      .srcStageMask        = srcStage,
+      .srcAccessMask       = srcAccess,
+      .dstStageMask        = dstStage,
+      .dstAccessMask       = dstAccess,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .buffer              = dynamic_cast<const Buffer*>(access.resource),
+      .offset              = 0,
+      .size                = VK_WHOLE_SIZE
+    });
+    return;
+  }
+
+  const bool merge = flags & MergePipelineBarriers;
+  const auto mergeable = [](const PipelineBarrier::ImageMemoryBarrier& a, const PipelineBarrier::ImageMemoryBarrier& b) {
+    return a.image == b.image && a.oldLayout == b.oldLayout && a.newLayout == b.newLayout && a.srcStageMask == b.srcStageMask && a.srcAccessMask == b.srcAccessMask && a.dstStageMask == b.dstStageMask && a.dstAccessMask == b.dstAccessMask && a.subresourceRange.aspectMask == b.subresourceRange.aspectMask;
+  };
+  // Barriers are made per subresource, then grown along mip levels and then along array layers, so an access that finds the whole image in one state needs a single barrier.
+  for (uint32_t layer{range.baseArrayLayer}; layer < range.baseArrayLayer + range.layerCount; ++layer) {
+    for (uint32_t mip{range.baseMipLevel}; mip < range.baseMipLevel + range.levelCount; ++mip) {
+      if (!advance(mip, layer)) continue;
+      const PipelineBarrier::ImageMemoryBarrier barrier{
+        .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .pNext               = nullptr,
+        .srcStageMask        = srcStage,
+        .srcAccessMask       = srcAccess,
+        .dstStageMask        = dstStage,
+        .dstAccessMask       = dstAccess,
+        .oldLayout           = oldLayout,
+        .newLayout           = newLayout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image               = image,
+        .subresourceRange    = {range.aspectMask, mip, 1, layer, 1}
+      };
+      if (PipelineBarrier::ImageMemoryBarrier* previous = pendingImageBarriers.empty() ? nullptr : &pendingImageBarriers.back(); merge && previous != nullptr && mergeable(*previous, barrier) && previous->subresourceRange.baseArrayLayer == layer && previous->subresourceRange.layerCount == 1 && previous->subresourceRange.baseMipLevel + previous->subresourceRange.levelCount == mip) ++previous->subresourceRange.levelCount;
+      else pendingImageBarriers.push_back(barrier);
+    }
+    if (!merge || pendingImageBarriers.size() < 2) continue;
+    PipelineBarrier::ImageMemoryBarrier& last     = pendingImageBarriers.back();
+    PipelineBarrier::ImageMemoryBarrier& previous = pendingImageBarriers.end()[-2];
+    if (last.subresourceRange.baseArrayLayer == layer && mergeable(previous, last) && previous.subresourceRange.baseMipLevel == last.subresourceRange.baseMipLevel && previous.subresourceRange.levelCount == last.subresourceRange.levelCount && previous.subresourceRange.baseArrayLayer + previous.subresourceRange.layerCount == layer) {
+      ++previous.subresourceRange.layerCount;
+      pendingImageBarriers.pop_back();
+    }
+  }
+}
+
+void CommandBuffer::flushBarriers(const PreprocessingFlags flags) {
+  if (flags & MergePipelineBarriers) {
+    if (!pendingImageBarriers.empty() || !pendingBufferBarriers.empty()) preprocessedCommands.push_back(create<PipelineBarrier>(0, std::span<PipelineBarrier::MemoryBarrier>{}, pendingBufferBarriers, pendingImageBarriers));
+  } else {
+    for (const PipelineBarrier::BufferMemoryBarrier& barrier: pendingBufferBarriers) preprocessedCommands.push_back(create<PipelineBarrier>(0, std::span<PipelineBarrier::MemoryBarrier>{}, std::span{&barrier, 1}, std::span<PipelineBarrier::ImageMemoryBarrier>{}));
+    for (const PipelineBarrier::ImageMemoryBarrier& barrier: pendingImageBarriers) preprocessedCommands.push_back(create<PipelineBarrier>(0, std::span<PipelineBarrier::MemoryBarrier>{}, std::span<PipelineBarrier::BufferMemoryBarrier>{}, std::span{&barrier, 1}));
   }
+  pendingImageBarriers.clear();
+  pendingBufferBarriers.clear();
+}
+
+void CommandBuffer::mergePipelineBinds() {
+  using VertexBuffer = std::pair<Buffer*, VkDeviceSize>;
+  // Everything that a draw needs bound. Descriptor sets and vertex buffers that have never been bound are null.
+  struct BoundState {
+    const Pipeline* pipeline{nullptr};
+    std::pmr::vector<VkDescriptorSet> descriptorSets;
+    std::pmr::vector<VertexBuffer> vertexBuffers;
+    const Buffer* indexBuffer{nullptr};
+    std::pmr::vector<const PushConstants*> pushConstants;
+
+    explicit BoundState(const std::pmr::polymorphic_allocator<>& allocator) : descriptorSets(allocator), vertexBuffers(allocator), pushConstants(allocator) {}
+  };
+  struct DeferredDraw {
+    BoundState state;
+    Command* draw;
+    std::array<std::size_t, 3> key;  // The order in which the pipeline, descriptor sets and vertex buffers were first used
+  };
+  // All of this only lives until the end of the frame, so it is allocated from the arena along with the commands.
+  const std::pmr::polymorphic_allocator<> arenaAllocator{&arena};
+  BoundState recorded{arenaAllocator};
+  BoundState emitted{arenaAllocator};
+  std::pmr::vector<DeferredDraw> deferredDraws{arenaAllocator};
+  std::pmr::unordered_map<const Pipeline*, std::size_t> pipelineKeys{arenaAllocator};
+  std::pmr::map<std::pmr::vector<VkDescriptorSet>, std::size_t> descriptorSetKeys{arenaAllocator};
+  std::pmr::map<std::pmr::vector<VertexBuffer>, std::size_t> vertexBufferKeys{arenaAllocator};
+  bool insideRenderPass = false;
+
+  // Binds each run of consecutive slots whose wanted value is bound and differs from the current one.
+  const auto bindChanged = [](const auto& wanted, auto& current, auto&& bind) {
+    const auto changed = [&](const std::size_t i) { return wanted[i] != std::ranges::range_value_t<decltype(wanted)>{} && (i >= current.size() || current[i] != wanted[i]); };
+    if (current.size() < wanted.size()) current.resize(wanted.size());
+    for (std::size_t i{}; i < wanted.size(); ++i) {
+      if (!changed(i)) continue;
+      std::size_t end{i + 1};
+      while (end < wanted.size() && changed(end)) ++end;
+      bind(i, end);
+      std::ranges::copy(wanted.begin() + i, wanted.begin() + end, current.begin() + i);
+      i = end;
+    }
+  };
+  const auto emit = [&](const BoundState& wanted, Command* const draw) {
+    if (wanted.pipeline != emitted.pipeline && wanted.pipeline != nullptr) {
+      preprocessedCommands.push_back(create<BindPipeline>(wanted.pipeline));
+      emitted.pipeline = wanted.pipeline;
+      // A new pipeline may have an incompatible layout, which would disturb descriptor sets and push constants.
+      emitted.descriptorSets.clear();
+      emitted.pushConstants.clear();
+    }
+    bindChanged(wanted.descriptorSets, emitted.descriptorSets, [&](const std::size_t begin, const std::size_t end) {
+      preprocessedCommands.push_back(create<BindDescriptorSets>(std::span{wanted.descriptorSets}.subspan(begin, end - begin), static_cast<uint32_t>(begin)));
+    });
+    bindChanged(wanted.vertexBuffers, emitted.vertexBuffers, [&](const std::size_t begin, const std::size_t end) {
+      const auto vertexBuffers = std::span{wanted.vertexBuffers}.subspan(begin, end - begin);
+      preprocessedCommands.push_back(create<BindVertexBuffers>(vertexBuffers | std::views::keys, vertexBuffers | std::views::values, static_cast<uint32_t>(begin)));
+    });
+    if (wanted.indexBuffer != emitted.indexBuffer && wanted.indexBuffer != nullptr) {
+      preprocessedCommands.push_back(create<BindIndexBuffer>(wanted.indexBuffer));
+      emitted.indexBuffer = wanted.indexBuffer;
+    }
+    for (const PushConstants* const pushConstants: wanted.pushConstants) {
+      if (std::ranges::contains(emitted.pushConstants, pushConstants)) continue;
+      preprocessedCommands.push_back(create<PushConstants>(pushConstants->data, pushConstants->stages, pushConstants->offset));
+      emitted.pushConstants.push_back(pushConstants);
+    }
+    preprocessedCommands.push_back(draw);
+  };
+  const auto flush = [&] {
+    std::ranges::stable_sort(deferredDraws, {}, &DeferredDraw::key);
+    for (const DeferredDraw& deferredDraw: deferredDraws) emit(deferredDraw.state, deferredDraw.draw);
+    deferredDraws.clear();
+  };
+
+  // Bind commands are only recorded into <c>recorded</c>. They are rebuilt in front of each draw as it is emitted.
+  preprocessedCommands.clear();
+  preprocessedCommands.reserve(commands.size());
+  for (Command* const command: commands) {
+    switch (command->kind) {
+      case kindOf<BindPipeline>(): recorded.pipeline = static_cast<const BindPipeline*>(command)->pipeline; break;
+      case kindOf<BindDescriptorSets>(): {
+        const auto* const bind = static_cast<const BindDescriptorSets*>(command);
+        recorded.descriptorSets.resize(std::max<std::size_t>(recorded.descriptorSets.size(), bind->firstSet + bind->descriptorSets.size()));
+        std::ranges::copy(bind->descriptorSets, recorded.descriptorSets.begin() + bind->firstSet);
+        break;
+      }
+      case kindOf<BindVertexBuffers>(): {
+        const auto* const bind = static_cast<const BindVertexBuffers*>(command);
+        recorded.vertexBuffers.resize(std::max<std::size_t>(recorded.vertexBuffers.size(), bind->firstBinding + bind->buffers.size()));
+        for (std::size_t i{}; i < bind->buffers.size(); ++i) recorded.vertexBuffers[bind->firstBinding + i] = {bind->buffers[i], bind->offsets[i]};
+        break;
+      }
+      case kindOf<BindIndexBuffer>(): recorded.indexBuffer = static_cast<const BindIndexBuffer*>(command)->buffer; break;
+      case kindOf<PushConstants>(): {
+        const auto* const pushConstants = static_cast<const PushConstants*>(command);
+        std::erase_if(recorded.pushConstants, [pushConstants](const PushConstants* const other) { return other->offset == pushConstants->offset && other->data.size() == pushConstants->data.size(); });
+        recorded.pushConstants.push_back(pushConstants);
+        break;
+      }
+      case kindOf<Draw>():
+      case kindOf<DrawIndexed>():
+      case kindOf<DrawIndexedIndirect>():
+        if (insideRenderPass && command->accesses.empty() && recorded.pipeline != nullptr && recorded.pipeline->isOrderIndependent()) {
+          deferredDraws.push_back({BoundState{arenaAllocator}, command, {
+            pipelineKeys.try_emplace(recorded.pipeline, pipelineKeys.size()).first->second,
+            descriptorSetKeys.try_emplace(recorded.descriptorSets, descriptorSetKeys.size()).first->second,
+            vertexBufferKeys.try_emplace(recorded.vertexBuffers, vertexBufferKeys.size()).first->second
+          }});
+          deferredDraws.back().state = recorded;
+        } else {
+          flush();
+          emit(recorded, command);
+        }
+        break;
+      default:
+        flush();
+        if (command->kind == kindOf<BeginRenderPass>()) {
+          insideRenderPass = true;
+          emitted          = BoundState{arenaAllocator};
+        } else if (command->kind == kindOf<EndRenderPass>()) insideRenderPass = false;
+        preprocessedCommands.push_back(command);
+    }
+  }
+  flush();
+  std::swap(commands, preprocessedCommands);
 }
 
 CommandBuffer::~CommandBuffer() {
-  for (Resource* const& resource: resources) delete resource;
+  clear();
 }
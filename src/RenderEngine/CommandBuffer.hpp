@@ -3,13 +3,18 @@
 #include "src/RenderEngine/RenderPass/RenderPass.hpp"
 #include "src/RenderEngine/Resources/Buffer.hpp"
 #include "src/RenderEngine/Resources/Image.hpp"
+#include "src/Tools/Arena.hpp"
 
 #include <vulkan/vulkan_core.h>
 
 #include <cpptrace/basic.hpp>
 
-#include <list>
+#include <array>
+#include <functional>
 #include <memory>
+#include <memory_resource>
+#include <span>
+#include <tuple>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -24,20 +29,45 @@ class Mesh;
 
 class CommandBuffer {
 public:
+  /**
+   * Preprocessing with only <c>AddPipelineBarriers</c> produces a naive but correct stream, with one barrier per accessed subresource,
+   * full stage and access masks, and no barriers removed. Every other barrier flag tightens that stream without changing its meaning.
+   */
   enum PreprocessingFlags {
-    AddPipelineBarriers = 0x1,
-    RemovePipelineBarriers = 0x2,
-    ModifyPipelineBarriers = 0x4,
-    MergePipelineBarriers = 0x8,
+    AddPipelineBarriers = 0x1,     // Insert the barriers that each command needs before it
+    RemovePipelineBarriers = 0x2,  // Skip barriers that would not change anything, including recorded ones
+    ModifyPipelineBarriers = 0x4,  // Narrow stage and access masks to the accesses actually being synchronized, and fix up recorded barriers
+    MergePipelineBarriers = 0x8,   // Coalesce the barriers before each command into one vkCmdPipelineBarrier2 with as few ranges as possible
     PipelineBarriers = AddPipelineBarriers | RemovePipelineBarriers | ModifyPipelineBarriers | MergePipelineBarriers,
     MergePipelineBinds = 0x10,
     StateTransitions = MergePipelineBinds,
     Everything = PipelineBarriers | StateTransitions
   };
 
-  struct ResourceState {
+  /**
+   * The synchronization state of a single mip level of a single array layer of an image, or of a whole buffer.
+   */
+  struct SubresourceState {
+    static constexpr VkImageLayout UnknownLayout = VK_IMAGE_LAYOUT_MAX_ENUM;  // Nothing is known about a subresource in this layout. Used for buffers too.
+
     VkImageLayout layout{VK_IMAGE_LAYOUT_UNDEFINED};
-    VkAccessFlags access{VK_ACCESS_FLAG_BITS_MAX_ENUM};
+    VkPipelineStageFlags2 writeStages{VK_PIPELINE_STAGE_2_NONE};    // The stages of the last write, or of the barrier that last changed the layout
+    VkAccessFlags2 writeAccess{VK_ACCESS_2_NONE};                   // The accesses of the last write
+    VkPipelineStageFlags2 readStages{VK_PIPELINE_STAGE_2_NONE};     // The stages that have read since the last write
+    VkPipelineStageFlags2 visibleStages{VK_PIPELINE_STAGE_2_NONE};  // The stages that the last write has been made visible to
+    VkAccessFlags2 visibleAccess{VK_ACCESS_2_NONE};                 // The accesses that the last write has been made visible to
+  };
+
+  struct ResourceState {
+    uint32_t mipLevels{1};
+    std::vector<SubresourceState> subresources{1};  // Indexed by <c>layer * mipLevels + mipLevel</c>. Buffers have exactly one.
+
+    [[nodiscard]] SubresourceState& get(const uint32_t mipLevel=0, const uint32_t layer=0) { return subresources[layer * mipLevels + mipLevel]; }
+    /**
+     * @param range The subresources to query
+     * @return The layout of the first subresource in <c>range</c>. After preprocessing, every subresource that a command accesses shares this layout.
+     */
+    [[nodiscard]] VkImageLayout getLayout(const VkImageSubresourceRange& range) const { return subresources[range.baseArrayLayer * mipLevels + range.baseMipLevel].layout; }
   };
 
   struct State {
@@ -46,6 +76,13 @@ public:
     const Pipeline* pipeline;
     const Buffer* indexBuffer;
     std::vector<const Buffer*> vertexBuffers;
+    /**
+     * When set, resources start in <c>UnknownLayout</c> and the first access to each subresource gets no barrier. The state that
+     * each of those accesses needs is stored in <c>entryStates</c> instead, so that <c>recordSeam</c> can add the barrier once the
+     * commands that come before this CommandBuffer are known. This lets CommandBuffers be preprocessed independently.
+     */
+    bool deferEntryBarriers{false};
+    std::unordered_map<const Resource*, ResourceState> entryStates;
   };
 
   struct Command {
@@ -59,33 +96,82 @@ public:
       const Resource* resource{nullptr};
       VkPipelineStageFlags stage{VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT};
       VkAccessFlags mask{VK_ACCESS_NONE};
-      std::vector<VkImageLayout> allowedLayouts{};
+      std::span<const VkImageLayout> allowedLayouts{};
+      VkImageSubresourceRange range{WholeRange};
+
+      static constexpr VkImageSubresourceRange WholeRange{VK_IMAGE_ASPECT_NONE, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS};
+
+      static constexpr std::array<VkImageLayout, 3> TransferSourceLayouts{VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR};
+      static constexpr std::array<VkImageLayout, 3> TransferDestinationLayouts{VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR};
+      static constexpr std::array<VkImageLayout, 2> GeneralLayouts{VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR};
     };
-    std::vector<ResourceAccess> accesses;
+    std::pmr::vector<ResourceAccess> accesses;
     enum Type : uint8_t {
       Synchronization,
       StateChange,
       Copy,
       Draw
     } type;
+    std::uint8_t kind{};  // The index of this command's concrete type in <c>Commands</c>
 #if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
     cpptrace::raw_trace trace;
 #endif
 
-    explicit Command(std::vector<ResourceAccess> accesses, Type type);
-    virtual ~Command() = default;
-
-  protected:
-    virtual std::string toString(bool includeArguments=false)              = 0;
-    virtual void        preprocess(State& state, PreprocessingFlags flags) = 0;
-    virtual void        bake(VkCommandBuffer commandBuffer)                = 0;
-
-    friend CommandBuffer;
+    Command(std::initializer_list<ResourceAccess> accesses, Type type);
+    Command(std::pmr::vector<ResourceAccess> accesses, Type type);
   };
 
 private:
-  std::list<std::unique_ptr<Command>> commands;
+  Tools::Arena arena;
+  std::vector<Command*> commands;
+  std::vector<Command*> preprocessedCommands;
+#if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
+  std::vector<Command*> createdCommands;  // Includes commands that preprocessing has dropped from the stream, whose traces must still be destroyed
+#endif
   plf::colony<Resource*> resources;
+  std::vector<std::function<void()>> cleanupFunctions;
+
+  static thread_local Tools::Arena* recordingArena;
+
+  /**
+   * @return An allocator for the Arena of the CommandBuffer that is currently recording on this thread. Commands allocate all of
+   * their variable length data through it so that none of it has to be freed individually.
+   */
+  static std::pmr::polymorphic_allocator<> allocator() { return recordingArena == nullptr ? std::pmr::get_default_resource() : recordingArena; }
+  static auto toArenaVector(std::ranges::range auto&& range) { return std::ranges::to<std::pmr::vector<std::ranges::range_value_t<decltype(range)>>>(range, allocator()); }
+
+  /**
+   * @return <c>range</c> with its aspect mask and any <c>VK_REMAINING_*</c> counts filled in from <c>image</c>
+   */
+  static VkImageSubresourceRange resolveRange(VkImageSubresourceRange range, const Image* image);
+  static ResourceState makeResourceState(const Resource* resource, VkImageLayout layout);
+
+  static VkImageSubresourceRange toRange(const VkImageSubresourceLayers& layers) { return {layers.aspectMask, layers.mipLevel, 1, layers.baseArrayLayer, layers.layerCount}; }
+  static VkImageSubresourceRange toRange(const VkImageSubresourceRange& range) { return range; }
+
+  /**
+   * @param regions The regions of a command
+   * @param projection Gets the VkImageSubresourceLayers or VkImageSubresourceRange of one image from a region
+   * @return The smallest range that covers every region, or <c>WholeRange</c> if there are no regions
+   */
+  static VkImageSubresourceRange coveredRange(std::ranges::range auto&& regions, auto projection) {
+    if (std::ranges::empty(regions)) return Command::ResourceAccess::WholeRange;
+    static_assert(VK_REMAINING_MIP_LEVELS == VK_REMAINING_ARRAY_LAYERS);
+    const auto cover = [](uint32_t& base, uint32_t& count, const uint32_t otherBase, const uint32_t otherCount) {
+      constexpr uint32_t Remaining = VK_REMAINING_MIP_LEVELS;
+      const uint32_t end = count == Remaining || otherCount == Remaining ? Remaining : std::max(base + count, otherBase + otherCount);
+      base               = std::min(base, otherBase);
+      count              = end == Remaining ? Remaining : end - base;
+    };
+    VkImageSubresourceRange covered = toRange(std::invoke(projection, *std::ranges::begin(regions)));
+    for (const auto& region: regions) {
+      const VkImageSubresourceRange range = toRange(std::invoke(projection, region));
+      covered.aspectMask |= range.aspectMask;
+      cover(covered.baseMipLevel, covered.levelCount, range.baseMipLevel, range.levelCount);
+      cover(covered.baseArrayLayer, covered.layerCount, range.baseArrayLayer, range.layerCount);
+    }
+    return covered;
+  }
 
 public:
   using iterator = decltype(commands)::iterator;
@@ -107,41 +193,45 @@ public:
     template<std::ranges::range T = std::span<VkClearValue>>
     /**@todo: Make renderPass const when declareAccesses has been made constable*/
     explicit BeginRenderPass(RenderPass* renderPass, T&& clearValues=T{}, const VkRect2D renderArea={}) :
-        Command([&]->std::vector<ResourceAccess>{
+        Command([&]->std::pmr::vector<ResourceAccess>{
           std::vector<std::pair<RenderGraph::ImageID, RenderGraph::ImageAccess>> attachments = renderPass->getImageAccesses();
-          std::vector<ResourceAccess> accesses;
+          std::pmr::vector<ResourceAccess> accesses(allocator());
           accesses.reserve(attachments.size());
           for (const auto& [id, access]: attachments) {
-            accesses.emplace_back(ResourceAccess::Write | ResourceAccess::Read, renderPass->getGraph().getImage(id).image.get(), access.stage, access.access, std::vector{access.layout});
+            accesses.emplace_back(ResourceAccess::Write | ResourceAccess::Read, renderPass->getGraph().getImage(id).image.get(), access.stage, access.access, std::span{allocator().new_object<VkImageLayout>(access.layout), 1});
           }
           return accesses;
         }(), StateChange),
         renderPass(renderPass),
         renderArea(renderArea.offset.x == 0 && renderArea.offset.y == 0 && renderArea.extent.width == 0 && renderArea.extent.height == 0 ? this->renderPass->getFramebuffer()->getRect() : renderArea),
-        clearValues(std::ranges::to<std::vector>(clearValues)),
+        clearValues(toArenaVector(clearValues)),
         renderPassBeginInfo() {}
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
     RenderPass* renderPass;
     VkRect2D renderArea;
-    std::vector<VkClearValue> clearValues;
+    std::pmr::vector<VkClearValue> clearValues;
     VkRenderPassBeginInfo renderPassBeginInfo;
   };
 
   struct BindDescriptorSets final : Command {
     explicit BindDescriptorSets(std::ranges::range auto&& descriptorSets, const uint32_t firstSet=0) :
         Command({}, StateChange),
-        descriptorSets{std::ranges::to<std::vector>(descriptorSets)},
+        descriptorSets{toArenaVector(descriptorSets)},
         firstSet(firstSet) {}
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
-    std::vector<VkDescriptorSet> descriptorSets;
+    std::pmr::vector<VkDescriptorSet> descriptorSets;
     uint32_t firstSet;
     VkPipelineLayout pipelineLayout{VK_NULL_HANDLE};
   };
@@ -149,9 +239,11 @@ public:
   struct BindIndexBuffer final : Command {
     explicit BindIndexBuffer(const Buffer* indexBuffer);
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
     const Buffer* buffer;
   };
@@ -159,9 +251,11 @@ public:
   struct BindPipeline final : Command {
     explicit BindPipeline(const Pipeline* pipeline);
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
     const Pipeline* pipeline;
     VkExtent2D extent;
@@ -170,33 +264,35 @@ public:
   struct BindVertexBuffers final : Command {
     explicit BindVertexBuffers(std::ranges::range auto&& vertexBuffers, std::ranges::range auto&& offsets, const uint32_t firstBinding=0) :
         Command({}, StateChange),
-        buffers(std::ranges::to<std::vector>(vertexBuffers)),
-        offsets(std::ranges::to<std::vector>(offsets)),
+        buffers(toArenaVector(vertexBuffers)),
+        offsets(toArenaVector(offsets)),
         firstBinding(firstBinding) {}
     explicit BindVertexBuffers(std::ranges::range auto&& vertexBuffers, const uint32_t firstBinding=0) :
         Command({}, StateChange),
-        buffers(std::ranges::to<std::vector>(vertexBuffers)),
-        offsets(buffers.size(), 0),
+        buffers(toArenaVector(vertexBuffers)),
+        offsets(buffers.size(), 0, allocator()),
         firstBinding(firstBinding) {}
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
-    std::vector<Buffer*> buffers;
-    std::vector<VkDeviceSize> offsets;
+    std::pmr::vector<Buffer*> buffers;
+    std::pmr::vector<VkDeviceSize> offsets;
     uint32_t firstBinding;
   };
 
   struct BlitImageToImage final : Command {
     template<std::ranges::range T = std::span<VkImageBlit>>
     BlitImageToImage(const Image* const source, const Image* const destination, T&& regions=T{}, const VkFilter filter=VK_FILTER_NEAREST) :
-        Command({ResourceAccess{ResourceAccess::Read, source, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR}},
-                 ResourceAccess{ResourceAccess::Write, destination, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR}}
+        Command({ResourceAccess{ResourceAccess::Read, source, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, TransferSourceLayouts, coveredRange(regions, &VkImageBlit::srcSubresource)},
+                 ResourceAccess{ResourceAccess::Write, destination, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, TransferDestinationLayouts, coveredRange(regions, &VkImageBlit::dstSubresource)}
         }, Copy),
         src(source),
         dst(destination),
-        blits(std::ranges::to<std::vector>(regions)),
+        blits(toArenaVector(regions)),
         filter(filter) {
       if (blits.empty()) blits.push_back({
         .srcSubresource = VkImageSubresourceLayers{source->getAspect(), 0, 0, source->getLayerCount()},
@@ -206,55 +302,61 @@ public:
       });
     }
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
     const Image* src;
     const Image* dst;
     VkImageLayout srcImageLayout{};
     VkImageLayout dstImageLayout{};
-    std::vector<VkImageBlit> blits{};
+    std::pmr::vector<VkImageBlit> blits{};
     VkFilter filter{};
   };
 
   struct ClearColorImage final : Command {
     template<std::ranges::range T = std::span<VkImageSubresourceRange>>
     explicit ClearColorImage(const Image* const image, const VkClearColorValue value={}, T&& subresourceRanges=T{}) :
-        Command({ResourceAccess{ResourceAccess::Write, image, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR}}}, Copy),
+        Command({ResourceAccess{ResourceAccess::Write, image, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, TransferDestinationLayouts, coveredRange(subresourceRanges, std::identity{})}}, Copy),
         image(image),
         value(value),
-        ranges(std::ranges::to<std::vector>(subresourceRanges)) {
+        ranges(toArenaVector(subresourceRanges)) {
       if (ranges.empty()) ranges.push_back({image->getAspect(), 0, image->getMipLevels(), 0, image->getLayerCount()});
     }
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
     const Image* image;
     VkClearColorValue value;
-    std::vector<VkImageSubresourceRange> ranges;
+    std::pmr::vector<VkImageSubresourceRange> ranges;
     VkImageLayout layout{VK_IMAGE_LAYOUT_MAX_ENUM};
   };
 
   struct ClearDepthStencilImage final : Command {
     template<std::ranges::range T = std::span<VkImageSubresourceRange>>
     explicit ClearDepthStencilImage(const Image* const image, const VkClearDepthStencilValue value={1}, T&& subresourceRanges=T{}) :
-        Command({ResourceAccess{ResourceAccess::Write, image, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR}}}, Copy),
+        Command({ResourceAccess{ResourceAccess::Write, image, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, TransferDestinationLayouts, coveredRange(subresourceRanges, std::identity{})}}, Copy),
         image(image),
         value(value),
-        ranges(std::ranges::to<std::vector>(subresourceRanges)) {
+        ranges(toArenaVector(subresourceRanges)) {
       if (ranges.empty()) ranges.push_back({image->getAspect(), 0, image->getMipLevels(), 0, image->getLayerCount()});
     }
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
     const Image* image;
     VkClearDepthStencilValue value;
-    std::vector<VkImageSubresourceRange> ranges;
+    std::pmr::vector<VkImageSubresourceRange> ranges;
     VkImageLayout layout{VK_IMAGE_LAYOUT_MAX_ENUM};
   };
 
@@ -266,7 +368,7 @@ public:
              Copy),
         src(source),
         dst(destination),
-        copies(std::ranges::to<std::vector>(regions)) {
+        copies(toArenaVector(regions)) {
       if (copies.empty()) copies.push_back({
         .srcOffset = 0,
         .dstOffset = 0,
@@ -274,24 +376,26 @@ public:
       });
     }
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
     const Buffer* src;
     const Buffer* dst;
-    std::vector<VkBufferCopy> copies;
+    std::pmr::vector<VkBufferCopy> copies;
   };
 
   struct CopyBufferToImage final : Command {
     template<std::ranges::range T = std::span<VkBufferImageCopy>>
     CopyBufferToImage(const Buffer* const source, const Image* const destination, T&& regions=T{}) :
         Command({ResourceAccess{ResourceAccess::Read, source, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT},
-                 ResourceAccess{ResourceAccess::Write, destination, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR}}},
+                 ResourceAccess{ResourceAccess::Write, destination, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, TransferDestinationLayouts, coveredRange(regions, &VkBufferImageCopy::imageSubresource)}},
                  Copy),
         src(source),
         dst(destination),
-        copies{std::ranges::to<std::vector<VkBufferImageCopy>>(regions)} {
+        copies{std::ranges::to<std::pmr::vector<VkBufferImageCopy>>(regions, allocator())} {
       if (copies.empty()) {
         const VkExtent3D texelBlockExtent = vkuFormatTexelBlockExtent(destination->getFormat());
         copies.push_back({
@@ -305,25 +409,27 @@ public:
       }
     }
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
     const Buffer* src;
     const Image* dst;
-    std::vector<VkBufferImageCopy> copies;
+    std::pmr::vector<VkBufferImageCopy> copies;
     VkImageLayout layout{VK_IMAGE_LAYOUT_MAX_ENUM};
   };
 
   struct CopyImageToBuffer final : Command {
     template<std::ranges::range T = std::span<VkBufferImageCopy>>
     CopyImageToBuffer(const Image* const source, const Buffer* const destination, T&& regions=T{}) :
-        Command({ResourceAccess{ResourceAccess::Read, source, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR}},
+        Command({ResourceAccess{ResourceAccess::Read, source, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, TransferSourceLayouts, coveredRange(regions, &VkBufferImageCopy::imageSubresource)},
              ResourceAccess{ResourceAccess::Write, destination, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT}},
              Copy),
         src(source),
         dst(destination),
-        copies(std::ranges::to<std::vector>(regions)) {
+        copies(toArenaVector(regions)) {
       if (copies.empty()) {
         const VkExtent3D texelBlockExtent = vkuFormatTexelBlockExtent(source->getFormat());
         copies.push_back({
@@ -337,27 +443,29 @@ public:
       }
     }
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
     const Image* src;
     const Buffer* dst;
-    std::vector<VkBufferImageCopy> copies;
+    std::pmr::vector<VkBufferImageCopy> copies;
     VkImageLayout layout{VK_IMAGE_LAYOUT_MAX_ENUM};
   };
 
   struct CopyImageToImage final : Command {
     template<std::ranges::range T = std::span<VkImageCopy>>
     CopyImageToImage(const Image* const src, const Image* const dst, T&& regions=T{}) :
-        Command(src == dst ? std::vector{ResourceAccess{ResourceAccess::Read, src, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, {VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR}},
-                                         ResourceAccess{ResourceAccess::Write, dst, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, {VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR}}}
-                           : std::vector{ResourceAccess{ResourceAccess::Read, src, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR}},
-                                         ResourceAccess{ResourceAccess::Write, dst, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR}}},
+        Command(src == dst ? std::pmr::vector<ResourceAccess>({ResourceAccess{ResourceAccess::Read, src, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, GeneralLayouts, coveredRange(regions, &VkImageCopy::srcSubresource)},
+                                                               ResourceAccess{ResourceAccess::Write, dst, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, GeneralLayouts, coveredRange(regions, &VkImageCopy::dstSubresource)}}, allocator())
+                           : std::pmr::vector<ResourceAccess>({ResourceAccess{ResourceAccess::Read, src, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, TransferSourceLayouts, coveredRange(regions, &VkImageCopy::srcSubresource)},
+                                                               ResourceAccess{ResourceAccess::Write, dst, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, TransferDestinationLayouts, coveredRange(regions, &VkImageCopy::dstSubresource)}}, allocator()),
                 Copy),
         src(src),
         dst(dst),
-        copies(std::ranges::to<std::vector>(regions)) {
+        copies(toArenaVector(regions)) {
       if (copies.empty()) {
         copies.push_back({
           .srcSubresource = VkImageSubresourceLayers{src->getAspect(), 0, 0, src->getLayerCount()},
@@ -369,13 +477,15 @@ public:
       }
     }
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
     const Image* src;
     const Image* dst;
-    std::vector<VkImageCopy> copies;
+    std::pmr::vector<VkImageCopy> copies;
     VkImageLayout srcLayout{VK_IMAGE_LAYOUT_MAX_ENUM};
     VkImageLayout dstLayout{VK_IMAGE_LAYOUT_MAX_ENUM};
   };
@@ -383,31 +493,43 @@ public:
   struct Draw final : Command {
     explicit Draw(uint32_t vertexCount=0);
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
     uint32_t vertexCount{0};
   };
 
   struct DrawIndexed final : Command {
-    explicit DrawIndexed(uint32_t instanceCount=1);
+    /**
+     * @param indexCount How many indices to draw, from <c>firstIndex</c>. By default, all of those left in the bound index buffer.
+     * @param vertexOffset Added to each index before it reads the vertex buffers
+     */
+    explicit DrawIndexed(uint32_t instanceCount=1, uint32_t indexCount=std::numeric_limits<uint32_t>::max(), uint32_t firstIndex=0, int32_t vertexOffset=0);
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
     uint32_t instanceCount{0};
     uint32_t vertexCount{0};
     uint32_t indexCount{0};
+    uint32_t firstIndex{0};
+    int32_t vertexOffset{0};
   };
 
   struct DrawIndexedIndirect final : Command {
     explicit DrawIndexedIndirect(const Buffer* buffer, uint32_t count=std::numeric_limits<uint32_t>::max(), VkDeviceSize offset=0, uint32_t stride=sizeof(VkDrawIndexedIndirectCommand));
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
     const Buffer* buffer;
     VkDeviceSize offset{0};
@@ -418,94 +540,166 @@ public:
   struct EndRenderPass final : Command {
     EndRenderPass();
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
   };
 
   struct PipelineBarrier final : Command {
     struct MemoryBarrier {
-      VkStructureType sType;
-      const void*     pNext;
-      VkAccessFlags   srcAccessMask;
-      VkAccessFlags   dstAccessMask;
-      explicit operator VkMemoryBarrier() const { return {sType, pNext, srcAccessMask, dstAccessMask}; }
+      VkStructureType       sType;
+      const void*           pNext;
+      VkPipelineStageFlags2 srcStageMask;
+      VkAccessFlags2        srcAccessMask;
+      VkPipelineStageFlags2 dstStageMask;
+      VkAccessFlags2        dstAccessMask;
+      explicit operator VkMemoryBarrier2() const { return {sType, pNext, srcStageMask, srcAccessMask, dstStageMask, dstAccessMask}; }
     };
     struct BufferMemoryBarrier {
-      VkStructureType sType;
-      const void*     pNext;
-      VkAccessFlags   srcAccessMask;
-      VkAccessFlags   dstAccessMask;
-      uint32_t        srcQueueFamilyIndex;
-      uint32_t        dstQueueFamilyIndex;
-      const Buffer*   buffer;
-      VkDeviceSize    offset;
-      VkDeviceSize    size;
-      explicit operator VkBufferMemoryBarrier() const { return {sType, pNext, srcAccessMask, dstAccessMask, srcQueueFamilyIndex, dstQueueFamilyIndex, buffer->getBuffer(), offset, size}; }
+      VkStructureType       sType;
+      const void*           pNext;
+      VkPipelineStageFlags2 srcStageMask;
+      VkAccessFlags2        srcAccessMask;
+      VkPipelineStageFlags2 dstStageMask;
+      VkAccessFlags2        dstAccessMask;
+      uint32_t              srcQueueFamilyIndex;
+      uint32_t              dstQueueFamilyIndex;
+      const Buffer*         buffer;
+      VkDeviceSize          offset;
+      VkDeviceSize          size;
+      explicit operator VkBufferMemoryBarrier2() const { return {sType, pNext, srcStageMask, srcAccessMask, dstStageMask, dstAccessMask, srcQueueFamilyIndex, dstQueueFamilyIndex, buffer->getBuffer(), offset, size}; }
     };
     struct ImageMemoryBarrier {
       VkStructureType         sType;
       const void*             pNext;
-      VkAccessFlags           srcAccessMask;
-      VkAccessFlags           dstAccessMask;
+      VkPipelineStageFlags2   srcStageMask;
+      VkAccessFlags2          srcAccessMask;
+      VkPipelineStageFlags2   dstStageMask;
+      VkAccessFlags2          dstAccessMask;
       VkImageLayout           oldLayout;
       VkImageLayout           newLayout;
       uint32_t                srcQueueFamilyIndex;
       uint32_t                dstQueueFamilyIndex;
       const Image*            image;
       VkImageSubresourceRange subresourceRange;
-      explicit operator VkImageMemoryBarrier() const { return {sType, pNext, srcAccessMask, dstAccessMask, oldLayout, newLayout, srcQueueFamilyIndex, dstQueueFamilyIndex, image->getImage(), subresourceRange}; }
+      explicit operator VkImageMemoryBarrier2() const { return {sType, pNext, srcStageMask, srcAccessMask, dstStageMask, dstAccessMask, oldLayout, newLayout, srcQueueFamilyIndex, dstQueueFamilyIndex, image->getImage(), subresourceRange}; }
     };
-    PipelineBarrier(const VkPipelineStageFlags srcStageMask, const VkPipelineStageFlags dstStageMask, const VkDependencyFlags dependencyFlags, std::ranges::range auto&& memoryBarriers, std::ranges::range auto&& bufferMemoryBarriers, std::ranges::range auto&& imageMemoryBarriers) :
+    PipelineBarrier(const VkDependencyFlags dependencyFlags, std::ranges::range auto&& memoryBarriers, std::ranges::range auto&& bufferMemoryBarriers, std::ranges::range auto&& imageMemoryBarriers) :
       Command({}, Synchronization),
-      srcStageMask(srcStageMask),
-      dstStageMask(dstStageMask),
       dependencyFlags(dependencyFlags),
-      memoryBarriers(std::ranges::to<std::vector>(memoryBarriers)),
-      bufferMemoryBarriers(std::ranges::to<std::vector>(bufferMemoryBarriers)),
-      imageMemoryBarriers(std::ranges::to<std::vector>(imageMemoryBarriers)) {}
+      memoryBarriers(toArenaVector(memoryBarriers)),
+      bufferMemoryBarriers(toArenaVector(bufferMemoryBarriers)),
+      imageMemoryBarriers(toArenaVector(imageMemoryBarriers)) {}
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
+
+    [[nodiscard]] bool empty() const { return memoryBarriers.empty() && bufferMemoryBarriers.empty() && imageMemoryBarriers.empty(); }
 
-    VkPipelineStageFlags srcStageMask;
-    VkPipelineStageFlags dstStageMask;
     VkDependencyFlags dependencyFlags;
-    std::vector<MemoryBarrier> memoryBarriers;
-    std::vector<BufferMemoryBarrier> bufferMemoryBarriers;
-    std::vector<ImageMemoryBarrier> imageMemoryBarriers;
+    std::pmr::vector<MemoryBarrier> memoryBarriers;
+    std::pmr::vector<BufferMemoryBarrier> bufferMemoryBarriers;
+    std::pmr::vector<ImageMemoryBarrier> imageMemoryBarriers;
   };
 
   struct PushConstants final : Command {
-    template<typename T> explicit PushConstants(T value, const VkShaderStageFlagBits stages, const std::uint32_t offset=0) :
+    template<typename T> requires (!std::ranges::range<T>) explicit PushConstants(T value, const VkShaderStageFlagBits stages, const std::uint32_t offset=0) :
         Command({}, StateChange),
+        data(sizeof(T), allocator()),
         offset(offset),
         stages(stages) {
-      data.resize(sizeof(T));
       std::memcpy(data.data(), &value, sizeof(T));
     }
     explicit PushConstants(std::ranges::range auto&& values, const VkShaderStageFlagBits stages, const std::uint32_t offset=0) :
         Command({}, StateChange),
+        data(std::ranges::size(values) * sizeof(std::ranges::range_value_t<decltype(values)>), allocator()),
         offset(offset),
         stages(stages) {
-      auto temp = std::ranges::to<std::vector>(values);
-      std::memcpy(data.data(), temp->data(), temp->size());
+      std::memcpy(data.data(), std::ranges::data(values), data.size());
     }
   private:
-    void preprocess(State& state, PreprocessingFlags flags) override;
-    void bake(VkCommandBuffer commandBuffer) override;
-    std::string toString(bool includeArguments) override;
+    friend CommandBuffer;
+
+    void preprocess(State& state, PreprocessingFlags flags);
+    void bake(VkCommandBuffer commandBuffer);
+    std::string toString(bool includeArguments);
 
-    std::vector<char> data;
+    std::pmr::vector<char> data;
     std::uint32_t offset;
     VkShaderStageFlagBits stages{};
     VkPipelineLayout layout{VK_NULL_HANDLE};
   };
 
-  template<typename T, typename... Args> requires std::constructible_from<T, Args...> && std::derived_from<T, Command> && (!std::is_same_v<T, Command>) const_iterator record(const const_iterator& iterator, Args&&... args) { return commands.insert(iterator, std::make_unique<T>(std::forward<Args&&>(args)...)); }
-  template<typename T, typename... Args> requires std::constructible_from<T, Args...> && std::derived_from<T, Command> && (!std::is_same_v<T, Command>) const_iterator record(Args&&... args) { return commands.insert(commands.cend(), std::make_unique<T>(std::forward<Args&&>(args)...)); }
+  using Commands = std::tuple<BeginRenderPass, BindDescriptorSets, BindIndexBuffer, BindPipeline, BindVertexBuffers, BlitImageToImage, ClearColorImage, ClearDepthStencilImage, CopyBufferToBuffer, CopyBufferToImage, CopyImageToBuffer, CopyImageToImage, Draw, DrawIndexed, DrawIndexedIndirect, EndRenderPass, PipelineBarrier, PushConstants>;
+
+private:
+  template<typename T, std::size_t I=0> static consteval std::uint8_t kindOf() {
+    if constexpr (std::is_same_v<T, std::tuple_element_t<I, Commands>>) return I;
+    else return kindOf<T, I + 1>();
+  }
+
+  /**
+   * Calls <c>function</c> with <c>command</c> cast to its concrete type. Dispatching on <c>Command::kind</c> instead of through a
+   * vtable lets the compiler inline every command's preprocess, bake and toString into the loops that call them.
+   */
+  template<typename F> static void visit(Command& command, F&& function) {
+    [&]<std::size_t... I>(std::index_sequence<I...>) {
+      static_cast<void>(((command.kind == I && (function(static_cast<std::tuple_element_t<I, Commands>&>(command)), true)) || ...));
+    }(std::make_index_sequence<std::tuple_size_v<Commands>>());
+  }
+
+  /**
+   * Brings the subresources that <c>access</c> touches into the state it needs, adding any barriers that requires to the pending barriers.
+   * @param touched The resources that earlier accesses of the same command have already synchronized
+   */
+  void synchronize(State& state, const Command::ResourceAccess& access, PreprocessingFlags flags, std::span<const Resource* const> touched);
+
+  /**
+   * Records the pending barriers into the preprocessed command stream.
+   */
+  void flushBarriers(PreprocessingFlags flags);
+
+  /**
+   * Sorts the draws inside each render pass by pipeline, then descriptor sets, then vertex buffers, and rebuilds the binds in front
+   * of them so that only state that actually changes is bound. Draws are only moved past other draws whose relative order cannot
+   * change the result, so any other command, a draw that declares accesses, or a pipeline that is not order independent ends the
+   * run of draws that may be sorted.
+   */
+  void mergePipelineBinds();
+
+  std::vector<PipelineBarrier::ImageMemoryBarrier> pendingImageBarriers;
+  std::vector<PipelineBarrier::BufferMemoryBarrier> pendingBufferBarriers;
+  std::vector<const Resource*> touchedResources;
+  std::vector<const Resource*> deferredResources;  // The resources whose entry barriers the current command has deferred
+
+  template<typename T, typename... Args> T* create(Args&&... args) {
+    Tools::Arena* const previousArena = std::exchange(recordingArena, &arena);
+    T* const command                  = arena.create<T>(std::forward<Args&&>(args)...);
+    recordingArena                    = previousArena;
+    command->kind                     = kindOf<T>();
+#if BOOTANICAL_GARDENS_ENABLE_COMMAND_BUFFER_TRACING
+    createdCommands.push_back(command);
+#endif
+    return command;
+  }
+
+public:
+  CommandBuffer() = default;
+  CommandBuffer(const CommandBuffer&) = delete;
+  CommandBuffer& operator=(const CommandBuffer&) = delete;
+
+  template<typename T, typename... Args> requires std::constructible_from<T, Args...> && std::derived_from<T, Command> && (!std::is_same_v<T, Command>) const_iterator record(const const_iterator& iterator, Args&&... args) { return commands.insert(iterator, create<T>(std::forward<Args&&>(args)...)); }
+  template<typename T, typename... Args> requires std::constructible_from<T, Args...> && std::derived_from<T, Command> && (!std::is_same_v<T, Command>) const_iterator record(Args&&... args) { return commands.insert(commands.cend(), create<T>(std::forward<Args&&>(args)...)); }
   void addCleanupResource(Resource* resource);
+  /**
+   * @param function Called when this CommandBuffer is cleared or destroyed, along with the deletion of the cleanup resources
+   */
+  void addCleanupFunction(std::function<void()> function);
   /**
    * This command will preprocess this CommandBuffer assuming a set of input states. This process involves not only modifying the recorded commands to be correct with each other, but optimizing them as well.
    * @param state The states of all resources as they will be at the time this command buffer is submitted to the GPU
@@ -515,13 +709,49 @@ public:
    */
   State preprocess(State state={}, PreprocessingFlags flags=Everything, bool apply=true);
 
-  [[nodiscard]] std::string toString() const;
+  /**
+   * @param includeArguments Whether to describe the arguments of each command, rather than only naming it
+   * @return A human readable listing of the recorded commands. Comparing listings is the easiest way to see what preprocessing did.
+   */
+  [[nodiscard]] std::string toString(bool includeArguments=false) const;
+
+  /**
+   * Records the barriers that bring every resource from <c>state</c> into the state that another CommandBuffer, preprocessed with
+   * <c>deferEntryBarriers</c>, expects when it starts. Then advances <c>state</c> to the state that the other CommandBuffer leaves
+   * resources in.
+   * @param state The state of all resources before the other CommandBuffer, which becomes their state after it
+   * @param other The State returned by preprocessing the other CommandBuffer
+   * @param flags The optimizations to perform on the barriers
+   */
+  void recordSeam(State& state, const State& other, PreprocessingFlags flags=PipelineBarriers);
 
   /**
    * This command will record all of this CommandBuffer's stored commands into a VkCommandBuffer.
    * @param commandBuffer The VkCommandBuffer to record commands into
    */
   void bake(VkCommandBuffer commandBuffer) const;
+
+  /**
+   * Records the commands inside each render pass into a secondary command buffer. This is safe to call from any thread as long as
+   * each thread uses command buffers from its own command pool.
+   * @param commandBuffers One secondary command buffer, ready to begin, for each render pass in this CommandBuffer
+   */
+  void bakeSecondary(std::span<const VkCommandBuffer> commandBuffers) const;
+
+  /**
+   * Records the commands outside of render passes into <c>commandBuffer</c>, and executes the secondary command buffers that
+   * <c>bakeSecondary</c> recorded in place of the commands inside them.
+   * @param commandBuffer The primary VkCommandBuffer to record commands into
+   * @param secondaryCommandBuffers The command buffers previously passed to <c>bakeSecondary</c>
+   */
+  void bakePrimary(VkCommandBuffer commandBuffer, std::span<const VkCommandBuffer> secondaryCommandBuffers) const;
+
+  [[nodiscard]] std::size_t getRenderPassCount() const;
+
+  /**
+   * Deletes the cleanup resources, calls the cleanup functions and drops every recorded command. The memory of the commands is kept for the next recording, so
+   * this does not free anything.
+   */
   void clear();
 
   void getDefaultState(State&state);
@@ -10,6 +10,15 @@ DescriptorSetRequirer::~DescriptorSetRequirer() {
   vkDestroyDescriptorSetLayout(device->device, layout, nullptr);
 }
 
+void DescriptorSetRequirer::setDescriptorSetLayout(const VkDescriptorSetLayout setLayout) {
+  if (layout != setLayout) vkDestroyDescriptorSetLayout(device->device, layout, nullptr);
+  layout = setLayout;
+}
+
 std::shared_ptr<VkDescriptorSet> DescriptorSetRequirer::getDescriptorSet(const std::size_t index) const {
   return descriptorSets[index];
 }
+
+VkDescriptorSetLayout DescriptorSetRequirer::getDescriptorSetLayout() const {
+  return layout;
+}
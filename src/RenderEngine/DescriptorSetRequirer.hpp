@@ -19,13 +19,18 @@ protected:
   std::vector<std::shared_ptr<VkDescriptorSet>> descriptorSets;
   VkDescriptorSetLayout layout{VK_NULL_HANDLE};
 
+  /**
+   * Takes ownership of <c>setLayout</c>, destroying the layout that it replaces.
+   */
+  void setDescriptorSetLayout(VkDescriptorSetLayout setLayout);
+
 public:
   explicit DescriptorSetRequirer(GraphicsDevice* device);
   virtual ~DescriptorSetRequirer();
 
   void setDescriptorSets(std::ranges::range auto&& sets, VkDescriptorSetLayout setLayout) {
     descriptorSets = std::ranges::to<std::vector>(sets);
-    layout = setLayout;
+    setDescriptorSetLayout(setLayout);
   }
 
   /**
@@ -36,4 +41,5 @@ public:
    */
   virtual void writeDescriptorSets(std::deque<std::tuple<void*, std::function<void(void*)>>>& miscMemoryPool, std::vector<VkWriteDescriptorSet>& writes, const RenderGraph& graph) = 0;
   [[nodiscard]] std::shared_ptr<VkDescriptorSet> getDescriptorSet(std::size_t index) const;
+  [[nodiscard]] VkDescriptorSetLayout getDescriptorSetLayout() const;
 };
\ No newline at end of file
@@ -3,24 +3,53 @@
 #include "src/RenderEngine/MeshGroup/Mesh.hpp"
 #include "src/RenderEngine/CommandBuffer.hpp"
 #include "src/RenderEngine/GraphicsInstance.hpp"
+#include "src/Filesystem/UpdateListener.hpp"
+#include "src/JobSystem.hpp"
 #include "src/RenderEngine/Pipeline/Pipeline.hpp"
 #include "src/RenderEngine/Pipeline/Shader.hpp"
+#include "src/RenderEngine/Resources/Resource.hpp"
+#include "src/RenderEngine/Resources/StagingRing.hpp"
 #include "src/RenderEngine/MeshGroup/Texture.hpp"
 #include "src/Tools/Hashing.hpp"
 
+#include <magic_enum/magic_enum.hpp>
 #include <volk/volk.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <ranges>
+#include <string>
+
 GraphicsDevice::GraphicsDevice(const std::filesystem::path& path) {
   vkb::PhysicalDeviceSelector deviceSelector{GraphicsInstance::instance};
   deviceSelector.defer_surface_initialization();
   deviceSelector.prefer_gpu_device_type(vkb::PreferredDeviceType::discrete);
-  vkb::DeviceBuilder deviceBuilder{deviceSelector.select().value()};
-  /**@todo: Do not hardcode the queues. Build an actually good algorithm to find the most suitable queues.
-   *    Assign badness to each queue family choice based on how many other capabilities that queue family has and how rare those capabilities are on the device.*/
-  constexpr float one = 1;
-  constexpr float zero = 0;
-  std::vector t{vkb::CustomQueueDescription(0, 1, &one), vkb::CustomQueueDescription(1, 1, &zero)};
-  deviceBuilder.custom_queue_setup(t);
+  deviceSelector.set_minimum_version(1, 3);
+  deviceSelector.set_required_features_12({
+    .sType             = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+    .pNext             = nullptr,
+    .timelineSemaphore = VK_TRUE
+  });
+  deviceSelector.set_required_features_13({
+    .sType                        = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+    .pNext                        = nullptr,
+    .pipelineCreationCacheControl = VK_TRUE,  // Lets the pipeline caches of bakePipelines be externally synchronized
+    .synchronization2             = VK_TRUE
+  });
+  const vkb::Result<vkb::PhysicalDevice> physicalDeviceResult = deviceSelector.select();
+  if (!physicalDeviceResult.has_value()) GraphicsInstance::showError(physicalDeviceResult.vk_result(), "Failed to select a Vulkan physical device");
+  vkb::PhysicalDevice physicalDevice = physicalDeviceResult.value();
+  textureCompressionBC = physicalDevice.enable_features_if_present({.textureCompressionBC = VK_TRUE});
+  const std::vector<VkQueueFamilyProperties> queueFamilies = physicalDevice.get_queue_families();
+  const QueueSelection queues = selectQueues(queueFamilies);
+  vkb::DeviceBuilder deviceBuilder{physicalDevice};
+  // Uploads are never urgent enough to take time away from rendering.
+  constexpr float priorities[]{1, 0};
+  std::vector queueDescriptions{vkb::CustomQueueDescription(queues.graphicsFamily, queues.transferFamily == queues.graphicsFamily ? queues.transferIndex + 1 : 1, priorities)};
+  if (queues.transferFamily != queues.graphicsFamily) queueDescriptions.emplace_back(queues.transferFamily, 1, &priorities[1]);
+  deviceBuilder.custom_queue_setup(queueDescriptions);
   const auto builderResult = deviceBuilder.build();
   if (!builderResult.has_value()) GraphicsInstance::showError(builderResult.vk_result(), "Failed to create the Vulkan device");
   device = builderResult.value();
@@ -42,12 +71,12 @@ GraphicsDevice::GraphicsDevice(const std::filesystem::path& path) {
   }
 #endif
   volkLoadDevice(device.device);
-  const vkb::Result<VkQueue> queueResult = device.get_queue(vkb::QueueType::graphics);
-  if (!queueResult.has_value()) GraphicsInstance::showError(queueResult.vk_result(), "Failed to get Vulkan device queue");
-  globalQueue = queueResult.value();
-  const vkb::Result<uint32_t> queueIndexResult = device.get_queue_index(vkb::QueueType::graphics);
-  if (!queueIndexResult.has_value()) GraphicsInstance::showError(queueIndexResult.vk_result(), "Failed to get Vulkan device queue index");
-  globalQueueFamilyIndex = queueIndexResult.value();
+  globalQueueFamilyIndex   = queues.graphicsFamily;
+  transferQueueFamilyIndex = queues.transferFamily;
+  vkGetDeviceQueue(device, globalQueueFamilyIndex, 0, &globalQueue);
+  vkGetDeviceQueue(device, transferQueueFamilyIndex, queues.transferIndex, &transferQueue);
+  graphicsTimeline = createTimelineSemaphore();
+  transferTimeline = createTimelineSemaphore();
 
   VmaVulkanFunctions vulkanFunctions {
     .vkGetInstanceProcAddr = vkGetInstanceProcAddr,
@@ -94,12 +123,50 @@ GraphicsDevice::GraphicsDevice(const std::filesystem::path& path) {
     .queueFamilyIndex = globalQueueFamilyIndex,
   };
   if (const VkResult result = vkCreateCommandPool(device, &commandPoolCreateInfo, nullptr, &commandPool); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create command pool");
+  const VkCommandPoolCreateInfo transferCommandPoolCreateInfo {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+    .pNext = nullptr,
+    .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    .queueFamilyIndex = transferQueueFamilyIndex,
+  };
+  if (const VkResult result = vkCreateCommandPool(device, &transferCommandPoolCreateInfo, nullptr, &transferCommandPool); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create transfer command pool");
+  stagingRing = std::make_unique<StagingRing>(this, 64 << 20);
+
+  pipelineCachePath = path.parent_path() / "cache" / "pipelines.bin";
+  pipelineCacheSeed = readPipelineCacheFile();
+  const VkPipelineCacheCreateInfo pipelineCacheCreateInfo {
+    .sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    .pNext           = nullptr,
+    .flags           = 0,
+    .initialDataSize = pipelineCacheSeed.size(),
+    .pInitialData    = pipelineCacheSeed.data()
+  };
+  if (const VkResult result = vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create pipeline cache");
 
   yyjson_read_err error;
-  graphicsJSON = yyjson_read_file(path.string().c_str(), YYJSON_READ_ALLOW_INF_AND_NAN, nullptr, &error);
-  if (graphicsJSON == nullptr) GraphicsInstance::showError("failed to read graphics data JSON: " + std::string(error.msg));
+  yyjson_doc* document = yyjson_read_file(path.string().c_str(), YYJSON_READ_ALLOW_INF_AND_NAN, nullptr, &error);
+  if (document == nullptr) GraphicsInstance::showError("failed to read graphics data JSON: " + std::string(error.msg));
+  graphicsJSONPath   = path;
   resourcesDirectory = path.parent_path();
+  readGraphicsJSON(document);
+  compileJSONShaders();
+  loadJSONTextures();
+
+  // Changes are only queued here. <c>update</c> acts on them between frames.
+  const UpdateListener::Func onChange = [this](const std::filesystem::path& file) {
+    const std::scoped_lock lock{changedFilesMutex};
+    if (!std::ranges::contains(changedFiles, file)) changedFiles.push_back(file);
+  };
+  // The caches are written while running, and nothing reloads from them.
+  UpdateListener::addDirectoryWatch(resourcesDirectory, onChange, nullptr, onChange, onChange, {resourcesDirectory / "cache"});
+  UpdateListener::startWatching();
+}
+
+void GraphicsDevice::readGraphicsJSON(yyjson_doc* document) {
+  graphicsJSON = document;
   yyjson_val* root = yyjson_doc_get_root(graphicsJSON);
+  JSONSamplerArray = yyjson_obj_get(root, "samplers");
+  JSONSamplerArrayCount = yyjson_arr_size(JSONSamplerArray);
   JSONTextureArray = yyjson_obj_get(root, "textures");
   JSONTextureArrayCount = yyjson_arr_size(JSONTextureArray);
   JSONOverrideProcesses = yyjson_obj_get(root, "overrideProcesses");
@@ -116,7 +183,15 @@ GraphicsDevice::GraphicsDevice(const std::filesystem::path& path) {
 }
 
 GraphicsDevice::~GraphicsDevice() {
+  UpdateListener::removeDirectoryWatch(resourcesDirectory);
+  reloadingShaders.clear();  // Waits for the shaders that are still compiling
   vkDeviceWaitIdle(device);
+  reclaimUploads();
+  pendingUploads.clear();  // Gives their staging memory back to the ring before it is destroyed
+  stagingRing.reset();
+  for (const ThreadCommandPool& threadPool: threadCommandPools | std::ranges::views::values) vkDestroyCommandPool(device, threadPool.pool, nullptr);
+  vkDestroySemaphore(device, graphicsTimeline, nullptr);
+  vkDestroySemaphore(device, transferTimeline, nullptr);
   for (VkSampler sampler: samplers | std::ranges::views::values) vkDestroySampler(device, sampler, nullptr);
   shaders.clear();
   textures.clear();
@@ -124,18 +199,24 @@ GraphicsDevice::~GraphicsDevice() {
   overrideMaterials.clear();
   materials.clear();
   meshes.clear();
+  savePipelineCache();
+  vkDestroyPipelineCache(device, pipelineCache, nullptr);
+  pipelineCache = VK_NULL_HANDLE;
   vkDestroyCommandPool(device, commandPool, nullptr);
+  vkDestroyCommandPool(device, transferCommandPool, nullptr);
   descriptorSetAllocator.destroy();
-  commandPool = VK_NULL_HANDLE;
+  commandPool         = VK_NULL_HANDLE;
+  transferCommandPool = VK_NULL_HANDLE;
   if (allocator != VK_NULL_HANDLE) vmaDestroyAllocator(allocator);
   allocator = VK_NULL_HANDLE;
-  globalQueue = VK_NULL_HANDLE;
+  globalQueue   = VK_NULL_HANDLE;
+  transferQueue = VK_NULL_HANDLE;
   destroy_device(device);
   yyjson_doc_free(graphicsJSON);
 }
 
-VkSampler* GraphicsDevice::getSampler(const VkFilter magnificationFilter, const VkFilter minificationFilter, const VkSamplerMipmapMode mipmapMode, const VkSamplerAddressMode addressMode, const float lodBias, const VkBorderColor borderColor) {
-  std::uint64_t id = Tools::hash(magnificationFilter, minificationFilter, mipmapMode, addressMode, lodBias, borderColor);
+VkSampler* GraphicsDevice::getSampler(const VkFilter magnificationFilter, const VkFilter minificationFilter, const VkSamplerMipmapMode mipmapMode, const VkSamplerAddressMode addressMode, const float lodBias, const VkBorderColor borderColor, const float maxLod) {
+  std::uint64_t id = Tools::hash(magnificationFilter, minificationFilter, mipmapMode, addressMode, lodBias, borderColor, maxLod);
   if (const auto it = samplers.find(id); it != samplers.end())
     return &it->second;
   const VkSamplerCreateInfo createInfo{
@@ -154,7 +235,7 @@ VkSampler* GraphicsDevice::getSampler(const VkFilter magnificationFilter, const
       .compareEnable           = VK_FALSE,
       .compareOp               = VK_COMPARE_OP_NEVER,
       .minLod                  = std::numeric_limits<float>::min(),
-      .maxLod                  = std::numeric_limits<float>::max(),
+      .maxLod                  = maxLod,
       .borderColor             = borderColor,
       .unnormalizedCoordinates = VK_FALSE
   };
@@ -163,6 +244,28 @@ VkSampler* GraphicsDevice::getSampler(const VkFilter magnificationFilter, const
   return sampler;
 }
 
+VkSampler* GraphicsDevice::getJSONSampler(const std::uint64_t id) {
+  if (id >= JSONSamplerArrayCount) return getSampler();
+  yyjson_val* json = yyjson_arr_get(JSONSamplerArray, id);
+  // Enums are written out by name, the same way as in the processes.
+  const auto getEnum = [json]<typename T>(const char* pointer, const T fallback) {
+    const char* name{};
+    if (!yyjson_ptr_get_str(json, pointer, &name)) return fallback;
+    return magic_enum::enum_cast<T>(name).value_or(fallback);
+  };
+  const VkFilter magnificationFilter     = getEnum("/magFilter", VK_FILTER_NEAREST);
+  const VkFilter minificationFilter      = getEnum("/minFilter", VK_FILTER_NEAREST);
+  const VkSamplerMipmapMode mipmapMode   = getEnum("/mipmapMode", VK_SAMPLER_MIPMAP_MODE_NEAREST);
+  const VkSamplerAddressMode addressMode = getEnum("/addressMode", VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+  const VkBorderColor borderColor        = getEnum("/borderColor", VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK);
+  // Numbers are read with <c>yyjson_ptr_get_num</c> so that whole numbers like <c>0</c> are accepted too.
+  double lodBias{};
+  yyjson_ptr_get_num(json, "/mipLodBias", &lodBias);
+  double maxLod{VK_LOD_CLAMP_NONE};
+  yyjson_ptr_get_num(json, "/maxLod", &maxLod);
+  return getSampler(magnificationFilter, minificationFilter, mipmapMode, addressMode, static_cast<float>(lodBias), borderColor, static_cast<float>(maxLod));
+}
+
 FragmentProcess* GraphicsDevice::getJSONFragmentProcess(const std::string& name) {
   return getJSONFragmentProcess(yyjson_get_uint(yyjson_obj_get(JSONOverrideProcesses, name.c_str())));
 }
@@ -185,17 +288,108 @@ VertexProcess* GraphicsDevice::getJSONVertexProcess(const std::uint64_t id) {
 
 Shader* GraphicsDevice::getJSONShader(const std::uint64_t id) {
   if (id >= JSONShaderArrayCount) return nullptr;
+  // Every shader has already been compiled by <c>compileJSONShaders</c>. Inserting here would race with other threads that look shaders up.
   if (const auto it = shaders.find(id); it != shaders.end()) return it->second.get();
-  return shaders.emplace(id, std::make_unique<Shader>(this, resourcesDirectory / "shaders" / yyjson_get_str(yyjson_obj_get(yyjson_arr_get(JSONShaderArray, id), "path")))).first->second.get();
+  GraphicsInstance::showError("shader " + std::to_string(id) + " has not been compiled");
+  return nullptr;
+}
+
+void GraphicsDevice::compileJSONShaders() {
+  // Shaders that hit the SPIR-V cache are cheap, so each Job takes one shader at a time to keep the expensive compiles spread out.
+  const std::vector<std::uint64_t> missing = std::views::iota(std::uint64_t{}, JSONShaderArrayCount) | std::views::filter([this](const std::uint64_t id) { return !shaders.contains(id); }) | std::ranges::to<std::vector>();
+  std::vector<std::unique_ptr<Shader>> compiled(missing.size());
+  JobSystem::parallelFor(compiled.size(), 1, [this, &missing, &compiled](const std::size_t begin, const std::size_t end) {
+    for (std::size_t i{begin}; i < end; ++i) compiled[i] = std::make_unique<Shader>(this, resourcesDirectory / "shaders" / yyjson_get_str(yyjson_obj_get(yyjson_arr_get(JSONShaderArray, missing[i]), "path")));
+  });
+  for (std::size_t i{}; i < compiled.size(); ++i) shaders.emplace(missing[i], std::move(compiled[i]));
+}
+
+void GraphicsDevice::loadJSONTextures() {
+  std::vector<Texture::Decoded> decoded(JSONTextureArrayCount);
+  JobSystem::parallelFor(decoded.size(), 1, [this, &decoded](const std::size_t begin, const std::size_t end) {
+    for (std::size_t i{begin}; i < end; ++i) {
+      // Textures whose files are missing are left to <c>getJSONTexture</c>, so they only fail if something actually uses them.
+      yyjson_val* textureJSON           = yyjson_arr_get(JSONTextureArray, i);
+      const std::filesystem::path path = Texture::jsonGetPath(this, textureJSON);
+      if (std::filesystem::exists(path)) decoded[i] = Texture::cook(this, path, Texture::jsonGetFormat(this, textureJSON));
+    }
+  });
+  // Textures are created and their uploads recorded here, on the thread that owns the GraphicsDevice.
+  for (std::size_t i{}; i < decoded.size(); ++i) {
+    if (decoded[i].data.empty()) continue;
+    auto commandBuffer = std::make_unique<CommandBuffer>();
+    textures.emplace(i, Texture::create(this, decoded[i], Texture::jsonGetSampler(this, yyjson_arr_get(JSONTextureArray, i)), *commandBuffer));
+    upload(std::move(commandBuffer));
+    decoded[i] = {};
+  }
+}
+
+void GraphicsDevice::applyReloads() {
+  // The old shader modules are only needed to create pipelines, and none are being created now, so they are destroyed straight away.
+  std::erase_if(reloadingShaders, [this](std::pair<Shader*, std::future<std::unique_ptr<Shader>>>& reload) {
+    auto& [shader, future] = reload;
+    if (future.wait_for(std::chrono::seconds::zero()) != std::future_status::ready) return false;
+    // A shader that failed to compile has already reported why, and the last one that worked is kept.
+    if (const std::unique_ptr<Shader> replacement = future.get(); replacement->getModule() != VK_NULL_HANDLE) {
+      shader->swap(*replacement);
+      ++reloadCount;
+    }
+    return true;
+  });
+
+  std::vector<std::filesystem::path> files;
+  {
+    const std::scoped_lock lock{changedFilesMutex};
+    files.swap(changedFiles);
+  }
+  std::vector<std::filesystem::path> deferred;
+  for (const std::filesystem::path& file: files) {
+    if (file == graphicsJSONPath) {
+      reloadGraphicsJSON();
+      continue;
+    }
+    for (const std::unique_ptr<Shader>& shader: shaders | std::views::values) {
+      if (!shader->dependsOn(file)) continue;
+      // A shader that is still compiling may have read the file before it changed, so it is compiled again once it has finished.
+      if (std::ranges::contains(reloadingShaders, shader.get(), &decltype(reloadingShaders)::value_type::first)) {
+        if (!std::ranges::contains(deferred, file)) deferred.push_back(file);
+        continue;
+      }
+      // Shaders are compiled on threads of their own, so that a long compile never holds up a frame that is waiting on the JobSystem.
+      reloadingShaders.emplace_back(shader.get(), std::async(std::launch::async, [this, path = shader->getSourcePath()] { return std::make_unique<Shader>(this, path); }));
+    }
+  }
+  if (!deferred.empty()) {
+    const std::scoped_lock lock{changedFilesMutex};
+    for (std::filesystem::path& file: deferred) if (!std::ranges::contains(changedFiles, file)) changedFiles.push_back(std::move(file));
+  }
+}
+
+void GraphicsDevice::reloadGraphicsJSON() {
+  yyjson_read_err error;
+  yyjson_doc* document = yyjson_read_file(graphicsJSONPath.string().c_str(), YYJSON_READ_ALLOW_INF_AND_NAN, nullptr, &error);
+  if (document == nullptr) return GraphicsInstance::showError("failed to reload graphics data JSON: " + std::string(error.msg));
+  yyjson_doc_free(graphicsJSON);
+  readGraphicsJSON(document);
+  compileJSONShaders();  // Shaders that were added to the JSON
+  // Materials point at the processes, so they are updated in place.
+  for (auto& [id, fragmentProcess]: fragmentProcesses) {
+    if (id >= JSONFragmentProcessArrayCount) continue;
+    fragmentProcess = FragmentProcess::jsonGet(this, yyjson_arr_get(JSONFragmentProcessArray, id));
+    if (fragmentProcess.multisampleState.pSampleMask != nullptr) fragmentProcess.multisampleState.pSampleMask = &fragmentProcess.multisampleState.sampleMask;  // Still points into the copy that was assigned from
+  }
+  for (auto& [id, vertexProcess]: vertexProcesses)
+    if (id < JSONVertexProcessArrayCount) vertexProcess = VertexProcess::jsonGet(this, yyjson_arr_get(JSONVertexProcessArray, id));
+  ++processReloadCount;
+  ++reloadCount;
 }
 
 std::weak_ptr<Texture> GraphicsDevice::getJSONTexture(const std::uint64_t id) {
   if (id >= JSONTextureArrayCount) return std::weak_ptr<Texture>();
   if (const auto it = textures.find(id); it != textures.end()) return it->second;
-  CommandBuffer commandBuffer;
-  std::shared_ptr<Texture> texture = textures.emplace(id, Texture::jsonGet(this, yyjson_arr_get(JSONTextureArray, id), commandBuffer)).first->second;
-  commandBuffer.preprocess();
-  executeCommandBufferImmediate(commandBuffer);
+  auto commandBuffer = std::make_unique<CommandBuffer>();
+  std::shared_ptr<Texture> texture = textures.emplace(id, Texture::jsonGet(this, yyjson_arr_get(JSONTextureArray, id), *commandBuffer)).first->second;
+  upload(std::move(commandBuffer));
   return texture;
 }
 
@@ -223,59 +417,354 @@ Mesh* GraphicsDevice::getJSONMesh(const std::uint64_t id) {
 }
 
 void GraphicsDevice::update() {
-  CommandBuffer commandBuffer;
-  for (Mesh& mesh: meshes | std::ranges::views::values) mesh.update(commandBuffer);
-  if (!commandBuffer.empty()) executeCommandBufferImmediate(commandBuffer);
-}
-
-GraphicsDevice::ImmediateExecutionContext GraphicsDevice::executeCommandBufferAsync(const CommandBuffer& commandBuffer) const {
-  const VkCommandBufferAllocateInfo allocateInfo{
-      .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-      .pNext              = nullptr,
-      .commandPool        = commandPool,
-      .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-      .commandBufferCount = 1,
+  applyReloads();
+  reclaimUploads();
+  submitUploads();
+}
+
+GraphicsDevice::QueueSelection GraphicsDevice::selectQueues(const std::span<const VkQueueFamilyProperties> families) {
+  constexpr uint32_t None = UINT32_MAX;
+  // Graphics and compute queues can always transfer, whether or not they say so.
+  const auto capabilities = [](const VkQueueFamilyProperties& family) { return family.queueFlags & VK_QUEUE_GRAPHICS_BIT || family.queueFlags & VK_QUEUE_COMPUTE_BIT ? family.queueFlags | VK_QUEUE_TRANSFER_BIT : family.queueFlags; };
+  const auto badness = [&](const VkQueueFamilyProperties& family, const VkQueueFlags needed) {
+    float total{};
+    for (VkQueueFlags unneeded = capabilities(family) & ~needed; unneeded != 0; unneeded &= unneeded - 1) {
+      const VkQueueFlags capability = unneeded & ~(unneeded - 1);
+      total += static_cast<float>(families.size()) / static_cast<float>(std::ranges::count_if(families, [&](const VkQueueFamilyProperties& other) { return (capabilities(other) & capability) != 0; }));
+    }
+    return total;
+  };
+  const auto choose = [&](const VkQueueFlags needed, const uint32_t excluded) {
+    uint32_t best = None;
+    for (uint32_t i{}; i < families.size(); ++i) {
+      if (i == excluded || families[i].queueCount == 0 || (capabilities(families[i]) & needed) != needed) continue;
+      if (best == None || badness(families[i], needed) < badness(families[best], needed)) best = i;
+    }
+    return best;
+  };
+  const uint32_t graphicsFamily = choose(VK_QUEUE_GRAPHICS_BIT, None);
+  if (graphicsFamily == None) GraphicsInstance::showError("the device has no graphics queue");
+  if (const uint32_t transferFamily = choose(VK_QUEUE_TRANSFER_BIT, graphicsFamily); transferFamily != None) return {graphicsFamily, transferFamily, 0};
+  // Without a family of its own, a second queue in the graphics family still lets uploads run alongside rendering. lavapipe has neither.
+  return {graphicsFamily, graphicsFamily, families[graphicsFamily].queueCount > 1 ? 1U : 0U};
+}
+
+void GraphicsDevice::upload(std::unique_ptr<CommandBuffer> commandBuffer) {
+  const CommandBuffer::State state = commandBuffer->preprocess();
+
+  // Ownership of everything that was written passes to the graphics queue family. The writes replace the old contents, so the transfer queue never has to take ownership first.
+  if (transferQueueFamilyIndex != globalQueueFamilyIndex) {
+    std::vector<CommandBuffer::PipelineBarrier::BufferMemoryBarrier> releaseBufferBarriers;
+    std::vector<CommandBuffer::PipelineBarrier::ImageMemoryBarrier> releaseImageBarriers;
+    for (const auto& [resource, resourceState]: state.resourceStates) {
+      if (resource->type == Resource::Buffer) {
+        const CommandBuffer::SubresourceState& subresource = resourceState.subresources.front();
+        const auto* const buffer = dynamic_cast<const Buffer*>(resource);
+        if (subresource.writeStages == VK_PIPELINE_STAGE_2_NONE || buffer->isConcurrent()) continue;  // Staging buffers are only read, and concurrent buffers belong to every family
+        releaseBufferBarriers.push_back({VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2, nullptr, subresource.writeStages, subresource.writeAccess, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, transferQueueFamilyIndex, globalQueueFamilyIndex, buffer, 0, VK_WHOLE_SIZE});
+        acquireBufferBarriers.push_back({VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2, nullptr, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT, transferQueueFamilyIndex, globalQueueFamilyIndex, buffer->getBuffer(), 0, VK_WHOLE_SIZE});
+        continue;
+      }
+      // Subresources are released one at a time, as they may have been left in different layouts.
+      const auto* const image = dynamic_cast<const Image*>(resource);
+      for (uint32_t i{}; i < resourceState.subresources.size(); ++i) {
+        const CommandBuffer::SubresourceState& subresource = resourceState.subresources[i];
+        if (subresource.writeStages == VK_PIPELINE_STAGE_2_NONE) continue;
+        const VkImageSubresourceRange range{image->getAspect(), i % resourceState.mipLevels, 1, i / resourceState.mipLevels, 1};
+        releaseImageBarriers.push_back({VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2, nullptr, subresource.writeStages, subresource.writeAccess, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, subresource.layout, subresource.layout, transferQueueFamilyIndex, globalQueueFamilyIndex, image, range});
+        acquireImageBarriers.push_back({VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2, nullptr, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT, subresource.layout, subresource.layout, transferQueueFamilyIndex, globalQueueFamilyIndex, image->getImage(), range});
+      }
+    }
+    if (!releaseBufferBarriers.empty() || !releaseImageBarriers.empty()) commandBuffer->record<CommandBuffer::PipelineBarrier>(0, std::span<CommandBuffer::PipelineBarrier::MemoryBarrier>{}, releaseBufferBarriers, releaseImageBarriers);
+  }
+
+  pendingUploads.push_back(std::move(commandBuffer));
+}
+
+void GraphicsDevice::submitUploads() {
+  if (pendingUploads.empty()) return;
+  // The command buffers of finished uploads are recorded again before any new ones are allocated.
+  const std::size_t reused = std::min(pendingUploads.size(), freeTransferCommandBuffers.size());
+  std::vector<VkCommandBuffer> commandBuffers(freeTransferCommandBuffers.end() - reused, freeTransferCommandBuffers.end());
+  freeTransferCommandBuffers.resize(freeTransferCommandBuffers.size() - reused);
+  commandBuffers.resize(pendingUploads.size());
+  if (reused < commandBuffers.size()) {
+    const VkCommandBufferAllocateInfo allocateInfo{
+        .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .pNext              = nullptr,
+        .commandPool        = transferCommandPool,
+        .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = static_cast<uint32_t>(commandBuffers.size() - reused),
+    };
+    if (const VkResult result = vkAllocateCommandBuffers(device, &allocateInfo, commandBuffers.data() + reused); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to allocate VkCommandBuffer");
+  }
+  constexpr VkCommandBufferBeginInfo beginInfo{
+      .sType            = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .pNext            = nullptr,
+      .flags            = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+      .pInheritanceInfo = nullptr,
+  };
+  for (std::size_t i{}; i < commandBuffers.size(); ++i) {
+    if (const VkResult result = vkBeginCommandBuffer(commandBuffers[i], &beginInfo); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to begin VkCommandBuffer");
+    pendingUploads[i]->bake(commandBuffers[i]);
+    if (const VkResult result = vkEndCommandBuffer(commandBuffers[i]); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to end VkCommandBuffer");
+  }
+  std::vector<VkCommandBufferSubmitInfo> commandBufferInfos(commandBuffers.size());
+  for (std::size_t i{}; i < commandBuffers.size(); ++i) commandBufferInfos[i] = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO, nullptr, commandBuffers[i], 0};
+  // The graphics queue waits for the transfer timeline to reach this value in its next submission.
+  const VkSemaphoreSubmitInfo signalInfo{
+      .sType       = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+      .pNext       = nullptr,
+      .semaphore   = transferTimeline,
+      .value       = transferTimelineValue + 1,
+      .stageMask   = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+      .deviceIndex = 0
   };
+  const VkSubmitInfo2 submitInfo{
+      .sType                    = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+      .pNext                    = nullptr,
+      .flags                    = 0,
+      .waitSemaphoreInfoCount   = 0,
+      .pWaitSemaphoreInfos      = nullptr,
+      .commandBufferInfoCount   = static_cast<uint32_t>(commandBufferInfos.size()),
+      .pCommandBufferInfos      = commandBufferInfos.data(),
+      .signalSemaphoreInfoCount = 1,
+      .pSignalSemaphoreInfos    = &signalInfo
+  };
+  {
+    // The transfer queue may be the graphics queue itself.
+    std::unique_lock<std::mutex> queueLock;
+    if (transferQueue == globalQueue) queueLock = std::unique_lock{globalQueueMutex};
+    if (const VkResult result = vkQueueSubmit2(transferQueue, 1, &submitInfo, VK_NULL_HANDLE); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to submit uploads to the transfer queue");
+  }
+  uploads.push_back({std::move(pendingUploads), std::move(commandBuffers), ++transferTimelineValue});
+  pendingUploads.clear();
+}
+
+std::uint64_t GraphicsDevice::acquireUploads(const VkCommandBuffer commandBuffer) {
+  submitUploads();
+  if (!acquireBufferBarriers.empty() || !acquireImageBarriers.empty()) {
+    const VkDependencyInfo dependencyInfo {
+      .sType                    = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .pNext                    = nullptr,
+      .dependencyFlags          = 0,
+      .memoryBarrierCount       = 0,
+      .pMemoryBarriers          = nullptr,
+      .bufferMemoryBarrierCount = static_cast<uint32_t>(acquireBufferBarriers.size()),
+      .pBufferMemoryBarriers    = acquireBufferBarriers.data(),
+      .imageMemoryBarrierCount  = static_cast<uint32_t>(acquireImageBarriers.size()),
+      .pImageMemoryBarriers     = acquireImageBarriers.data()
+    };
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+    acquireBufferBarriers.clear();
+    acquireImageBarriers.clear();
+  }
+  return transferTimelineValue;
+}
+
+void GraphicsDevice::reclaimUploads() {
+  // Uploads finish in the order that they were submitted, so the first one that is still running ends the search.
+  std::uint64_t completed;
+  if (const VkResult result = vkGetSemaphoreCounterValue(device, transferTimeline, &completed); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to get semaphore counter value");
+  const auto running = std::ranges::find_if(uploads, [completed](const Upload& upload) { return upload.timelineValue > completed; });
+  for (const Upload& upload: std::ranges::subrange(uploads.begin(), running)) freeTransferCommandBuffers.insert_range(freeTransferCommandBuffers.end(), upload.commandBuffers);
+  uploads.erase(uploads.begin(), running);
+}
+
+VkPipelineCache GraphicsDevice::createPipelineCache() const {
+  const VkPipelineCacheCreateInfo createInfo {
+    .sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    .pNext           = nullptr,
+    .flags           = VK_PIPELINE_CACHE_CREATE_EXTERNALLY_SYNCHRONIZED_BIT,
+    .initialDataSize = pipelineCacheSeed.size(),
+    .pInitialData    = pipelineCacheSeed.data()
+  };
+  VkPipelineCache cache;
+  if (const VkResult result = vkCreatePipelineCache(device, &createInfo, nullptr, &cache); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create pipeline cache");
+  return cache;
+}
+
+void GraphicsDevice::mergePipelineCaches(const std::span<const VkPipelineCache> caches) const {
+  if (caches.empty()) return;
+  if (const VkResult result = vkMergePipelineCaches(device, pipelineCache, caches.size(), caches.data()); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to merge pipeline caches");
+  for (const VkPipelineCache cache: caches) vkDestroyPipelineCache(device, cache, nullptr);
+}
+
+GraphicsDevice::PipelineCacheFileHeader GraphicsDevice::makePipelineCacheFileHeader(const std::string_view data) const {
+  PipelineCacheFileHeader header {
+    .magic         = PipelineCacheFileHeader::Magic,
+    .driverVersion = device.physical_device.properties.driverVersion,
+    .dataSize      = data.size(),
+    .dataHash      = Tools::hash(data)
+  };
+  std::memcpy(header.pipelineCacheUUID, device.physical_device.properties.pipelineCacheUUID, VK_UUID_SIZE);
+  return header;
+}
+
+std::string GraphicsDevice::readPipelineCacheFile() const {
+  std::ifstream stream{pipelineCachePath, std::ios_base::ate | std::ios_base::binary};
+  if (!stream.is_open()) return {};
+  const std::size_t size = stream.tellg();
+  if (size < sizeof(PipelineCacheFileHeader) + sizeof(VkPipelineCacheHeaderVersionOne)) return {};
+  stream.seekg(0, std::ios_base::beg);
+  PipelineCacheFileHeader header;
+  std::string data(size - sizeof(PipelineCacheFileHeader), '\0');
+  stream.read(reinterpret_cast<char*>(&header), sizeof(PipelineCacheFileHeader));
+  stream.read(data.data(), static_cast<std::streamsize>(data.size()));
+  if (!stream || header != makePipelineCacheFileHeader(data)) return {};
+  // Drivers are meant to reject data from other devices themselves, but not all of them do.
+  VkPipelineCacheHeaderVersionOne vulkanHeader;
+  std::memcpy(&vulkanHeader, data.data(), sizeof(VkPipelineCacheHeaderVersionOne));
+  const VkPhysicalDeviceProperties& properties = device.physical_device.properties;
+  if (vulkanHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || vulkanHeader.vendorID != properties.vendorID || vulkanHeader.deviceID != properties.deviceID || std::memcmp(vulkanHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) return {};
+  return data;
+}
+
+void GraphicsDevice::savePipelineCache() const {
+  std::size_t size;
+  if (const VkResult result = vkGetPipelineCacheData(device, pipelineCache, &size, nullptr); result != VK_SUCCESS) return GraphicsInstance::showError(result, "failed to get pipeline cache data size");
+  std::string data(size, '\0');
+  if (const VkResult result = vkGetPipelineCacheData(device, pipelineCache, &size, data.data()); result != VK_SUCCESS) return GraphicsInstance::showError(result, "failed to get pipeline cache data");
+  data.resize(size);
+  if (data == pipelineCacheSeed) return;  // Nothing new was compiled
+
+  // The cache only saves time, so failing to write it is not worth reporting.
+  std::error_code error;
+  std::filesystem::create_directories(pipelineCachePath.parent_path(), error);
+  std::filesystem::path temporaryPath = pipelineCachePath;
+  temporaryPath += ".tmp";
+  std::ofstream stream{temporaryPath, std::ios_base::trunc | std::ios_base::binary};
+  const PipelineCacheFileHeader header = makePipelineCacheFileHeader(data);
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(PipelineCacheFileHeader));
+  stream.write(data.data(), static_cast<std::streamsize>(data.size()));
+  stream.close();
+  if (stream) std::filesystem::rename(temporaryPath, pipelineCachePath, error);
+  else std::filesystem::remove(temporaryPath, error);
+}
+
+GraphicsDevice::AsyncHandle GraphicsDevice::executeCommandBufferAsync(const CommandBuffer& commandBuffer) {
+  ThreadCommandPool* threadPool;
+  {
+    std::lock_guard lock{threadCommandPoolsMutex};
+    threadPool = &threadCommandPools[std::this_thread::get_id()];
+  }
+  // Nothing but this thread ever touches its pool, so it is used without holding the lock.
+  if (threadPool->pool == VK_NULL_HANDLE) {
+    const VkCommandPoolCreateInfo commandPoolCreateInfo {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .pNext = nullptr,
+      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+      .queueFamilyIndex = globalQueueFamilyIndex,
+    };
+    if (const VkResult result = vkCreateCommandPool(device, &commandPoolCreateInfo, nullptr, &threadPool->pool); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create command pool");
+  }
+  // Submissions finish in order, so the command buffers that have finished are all at the front.
+  std::uint64_t completed;
+  if (const VkResult result = vkGetSemaphoreCounterValue(device, graphicsTimeline, &completed); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to get semaphore counter value");
+  while (!threadPool->submitted.empty() && threadPool->submitted.front().first <= completed) {
+    threadPool->free.push_back(threadPool->submitted.front().second);
+    threadPool->submitted.pop_front();
+  }
   VkCommandBuffer vkCmdBuf;
-  if (const VkResult result = vkAllocateCommandBuffers(device, &allocateInfo, &vkCmdBuf); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to allocate VkCommandBuffer");
+  if (!threadPool->free.empty()) {
+    vkCmdBuf = threadPool->free.back();
+    threadPool->free.pop_back();
+  } else {
+    const VkCommandBufferAllocateInfo allocateInfo{
+        .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .pNext              = nullptr,
+        .commandPool        = threadPool->pool,
+        .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    if (const VkResult result = vkAllocateCommandBuffers(device, &allocateInfo, &vkCmdBuf); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to allocate VkCommandBuffer");
+  }
   constexpr VkCommandBufferBeginInfo beginInfo{
       .sType            = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
       .pNext            = nullptr,
       .flags            = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
       .pInheritanceInfo = nullptr,
   };
+  // Beginning a recycled command buffer implicitly resets it.
   if (const VkResult result = vkBeginCommandBuffer(vkCmdBuf, &beginInfo); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to begin VkCommandBuffer");
   commandBuffer.bake(vkCmdBuf);
   if (const VkResult result = vkEndCommandBuffer(vkCmdBuf); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to end VkCommandBuffer");
-  std::array<VkPipelineStageFlags, 1> arr{VK_PIPELINE_STAGE_NONE};
-  const VkSubmitInfo submitInfo{
-      .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-      .pNext                = nullptr,
-      .waitSemaphoreCount   = 0,
-      .pWaitSemaphores      = nullptr,
-      .pWaitDstStageMask    = arr.data(),
-      .commandBufferCount   = 1,
-      .pCommandBuffers      = &vkCmdBuf,
-      .signalSemaphoreCount = 0,
-      .pSignalSemaphores    = nullptr
+  const VkCommandBufferSubmitInfo commandBufferInfo{
+      .sType         = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+      .pNext         = nullptr,
+      .commandBuffer = vkCmdBuf,
+      .deviceMask    = 0
   };
-  constexpr VkFenceCreateInfo fenceCreateInfo{
-      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-      .pNext = nullptr,
-      .flags = 0,
+  std::lock_guard queueLock{globalQueueMutex};
+  const VkSemaphoreSubmitInfo signalInfo{
+      .sType       = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+      .pNext       = nullptr,
+      .semaphore   = graphicsTimeline,
+      .value       = graphicsTimelineValue + 1,
+      .stageMask   = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+      .deviceIndex = 0
+  };
+  const VkSubmitInfo2 submitInfo{
+      .sType                    = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+      .pNext                    = nullptr,
+      .flags                    = 0,
+      .waitSemaphoreInfoCount   = 0,
+      .pWaitSemaphoreInfos      = nullptr,
+      .commandBufferInfoCount   = 1,
+      .pCommandBufferInfos      = &commandBufferInfo,
+      .signalSemaphoreInfoCount = 1,
+      .pSignalSemaphoreInfos    = &signalInfo
   };
-  VkFence fence;
-  if (const VkResult result = vkCreateFence(device, &fenceCreateInfo, nullptr, &fence); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create VkFence");
-  if (const VkResult result = vkQueueSubmit(globalQueue, 1, &submitInfo, fence); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed VkQueue submission");
-  return {vkCmdBuf, fence};
+  if (const VkResult result = vkQueueSubmit2(globalQueue, 1, &submitInfo, VK_NULL_HANDLE); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed VkQueue submission");
+  threadPool->submitted.emplace_back(++graphicsTimelineValue, vkCmdBuf);
+  return {graphicsTimelineValue};
 }
 
-void GraphicsDevice::waitForAsyncCommandBuffer(const ImmediateExecutionContext context) const {
-  if (const VkResult result = vkWaitForFences(device, 1, &context.fence, VK_TRUE, -1ULL); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to wait for VkFence");
-  vkFreeCommandBuffers(device, commandPool, 1, &context.commandBuffer);
-  vkDestroyFence(device, context.fence, nullptr);
+bool GraphicsDevice::isAsyncCommandBufferFinished(const AsyncHandle handle) const {
+  return hasTimelineReached(graphicsTimeline, handle.timelineValue);
 }
 
-void GraphicsDevice::executeCommandBufferImmediate(const CommandBuffer& commandBuffer) const {
+void GraphicsDevice::waitForAsyncCommandBuffer(const AsyncHandle handle) const {
+  waitForTimeline(graphicsTimeline, handle.timelineValue);
+}
+
+void GraphicsDevice::executeCommandBufferImmediate(const CommandBuffer& commandBuffer) {
   waitForAsyncCommandBuffer(executeCommandBufferAsync(commandBuffer));
+}
+
+VkSemaphore GraphicsDevice::createTimelineSemaphore() const {
+  constexpr VkSemaphoreTypeCreateInfo typeCreateInfo{
+      .sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+      .pNext         = nullptr,
+      .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+      .initialValue  = 0
+  };
+  const VkSemaphoreCreateInfo createInfo{
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      .pNext = &typeCreateInfo,
+      .flags = 0
+  };
+  VkSemaphore semaphore;
+  if (const VkResult result = vkCreateSemaphore(device, &createInfo, nullptr, &semaphore); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create timeline semaphore");
+  return semaphore;
+}
+
+bool GraphicsDevice::waitForTimeline(const VkSemaphore timeline, const std::uint64_t value, const std::uint64_t timeout) const {
+  const VkSemaphoreWaitInfo waitInfo{
+      .sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+      .pNext          = nullptr,
+      .flags          = 0,
+      .semaphoreCount = 1,
+      .pSemaphores    = &timeline,
+      .pValues        = &value
+  };
+  const VkResult result = vkWaitSemaphores(device, &waitInfo, timeout);
+  if (result != VK_SUCCESS && result != VK_TIMEOUT) GraphicsInstance::showError(result, "failed to wait for timeline semaphore");
+  return result == VK_SUCCESS;
+}
+
+bool GraphicsDevice::hasTimelineReached(const VkSemaphore timeline, const std::uint64_t value) const {
+  std::uint64_t completed;
+  if (const VkResult result = vkGetSemaphoreCounterValue(device, timeline, &completed); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to get semaphore counter value");
+  return completed >= value;
 }
\ No newline at end of file
@@ -8,8 +8,19 @@
 #include <vma/vk_mem_alloc.h>
 
 
+#include <cstdint>
+#include <deque>
 #include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 struct FragmentProcess;
 class Shader;
@@ -18,14 +29,138 @@ class Material;
 class Mesh;
 class Pipeline;
 class CommandBuffer;
+class StagingRing;
 
 class GraphicsDevice {
+  /**
+   * Where work is submitted. Uploads go to a queue of their own when the device has one to spare, so that they run alongside
+   * rendering instead of queueing up behind it.
+   */
+  struct QueueSelection {
+    uint32_t graphicsFamily;
+    uint32_t transferFamily;
+    uint32_t transferIndex;  // The index of the transfer queue within its family. It is the graphics queue itself when both are zero and the families match.
+  };
+
+  /**
+   * Picks the family with the fewest capabilities beyond what is needed for the graphics queue and for the transfer queue. Each
+   * unneeded capability costs more the fewer families there are that have it, so that the rare families are left alone.
+   * @param families The queue families of the physical device
+   * @return The chosen queues. The transfer queue falls back to a second graphics queue, then to the graphics queue itself.
+   */
+  [[nodiscard]] static QueueSelection selectQueues(std::span<const VkQueueFamilyProperties> families);
+
+  /**
+   * A batch of uploads that has been submitted to the transfer queue at once. It keeps the commands that it was recorded from, and
+   * with them the staging memory that they read from, until the transfer timeline reaches its value.
+   */
+  struct Upload {
+    std::vector<std::unique_ptr<CommandBuffer>> commands;
+    std::vector<VkCommandBuffer> commandBuffers;
+    std::uint64_t timelineValue;
+  };
+
+  std::vector<std::unique_ptr<CommandBuffer>> pendingUploads;  // Queued by <c>upload</c>, but not yet submitted
+  std::vector<Upload> uploads;                                // In submission order
+  std::vector<VkCommandBuffer> freeTransferCommandBuffers;    // Recorded again by later uploads instead of being freed
+  std::vector<VkBufferMemoryBarrier2> acquireBufferBarriers;  // Take ownership of the buffers that those uploads wrote
+  std::vector<VkImageMemoryBarrier2> acquireImageBarriers;    // Take ownership of the images that those uploads wrote
+
+  /**
+   * Frees the uploads that the transfer queue has finished with.
+   */
+  void reclaimUploads();
+  /**
+   * Submits every pending upload to the transfer queue in a single batch, which signals the next value of the transfer timeline.
+   */
+  void submitUploads();
+
+  /**
+   * The command buffers that one thread records asynchronous submissions into. Only that thread ever touches its pool.
+   */
+  struct ThreadCommandPool {
+    VkCommandPool pool{VK_NULL_HANDLE};
+    std::deque<std::pair<std::uint64_t, VkCommandBuffer>> submitted;  // In submission order, with the graphics timeline value that each one signals
+    std::vector<VkCommandBuffer> free;
+  };
+
+  std::mutex threadCommandPoolsMutex;
+  std::unordered_map<std::thread::id, ThreadCommandPool> threadCommandPools;
+
+  [[nodiscard]] VkSemaphore createTimelineSemaphore() const;
+
+  /**
+   * Precedes the pipeline cache data on disk. The data is only loaded if it was written by the same driver for the same device,
+   * and has not been truncated or corrupted since.
+   */
+  struct PipelineCacheFileHeader {
+    static constexpr std::uint32_t Magic = 0x43504742;  // "BGPC"
+
+    std::uint32_t magic;
+    std::uint32_t driverVersion;
+    std::uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    std::uint64_t dataSize;
+    std::uint64_t dataHash;
+
+    bool operator==(const PipelineCacheFileHeader&) const = default;
+  };
+
+  [[nodiscard]] PipelineCacheFileHeader makePipelineCacheFileHeader(std::string_view data) const;
+  /**
+   * @return The contents of the pipeline cache file if it exists and is valid for this device, or an empty string otherwise.
+   */
+  [[nodiscard]] std::string readPipelineCacheFile() const;
+  /**
+   * Compiles every shader in the graphics data JSON that has not been compiled yet, in parallel. <c>getJSONShader</c> only ever
+   * looks shaders up, so it may be called from any thread.
+   */
+  void compileJSONShaders();
+  /**
+   * Cooks every texture in the graphics data JSON in parallel, then uploads them all. Cooking is most of the cost of loading a
+   * texture, and it needs nothing from the GraphicsDevice.
+   */
+  void loadJSONTextures();
+
+  std::filesystem::path graphicsJSONPath;
+  std::mutex changedFilesMutex;
+  std::vector<std::filesystem::path> changedFiles;  // Filled on the file watcher's thread, emptied by <c>update</c>
+  std::vector<std::pair<Shader*, std::future<std::unique_ptr<Shader>>>> reloadingShaders;
+
+  void readGraphicsJSON(yyjson_doc* document);
+  /**
+   * Rereads the graphics data JSON and updates every process that has been loaded from it in place.
+   */
+  void reloadGraphicsJSON();
+  /**
+   * Swaps in the shaders that have finished recompiling, then starts recompiling the shaders that depend on files that changed.
+   */
+  void applyReloads();
+
 public:
   vkb::Device device;
+  bool textureCompressionBC{};  // Whether the device can sample BC formats. Textures are left uncompressed on devices that cannot.
   VkQueue globalQueue;
+  std::mutex globalQueueMutex;  // Held while submitting or presenting to <c>globalQueue</c>, as any thread may submit to it
+  /**
+   * Every submission to <c>globalQueue</c> signals the next value of this timeline semaphore, so the value that a submission
+   * signals tells when it, and everything submitted before it, has finished.
+   */
+  VkSemaphore graphicsTimeline{VK_NULL_HANDLE};
+  std::uint64_t graphicsTimelineValue{};  // The value signalled by the last submission to <c>globalQueue</c>. Guarded by <c>globalQueueMutex</c>.
   uint32_t globalQueueFamilyIndex;
+  VkQueue transferQueue;  // May be <c>globalQueue</c> on devices that only have one queue
+  uint32_t transferQueueFamilyIndex;
+  VkSemaphore transferTimeline{VK_NULL_HANDLE};  // Every batch of uploads signals the next value
+  std::uint64_t transferTimelineValue{};         // The value signalled by the last batch of uploads
   VmaAllocator allocator{VK_NULL_HANDLE};
   VkCommandPool commandPool{VK_NULL_HANDLE};
+  VkCommandPool transferCommandPool{VK_NULL_HANDLE};
+  std::unique_ptr<StagingRing> stagingRing;  // Stages the data of every upload
+  VkPipelineCache pipelineCache{VK_NULL_HANDLE};
+  std::filesystem::path pipelineCachePath;
+  std::string pipelineCacheSeed;  // What the pipeline cache file held at startup
+  std::uint64_t reloadCount{};         // Incremented whenever <c>update</c> swaps in reloaded shaders or processes
+  std::uint64_t processReloadCount{};  // Incremented whenever <c>update</c> reloads the processes
   DescriptorSetAllocator descriptorSetAllocator{*this};
 
   std::unordered_map<std::uint64_t, VkSampler> samplers;
@@ -40,6 +175,8 @@ public:
 
   yyjson_doc* graphicsJSON;
   std::filesystem::path resourcesDirectory;
+  yyjson_val* JSONSamplerArray;
+  std::uint64_t JSONSamplerArrayCount;
   yyjson_val* JSONTextureArray;
   std::uint64_t JSONTextureArrayCount;
   yyjson_val* JSONShaderArray;
@@ -57,7 +194,11 @@ public:
   explicit GraphicsDevice(const std::filesystem::path& path);
   ~GraphicsDevice();
 
-  VkSampler* getSampler(VkFilter magnificationFilter=VK_FILTER_NEAREST, VkFilter minificationFilter=VK_FILTER_NEAREST, VkSamplerMipmapMode mipmapMode=VK_SAMPLER_MIPMAP_MODE_NEAREST, VkSamplerAddressMode addressMode=VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, float lodBias=0, VkBorderColor borderColor=VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK);
+  VkSampler* getSampler(VkFilter magnificationFilter=VK_FILTER_NEAREST, VkFilter minificationFilter=VK_FILTER_NEAREST, VkSamplerMipmapMode mipmapMode=VK_SAMPLER_MIPMAP_MODE_NEAREST, VkSamplerAddressMode addressMode=VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, float lodBias=0, VkBorderColor borderColor=VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK, float maxLod=VK_LOD_CLAMP_NONE);
+  /**
+   * @return The sampler described by the graphics data JSON. Anything that the JSON leaves out takes the same default as in <c>getSampler</c>.
+   */
+  VkSampler* getJSONSampler(std::uint64_t id);
   FragmentProcess* getJSONFragmentProcess(const std::string& name);
   FragmentProcess* getJSONFragmentProcess(std::uint64_t id);
   VertexProcess* getJSONVertexProcess(const std::string& name);
@@ -69,14 +210,66 @@ public:
   Material* getMaterial(std::uint64_t id);
   Mesh* getJSONMesh(std::uint64_t id);
 
+  /**
+   * Call once per frame, while no commands are being recorded. Swaps in any shaders and processes that have been reloaded since the
+   * last call, then uploads modified meshes along with everything else queued since the last frame, without waiting for the
+   * uploads to finish.
+   */
   void update();
 
-  struct ImmediateExecutionContext {
-    VkCommandBuffer commandBuffer;
-    VkFence fence;
+  /**
+   * @return A new pipeline cache that starts out with everything that the pipeline cache file held at startup. It is externally
+   * synchronized, so each thread that creates pipelines should use its own, then merge them all back with <c>mergePipelineCaches</c>.
+   */
+  [[nodiscard]] VkPipelineCache createPipelineCache() const;
+  /**
+   * Merges <c>caches</c> into <c>pipelineCache</c>, then destroys them.
+   */
+  void mergePipelineCaches(std::span<const VkPipelineCache> caches) const;
+  /**
+   * Writes <c>pipelineCache</c> to disk. The file is replaced atomically, so a crash while writing it never leaves a broken cache behind.
+   */
+  void savePipelineCache() const;
+
+  /**
+   * Queues <c>commandBuffer</c> for the transfer queue. Queued uploads are submitted together by the next <c>update</c> or
+   * <c>acquireUploads</c>, and nothing ever waits on the host for them to finish. Every resource that it writes is handed over to
+   * the graphics queue family, so it must overwrite those resources entirely, unless they are concurrently shared buffers. The next
+   * submission to the graphics queue must go through <c>acquireUploads</c> before it uses them.
+   * @param commandBuffer The upload commands. They are preprocessed here, and destroyed along with their cleanup resources once the upload has finished.
+   */
+  void upload(std::unique_ptr<CommandBuffer> commandBuffer);
+  /**
+   * Submits any queued uploads, then records the barriers that take ownership of everything uploaded since the last call into
+   * <c>commandBuffer</c>, which must be recorded for the graphics queue.
+   * @param commandBuffer The graphics queue command buffer to record the barriers into, before anything else that it records
+   * @return The value of <c>transferTimeline</c> that the submission of <c>commandBuffer</c> must wait on
+   */
+  [[nodiscard]] std::uint64_t acquireUploads(VkCommandBuffer commandBuffer);
+
+  /**
+   * Blocks until <c>timeline</c> reaches <c>value</c>.
+   * @return <c>false</c> if the timeout passed first
+   */
+  bool waitForTimeline(VkSemaphore timeline, std::uint64_t value, std::uint64_t timeout=UINT64_MAX) const;
+  [[nodiscard]] bool hasTimelineReached(VkSemaphore timeline, std::uint64_t value) const;
+
+  /**
+   * Identifies a submission made by <c>executeCommandBufferAsync</c> by the value of <c>graphicsTimeline</c> that it signals.
+   */
+  struct AsyncHandle {
+    std::uint64_t timelineValue;
   };
 
-  [[nodiscard]] ImmediateExecutionContext executeCommandBufferAsync(const CommandBuffer& commandBuffer) const;
-  void waitForAsyncCommandBuffer(ImmediateExecutionContext context) const;
-  void executeCommandBufferImmediate(const CommandBuffer& commandBuffer) const;
+  /**
+   * Submits <c>commandBuffer</c> to the graphics queue without waiting for it to finish. It is recorded into a command buffer from
+   * the calling thread's pool, which is reused by that thread once the graphics timeline shows the submission to have finished.
+   * May be called from any thread.
+   * @param commandBuffer The commands to submit. It must outlive the submission, along with the resources it uses.
+   * @return A handle to poll or wait on
+   */
+  [[nodiscard]] AsyncHandle executeCommandBufferAsync(const CommandBuffer& commandBuffer);
+  [[nodiscard]] bool isAsyncCommandBufferFinished(AsyncHandle handle) const;
+  void waitForAsyncCommandBuffer(AsyncHandle handle) const;
+  void executeCommandBufferImmediate(const CommandBuffer& commandBuffer);
 };
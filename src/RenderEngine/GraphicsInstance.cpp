@@ -83,6 +83,7 @@ void GraphicsInstance::create(std::vector<const char*> extensions) {
   builder.enable_extensions(extensions);
   builder.set_app_name("Bootanical Gardens").set_app_version(0, 0, 1);
   builder.set_engine_name("Boo Engine").set_engine_version(0, 0, 1);
+  builder.require_api_version(1, 3, 0);
 #if !NDEBUG & defined(BOOTANICAL_GARDENS_ENABLE_VULKAN_VALIDATION)
   builder.enable_validation_layers(std::getenv(BOOTANICAL_GARDENS_ENABLE_VULKAN_VALIDATION) != nullptr);
   builder.set_debug_callback(reinterpret_cast<PFN_vkDebugUtilsMessengerCallbackEXT>(&GraphicsInstance::debugCallback));
@@ -0,0 +1,249 @@
+#include "BlockCompression.hpp"
+
+#include "src/JobSystem.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+template<std::size_t Channels> std::array<float, Channels> BlockCompression::principalAxis(const Block& block) {
+  std::array<float, Channels> mean{};
+  for (const std::uint32_t texel: block)
+    for (std::size_t channel{}; channel < Channels; ++channel) mean[channel] += static_cast<float>(texel >> channel * 8 & 0xFF) / block.size();
+  std::array<std::array<float, Channels>, Channels> covariance{};
+  for (const std::uint32_t texel: block) {
+    std::array<float, Channels> offset;
+    for (std::size_t channel{}; channel < Channels; ++channel) offset[channel] = static_cast<float>(texel >> channel * 8 & 0xFF) - mean[channel];
+    for (std::size_t row{}; row < Channels; ++row)
+      for (std::size_t column{}; column < Channels; ++column) covariance[row][column] += offset[row] * offset[column];
+  }
+  // Power iteration converges on the eigenvector with the largest eigenvalue. It starts from the row of the channel that varies the
+  // most, which is never perpendicular to that eigenvector unless the block is a single colour.
+  std::size_t widest{};
+  for (std::size_t channel{1}; channel < Channels; ++channel)
+    if (covariance[channel][channel] > covariance[widest][widest]) widest = channel;
+  std::array<float, Channels> axis = covariance[widest];
+  if (covariance[widest][widest] == 0) {
+    axis.fill(1);
+    return axis;
+  }
+  for (std::uint32_t iteration{}; iteration < 8; ++iteration) {
+    std::array<float, Channels> next{};
+    float length{};
+    for (std::size_t row{}; row < Channels; ++row) {
+      for (std::size_t column{}; column < Channels; ++column) next[row] += covariance[row][column] * axis[column];
+      length = std::max(length, std::abs(next[row]));
+    }
+    if (length == 0) break;
+    for (std::size_t channel{}; channel < Channels; ++channel) axis[channel] = next[channel] / length;
+  }
+  return axis;
+}
+
+template<std::size_t Channels> std::array<std::uint32_t, 2> BlockCompression::extremes(const Block& block, const std::array<float, Channels>& axis) {
+  std::array<std::uint32_t, 2> result{};
+  float lowest  = std::numeric_limits<float>::max();
+  float highest = std::numeric_limits<float>::lowest();
+  for (std::uint32_t i{}; i < block.size(); ++i) {
+    float projection{};
+    for (std::size_t channel{}; channel < Channels; ++channel) projection += static_cast<float>(block[i] >> channel * 8 & 0xFF) * axis[channel];
+    if (projection < lowest) {
+      lowest    = projection;
+      result[0] = i;
+    }
+    if (projection > highest) {
+      highest   = projection;
+      result[1] = i;
+    }
+  }
+  return result;
+}
+
+bool BlockCompression::supports(const VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK: return true;
+    default: return false;
+  }
+}
+
+std::vector<std::byte> BlockCompression::compress(const VkFormat format, const std::span<const std::uint32_t> pixels, const std::uint32_t width, const std::uint32_t height) {
+  void (*encode)(const Block&, std::byte*);
+  std::size_t blockSize{16};
+  switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK: encode = encodeBC1; blockSize = 8; break;
+    case VK_FORMAT_BC4_UNORM_BLOCK: encode = [](const Block& block, std::byte* output) { encodeBC4(block, output); }; blockSize = 8; break;
+    case VK_FORMAT_BC5_UNORM_BLOCK: encode = encodeBC5; break;
+    default: encode = encodeBC7; break;
+  }
+  const std::size_t blocksWide = (width + 3) / 4;
+  const std::size_t blocksHigh = (height + 3) / 4;
+  std::vector<std::byte> output(blocksWide * blocksHigh * blockSize);
+  JobSystem::parallelFor(blocksHigh, 16, [&](const std::size_t begin, const std::size_t end) {
+    Block block;
+    for (std::size_t blockY{begin}; blockY < end; ++blockY) {
+      for (std::size_t blockX{}; blockX < blocksWide; ++blockX) {
+        for (std::size_t i{}; i < block.size(); ++i) {
+          const std::size_t x = std::min<std::size_t>(blockX * 4 + i % 4, width - 1);
+          const std::size_t y = std::min<std::size_t>(blockY * 4 + i / 4, height - 1);
+          block[i] = pixels[y * width + x];
+        }
+        encode(block, output.data() + (blockY * blocksWide + blockX) * blockSize);
+      }
+    }
+  });
+  return output;
+}
+
+void BlockCompression::encodeBC1(const Block& block, std::byte* output) {
+  const auto [low, high] = extremes(block, principalAxis<3>(block));
+  const auto toRGB565 = [](const std::uint32_t texel) {
+    return static_cast<std::uint16_t>(((texel & 0xFF) * 31 + 127) / 255 << 11 | ((texel >> 8 & 0xFF) * 63 + 127) / 255 << 5 | ((texel >> 16 & 0xFF) * 31 + 127) / 255);
+  };
+  std::uint16_t color0 = toRGB565(block[high]);
+  std::uint16_t color1 = toRGB565(block[low]);
+  // The first endpoint must be the larger one to select the four colour mode.
+  if (color0 < color1) std::swap(color0, color1);
+  std::uint32_t indices{};
+  // Equal endpoints select the three colour mode instead, but index zero is the first endpoint in either mode.
+  if (color0 != color1) {
+    const auto expand = [](const std::uint16_t color) {
+      const std::uint32_t red = color >> 11, green = color >> 5 & 0x3F, blue = color & 0x1F;
+      return std::array<std::int32_t, 3>{static_cast<std::int32_t>(red << 3 | red >> 2), static_cast<std::int32_t>(green << 2 | green >> 4), static_cast<std::int32_t>(blue << 3 | blue >> 2)};
+    };
+    const std::array<std::int32_t, 3> endpoint0 = expand(color0);
+    const std::array<std::int32_t, 3> endpoint1 = expand(color1);
+    std::array<std::array<std::int32_t, 3>, 4> palette{endpoint0, endpoint1};
+    for (std::size_t channel{}; channel < 3; ++channel) {
+      palette[2][channel] = (2 * endpoint0[channel] + endpoint1[channel]) / 3;
+      palette[3][channel] = (endpoint0[channel] + 2 * endpoint1[channel]) / 3;
+    }
+    for (std::uint32_t i{}; i < block.size(); ++i) {
+      std::uint32_t best{};
+      std::int32_t bestError = std::numeric_limits<std::int32_t>::max();
+      for (std::uint32_t entry{}; entry < palette.size(); ++entry) {
+        std::int32_t error{};
+        for (std::size_t channel{}; channel < 3; ++channel) {
+          const std::int32_t difference = static_cast<std::int32_t>(block[i] >> channel * 8 & 0xFF) - palette[entry][channel];
+          error += difference * difference;
+        }
+        if (error < bestError) {
+          bestError = error;
+          best      = entry;
+        }
+      }
+      indices |= best << i * 2;
+    }
+  }
+  const std::uint64_t bits = color0 | static_cast<std::uint64_t>(color1) << 16 | static_cast<std::uint64_t>(indices) << 32;
+  for (std::uint32_t i{}; i < 8; ++i) output[i] = static_cast<std::byte>(bits >> i * 8);
+}
+
+void BlockCompression::encodeBC4(const Block& block, std::byte* output, const std::uint32_t shift) {
+  std::int32_t high = std::numeric_limits<std::int32_t>::min();
+  std::int32_t low  = std::numeric_limits<std::int32_t>::max();
+  for (const std::uint32_t texel: block) {
+    high = std::max(high, static_cast<std::int32_t>(texel >> shift & 0xFF));
+    low  = std::min(low, static_cast<std::int32_t>(texel >> shift & 0xFF));
+  }
+  // The first endpoint being the larger one selects the mode with six values between the endpoints.
+  std::uint64_t bits = static_cast<std::uint64_t>(high) | static_cast<std::uint64_t>(low) << 8;
+  if (high > low) {
+    std::array<std::int32_t, 8> palette{high, low};
+    for (std::int32_t entry{2}; entry < 8; ++entry) palette[entry] = ((8 - entry) * high + (entry - 1) * low + 3) / 7;
+    for (std::uint32_t i{}; i < block.size(); ++i) {
+      const std::int32_t value = static_cast<std::int32_t>(block[i] >> shift & 0xFF);
+      std::uint64_t best{};
+      for (std::uint64_t entry{1}; entry < palette.size(); ++entry)
+        if (std::abs(value - palette[entry]) < std::abs(value - palette[best])) best = entry;
+      bits |= best << (16 + i * 3);
+    }
+  }
+  for (std::uint32_t i{}; i < 8; ++i) output[i] = static_cast<std::byte>(bits >> i * 8);
+}
+
+void BlockCompression::encodeBC5(const Block& block, std::byte* output) {
+  encodeBC4(block, output, 0);
+  encodeBC4(block, output + 8, 8);
+}
+
+void BlockCompression::encodeBC7(const Block& block, std::byte* output) {
+  const auto [low, high] = extremes(block, principalAxis<4>(block));
+  // Each endpoint stores seven bits of every channel, and one p-bit that becomes the lowest bit of all four channels. The p-bit that
+  // brings the endpoint closest to the texel is kept.
+  const auto quantize = [](const std::uint32_t texel, std::array<std::uint32_t, 4>& endpoint) {
+    std::uint32_t bestPBit{};
+    std::int32_t bestError = std::numeric_limits<std::int32_t>::max();
+    for (std::uint32_t pBit{}; pBit < 2; ++pBit) {
+      std::int32_t error{};
+      for (std::size_t channel{}; channel < 4; ++channel) {
+        const std::uint32_t value      = texel >> channel * 8 & 0xFF;
+        const std::uint32_t quantized  = std::min((value - pBit + 1) >> 1, 127U);
+        const std::int32_t difference = static_cast<std::int32_t>(quantized << 1 | pBit) - static_cast<std::int32_t>(value);
+        error += difference * difference;
+      }
+      if (error < bestError) {
+        bestError = error;
+        bestPBit  = pBit;
+      }
+    }
+    for (std::size_t channel{}; channel < 4; ++channel) endpoint[channel] = std::min(((texel >> channel * 8 & 0xFF) - bestPBit + 1) >> 1, 127U);
+    return bestPBit;
+  };
+  std::array<std::array<std::uint32_t, 4>, 2> endpoints;
+  std::array<std::uint32_t, 2> pBits{quantize(block[low], endpoints[0]), quantize(block[high], endpoints[1])};
+
+  constexpr std::array<std::int32_t, 16> Weights{0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+  std::array<std::array<std::int32_t, 4>, 16> palette;
+  for (std::size_t entry{}; entry < palette.size(); ++entry)
+    for (std::size_t channel{}; channel < 4; ++channel) {
+      const std::int32_t endpoint0 = static_cast<std::int32_t>(endpoints[0][channel] << 1 | pBits[0]);
+      const std::int32_t endpoint1 = static_cast<std::int32_t>(endpoints[1][channel] << 1 | pBits[1]);
+      palette[entry][channel] = ((64 - Weights[entry]) * endpoint0 + Weights[entry] * endpoint1 + 32) >> 6;
+    }
+  std::array<std::uint32_t, 16> indices;
+  for (std::uint32_t i{}; i < block.size(); ++i) {
+    std::int32_t bestError = std::numeric_limits<std::int32_t>::max();
+    for (std::uint32_t entry{}; entry < palette.size(); ++entry) {
+      std::int32_t error{};
+      for (std::size_t channel{}; channel < 4; ++channel) {
+        const std::int32_t difference = static_cast<std::int32_t>(block[i] >> channel * 8 & 0xFF) - palette[entry][channel];
+        error += difference * difference;
+      }
+      if (error < bestError) {
+        bestError  = error;
+        indices[i] = entry;
+      }
+    }
+  }
+  // The first index is stored without its highest bit, so that bit must be zero. Swapping the endpoints flips every index.
+  if (indices[0] & 8) {
+    std::swap(endpoints[0], endpoints[1]);
+    std::swap(pBits[0], pBits[1]);
+    for (std::uint32_t& index: indices) index = 15 - index;
+  }
+
+  std::array<std::uint64_t, 2> bits{};
+  std::uint32_t position{};
+  const auto write = [&](const std::uint64_t value, const std::uint32_t count) {
+    bits[position / 64] |= value << position % 64;
+    if (position % 64 + count > 64) bits[position / 64 + 1] |= value >> (64 - position % 64);
+    position += count;
+  };
+  write(1 << 6, 7);  // Mode 6
+  for (std::size_t channel{}; channel < 4; ++channel) {
+    write(endpoints[0][channel], 7);
+    write(endpoints[1][channel], 7);
+  }
+  write(pBits[0], 1);
+  write(pBits[1], 1);
+  write(indices[0], 3);
+  for (std::uint32_t i{1}; i < indices.size(); ++i) write(indices[i], 4);
+  for (std::uint32_t i{}; i < 16; ++i) output[i] = static_cast<std::byte>(bits[i / 8] >> i % 8 * 8);
+}
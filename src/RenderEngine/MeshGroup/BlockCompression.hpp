@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/**
+ * CPU encoders for the BC formats. Each encoder takes one 4x4 block of RGBA8 texels, packed as <c>r | g << 8 | b << 16 | a << 24</c>
+ * in row order, and writes the encoded block. They are fast, single pass encoders that fit each block along its principal axis,
+ * rather than searching for the best encoding.
+ */
+class BlockCompression {
+public:
+  using Block = std::array<std::uint32_t, 16>;
+
+private:
+  /**
+   * @return The direction along which the first <c>Channels</c> channels of the texels in <c>block</c> vary the most
+   */
+  template<std::size_t Channels> static std::array<float, Channels> principalAxis(const Block& block);
+  /**
+   * @return The indices into <c>block</c> of the two texels that lie furthest apart along <c>axis</c>, lowest first
+   */
+  template<std::size_t Channels> static std::array<std::uint32_t, 2> extremes(const Block& block, const std::array<float, Channels>& axis);
+
+public:
+  BlockCompression() = delete;
+
+  /**
+   * @return <c>true</c> if <c>compress</c> can encode <c>format</c>
+   */
+  [[nodiscard]] static bool supports(VkFormat format);
+
+  /**
+   * Encodes a whole image on the JobSystem. Blocks that hang over the right or bottom edge repeat the texels along that edge.
+   * @param format A format that <c>supports</c> accepts
+   * @param pixels <c>width</c> times <c>height</c> texels in row order
+   * @return The encoded blocks in row order
+   */
+  [[nodiscard]] static std::vector<std::byte> compress(VkFormat format, std::span<const std::uint32_t> pixels, std::uint32_t width, std::uint32_t height);
+
+  // Encodes the RGB channels, always in the four colour mode, so alpha is one everywhere. 8 bytes.
+  static void encodeBC1(const Block& block, std::byte* output);
+  // Encodes the channel that starts at bit <c>shift</c> of each texel. 8 bytes.
+  static void encodeBC4(const Block& block, std::byte* output, std::uint32_t shift=0);
+  // Encodes the red and the green channels. 16 bytes.
+  static void encodeBC5(const Block& block, std::byte* output);
+  // Encodes all four channels with mode 6, which has a single subset with seven bit endpoints, a p-bit each and four bit indices. 16 bytes.
+  static void encodeBC7(const Block& block, std::byte* output);
+};
@@ -8,6 +8,7 @@
 #include "src/RenderEngine/MeshGroup/Vertex.hpp"
 #include "src/RenderEngine/Pipeline/Shader.hpp"
 
+#include <bit>
 #include <ranges>
 
 Material::Material(GraphicsDevice* device, yyjson_val* json) : device(device) {
@@ -17,11 +18,26 @@ Material::Material(GraphicsDevice* device, yyjson_val* json) : device(device) {
   val = yyjson_obj_get(json, "fragmentProcess");
   fragmentProcess = device->getJSONFragmentProcess(yyjson_get_uint(val));
   alphaMode = static_cast<fastgltf::AlphaMode>(yyjson_get_uint(yyjson_obj_get(json, "alphaMode")));
-  alphaCutoff = static_cast<float>(yyjson_get_real(yyjson_obj_get(json, "alphaCutoff")));
+  val = yyjson_obj_get(json, "alphaCutoff");
+  alphaCutoff = yyjson_is_num(val) ? static_cast<float>(yyjson_get_num(val)) : 0.5F;  // glTF's default
   val = yyjson_obj_get(json, "albedoTexture");
   albedoTexture = device->getJSONTexture(yyjson_get_uint(val));
   val = yyjson_obj_get(json, "normalTexture");
   normalTexture = device->getJSONTexture(yyjson_get_uint(val));
+
+  // Specialization constants. The alpha mode and cutoff are always available to shaders under these names.
+  specializationConstants[Tools::hash("alphaMode")]   = static_cast<std::uint32_t>(alphaMode);
+  specializationConstants[Tools::hash("alphaCutoff")] = std::bit_cast<std::uint32_t>(alphaCutoff);
+  std::size_t idx, max;
+  yyjson_val* key;
+  yyjson_obj_foreach(yyjson_obj_get(json, "specializationConstants"), idx, max, key, val) {
+    std::uint32_t value;
+    if (yyjson_is_bool(val)) value = yyjson_get_bool(val) ? VK_TRUE : VK_FALSE;
+    else if (yyjson_is_real(val)) value = std::bit_cast<std::uint32_t>(static_cast<float>(yyjson_get_real(val)));
+    else if (yyjson_is_sint(val)) value = static_cast<std::uint32_t>(static_cast<std::int32_t>(yyjson_get_sint(val)));
+    else value = static_cast<std::uint32_t>(yyjson_get_uint(val));
+    specializationConstants[Tools::hash(yyjson_get_str(key))] = value;
+  }
 }
 
 const std::unordered_map<uint32_t, Material::Binding>* Material::getBindings(const uint8_t set) const {
@@ -238,19 +254,29 @@ std::vector<VkVertexInputBindingDescription> Material::computeVertexBindingDescr
   reflectionData->EnumerateInputVariables(&count, nullptr);
   std::vector<SpvReflectInterfaceVariable*> interfaceVariables(count);
   reflectionData->EnumerateInputVariables(&count, interfaceVariables.data());
+  // The per vertex inputs of the Packed layout all share the first binding, so they do not get one each.
+  const bool packed = vertexProcess->vertexLayout == Vertex::Layout::Packed;
+  bool readsPackedVertex = false;
   std::map<uint32_t, VkVertexInputBindingDescription> bindingDescriptions;
   for (SpvReflectInterfaceVariable* const& interfaceVariable: interfaceVariables) {
     if (interfaceVariable->built_in > 0) continue;
+    if (packed && Vertex::inputRates.at(interfaceVariable->name) == VK_VERTEX_INPUT_RATE_VERTEX) {
+      readsPackedVertex = true;
+      continue;
+    }
     uint32_t arrayValues = 1;
     for (uint32_t i = interfaceVariable->array.dims_count; i > 0;) arrayValues *= interfaceVariable->array.dims[--i];
     arrayValues = std::max(1U, arrayValues);
     const uint32_t elementSize = interfaceVariable->numeric.scalar.width / 8 * std::max(1U, interfaceVariable->numeric.vector.component_count) * std::max(1U, interfaceVariable->numeric.matrix.column_count);
     bindingDescriptions.emplace(interfaceVariable->location, VkVertexInputBindingDescription{std::numeric_limits<uint32_t>::max(), elementSize * arrayValues, Vertex::inputRates.at(interfaceVariable->name)});
   }
-  count = 0;
+  count = readsPackedVertex ? 1 : 0;
   for (VkVertexInputBindingDescription& bindingDescription: bindingDescriptions | std::ranges::views::values)
     bindingDescription.binding = count++;
-  return std::ranges::to<std::vector>(bindingDescriptions | std::ranges::views::values);
+  std::vector<VkVertexInputBindingDescription> results;
+  if (readsPackedVertex) results.push_back({0, sizeof(Vertex::Packed), VK_VERTEX_INPUT_RATE_VERTEX});
+  results.append_range(bindingDescriptions | std::ranges::views::values);
+  return results;
 }
 
 std::vector<VkVertexInputAttributeDescription> Material::computeVertexAttributeDescriptions() const {
@@ -260,21 +286,30 @@ std::vector<VkVertexInputAttributeDescription> Material::computeVertexAttributeD
   reflectionData->EnumerateInputVariables(&count, nullptr);
   std::vector<SpvReflectInterfaceVariable*> interfaceVariables(count);
   reflectionData->EnumerateInputVariables(&count, interfaceVariables.data());
+  const bool packed = vertexProcess->vertexLayout == Vertex::Layout::Packed;
+  std::vector<VkVertexInputAttributeDescription> packedAttributeDescriptions;  // All in the first binding
   std::map<uint32_t, VkVertexInputAttributeDescription> attributeDescriptions;
   for (SpvReflectInterfaceVariable* const& interfaceVariable: interfaceVariables) {
     if (interfaceVariable->built_in > 0) continue;
+    if (packed && Vertex::inputRates.at(interfaceVariable->name) == VK_VERTEX_INPUT_RATE_VERTEX) {
+      // The shader's own type says nothing about how the attribute is stored, so the format comes from the layout instead.
+      const Vertex::PackedAttribute& packedAttribute = Vertex::packedAttributes.at(interfaceVariable->name);
+      packedAttributeDescriptions.push_back({interfaceVariable->location, 0, packedAttribute.format, packedAttribute.offset});
+      continue;
+    }
     count = 0;
     for (uint32_t i = 0; i < std::max(1U, interfaceVariable->numeric.matrix.column_count); ++i) {
       attributeDescriptions.emplace(interfaceVariable->location + i, VkVertexInputAttributeDescription{interfaceVariable->location + i, count, static_cast<VkFormat>(interfaceVariable->format), vkuFormatElementSize(static_cast<VkFormat>(interfaceVariable->format)) * i});
       count = std::numeric_limits<uint32_t>::max();
     }
   }
-  count = std::numeric_limits<uint32_t>::max();
+  count = packedAttributeDescriptions.empty() ? std::numeric_limits<uint32_t>::max() : 0;
   for (VkVertexInputAttributeDescription& attributeDescription: attributeDescriptions | std::ranges::views::values) {
     if (attributeDescription.binding == 0) attributeDescription.binding = ++count;
     else attributeDescription.binding = count;
   }
-  return std::ranges::to<std::vector>(attributeDescriptions | std::ranges::views::values);
+  packedAttributeDescriptions.append_range(attributeDescriptions | std::ranges::views::values);
+  return packedAttributeDescriptions;
 }
 
 std::vector<VkPushConstantRange> Material::computePushConstantRanges() const {
@@ -305,15 +340,41 @@ std::vector<VkPushConstantRange> Material::computePushConstantRanges() const {
   return pushConstantRanges;
 }
 
+void Material::computeSpecializationConstants(const Shader& shader, std::vector<VkSpecializationMapEntry>& entries, std::vector<std::uint32_t>& data) const {
+  const spv_reflect::ShaderModule* reflectedData = shader.getReflectedData();
+  uint32_t count;
+  reflectedData->EnumerateSpecializationConstants(&count, nullptr);
+  std::vector<SpvReflectSpecializationConstant*> constants(count);
+  reflectedData->EnumerateSpecializationConstants(&count, constants.data());
+  for (const SpvReflectSpecializationConstant* constant: constants) {
+    if (constant->name == nullptr) continue;
+    const auto it = specializationConstants.find(Tools::hash(constant->name));
+    if (it == specializationConstants.end()) continue;
+    entries.push_back({
+      .constantID = constant->constant_id,
+      .offset     = static_cast<uint32_t>(data.size() * sizeof(std::uint32_t)),
+      .size       = sizeof(std::uint32_t)
+    });
+    data.push_back(it->second);
+  }
+}
+
+std::uint64_t Material::hashSpecializationConstants() const {
+  // Summed so that the hash does not depend on the order of the map.
+  std::uint64_t hash = 0;
+  for (const auto& [name, value]: specializationConstants) hash += Tools::hash(name, value);
+  return hash;
+}
+
 Material* Material::getVertexVariation(VertexProcess* vertexProcess) const {
-  const std::uint64_t id = Tools::hash(vertexProcess, fragmentProcess, static_cast<std::uint64_t>(alphaMode), static_cast<std::uint64_t>(alphaCutoff), std::bit_cast<std::uint64_t>(albedoTexture.lock().get()), std::bit_cast<std::uint64_t>(normalTexture.lock().get()));
+  const std::uint64_t id = Tools::hash(vertexProcess, fragmentProcess, static_cast<std::uint64_t>(alphaMode), static_cast<std::uint64_t>(alphaCutoff), std::bit_cast<std::uint64_t>(albedoTexture.lock().get()), std::bit_cast<std::uint64_t>(normalTexture.lock().get()), hashSpecializationConstants());
   Material* material = device->getMaterial(id, this);
   material->vertexProcess = vertexProcess;
   return material;
 }
 
 Material* Material::getFragmentVariation(FragmentProcess* fragmentProcess) const {
-  const std::uint64_t id = Tools::hash(vertexProcess, fragmentProcess, static_cast<std::uint64_t>(alphaMode), static_cast<std::uint64_t>(alphaCutoff), std::bit_cast<std::uint64_t>(albedoTexture.lock().get()), std::bit_cast<std::uint64_t>(normalTexture.lock().get()));
+  const std::uint64_t id = Tools::hash(vertexProcess, fragmentProcess, static_cast<std::uint64_t>(alphaMode), static_cast<std::uint64_t>(alphaCutoff), std::bit_cast<std::uint64_t>(albedoTexture.lock().get()), std::bit_cast<std::uint64_t>(normalTexture.lock().get()), hashSpecializationConstants());
   Material* material = device->getMaterial(id, this);
   material->fragmentProcess = fragmentProcess;
   return material;
@@ -21,6 +21,8 @@ class GraphicsDevice;
 class CommandBuffer;
 
 class Material {
+  [[nodiscard]] std::uint64_t hashSpecializationConstants() const;
+
 public:
   struct Binding {
     uint64_t nameHash;
@@ -42,6 +44,8 @@ public:
 
   fastgltf::AlphaMode alphaMode = fastgltf::AlphaMode::Opaque;
   float alphaCutoff = 0;
+  // Values of specialization constants by the hash of their names. Each value holds the 32 bits that the shader reads, whatever their type.
+  std::unordered_map<std::uint64_t, std::uint32_t> specializationConstants;
 
   std::weak_ptr<Texture> albedoTexture;
   std::weak_ptr<Texture> normalTexture;
@@ -60,6 +64,14 @@ public:
   [[nodiscard]] std::vector<VkVertexInputBindingDescription> computeVertexBindingDescriptions() const;
   [[nodiscard]] std::vector<VkVertexInputAttributeDescription> computeVertexAttributeDescriptions() const;
   [[nodiscard]] std::vector<VkPushConstantRange> computePushConstantRanges() const;
+  /**
+   * Specialization constants are matched to this Material's values by name. Those that this Material does not set keep the default
+   * values given in the shader.
+   * @param shader The shader to specialize
+   * @param entries Receives one entry for each specialization constant of <c>shader</c> that this Material sets
+   * @param data Receives the values that <c>entries</c> point into
+   */
+  void computeSpecializationConstants(const Shader& shader, std::vector<VkSpecializationMapEntry>& entries, std::vector<std::uint32_t>& data) const;
 
   Material* getVertexVariation(VertexProcess* vertexProcess) const;
   Material* getFragmentVariation(FragmentProcess* fragmentProcess) const;
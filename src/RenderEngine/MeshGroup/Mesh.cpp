@@ -3,17 +3,25 @@
 #include "draco/compression/decode.h"
 #include "draco/mesh/mesh.h"
 #include "src/RenderEngine/Resources/Buffer.hpp"
-#include "src/RenderEngine/Resources/StagingBuffer.hpp"
+#include "src/RenderEngine/Resources/StagingRing.hpp"
 #include "src/RenderEngine/CommandBuffer.hpp"
 #include "src/RenderEngine/GraphicsDevice.hpp"
 #include "src/RenderEngine/GraphicsInstance.hpp"
 #include "src/RenderEngine/MeshGroup/Vertex.hpp"
+#include "src/JobSystem.hpp"
 #include "src/Tools/Hashing.hpp"
 
 #include <fastgltf/glm_element_traits.hpp>
 #include <fastgltf/core.hpp>
+#include <fastgltf/tools.hpp>
 
 #include <draco/core/decoder_buffer.h>
+#include <meshoptimizer.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <numeric>
 
 Mesh::Mesh(GraphicsDevice* device, yyjson_val* json) : device(device) {
   std::filesystem::path path = device->resourcesDirectory / "meshes" / yyjson_get_str(yyjson_obj_get(json, "path"));
@@ -25,34 +33,106 @@ Mesh::Mesh(GraphicsDevice* device, yyjson_val* json) : device(device) {
     if (gltfAsset.error() != fastgltf::Error::None) GraphicsInstance::showError(std::string("failed to parse GLTF file '") + path.string() + "': " + std::string(magic_enum::enum_name(gltfAsset.error())));
     asset = std::move(gltfAsset.get());
   }
-  CommandBuffer commandBuffer;
-  if (asset.meshes.size() != 1) GraphicsInstance::showError("This error should really be a warning. Only the first mesh in the asset '" + path.string() + "' will be imported. All others will be ignored.");
-  if (asset.meshes[0].primitives.size() != 1) GraphicsInstance::showError("This error should really be a warning. Only the first primitive in the first mesh in the asset '" + path.string() + "' will be imported. All others will be ignored.");
-  fastgltf::Primitive& primitive = asset.meshes[0].primitives[0];
-
-  // Determine this mesh's topology
-  switch (primitive.type) {
-    case fastgltf::PrimitiveType::Points: topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST; break;
-    case fastgltf::PrimitiveType::Lines: topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST; break;
-    case fastgltf::PrimitiveType::LineLoop:
-    case fastgltf::PrimitiveType::LineStrip: topology = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP; break;
-    case fastgltf::PrimitiveType::Triangles: topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST; break;
-    case fastgltf::PrimitiveType::TriangleStrip: topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP; break;
-    case fastgltf::PrimitiveType::TriangleFan: topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN; break;
+  auto commandBuffer = std::make_unique<CommandBuffer>();
+  const char* layout = yyjson_get_str(yyjson_obj_get(json, "vertexLayout"));
+  vertexLayout = layout == nullptr ? Vertex::Layout::Separate : magic_enum::enum_cast<Vertex::Layout>(layout).value_or(Vertex::Layout::Separate);
+
+  // Find every primitive in the scene along with the matrix of its node. The meshes of assets without scenes are taken as they are.
+  struct Source {
+    const fastgltf::Primitive* primitive;
+    glm::mat4 matrix;
+  };
+  std::vector<Source> sources;
+  if (asset.scenes.empty()) {
+    for (const fastgltf::Mesh& mesh: asset.meshes)
+      for (const fastgltf::Primitive& primitive: mesh.primitives) sources.push_back({&primitive, glm::mat4(1)});
+  } else {
+    fastgltf::iterateSceneNodes(asset, asset.defaultScene.value_or(0), fastgltf::math::fmat4x4(), [&asset, &sources](fastgltf::Node& node, fastgltf::math::fmat4x4 matrix) {
+      if (!node.meshIndex.has_value()) return;
+      for (const fastgltf::Primitive& primitive: asset.meshes[*node.meshIndex].primitives) sources.push_back({&primitive, std::bit_cast<glm::mat4>(matrix)});
+    });
+  }
+  if (sources.empty()) GraphicsInstance::showError("The asset '" + path.string() + "' has no primitives to import.");
+
+  // Each primitive is decoded, moved and optimized independently of the others.
+  std::vector<Geometry> geometries(sources.size());
+  JobSystem::parallelFor(sources.size(), 1, [&asset, &sources, &geometries](const std::size_t begin, const std::size_t end) {
+    for (std::size_t i{begin}; i < end; ++i) {
+      // meshoptimizer's passes, and the winding fix for mirrored nodes, all assume lists of triangles.
+      const bool triangleList = sources[i].primitive->type == fastgltf::PrimitiveType::Triangles;
+      geometries[i] = decode(asset, *sources[i].primitive);
+      transform(geometries[i], sources[i].matrix, triangleList);
+      if (triangleList) optimize(geometries[i]);
+    }
+  });
+
+  // Pack the primitives one after the other. Indices stay relative to their own primitive's vertices, and are offset by the draws.
+  const auto getTopology = [](const fastgltf::PrimitiveType type) {
+    switch (type) {
+      case fastgltf::PrimitiveType::Points: return VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+      case fastgltf::PrimitiveType::Lines: return VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+      case fastgltf::PrimitiveType::LineLoop:  // Closed when packed
+      case fastgltf::PrimitiveType::LineStrip: return VK_PRIMITIVE_TOPOLOGY_LINE_STRIP;
+      case fastgltf::PrimitiveType::Triangles: return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+      case fastgltf::PrimitiveType::TriangleStrip: return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+      case fastgltf::PrimitiveType::TriangleFan: return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN;
+    }
+    return VK_PRIMITIVE_TOPOLOGY_MAX_ENUM;
+  };
+  materialSlots.resize(std::max<std::size_t>(asset.materials.size(), 1));
+  Geometry packed;
+  for (std::size_t i{}; i < sources.size(); ++i) {
+    Geometry& geometry = geometries[i];
+    if (geometry.indices.empty()) continue;  // Failed to decode
+    // Line loops are drawn as line strips that return to their first vertex.
+    if (sources[i].primitive->type == fastgltf::PrimitiveType::LineLoop) geometry.indices.push_back(geometry.indices.front());
+    materialSlots[sources[i].primitive->materialIndex.value_or(0)].primitives.push_back({
+      .topology     = getTopology(sources[i].primitive->type),
+      .firstIndex   = static_cast<uint32_t>(packed.indices.size()),
+      .indexCount   = static_cast<uint32_t>(geometry.indices.size()),
+      .vertexOffset = static_cast<int32_t>(packed.positions.size())
+    });
+    packed.positions.append_range(geometry.positions);
+    packed.textureCoordinates.append_range(geometry.textureCoordinates);
+    packed.normals.append_range(geometry.normals);
+    packed.tangents.append_range(geometry.tangents);
+    packed.indices.append_range(geometry.indices);
+    geometry = {};
   }
 
+  StagingRing& stagingRing = *device->stagingRing;
+  const auto createBuffer = [&](const std::string& name, const void* data, const VkDeviceSize size, const VkBufferUsageFlags usage) {
+    const StagingRing::Allocation staging = stagingRing.allocate(*commandBuffer, size);
+    std::memcpy(staging.data, data, size);
+    auto buffer = std::make_unique<Buffer>(device, name, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VMA_ALLOCATION_CREATE_STRATEGY_MIN_MEMORY_BIT);
+    commandBuffer->record<CommandBuffer::CopyBufferToBuffer>(staging.buffer, buffer.get(), std::array{VkBufferCopy{staging.offset, 0, size}});
+    return buffer;
+  };
+  if (vertexLayout == Vertex::Layout::Packed) {
+    std::vector<Vertex::Packed> vertices(packed.positions.size());
+    for (std::size_t i{}; i < vertices.size(); ++i) vertices[i] = Vertex::pack(packed.positions[i], packed.textureCoordinates[i], packed.normals[i], packed.tangents[i]);
+    vertexBuffers.push_back(createBuffer("Vertex Buffer | Packed", vertices.data(), vertices.size() * sizeof(Vertex::Packed), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT));
+  } else {
+    vertexBuffers.push_back(createBuffer("Vertex Buffer | Positions", packed.positions.data(), packed.positions.size() * sizeof(glm::vec3), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT));
+    vertexBuffers.push_back(createBuffer("Vertex Buffer | Texture Coordinates", packed.textureCoordinates.data(), packed.textureCoordinates.size() * sizeof(glm::vec2), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT));
+    vertexBuffers.push_back(createBuffer("Vertex Buffer | Normals", packed.normals.data(), packed.normals.size() * sizeof(glm::vec3), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT));
+    vertexBuffers.push_back(createBuffer("Vertex Buffer | Tangents", packed.tangents.data(), packed.tangents.size() * sizeof(glm::vec3), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT));
+  }
+  indexBuffer = createBuffer("Index Buffer", packed.indices.data(), packed.indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+  device->upload(std::move(commandBuffer));
+}
+
+Mesh::Geometry Mesh::decode(const fastgltf::Asset& asset, const fastgltf::Primitive& primitive) {
   // Determine vertex count (GLTF spec states that "All attribute accessors for a given primitive <b>MUST</b> have the same <c>count</c>." Therefore, the count of the first accessor for this primitive is used to decide the vertex count)
-  std::size_t vertexCount = asset.accessors[primitive.attributes[0].accessorIndex].count;
-  StagingBuffer positionsVertexBufferTemp(device, "Vertex Upload Buffer | Positions", vertexCount * sizeof(glm::vec3));
-  StagingBuffer textureCoordinatesVertexBufferTemp(device, "Vertex Upload Buffer | Texture Coordinates", vertexCount * sizeof(glm::vec2));
-  StagingBuffer normalsVertexBufferTemp(device, "Vertex Upload Buffer | Normals", vertexCount * sizeof(glm::vec3));
-  StagingBuffer tangentsVertexBufferTemp(device, "Vertex Upload Buffer | Tangents", vertexCount * sizeof(glm::vec3));
-  StagingBuffer indexBufferTemp(device, "Index Upload Buffer", asset.accessors[primitive.indicesAccessor.value()].count * sizeof(uint32_t));
-  std::shared_ptr<Buffer::BufferMapping> positionsVertexBufferTempMap = positionsVertexBufferTemp.map();
-  std::shared_ptr<Buffer::BufferMapping> textureCoordinatesVertexBufferTempMap = textureCoordinatesVertexBufferTemp.map();
-  std::shared_ptr<Buffer::BufferMapping> normalsVertexBufferTempMap = normalsVertexBufferTemp.map();
-  std::shared_ptr<Buffer::BufferMapping> tangentsVertexBufferTempMap = tangentsVertexBufferTemp.map();
-  std::shared_ptr<Buffer::BufferMapping> indexBufferTempMap = indexBufferTemp.map();
+  const std::size_t vertexCount = asset.accessors[primitive.attributes[0].accessorIndex].count;
+  Geometry geometry{
+    .positions          = std::vector<glm::vec3>(vertexCount),
+    .textureCoordinates = std::vector<glm::vec2>(vertexCount),
+    .normals            = std::vector<glm::vec3>(vertexCount),
+    .tangents           = std::vector<glm::vec3>(vertexCount),
+    .indices            = std::vector<uint32_t>(asset.accessors[primitive.indicesAccessor.value()].count)
+  };
   if (primitive.dracoCompression) {
     std::size_t size;
     const char* byteBuf = std::visit(fastgltf::visitor {
@@ -68,115 +148,208 @@ Mesh::Mesh(GraphicsDevice* device, yyjson_val* json) : device(device) {
         return reinterpret_cast<const char*>(vector.bytes.data());
       }
     }, asset.buffers[asset.bufferViews[primitive.dracoCompression->bufferView].bufferIndex].data);
+    // The compressed mesh is only the part of its buffer that its buffer view covers.
+    const fastgltf::BufferView& bufferView = asset.bufferViews[primitive.dracoCompression->bufferView];
+    if (bufferView.byteOffset + bufferView.byteLength > size) {
+      GraphicsInstance::showError("This error should really be a warning. A Draco compressed primitive's buffer view runs past the end of its buffer, so the primitive was skipped.");
+      return {};
+    }
     draco::DecoderBuffer buffer;
-    buffer.Init(byteBuf, size);
+    buffer.Init(byteBuf + bufferView.byteOffset, bufferView.byteLength);
     draco::Decoder decoder;
     draco::StatusOr<std::unique_ptr<draco::Mesh>> statusOrMesh = decoder.DecodeMeshFromBuffer(&buffer);
-    if (!statusOrMesh.ok()) GraphicsInstance::showError("failed to decode Draco compressed mesh: '" + statusOrMesh.status().error_msg_string() + "', Status: '" + std::string(magic_enum::enum_name<draco::Status::Code>(statusOrMesh.status().code())) + "'");
-    for (auto i = draco::FaceIndex(0); i < statusOrMesh.value()->num_faces(); ++i)
-      std::memcpy(static_cast<uint32_t*>(indexBufferTempMap->data) + i.value() * 3, reinterpret_cast<const uint32_t*>(statusOrMesh.value()->face(i).data()), sizeof(uint32_t) * 3);
-    const draco::PointAttribute* position = statusOrMesh.value()->GetNamedAttribute(draco::GeometryAttribute::POSITION);
-    const draco::PointAttribute* texCoords = statusOrMesh.value()->GetNamedAttribute(draco::GeometryAttribute::TEX_COORD);
-    const draco::PointAttribute* normals = statusOrMesh.value()->GetNamedAttribute(draco::GeometryAttribute::NORMAL);
-    const draco::PointAttribute* tangents = statusOrMesh.value()->GetNamedAttribute(draco::GeometryAttribute::GENERIC);  /**@todo: Find out how to get the tangents out of the draco mesh.*/
+    if (!statusOrMesh.ok()) {
+      GraphicsInstance::showError("failed to decode Draco compressed mesh: '" + statusOrMesh.status().error_msg_string() + "', Status: '" + std::string(magic_enum::enum_name<draco::Status::Code>(statusOrMesh.status().code())) + "'");
+      return {};
+    }
+    const draco::Mesh& mesh = *statusOrMesh.value();
+    // The decoded mesh is written into arrays sized by the accessors, so it must match them exactly.
+    if (mesh.num_points() != vertexCount || static_cast<std::size_t>(mesh.num_faces()) * 3 != geometry.indices.size()) {
+      GraphicsInstance::showError("This error should really be a warning. A Draco compressed primitive decoded to " + std::to_string(mesh.num_points()) + " vertices and " + std::to_string(mesh.num_faces()) + " triangles, which does not match its accessors, so the primitive was skipped.");
+      return {};
+    }
+    for (auto i = draco::FaceIndex(0); i < mesh.num_faces(); ++i)
+      std::memcpy(geometry.indices.data() + i.value() * 3, reinterpret_cast<const uint32_t*>(mesh.face(i).data()), sizeof(uint32_t) * 3);
+    const draco::PointAttribute* position = mesh.GetNamedAttribute(draco::GeometryAttribute::POSITION);
+    const draco::PointAttribute* texCoords = mesh.GetNamedAttribute(draco::GeometryAttribute::TEX_COORD);
+    const draco::PointAttribute* normal = mesh.GetNamedAttribute(draco::GeometryAttribute::NORMAL);
+    const draco::PointAttribute* tangent = mesh.GetNamedAttribute(draco::GeometryAttribute::GENERIC);  /**@todo: Find out how to get the tangents out of the draco mesh.*/
     /**@todo: Ensure that the format of the draco data matches that of the Vertex. attribute->data_type && attribute->num_components*/
-    // std::memcpy(positionsVertexBufferTempMap->data, position->buffer()->data(), positionsVertexBufferTempMap->buffer->getSize());
-    if (statusOrMesh.value()->num_points() != vertexCount) GraphicsInstance::showError("Could not decode the expected number of vertices!");
-    for (auto i = draco::PointIndex(0); i < statusOrMesh.value()->num_points(); ++i) {
-      position->ConvertValue<float, 3>(position->mapped_index(i), reinterpret_cast<float*>(static_cast<glm::vec3*>(positionsVertexBufferTempMap->data) + i.value()));
-      texCoords->ConvertValue<float, 2>(texCoords->mapped_index(i), reinterpret_cast<float*>(static_cast<glm::vec2*>(textureCoordinatesVertexBufferTempMap->data) + i.value()));
-      normals->ConvertValue<float, 3>(normals->mapped_index(i), reinterpret_cast<float*>(static_cast<glm::vec3*>(normalsVertexBufferTempMap->data) + i.value()));
-      tangents->ConvertValue<float, 3>(tangents->mapped_index(i), reinterpret_cast<float*>(static_cast<glm::vec3*>(tangentsVertexBufferTempMap->data) + i.value()));
+    for (auto i = draco::PointIndex(0); i < mesh.num_points(); ++i) {
+      if (position != nullptr) position->ConvertValue<float, 3>(position->mapped_index(i), &geometry.positions[i.value()].x);
+      if (texCoords != nullptr) texCoords->ConvertValue<float, 2>(texCoords->mapped_index(i), &geometry.textureCoordinates[i.value()].x);
+      if (normal != nullptr) normal->ConvertValue<float, 3>(normal->mapped_index(i), &geometry.normals[i.value()].x);
+      if (tangent != nullptr) tangent->ConvertValue<float, 3>(tangent->mapped_index(i), &geometry.tangents[i.value()].x);
     }
   } else {
-    fastgltf::copyFromAccessor<uint32_t>(asset, asset.accessors[primitive.indicesAccessor.value()], indexBufferTempMap->data);
-    if (auto* attribute = primitive.findAttribute("POSITION")) fastgltf::copyFromAccessor<glm::vec3, sizeof(glm::vec3)>(asset, asset.accessors[attribute->accessorIndex], positionsVertexBufferTempMap->data);
-    else std::memset(positionsVertexBufferTempMap->data, 0, positionsVertexBufferTempMap->buffer->getSize());
-    if (auto* attribute = primitive.findAttribute("TEXCOORD_0")) fastgltf::copyFromAccessor<glm::vec2, sizeof(glm::vec2)>(asset, asset.accessors[attribute->accessorIndex], textureCoordinatesVertexBufferTempMap->data);
-    else std::memset(textureCoordinatesVertexBufferTempMap->data, 0, textureCoordinatesVertexBufferTempMap->buffer->getSize());
-    if (auto* attribute = primitive.findAttribute("NORMAL")) fastgltf::copyFromAccessor<glm::vec3, sizeof(glm::vec3)>(asset, asset.accessors[attribute->accessorIndex], normalsVertexBufferTempMap->data);
-    else std::memset(normalsVertexBufferTempMap->data, 0, normalsVertexBufferTempMap->buffer->getSize());
-    if (auto* attribute = primitive.findAttribute("TANGENT")) fastgltf::copyFromAccessor<glm::vec3, sizeof(glm::vec3)>(asset, asset.accessors[attribute->accessorIndex], tangentsVertexBufferTempMap->data);
-    else std::memset(tangentsVertexBufferTempMap->data, 0, tangentsVertexBufferTempMap->buffer->getSize());
+    fastgltf::copyFromAccessor<uint32_t>(asset, asset.accessors[primitive.indicesAccessor.value()], geometry.indices.data());
+    if (auto* attribute = primitive.findAttribute("POSITION")) fastgltf::copyFromAccessor<glm::vec3, sizeof(glm::vec3)>(asset, asset.accessors[attribute->accessorIndex], geometry.positions.data());
+    if (auto* attribute = primitive.findAttribute("TEXCOORD_0")) fastgltf::copyFromAccessor<glm::vec2, sizeof(glm::vec2)>(asset, asset.accessors[attribute->accessorIndex], geometry.textureCoordinates.data());
+    if (auto* attribute = primitive.findAttribute("NORMAL")) fastgltf::copyFromAccessor<glm::vec3, sizeof(glm::vec3)>(asset, asset.accessors[attribute->accessorIndex], geometry.normals.data());
+    if (auto* attribute = primitive.findAttribute("TANGENT")) fastgltf::copyFromAccessor<glm::vec3, sizeof(glm::vec3)>(asset, asset.accessors[attribute->accessorIndex], geometry.tangents.data());
   }
 
-  positionsVertexBuffer = std::make_unique<Buffer>(device, "Vertex Buffer | Positions", positionsVertexBufferTemp.getSize(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VMA_ALLOCATION_CREATE_STRATEGY_MIN_MEMORY_BIT);
-  commandBuffer.record<CommandBuffer::CopyBufferToBuffer>(&positionsVertexBufferTemp, positionsVertexBuffer.get());
-
-  textureCoordinatesVertexBuffer = std::make_unique<Buffer>(device, "Vertex Buffer | Texture Coordinates", textureCoordinatesVertexBufferTemp.getSize(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VMA_ALLOCATION_CREATE_STRATEGY_MIN_MEMORY_BIT);
-  commandBuffer.record<CommandBuffer::CopyBufferToBuffer>(&textureCoordinatesVertexBufferTemp, textureCoordinatesVertexBuffer.get());
-
-  normalsVertexBuffer = std::make_unique<Buffer>(device, "Vertex Buffer | Normals", normalsVertexBufferTemp.getSize(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VMA_ALLOCATION_CREATE_STRATEGY_MIN_MEMORY_BIT);
-  commandBuffer.record<CommandBuffer::CopyBufferToBuffer>(&normalsVertexBufferTemp, normalsVertexBuffer.get());
+  return geometry;
+}
 
-  tangentsVertexBuffer = std::make_unique<Buffer>(device, "Vertex Buffer | Tangents", tangentsVertexBufferTemp.getSize(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VMA_ALLOCATION_CREATE_STRATEGY_MIN_MEMORY_BIT);
-  commandBuffer.record<CommandBuffer::CopyBufferToBuffer>(&tangentsVertexBufferTemp, tangentsVertexBuffer.get());
+void Mesh::transform(Geometry& geometry, const glm::mat4& matrix, const bool triangleList) {
+  if (matrix == glm::mat4(1)) return;
+  const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(matrix)));
+  // Missing normals and tangents are left zeroed rather than normalized into NaNs.
+  const auto direction = [](const glm::vec3 vector) { return vector == glm::vec3(0) ? vector : glm::normalize(vector); };
+  for (glm::vec3& position: geometry.positions) position = glm::vec3(matrix * glm::vec4(position, 1));
+  for (glm::vec3& normal: geometry.normals) normal = direction(normalMatrix * normal);
+  for (glm::vec3& tangent: geometry.tangents) tangent = direction(glm::mat3(matrix) * tangent);
+  if (triangleList && glm::determinant(glm::mat3(matrix)) < 0)
+    for (std::size_t i{}; i + 2 < geometry.indices.size(); i += 3) std::swap(geometry.indices[i + 1], geometry.indices[i + 2]);
+}
 
-  indexBuffer = std::make_unique<Buffer>(device, "Index Buffer", indexBufferTemp.getSize(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VMA_ALLOCATION_CREATE_STRATEGY_MIN_MEMORY_BIT);
-  commandBuffer.record<CommandBuffer::CopyBufferToBuffer>(&indexBufferTemp, indexBuffer.get());
+void Mesh::optimize(Geometry& geometry) {
+  std::vector<uint32_t>& indices = geometry.indices;
+  if (indices.empty()) return;
+  const std::size_t vertexCount = geometry.positions.size();
+  meshopt_optimizeVertexCache(indices.data(), indices.data(), indices.size(), vertexCount);
+  meshopt_optimizeOverdraw(indices.data(), indices.data(), indices.size(), &geometry.positions[0].x, vertexCount, sizeof(glm::vec3), 1.05F);
+  // Reorders the vertices into the order that the indices first use them in, which also drops those that no index uses.
+  std::vector<uint32_t> remap(vertexCount);
+  const std::size_t usedVertexCount = meshopt_optimizeVertexFetchRemap(remap.data(), indices.data(), indices.size(), vertexCount);
+  meshopt_remapIndexBuffer(indices.data(), indices.data(), indices.size(), remap.data());
+  const auto remapVertices = [&]<typename T>(std::vector<T>& vertices) {
+    meshopt_remapVertexBuffer(vertices.data(), vertices.data(), vertexCount, sizeof(T), remap.data());
+    vertices.resize(usedVertexCount);
+  };
+  remapVertices(geometry.positions);
+  remapVertices(geometry.textureCoordinates);
+  remapVertices(geometry.normals);
+  remapVertices(geometry.tangents);
+}
 
-  commandBuffer.preprocess();
-  device->executeCommandBufferImmediate(commandBuffer);
+void Mesh::InstanceCollection::markDirty(const uint32_t slot) {
+  for (FrameBuffers& frame: frames) {
+    if (frame.dirty.size() <= slot) frame.dirty.resize(slot + 1);
+    if (frame.dirty[slot]) continue;
+    frame.dirty[slot] = true;
+    frame.dirtySlots.push_back(slot);
+  }
 }
 
-Mesh::InstanceReference Mesh::addInstance(const uint64_t materialID, glm::mat4 mat) {
+Mesh::InstanceReference Mesh::addInstance(const uint64_t materialID, glm::mat4 mat, const uint32_t materialSlot) {
   Material* material = indexBuffer->device->getMaterial(materialID);
-  InstanceCollection& instanceCollection = instances[material];
-  InstanceReference instanceReference;
-  instanceReference.material = material;
-  instanceReference.modelInstanceID = instanceCollection.modelInstances.emplace(mat);
-  instanceReference.materialInstanceID = instanceCollection.materialInstances.emplace(material->fragmentProcess->id);
-  instanceReference.perInstanceDataID = instanceCollection.perInstanceData.emplace(mat);
-  instanceCollection.stale = true;
+  if (material->vertexProcess->vertexLayout != vertexLayout) GraphicsInstance::showError("This error should really be a warning. The material '" + material->name + "' reads the " + std::string(magic_enum::enum_name(material->vertexProcess->vertexLayout)) + " vertex layout, but its mesh is stored in the " + std::string(magic_enum::enum_name(vertexLayout)) + " vertex layout.");
+  if (std::ranges::any_of(materialSlots.at(materialSlot).primitives, [material](const Primitive& primitive) { return primitive.topology != material->vertexProcess->topology; })) GraphicsInstance::showError("This error should really be a warning. The material '" + material->name + "' draws " + std::string(magic_enum::enum_name(material->vertexProcess->topology)) + ", but some primitives of its mesh are stored in another topology. Those primitives will not be drawn with it.");
+  InstanceCollection& instanceCollection = materialSlots.at(materialSlot).instances[material];
+  uint32_t slot;
+  if (instanceCollection.freeSlots.empty()) {
+    slot = static_cast<uint32_t>(instanceCollection.modelInstances.size());
+    instanceCollection.modelInstances.push_back(mat);
+    instanceCollection.materialInstances.push_back(material->fragmentProcess->id);
+    instanceCollection.perInstanceData.push_back({mat});
+  } else {
+    slot = instanceCollection.freeSlots.back();
+    instanceCollection.freeSlots.pop_back();
+    instanceCollection.modelInstances[slot] = mat;
+    instanceCollection.materialInstances[slot] = material->fragmentProcess->id;
+    instanceCollection.perInstanceData[slot] = {mat};
+  }
+  instanceCollection.markDirty(slot);
   stale = true;
-  return instanceReference;
+  return {material, materialSlot, slot};
 }
 
 void Mesh::removeInstance(InstanceReference&& instanceReference) {
+  std::unordered_map<Material*, InstanceCollection>& instances = materialSlots[instanceReference.materialSlot].instances;
   const auto it = instances.find(instanceReference.material);
   if (it == instances.end()) return;
   InstanceCollection& instanceCollection = it->second;
-  instanceCollection.modelInstances.erase(instanceReference.modelInstanceID);
-  instanceCollection.materialInstances.erase(instanceReference.materialInstanceID);
-  instanceCollection.perInstanceData.erase(instanceReference.perInstanceDataID);
-  instanceCollection.stale = true;
+  // The slot keeps being drawn until it is reused, so its model matrix collapses it to a single point.
+  instanceCollection.modelInstances[instanceReference.slot] = glm::mat4(0);
+  instanceCollection.freeSlots.push_back(instanceReference.slot);
+  instanceCollection.markDirty(instanceReference.slot);
   stale = true;
 }
 
-void Mesh::update(CommandBuffer& commandBuffer) {
+void Mesh::updateInstance(const InstanceReference& instanceReference, const glm::mat4& modelMatrix) {
+  InstanceCollection& instanceCollection = materialSlots[instanceReference.materialSlot].instances.at(instanceReference.material);
+  if (instanceCollection.modelInstances[instanceReference.slot] == modelMatrix) return;
+  instanceCollection.modelInstances[instanceReference.slot] = modelMatrix;
+  instanceCollection.markDirty(instanceReference.slot);
+  stale = true;
+}
+
+const Mesh::InstanceCollection::PerInstanceData& Mesh::getPerInstanceData(const InstanceReference& instanceReference) const {
+  return materialSlots[instanceReference.materialSlot].instances.at(instanceReference.material).perInstanceData[instanceReference.slot];
+}
+
+void Mesh::update(CommandBuffer& commandBuffer, const uint32_t frameIndex, const uint32_t framesInFlight) {
   if (!stale) return;
-  for (InstanceCollection& instanceCollection: instances | std::ranges::views::values) {
-    if (!instanceCollection.stale) continue;
-    if (instanceCollection.perInstanceData.empty()) {
-      instanceCollection.materialInstanceBuffer = nullptr;
-      instanceCollection.modelInstanceBuffer = nullptr;
-    } else {
-      if (const std::size_t materialSize = instanceCollection.materialInstances.size() * sizeof(decltype(InstanceCollection::materialInstances)::value_type); instanceCollection.materialInstanceBuffer == nullptr || instanceCollection.materialInstanceBuffer->getSize() != materialSize) {
-        // Re-build the buffers
-        const std::size_t modelSize = instanceCollection.modelInstances.size() * sizeof(decltype(InstanceCollection::modelInstances)::value_type);
-        instanceCollection.materialInstanceBuffer = nullptr;  // Make sure that the old buffer has been deleted before building the new one.
-        instanceCollection.modelInstanceBuffer = nullptr;
-        instanceCollection.materialInstanceBuffer = std::make_unique<Buffer>(device, "Mesh-Material Instance Buffer", materialSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VMA_ALLOCATION_CREATE_STRATEGY_MIN_MEMORY_BIT);
-        instanceCollection.modelInstanceBuffer = std::make_unique<Buffer>(device, "Mesh-Transform Instance Buffer", modelSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VMA_ALLOCATION_CREATE_STRATEGY_MIN_MEMORY_BIT);
-      } {  // Update the material buffer
-        auto* stagingBuffer = new StagingBuffer(device, "Mesh-Material Instance Staging Buffer", instanceCollection.materialInstanceBuffer->getSize());
-        const std::shared_ptr<Buffer::BufferMapping> map = stagingBuffer->map();
-        std::size_t i = std::numeric_limits<std::size_t>::max();
-        for (const float materialInstance: instanceCollection.materialInstances)
-          static_cast<float*>(map->data)[++i] = materialInstance;
-        commandBuffer.record<CommandBuffer::CopyBufferToBuffer>(stagingBuffer, instanceCollection.materialInstanceBuffer.get());
-        commandBuffer.addCleanupResource(stagingBuffer);
-      } {  // Update the model buffer
-        auto* stagingBuffer = new StagingBuffer(device, "Mesh-Model Instance Staging Buffer", instanceCollection.modelInstanceBuffer->getSize());
-        const std::shared_ptr<Buffer::BufferMapping> map = stagingBuffer->map();
-        std::size_t i = std::numeric_limits<std::size_t>::max();
-        for (const glm::mat4& modelInstance: instanceCollection.modelInstances)
-          static_cast<glm::mat4*>(map->data)[++i] = modelInstance;
-        commandBuffer.record<CommandBuffer::CopyBufferToBuffer>(stagingBuffer, instanceCollection.modelInstanceBuffer.get());
-        commandBuffer.addCleanupResource(stagingBuffer);
+  stale = false;
+  for (InstanceCollection& instanceCollection: materialSlots | std::views::transform(&MaterialSlot::instances) | std::views::join | std::ranges::views::values) {
+    if (instanceCollection.frames.size() != framesInFlight) instanceCollection.frames.resize(framesInFlight);
+    if (instanceCollection.freeSlots.size() == instanceCollection.perInstanceData.size()) {
+      // Nothing is drawn any more. The buffers are kept, as other frames may still be drawing from them.
+      instanceCollection.modelInstances.clear();
+      instanceCollection.materialInstances.clear();
+      instanceCollection.perInstanceData.clear();
+      instanceCollection.freeSlots.clear();
+      for (InstanceCollection::FrameBuffers& frame: instanceCollection.frames) {
+        frame.dirty.clear();
+        frame.dirtySlots.clear();
       }
+      continue;
+    }
+    InstanceCollection::FrameBuffers& frame = instanceCollection.frames[frameIndex];
+    const auto slotCount = static_cast<uint32_t>(instanceCollection.modelInstances.size());
+    if (frame.modelInstanceBuffer == nullptr || frame.modelInstanceBuffer->getSize() < slotCount * sizeof(glm::mat4)) {
+      // Re-build the buffers, with room to grow so that adding instances one at a time does not rebuild them every time. No frame
+      // that is still being drawn uses them, so the old ones can be destroyed right away.
+      const uint32_t capacity = std::bit_ceil(slotCount);
+      const std::array queueFamilies{device->globalQueueFamilyIndex, device->transferQueueFamilyIndex};
+      frame.materialInstanceBuffer = nullptr;  // Make sure that the old buffer has been deleted before building the new one.
+      frame.modelInstanceBuffer = nullptr;
+      frame.materialInstanceBuffer = std::make_unique<Buffer>(device, "Mesh-Material Instance Buffer", capacity * sizeof(float), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VMA_MEMORY_USAGE_AUTO, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, queueFamilies);
+      frame.modelInstanceBuffer = std::make_unique<Buffer>(device, "Mesh-Transform Instance Buffer", capacity * sizeof(glm::mat4), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VMA_MEMORY_USAGE_AUTO, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, queueFamilies);
+      frame.dirty.assign(slotCount, true);
+      frame.dirtySlots.resize(slotCount);
+      std::iota(frame.dirtySlots.begin(), frame.dirtySlots.end(), 0U);
+    }
+    if (frame.dirtySlots.empty()) continue;
+
+    // Coalesce the dirty slots into runs of adjacent slots.
+    std::ranges::sort(frame.dirtySlots);
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;  // Begin and end slots
+    for (const uint32_t slot: frame.dirtySlots) {
+      if (!ranges.empty() && ranges.back().second == slot) ++ranges.back().second;
+      else ranges.emplace_back(slot, slot + 1);
+      frame.dirty[slot] = false;
     }
-    instanceCollection.stale = false;
+    const auto dirtyCount = static_cast<VkDeviceSize>(frame.dirtySlots.size());
+    frame.dirtySlots.clear();
+
+    const auto upload = [&]<typename T>(const std::vector<T>& values, const Buffer* buffer) {
+      if (auto* mapped = static_cast<std::byte*>(buffer->getMappedData()); mapped != nullptr) {
+        // The buffer is visible to the host, so the ranges are written to it directly.
+        for (const auto& [begin, end]: ranges) {
+          std::memcpy(mapped + begin * sizeof(T), values.data() + begin, (end - begin) * sizeof(T));
+          buffer->flush(begin * sizeof(T), (end - begin) * sizeof(T));
+        }
+        return;
+      }
+      const StagingRing::Allocation staging = device->stagingRing->allocate(commandBuffer, dirtyCount * sizeof(T));
+      std::vector<VkBufferCopy> regions;
+      regions.reserve(ranges.size());
+      VkDeviceSize offset{};
+      for (const auto& [begin, end]: ranges) {
+        std::memcpy(static_cast<std::byte*>(staging.data) + offset, values.data() + begin, (end - begin) * sizeof(T));
+        regions.push_back({staging.offset + offset, begin * sizeof(T), (end - begin) * sizeof(T)});
+        offset += (end - begin) * sizeof(T);
+      }
+      commandBuffer.record<CommandBuffer::CopyBufferToBuffer>(staging.buffer, buffer, regions);
+    };
+    upload(instanceCollection.materialInstances, frame.materialInstanceBuffer.get());
+    upload(instanceCollection.modelInstances, frame.modelInstanceBuffer.get());
   }
-  stale = false;
+  // The other frames still have to catch up on the changes that were just uploaded, or build their buffers in the first place.
+  for (const InstanceCollection& instanceCollection: materialSlots | std::views::transform(&MaterialSlot::instances) | std::views::join | std::ranges::views::values)
+    for (const InstanceCollection::FrameBuffers& frame: instanceCollection.frames)
+      stale |= !frame.dirtySlots.empty() || (frame.modelInstanceBuffer == nullptr && !instanceCollection.perInstanceData.empty());
 }
\ No newline at end of file
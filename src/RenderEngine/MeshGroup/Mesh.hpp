@@ -1,11 +1,17 @@
 #pragma once
 
 #include "src/RenderEngine/RenderGraph.hpp"
+#include "src/RenderEngine/MeshGroup/Vertex.hpp"
 #include "src/RenderEngine/Resources/Buffer.hpp"
 
+#include <fastgltf/types.hpp>
 #include <glm/matrix.hpp>
+#include <glm/vec2.hpp>
 #include <yyjson.h>
 
+#include <cstdint>
+#include <vector>
+
 class Buffer;
 class CommandBuffer;
 class GraphicsDevice;
@@ -14,39 +20,124 @@ template<typename T> class UniformBuffer;
 
 class Mesh {
 public:
+  /**
+   * The instances of a Mesh that use one Material. Each instance keeps the same slot for as long as it exists, and the slots of
+   * removed instances are reused before new ones are added. Removed instances are left in their slots with a zero model matrix,
+   * which collapses them to nothing, so every slot can still be drawn.
+   * Each frame in flight draws from instance buffers of its own, so that they can be written while other frames are still being
+   * drawn. Only the slots that have changed since a frame's buffers were last written are uploaded to them.
+   */
   struct InstanceCollection {
     struct PerInstanceData {
       glm::mat4 originalModelMatrix;
     };
-    plf::colony<glm::mat4> modelInstances;
-    plf::colony<float> materialInstances;
-    plf::colony<PerInstanceData> perInstanceData;
-    std::unique_ptr<Buffer> modelInstanceBuffer{nullptr};
-    std::unique_ptr<Buffer> materialInstanceBuffer{nullptr};
-    bool stale = true;
+
+    struct FrameBuffers {
+      std::unique_ptr<Buffer> modelInstanceBuffer{nullptr};
+      std::unique_ptr<Buffer> materialInstanceBuffer{nullptr};
+      std::vector<std::uint8_t> dirty;  // Indexed by slot
+      std::vector<uint32_t> dirtySlots;
+    };
+
+    // Indexed by slot
+    std::vector<glm::mat4> modelInstances;
+    std::vector<float> materialInstances;
+    std::vector<PerInstanceData> perInstanceData;
+    std::vector<uint32_t> freeSlots;
+    // Indexed by the RenderGraph's frame index
+    std::vector<FrameBuffers> frames;
+
+    void markDirty(uint32_t slot);
   };
 
   struct InstanceReference {
     Material* material;
-    decltype(InstanceCollection::modelInstances)::iterator modelInstanceID;
-    decltype(InstanceCollection::materialInstances)::iterator materialInstanceID;
-    decltype(InstanceCollection::perInstanceData)::iterator perInstanceDataID;
+    uint32_t materialSlot;
+    uint32_t slot;
+  };
+
+  // The range of the shared index and vertex buffers that one glTF primitive was packed into. It is only drawn by Materials whose
+  // vertex process assembles the same topology.
+  struct Primitive {
+    VkPrimitiveTopology topology;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t vertexOffset;
+  };
+
+  /**
+   * The primitives that share a glTF material, and the instances that draw them. Each instance of a Mesh has one Material for each
+   * of its MaterialSlots. Primitives without a material share the first MaterialSlot.
+   */
+  struct MaterialSlot {
+    std::vector<Primitive> primitives;
+    std::unordered_map<Material*, InstanceCollection> instances;
   };
 
-  VkPrimitiveTopology topology{VK_PRIMITIVE_TOPOLOGY_MAX_ENUM};
   GraphicsDevice* device;
-  std::unordered_map<Material*, InstanceCollection> instances;
-  std::unique_ptr<Buffer> positionsVertexBuffer{nullptr};
-  std::unique_ptr<Buffer> textureCoordinatesVertexBuffer{nullptr};
-  std::unique_ptr<Buffer> normalsVertexBuffer{nullptr};
-  std::unique_ptr<Buffer> tangentsVertexBuffer{nullptr};
+  // Indexed by the glTF material
+  std::vector<MaterialSlot> materialSlots;
+  Vertex::Layout vertexLayout{Vertex::Layout::Separate};
+  // Bound from the first binding up, in the order that <c>vertexLayout</c> gives them. The instance buffers are bound after them.
+  std::vector<std::unique_ptr<Buffer>> vertexBuffers;
   std::unique_ptr<Buffer> indexBuffer{nullptr};
   bool stale = true;
 
+private:
+  // The vertices and indices of one glTF primitive, before they are packed into the shared buffers.
+  struct Geometry {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> textureCoordinates;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec3> tangents;
+    std::vector<uint32_t> indices;
+  };
+
+  /**
+   * Reads every attribute of <c>primitive</c>, decoding it first if it is Draco compressed. Attributes that the primitive does not
+   * have are left zeroed.
+   */
+  [[nodiscard]] static Geometry decode(const fastgltf::Asset& asset, const fastgltf::Primitive& primitive);
+  /**
+   * Moves <c>geometry</c> from the space of its glTF node into the space of the Mesh.
+   * @param triangleList Whether <c>geometry</c> is a list of triangles, whose winding must be reversed if <c>matrix</c> mirrors it
+   */
+  static void transform(Geometry& geometry, const glm::mat4& matrix, bool triangleList);
+  /**
+   * Runs meshoptimizer's vertex cache, overdraw and vertex fetch passes over a list of triangles. The indices are reordered in
+   * place, and the vertices are reordered to match, dropping any that no index uses.
+   */
+  static void optimize(Geometry& geometry);
+
+public:
+  /**
+   * Imports every primitive of every mesh in the glTF file's scene, in the space of the scene's root. All of them are packed into
+   * one set of vertex buffers and one index buffer, so that the whole scene draws without binding any others.
+   */
   Mesh(GraphicsDevice* device, yyjson_val* json);
 
-  InstanceReference addInstance(uint64_t materialID, glm::mat4 mat);
+  /**
+   * @param materialSlot The MaterialSlot whose primitives the instance draws with the Material
+   */
+  InstanceReference addInstance(uint64_t materialID, glm::mat4 mat, uint32_t materialSlot=0);
   void removeInstance(InstanceReference&& instanceReference);
 
-  void update(CommandBuffer& commandBuffer);
+  /**
+   * Replace the model matrix of a single instance. Only instances that have actually moved should be passed to this function.
+   * @param instanceReference The instance to modify
+   * @param modelMatrix The new model matrix of the instance
+   */
+  void updateInstance(const InstanceReference& instanceReference, const glm::mat4& modelMatrix);
+  [[nodiscard]] const InstanceCollection::PerInstanceData& getPerInstanceData(const InstanceReference& instanceReference) const;
+
+  /**
+   * Uploads the instances that have changed since the instance buffers of frame <c>frameIndex</c> were last written. Changed
+   * slots are coalesced into ranges. Instance buffers that the host can write to, as with resizable BAR, are written directly.
+   * Otherwise, the ranges are staged and copied by commands recorded into <c>commandBuffer</c>. The GPU must have finished the
+   * last frame that drew from the buffers of <c>frameIndex</c>.
+   * @param commandBuffer The upload commands
+   * @param frameIndex The frame in flight whose instance buffers are written
+   * @param framesInFlight The number of frames in flight
+   */
+  void update(CommandBuffer& commandBuffer, uint32_t frameIndex, uint32_t framesInFlight);
 };
@@ -12,8 +12,15 @@ MeshGroup::MeshGroup(const std::uint64_t id, Entity& entity, GraphicsDevice* con
   const std::uint64_t size = yyjson_arr_size(transformationsArray);
   for (uint64_t i = 0; i < size; ++i) {
     Mesh* mesh = device->getJSONMesh(yyjson_get_uint(yyjson_arr_get(meshesArray, i)));
-    meshes[mesh].emplace(mesh->addInstance(yyjson_get_uint(yyjson_arr_get(materialsArray, i)), Tools::jsonGet<glm::mat4>(yyjson_arr_get(transformationsArray, i))));
+    const glm::mat4 transformation = Tools::jsonGet<glm::mat4>(yyjson_arr_get(transformationsArray, i));
+    // Either one material for each of the mesh's material slots, or a single material for all of them.
+    yyjson_val* materials = yyjson_arr_get(materialsArray, i);
+    for (uint32_t materialSlot{}; materialSlot < mesh->materialSlots.size(); ++materialSlot) {
+      const std::uint64_t materialID = yyjson_get_uint(yyjson_is_arr(materials) ? yyjson_arr_get(materials, materialSlot) : materials);
+      meshes[mesh].emplace(mesh->addInstance(materialID, transformation, materialSlot));
+    }
   }
+  onTransformChanged(TransformHierarchy::getWorldMatrix(entity.getTransform()));
 }
 
 MeshGroup::~MeshGroup() {
@@ -23,19 +30,17 @@ MeshGroup::~MeshGroup() {
   // }
 }
 
-void MeshGroup::onTick() {
-  /**@todo: Move me to somewhere in the graphics engine.*/
-  // plf::colony<MeshGroup> meshGroups = ECS::getAll<MeshGroup>();
-  // for (const MeshGroup& meshGroup: meshGroups) {
-  //   const glm::mat4 entityTransform = glm::translate(glm::rotate(glm::scale(glm::identity<glm::mat4>(), meshGroup.entity.scale), glm::angle(meshGroup.entity.rotation), glm::axis(meshGroup.entity.rotation)), meshGroup.entity.position);
-    const glm::mat4 entityTransform = glm::translate(glm::rotate(glm::scale(glm::identity<glm::mat4>(), entity.scale), glm::angle(entity.rotation), glm::axis(entity.rotation)), entity.position);
-    for (auto& [mesh, references]: meshes) {
-      bool& stale = mesh->stale;
-      for (const Mesh::InstanceReference& reference: references) {
-        glm::mat4 modelMatrix = *reference.modelInstanceID;
-        *reference.modelInstanceID = entityTransform * reference.perInstanceDataID->originalModelMatrix;
-        stale |= mesh->instances[reference.material].stale |= modelMatrix != *reference.modelInstanceID;
-      }
-    }
-  // }
+void MeshGroup::onTick() {}
+
+void MeshGroup::onTransformChanged(const glm::mat4& worldMatrix) {
+  for (auto& [mesh, references]: meshes)
+    for (const Mesh::InstanceReference& reference: references)
+      mesh->updateInstance(reference, worldMatrix * mesh->getPerInstanceData(reference).originalModelMatrix);
+}
+
+void MeshGroupSystem::run() {
+  for (const TransformHierarchy::Handle handle: TransformHierarchy::getChanged()) {
+    Entity* entity = TransformHierarchy::getEntity(handle);
+    for (MeshGroup* meshGroup: entity->getComponentsOfType<MeshGroup>()) meshGroup->onTransformChanged(TransformHierarchy::getWorldMatrix(handle));
+  }
 }
\ No newline at end of file
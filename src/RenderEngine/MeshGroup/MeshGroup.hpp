@@ -3,16 +3,33 @@
 #include "Mesh.hpp"
 
 #include "src/Component.hpp"
+#include "src/TransformHierarchy.hpp"
 
 #include <yyjson.h>
 #include <plf_colony.h>
 
-struct MeshGroup : Component {
+struct MeshGroup final : Component {
   GraphicsDevice* const device;
   std::unordered_map<Mesh*, plf::colony<Mesh::InstanceReference>> meshes;
 
   MeshGroup(std::uint64_t id, Entity& entity, GraphicsDevice* device, yyjson_val* val);
   ~MeshGroup() override;
 
-  void onTick() override;  // Move to an 'AnimationSystem'
+  void onTick() override;
+
+  /**
+   * Move every instance of this MeshGroup to follow its Entity.
+   * @param worldMatrix The new world matrix of the Entity
+   */
+  void onTransformChanged(const glm::mat4& worldMatrix);
+};
+
+/**
+ * Forwards the transforms that changed this tick to the MeshGroups of their Entities. MeshGroups that did not move are not visited.
+ */
+class MeshGroupSystem final : public System {
+public:
+  MeshGroupSystem() : System({ECS::typeId<TransformHierarchy>()}, {ECS::typeId<MeshGroup>(), ECS::typeId<Mesh>()}) {}
+
+  void run() override;
 };
\ No newline at end of file
@@ -1,58 +1,281 @@
 #include "Texture.hpp"
 
+#include "BlockCompression.hpp"
+#include "src/JobSystem.hpp"
 #include "src/RenderEngine/CommandBuffer.hpp"
-#include "src/RenderEngine/Resources/StagingBuffer.hpp"
+#include "src/RenderEngine/GraphicsInstance.hpp"
+#include "src/RenderEngine/Resources/StagingRing.hpp"
+#include "src/Tools/Hashing.hpp"
 
 #include <OpenEXR/ImfRgbaFile.h>
-#include <OpenEXR/ImfArray.h>
+#include <OpenEXR/ImfThreading.h>
+#include <Imath/half.h>
+#include <magic_enum/magic_enum.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
 
 VkSampler Texture::getSampler() const {
   return *sampler;
 }
 
-std::unique_ptr<Texture> Texture::jsonGet(GraphicsDevice* device, yyjson_val* textureJSON, CommandBuffer& commandBuffer) {
-  std::filesystem::path path = yyjson_get_str(yyjson_obj_get(textureJSON, "path"));
-  path = (device->resourcesDirectory / "textures" / path).c_str();
+void Texture::convertToRGBA8(const std::span<const std::uint16_t> halves, const std::span<std::uint32_t> pixels, const bool sRGB) {
+  // Every half float maps to exactly one byte, so the conversion is a table lookup. The first half of the table encodes colour
+  // channels with the sRGB transfer function, and the second half holds linear values, for alpha and for linear textures. The padding lets the AVX2 path
+  // gather four bytes at a time starting from any entry.
+  static const std::unique_ptr<std::array<std::uint8_t, 2 * 65536 + 3>> table = [] {
+    auto result = std::make_unique<std::array<std::uint8_t, 2 * 65536 + 3>>();
+    for (std::uint32_t bits{}; bits < 65536; ++bits) {
+      Imath::half half;
+      half.setBits(static_cast<std::uint16_t>(bits));
+      const double linear = std::isnan(static_cast<float>(half)) ? 0 : std::clamp(static_cast<double>(half), 0.0, 1.0);
+      const double encoded = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1 / 2.4) - 0.055;
+      (*result)[bits]         = static_cast<std::uint8_t>(std::lround(encoded * 255));
+      (*result)[65536 + bits] = static_cast<std::uint8_t>(std::lround(linear * 255));
+    }
+    return result;
+  }();
+  static const bool hasAVX2 = [] {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    return __builtin_cpu_supports("avx2") != 0;
+#elif defined(_M_X64)
+    int info[4];
+    __cpuid(info, 1);
+    if ((info[2] & 1 << 27) == 0 || (_xgetbv(0) & 6) != 6) return false;  // The OS must save the YMM registers
+    __cpuidex(info, 7, 0);
+    return (info[1] & 1 << 5) != 0;
+#else
+    return false;
+#endif
+  }();
+  // Each of the threads converts a contiguous band of pixels.
+  const std::size_t count = std::min(halves.size() / 4, pixels.size());
+  JobSystem::parallelFor(count, 64 * 1024, [&](const std::size_t begin, const std::size_t end) {
+    if (hasAVX2) convertToRGBA8AVX2(halves.data() + begin * 4, pixels.data() + begin, end - begin, table->data(), sRGB);
+    else convertToRGBA8Scalar(halves.data() + begin * 4, pixels.data() + begin, end - begin, table->data(), sRGB);
+  });
+}
+
+void Texture::convertToRGBA8Scalar(const std::uint16_t* halves, std::uint32_t* pixels, const std::size_t count, const std::uint8_t* table, const bool sRGB) {
+  const std::uint8_t* colour = sRGB ? table : table + 65536;
+  for (std::size_t i{}; i < count; ++i, halves += 4) {
+    pixels[i] = colour[halves[0]] | colour[halves[1]] << 8 | colour[halves[2]] << 16 | static_cast<std::uint32_t>(table[65536 + halves[3]]) << 24;
+  }
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx2")))
+#endif
+void Texture::convertToRGBA8AVX2(const std::uint16_t* halves, std::uint32_t* pixels, const std::size_t count, const std::uint8_t* table, const bool sRGB) {
+  // Two pixels at a time: their eight channels are widened to indices into the table, linear channels are moved to the second half
+  // of the table, and the bytes are gathered, then packed back down.
+  const __m256i linearOffset = sRGB ? _mm256_setr_epi32(0, 0, 0, 65536, 0, 0, 0, 65536) : _mm256_set1_epi32(65536);
+  const __m256i lowByte     = _mm256_set1_epi32(0xFF);
+  const __m256i packBytes   = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m256i packPixels  = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+  std::size_t i{};
+  for (; i + 2 <= count; i += 2) {
+    const __m256i indices = _mm256_add_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(halves + i * 4))), linearOffset);
+    __m256i bytes         = _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(table), indices, 1), lowByte);
+    bytes                 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(bytes, packBytes), packPixels);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(pixels + i), _mm256_castsi256_si128(bytes));
+  }
+  convertToRGBA8Scalar(halves + i * 4, pixels + i, count - i, table, sRGB);
+}
+#else
+void Texture::convertToRGBA8AVX2(const std::uint16_t* halves, std::uint32_t* pixels, const std::size_t count, const std::uint8_t* table, const bool sRGB) {
+  convertToRGBA8Scalar(halves, pixels, count, table, sRGB);
+}
+#endif
+
+VkDeviceSize Texture::getLevelSize(const VkFormat format, const VkExtent3D extent, const std::uint32_t level) {
+  const VkExtent3D blockExtent = vkuFormatTexelBlockExtent(format);
+  const VkDeviceSize width     = std::max(extent.width >> level, 1U);
+  const VkDeviceSize height    = std::max(extent.height >> level, 1U);
+  return (width + blockExtent.width - 1) / blockExtent.width * ((height + blockExtent.height - 1) / blockExtent.height) * vkuFormatElementSize(format);
+}
+
+VkDeviceSize Texture::getDataSize(const VkFormat format, const VkExtent3D extent, const std::uint32_t mipLevels) {
+  VkDeviceSize size{};
+  for (std::uint32_t level{}; level < mipLevels; ++level) size += getLevelSize(format, extent, level);
+  return size;
+}
+
+Texture::Decoded Texture::decode(const std::filesystem::path& path, const VkFormat format) {
+  // OpenEXR's thread pool is shared by every file, so it is started once, the first time that it is needed.
+  [[maybe_unused]] static const bool threadPoolStarted = [] {
+    Imf::setGlobalThreadCount(static_cast<int>(JobSystem::getConcurrency()));
+    return true;
+  }();
   Imf::RgbaInputFile file(path.c_str());
   const Imath::Box2i dataWindow = file.dataWindow();
   const unsigned int width  = dataWindow.max.x - dataWindow.min.x + 1;
   const unsigned int height = dataWindow.max.y - dataWindow.min.y + 1;
-  Imf::Array2D<Imf::Rgba> pixels(width, height);
-  Imf::FrameBuffer framebuffer;
-  file.setFrameBuffer(&pixels[0][0], 1, width);
+  const std::uint32_t mipLevels = std::bit_width(std::max(width, height));
+  std::size_t pixelCount{};
+  for (std::uint32_t level{}; level < mipLevels; ++level) pixelCount += static_cast<std::size_t>(std::max(width >> level, 1U)) * std::max(height >> level, 1U);
+  std::vector<Imf::Rgba> halves(pixelCount);
+  file.setFrameBuffer(halves.data() - dataWindow.min.x - static_cast<std::ptrdiff_t>(dataWindow.min.y) * width, 1, width);
   file.readPixels(dataWindow.min.y, dataWindow.max.y);
-  auto texture = std::make_unique<Texture>(device, path, VK_FORMAT_R8G8B8A8_SRGB, VkExtent3D{width, height, 1}, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
-  struct Pixel{uint8_t r; uint8_t g; uint8_t b; uint8_t a;};
-  std::vector<Pixel> data(width * height);
-  for (uint32_t columnIndex = 0; columnIndex < width; ++columnIndex) {
-    const Imf::Rgba* column = pixels[columnIndex];
-    for (uint32_t rowIndex = 0; rowIndex < height; ++rowIndex) {
-      const Imf::Rgba& pixel = column[rowIndex];
-      data[rowIndex + columnIndex * width] = Pixel{
-        .r = static_cast<uint8_t>(pixel.r * std::numeric_limits<decltype(Pixel::r)>::max()),
-        .g = static_cast<uint8_t>(pixel.g * std::numeric_limits<decltype(Pixel::g)>::max()),
-        .b = static_cast<uint8_t>(pixel.b * std::numeric_limits<decltype(Pixel::b)>::max()),
-        .a = static_cast<uint8_t>(pixel.a * std::numeric_limits<decltype(Pixel::a)>::max())
-      };
-    }
+  // Each texel of a level averages the two by two texels above it. Along an odd edge, the last texel of the level above is left out.
+  Imf::Rgba* source = halves.data();
+  for (std::uint32_t level{1}; level < mipLevels; ++level) {
+    const unsigned int sourceWidth  = std::max(width >> (level - 1), 1U);
+    const unsigned int sourceHeight = std::max(height >> (level - 1), 1U);
+    const unsigned int levelWidth   = std::max(width >> level, 1U);
+    const unsigned int levelHeight  = std::max(height >> level, 1U);
+    Imf::Rgba* destination = source + static_cast<std::size_t>(sourceWidth) * sourceHeight;
+    JobSystem::parallelFor(levelHeight, 64, [=](const std::size_t begin, const std::size_t end) {
+      for (std::size_t y{begin}; y < end; ++y) {
+        const Imf::Rgba* row0 = source + std::min<std::size_t>(y * 2, sourceHeight - 1) * sourceWidth;
+        const Imf::Rgba* row1 = source + std::min<std::size_t>(y * 2 + 1, sourceHeight - 1) * sourceWidth;
+        for (std::size_t x{}; x < levelWidth; ++x) {
+          const std::size_t x0 = std::min<std::size_t>(x * 2, sourceWidth - 1);
+          const std::size_t x1 = std::min<std::size_t>(x * 2 + 1, sourceWidth - 1);
+          const auto average   = [&](Imath::half Imf::Rgba::* channel) { return Imath::half((row0[x0].*channel + row0[x1].*channel + row1[x0].*channel + row1[x1].*channel) * 0.25F); };
+          destination[y * levelWidth + x] = Imf::Rgba(average(&Imf::Rgba::r), average(&Imf::Rgba::g), average(&Imf::Rgba::b), average(&Imf::Rgba::a));
+        }
+      }
+    });
+    source = destination;
   }
-  auto* buffer  = new StagingBuffer(device, (std::string(path) + " | upload buffer").c_str(), data);
-  std::vector<VkBufferImageCopy> regions{
-    {
-      .bufferOffset = 0,
+  Decoded decoded{path, format, {width, height, 1}, mipLevels, std::vector<std::byte>(halves.size() * sizeof(std::uint32_t))};
+  static_assert(sizeof(Imf::Rgba) == 4 * sizeof(std::uint16_t));
+  const std::span pixels{reinterpret_cast<std::uint32_t*>(decoded.data.data()), halves.size()};
+  convertToRGBA8({reinterpret_cast<const std::uint16_t*>(halves.data()), halves.size() * 4}, pixels, vkuFormatIsSRGB(format));
+  if (!BlockCompression::supports(format)) return decoded;
+  std::vector<std::byte> compressed;
+  compressed.reserve(getDataSize(format, decoded.extent, mipLevels));
+  std::size_t offset{};
+  for (std::uint32_t level{}; level < mipLevels; ++level) {
+    const std::uint32_t levelWidth  = std::max(width >> level, 1U);
+    const std::uint32_t levelHeight = std::max(height >> level, 1U);
+    compressed.append_range(BlockCompression::compress(format, pixels.subspan(offset, static_cast<std::size_t>(levelWidth) * levelHeight), levelWidth, levelHeight));
+    offset += static_cast<std::size_t>(levelWidth) * levelHeight;
+  }
+  decoded.data = std::move(compressed);
+  return decoded;
+}
+
+Texture::Decoded Texture::cook(const GraphicsDevice* device, const std::filesystem::path& path, const VkFormat format) {
+  std::ifstream file{path, std::ios_base::ate | std::ios_base::binary};
+  if (!file.is_open()) GraphicsInstance::showError("failed to read file: '" + path.string() + "'");
+  std::string contents(static_cast<std::size_t>(file.tellg()), '\0');
+  file.seekg(0, std::ios_base::beg);
+  file.read(contents.data(), static_cast<std::streamsize>(contents.size()));
+  const std::uint64_t key = Tools::hash(path.string(), contents, format, CacheHeader::Version);
+  Decoded decoded;
+  if (readCache(device, key, path, decoded)) return decoded;
+  decoded = decode(path, format);
+  writeCache(device, key, decoded);
+  return decoded;
+}
+
+std::filesystem::path Texture::getCachePath(const GraphicsDevice* device, const std::uint64_t key) {
+  return device->resourcesDirectory / "cache" / "textures" / (std::to_string(key) + ".tex");
+}
+
+bool Texture::readCache(const GraphicsDevice* device, const std::uint64_t key, const std::filesystem::path& path, Decoded& decoded) {
+  std::ifstream stream{getCachePath(device, key), std::ios_base::binary};
+  if (!stream.is_open()) return false;
+  CacheHeader header{};
+  stream.read(reinterpret_cast<char*>(&header), sizeof(CacheHeader));
+  if (!stream || header.magic != CacheHeader::Magic || header.key != key || header.mipLevels == 0 || header.dataSize != getDataSize(header.format, header.extent, header.mipLevels)) return false;
+  decoded = {path, header.format, header.extent, header.mipLevels, std::vector<std::byte>(header.dataSize)};
+  stream.read(reinterpret_cast<char*>(decoded.data.data()), static_cast<std::streamsize>(header.dataSize));
+  return static_cast<bool>(stream);
+}
+
+void Texture::writeCache(const GraphicsDevice* device, const std::uint64_t key, const Decoded& decoded) {
+  // The cache only saves time, so failing to write it is not worth reporting.
+  const std::filesystem::path path = getCachePath(device, key);
+  std::error_code error;
+  std::filesystem::create_directories(path.parent_path(), error);
+  std::filesystem::path temporaryPath = path;
+  temporaryPath += ".tmp";
+  std::ofstream stream{temporaryPath, std::ios_base::trunc | std::ios_base::binary};
+  const CacheHeader header {
+    .magic     = CacheHeader::Magic,
+    .format    = decoded.format,
+    .key       = key,
+    .extent    = decoded.extent,
+    .mipLevels = decoded.mipLevels,
+    .dataSize  = decoded.data.size()
+  };
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+  stream.write(reinterpret_cast<const char*>(decoded.data.data()), static_cast<std::streamsize>(decoded.data.size()));
+  stream.close();
+  if (stream) std::filesystem::rename(temporaryPath, path, error);
+  else std::filesystem::remove(temporaryPath, error);
+}
+
+std::unique_ptr<Texture> Texture::create(GraphicsDevice* device, const Decoded& decoded, VkSampler* sampler, CommandBuffer& commandBuffer) {
+  auto texture = std::make_unique<Texture>(device, decoded.path.string(), sampler, decoded.format, decoded.extent, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, decoded.mipLevels);
+  const StagingRing::Allocation staging = device->stagingRing->stage(commandBuffer, decoded.data);
+  // Every mip level is copied out of the same staging allocation.
+  std::vector<VkBufferImageCopy> regions;
+  regions.reserve(decoded.mipLevels);
+  VkDeviceSize offset = staging.offset;
+  for (std::uint32_t level{}; level < decoded.mipLevels; ++level) {
+    const VkExtent3D extent{std::max(decoded.extent.width >> level, 1U), std::max(decoded.extent.height >> level, 1U), 1};
+    regions.push_back({
+      .bufferOffset = offset,
       .bufferRowLength = 0,
       .bufferImageHeight = 0,
       .imageSubresource = VkImageSubresourceLayers{
         .aspectMask     = texture->getAspect(),
-        .mipLevel       = 0,
+        .mipLevel       = level,
         .baseArrayLayer = 0,
         .layerCount     = texture->getLayerCount(),
       },
       .imageOffset = {},
-      .imageExtent = texture->getExtent()
-    }
-  };
-  commandBuffer.record<CommandBuffer::CopyBufferToImage>(buffer, texture.get(), regions);
-  commandBuffer.addCleanupResource(buffer);
+      .imageExtent = extent
+    });
+    offset += getLevelSize(decoded.format, decoded.extent, level);
+  }
+  commandBuffer.record<CommandBuffer::CopyBufferToImage>(staging.buffer, texture.get(), regions);
   return texture;
-}
\ No newline at end of file
+}
+
+std::unique_ptr<Texture> Texture::jsonGet(GraphicsDevice* device, yyjson_val* textureJSON, CommandBuffer& commandBuffer) {
+  return create(device, cook(device, jsonGetPath(device, textureJSON), jsonGetFormat(device, textureJSON)), jsonGetSampler(device, textureJSON), commandBuffer);
+}
+
+std::filesystem::path Texture::jsonGetPath(const GraphicsDevice* device, yyjson_val* textureJSON) {
+  return device->resourcesDirectory / "textures" / yyjson_get_str(yyjson_obj_get(textureJSON, "path"));
+}
+
+VkSampler* Texture::jsonGetSampler(GraphicsDevice* device, yyjson_val* textureJSON) {
+  yyjson_val* sampler = yyjson_obj_get(textureJSON, "sampler");
+  return sampler == nullptr ? device->getSampler() : device->getJSONSampler(yyjson_get_uint(sampler));
+}
+
+VkFormat Texture::jsonGetFormat(const GraphicsDevice* device, yyjson_val* textureJSON) {
+  const char* name{};
+  yyjson_ptr_get_str(textureJSON, "/compression", &name);
+  const Compression compression = name == nullptr ? Compression::None : magic_enum::enum_cast<Compression>(name).value_or(Compression::None);
+  const bool linear = yyjson_get_bool(yyjson_obj_get(textureJSON, "linear")) || compression == Compression::BC4 || compression == Compression::BC5;
+  if (device->textureCompressionBC) {
+    switch (compression) {
+      case Compression::BC1: return linear ? VK_FORMAT_BC1_RGB_UNORM_BLOCK : VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+      case Compression::BC4: return VK_FORMAT_BC4_UNORM_BLOCK;
+      case Compression::BC5: return VK_FORMAT_BC5_UNORM_BLOCK;
+      case Compression::BC7: return linear ? VK_FORMAT_BC7_UNORM_BLOCK : VK_FORMAT_BC7_SRGB_BLOCK;
+      case Compression::None: break;
+    }
+  }
+  return linear ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R8G8B8A8_SRGB;
+}
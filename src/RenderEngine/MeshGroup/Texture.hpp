@@ -3,14 +3,115 @@
 #include "src/RenderEngine/GraphicsDevice.hpp"
 #include "src/RenderEngine/Resources/Image.hpp"
 
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <vector>
+
 class Texture : public Image {
+public:
+  /**
+   * How a texture is stored on the GPU, as named by the <c>compression</c> of a texture in the graphics data JSON. BC4 and BC5 are
+   * always linear. The others are sRGB unless the texture is marked <c>linear</c>.
+   */
+  enum class Compression : std::uint8_t {
+    None,  // RGBA8
+    BC1,   // RGB, for colours without alpha
+    BC4,   // The red channel only, for single channel data
+    BC5,   // The red and green channels, for normal maps
+    BC7,   // RGBA, for colours
+  };
+
+  /**
+   * The contents of a texture, ready to be uploaded. Cooking touches nothing but the texture's file and its cache file, so any number
+   * of textures may be cooked at once on different threads.
+   */
+  struct Decoded {
+    std::filesystem::path path;
+    VkFormat format;
+    VkExtent3D extent;            // The extent of the first mip level
+    std::uint32_t mipLevels;
+    std::vector<std::byte> data;  // Every mip level one after the other from the largest down, each laid out as <c>format</c> is in memory
+  };
+
+private:
+  /**
+   * Precedes each cooked texture in the cache. It is followed by the data of every mip level, as in <c>Decoded</c>.
+   */
+  struct CacheHeader {
+    static constexpr std::uint32_t Magic   = 0x43544742;  // "BGTC"
+    static constexpr std::uint32_t Version = 1;  // Must be bumped whenever decoding, mip generation or the block encoders change.
+
+    std::uint32_t magic;
+    VkFormat format;
+    std::uint64_t key;
+    VkExtent3D extent;
+    std::uint32_t mipLevels;
+    std::uint64_t dataSize;
+  };
+
   VkSampler* sampler;
 
+  /**
+   * Converts RGBA pixels of half floats to RGBA8. Alpha is always left linear. Uses AVX2 where the CPU supports it.
+   * @param halves Four half floats for each pixel
+   * @param pixels Receives one packed RGBA8 value for each pixel
+   * @param sRGB Whether to encode the colour channels with the sRGB transfer function
+   */
+  static void convertToRGBA8(std::span<const std::uint16_t> halves, std::span<std::uint32_t> pixels, bool sRGB);
+  // Both look every channel up in <c>table</c>, so they give identical results.
+  static void convertToRGBA8Scalar(const std::uint16_t* halves, std::uint32_t* pixels, std::size_t count, const std::uint8_t* table, bool sRGB);
+  static void convertToRGBA8AVX2(const std::uint16_t* halves, std::uint32_t* pixels, std::size_t count, const std::uint8_t* table, bool sRGB);
+
+  /**
+   * @return The size in bytes of mip level <c>level</c> of an image with the given format and extent
+   */
+  [[nodiscard]] static VkDeviceSize getLevelSize(VkFormat format, VkExtent3D extent, std::uint32_t level);
+  /**
+   * @return The size in bytes of the first <c>mipLevels</c> mip levels of an image with the given format and extent
+   */
+  [[nodiscard]] static VkDeviceSize getDataSize(VkFormat format, VkExtent3D extent, std::uint32_t mipLevels);
+
+  /**
+   * Reads an EXR file, then generates its full mip chain. OpenEXR decodes the lines or tiles of the file on its own thread pool.
+   * Each mip level is a box filter of the one above it, taken before the sRGB encoding so that it averages linear values. Each level
+   * is then block compressed if <c>format</c> is a BC format.
+   */
+  [[nodiscard]] static Decoded decode(const std::filesystem::path& path, VkFormat format);
+
+  [[nodiscard]] static std::filesystem::path getCachePath(const GraphicsDevice* device, std::uint64_t key);
+  /**
+   * Loads the cooked texture stored under <c>key</c> into <c>decoded</c>.
+   * @return <c>false</c> if nothing is stored under <c>key</c>
+   */
+  static bool readCache(const GraphicsDevice* device, std::uint64_t key, const std::filesystem::path& path, Decoded& decoded);
+  static void writeCache(const GraphicsDevice* device, std::uint64_t key, const Decoded& decoded);
+
 public:
+
   [[nodiscard]] VkSampler getSampler() const;
 
   template <typename... Args> requires(std::constructible_from<Image, GraphicsDevice* const, const std::string&, Args&&...>) Texture(GraphicsDevice* device, const std::string& name, VkSampler* sampler, Args&&... args) : Image(device, name, args...), sampler(sampler) {}
   template <typename... Args> requires(std::constructible_from<Image, GraphicsDevice* const, const std::string&, Args&&...>) Texture(GraphicsDevice* device, const std::string& name, Args&&... args) : Image(device, name, args...), sampler(device->getSampler()) {}
 
+  /**
+   * Gets an EXR file ready to be uploaded as <c>format</c>. The result is cached, keyed by the contents of the file, so each file is
+   * only decoded and compressed again once it changes.
+   */
+  [[nodiscard]] static Decoded cook(const GraphicsDevice* device, const std::filesystem::path& path, VkFormat format);
+  /**
+   * Creates the texture for <c>decoded</c>, and records its upload into <c>commandBuffer</c>. Must be called on the thread that owns the GraphicsDevice.
+   */
+  static std::unique_ptr<Texture> create(GraphicsDevice* device, const Decoded& decoded, VkSampler* sampler, CommandBuffer& commandBuffer);
   static std::unique_ptr<Texture> jsonGet(GraphicsDevice* device, yyjson_val* textureJSON, CommandBuffer& commandBuffer);
+  [[nodiscard]] static std::filesystem::path jsonGetPath(const GraphicsDevice* device, yyjson_val* textureJSON);
+  /**
+   * @return The sampler named by the texture's <c>sampler</c> index into the graphics data JSON, or the default sampler if it has none.
+   */
+  [[nodiscard]] static VkSampler* jsonGetSampler(GraphicsDevice* device, yyjson_val* textureJSON);
+  /**
+   * @return The format that the texture is stored in on this device. Where the device cannot sample block compressed formats, a
+   * texture that asks for compression falls back to RGBA8 in the same colour space.
+   */
+  [[nodiscard]] static VkFormat jsonGetFormat(const GraphicsDevice* device, yyjson_val* textureJSON);
 };
@@ -1,5 +1,10 @@
 #include "Vertex.hpp"
 
+#include <glm/common.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <cstddef>
+
 std::unordered_map<std::string, VkVertexInputRate> Vertex::inputRates = {
       {"inPosition", VK_VERTEX_INPUT_RATE_VERTEX},
       {"inTextureCoordinates", VK_VERTEX_INPUT_RATE_VERTEX},
@@ -7,4 +12,28 @@ std::unordered_map<std::string, VkVertexInputRate> Vertex::inputRates = {
       {"inTangent", VK_VERTEX_INPUT_RATE_VERTEX},
       {"inModelMatrix", VK_VERTEX_INPUT_RATE_INSTANCE},
       {"inMaterialID", VK_VERTEX_INPUT_RATE_INSTANCE}
-};
\ No newline at end of file
+};
+
+std::unordered_map<std::string, Vertex::PackedAttribute> Vertex::packedAttributes = {
+      {"inPosition", {VK_FORMAT_R32G32B32_SFLOAT, offsetof(Packed, position)}},
+      {"inTextureCoordinates", {VK_FORMAT_R16G16_SFLOAT, offsetof(Packed, textureCoordinates)}},
+      {"inNormal", {VK_FORMAT_R16G16_SNORM, offsetof(Packed, normal)}},
+      {"inTangent", {VK_FORMAT_R16G16_SNORM, offsetof(Packed, tangent)}}
+};
+
+std::uint32_t Vertex::octahedralEncode(const glm::vec3 direction) {
+  const float length = glm::abs(direction.x) + glm::abs(direction.y) + glm::abs(direction.z);
+  if (length == 0) return 0;  // Decodes to +z, as good as any direction for a missing one.
+  glm::vec2 encoded = glm::vec2(direction) / length;
+  if (direction.z < 0) encoded = (1.0F - glm::abs(glm::vec2(encoded.y, encoded.x))) * glm::vec2(encoded.x >= 0 ? 1 : -1, encoded.y >= 0 ? 1 : -1);
+  return glm::packSnorm2x16(encoded);
+}
+
+Vertex::Packed Vertex::pack(const glm::vec3 position, const glm::vec2 textureCoordinates, const glm::vec3 normal, const glm::vec3 tangent) {
+  return {
+    .position           = position,
+    .textureCoordinates = glm::packHalf2x16(textureCoordinates),
+    .normal             = octahedralEncode(normal),
+    .tangent            = octahedralEncode(tangent)
+  };
+}
\ No newline at end of file
@@ -1,10 +1,51 @@
 #pragma once
 
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
 #include <vulkan/vulkan_core.h>
 
+#include <cstdint>
 #include <string>
 #include <unordered_map>
 
 struct Vertex {
+  /**
+   * How a Mesh stores its vertices, as named by the <c>vertexLayout</c> of a mesh or a vertex process in the graphics data JSON. A
+   * Mesh must only be drawn with Materials whose vertex process reads the same layout.
+   */
+  enum class Layout : std::uint8_t {
+    Separate,  // One full precision buffer for each attribute
+    Packed,    // A single buffer of interleaved <c>Vertex::Packed</c>s
+  };
+
+  /**
+   * One vertex of the <c>Packed</c> layout. Normals and tangents are octahedral encoded, so shaders must decode them with
+   * <c>octahedralDecode</c> from BooLib.glsl.
+   */
+  struct Packed {
+    glm::vec3 position;
+    std::uint32_t textureCoordinates;  // Two half floats
+    std::uint32_t normal;              // Two 16 bit snorms
+    std::uint32_t tangent;             // Two 16 bit snorms
+  };
+  static_assert(sizeof(Packed) == 24);
+
+  struct PackedAttribute {
+    VkFormat format;
+    std::uint32_t offset;
+  };
+
+private:
+  /**
+   * Maps a direction onto an octahedron, then unfolds the octahedron's lower half over its upper half.
+   * @return Two 16 bit snorms, ready for <c>VK_FORMAT_R16G16_SNORM</c>
+   */
+  static std::uint32_t octahedralEncode(glm::vec3 direction);
+
+public:
   static std::unordered_map<std::string, VkVertexInputRate> inputRates;
+  // The shader inputs that read a <c>Packed</c>, by name
+  static std::unordered_map<std::string, PackedAttribute> packedAttributes;
+
+  [[nodiscard]] static Packed pack(glm::vec3 position, glm::vec2 textureCoordinates, glm::vec3 normal, glm::vec3 tangent);
 };
\ No newline at end of file
@@ -13,13 +13,14 @@
 #include <magic_enum/magic_enum.hpp>
 #include <volk/volk.h>
 
+#include <algorithm>
 #include <deque>
 
 Pipeline::Pipeline(GraphicsDevice* const device, Material* material) : DescriptorSetRequirer(device), device(device), material(material), bindPoint(VK_PIPELINE_BIND_POINT_GRAPHICS) {}
 
-/**@todo: Only rebake if out-of-date.*/
 void Pipeline::bake(const std::shared_ptr<const RenderPass>& renderPass, const uint32_t subpassIndex, std::span<VkDescriptorSetLayout> layouts, std::deque<std::tuple<void*, std::function<void(void*)>>>& miscMemoryPool, std::vector<VkGraphicsPipelineCreateInfo>& createInfos, std::vector<VkPipeline*>& pipelines) {
-  // Create the pipeline layout
+  // Create the pipeline layout, replacing the one from the previous bake
+  vkDestroyPipelineLayout(device->device, layout, nullptr);
   std::vector<VkPushConstantRange> pushConstantRanges = material->computePushConstantRanges();
   const VkPipelineLayoutCreateInfo createInfo {
       .sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
@@ -37,6 +38,15 @@ void Pipeline::bake(const std::shared_ptr<const RenderPass>& renderPass, const u
   VkPipelineShaderStageCreateInfo(&stages)[] = *static_cast<VkPipelineShaderStageCreateInfo(*)[]>(std::get<0>(miscMemoryPool.emplace_back(new VkPipelineShaderStageCreateInfo[shaders.size()], [](void* mem){ delete[] static_cast<VkPipelineShaderStageCreateInfo*>(mem); })));
   for (uint32_t i{}; i < shaders.size(); ++i) {
     const Shader* shader = shaders[i];
+    // Branches on specialization constants are folded by the driver when the pipeline is created, so the Material's values cost nothing at runtime.
+    auto& [entries, data] = *static_cast<std::pair<std::vector<VkSpecializationMapEntry>, std::vector<std::uint32_t>>*>(std::get<0>(miscMemoryPool.emplace_back(new std::pair<std::vector<VkSpecializationMapEntry>, std::vector<std::uint32_t>>, [](void* mem){ delete static_cast<std::pair<std::vector<VkSpecializationMapEntry>, std::vector<std::uint32_t>>*>(mem); })));
+    material->computeSpecializationConstants(*shader, entries, data);
+    const VkSpecializationInfo* specializationInfo = entries.empty() ? nullptr : static_cast<VkSpecializationInfo*>(std::get<0>(miscMemoryPool.emplace_back(new VkSpecializationInfo{
+        .mapEntryCount = static_cast<uint32_t>(entries.size()),
+        .pMapEntries   = entries.data(),
+        .dataSize      = data.size() * sizeof(std::uint32_t),
+        .pData         = data.data()
+    }, [](void* mem){ delete static_cast<VkSpecializationInfo*>(mem); })));
     stages[i] = VkPipelineShaderStageCreateInfo{
         .sType               = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .pNext               = nullptr,
@@ -44,7 +54,7 @@ void Pipeline::bake(const std::shared_ptr<const RenderPass>& renderPass, const u
         .stage               = shader->getStage(),
         .module              = shader->getModule(),
         .pName               = shader->getEntryPoint().data(),
-        .pSpecializationInfo = VK_NULL_HANDLE
+        .pSpecializationInfo = specializationInfo
     };
   }
 
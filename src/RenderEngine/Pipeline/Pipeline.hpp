@@ -34,4 +34,9 @@ public:
   [[nodiscard]] VkPipeline getPipeline() const;
   [[nodiscard]] VkPipelineLayout getLayout() const;
   [[nodiscard]] Material* getMaterial() const;
+  /**
+   * @return <c>true</c> if draws using this pipeline produce the same image no matter what order they are submitted in. This holds
+   * when nothing is blended and the depth test resolves overlapping fragments.
+   */
+  [[nodiscard]] bool isOrderIndependent() const;
 };
\ No newline at end of file
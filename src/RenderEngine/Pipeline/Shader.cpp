@@ -10,7 +10,9 @@
 #include <volk/volk.h>
 #include <yyjson.h>
 
+#include <algorithm>
 #include <fstream>
+#include <string>
 
 bool readFile(const std::filesystem::path& path, std::string& contents) {
   std::ifstream stream{path, std::ios_base::ate | std::ios_base::binary};
@@ -33,9 +35,17 @@ bool readFile(const std::filesystem::path& path, char*& contents, std::streamsiz
 }
 
 class Includer final : public shaderc::CompileOptions::IncluderInterface {
+  std::vector<std::filesystem::path>& includes;
+
 public:
+  /**
+   * @param includes Receives the path of every file that gets included, including those included by other included files
+   */
+  explicit Includer(std::vector<std::filesystem::path>& includes) : includes(includes) {}
+
   shaderc_include_result* GetInclude(const char* requested_source, shaderc_include_type type, const char* requesting_source, size_t include_depth) override {
     const std::filesystem::path path = canonical(std::filesystem::canonical(requesting_source).parent_path()/requested_source);
+    includes.push_back(path);
     char* contents;
     std::streamsize contentSize;
     readFile(path, contents, contentSize);
@@ -52,6 +62,48 @@ public:
   }
 };
 
+struct Shader::CompileSettings {
+  bool generateDebugInfo;
+  bool hlsl16BitTypes;
+  shaderc_optimization_level optimizationLevel;  // Of the compiler. The optimizer runs afterward.
+  spv_target_env optimizerTargetEnvironment;
+};
+
+const Shader::CompileSettings Shader::compileSettings{
+  .generateDebugInfo          = true,  // Reflection reads the names from the debug info
+  .hlsl16BitTypes             = true,
+  .optimizationLevel          = shaderc_optimization_level_zero,
+  .optimizerTargetEnvironment = SPV_ENV_UNIVERSAL_1_0
+};
+
+const shaderc::Compiler Shader::compiler{};
+
+void Shader::configure(shaderc::CompileOptions& options) {
+  if (compileSettings.generateDebugInfo) options.SetGenerateDebugInfo();
+  options.SetHlsl16BitTypes(compileSettings.hlsl16BitTypes);
+  options.SetOptimizationLevel(compileSettings.optimizationLevel);
+}
+
+void Shader::configure(spvtools::Optimizer& optimizer) {
+  optimizer.RegisterSizePasses();
+  optimizer.RegisterPerformancePasses();
+}
+
+const std::string& Shader::getCompileDescription() {
+  static const std::string description = [] {
+    std::string description = std::string("debug info: ") + (compileSettings.generateDebugInfo ? "on" : "off") +
+                              ", HLSL 16 bit types: " + (compileSettings.hlsl16BitTypes ? "on" : "off") +
+                              ", optimization level: " + std::to_string(compileSettings.optimizationLevel) +
+                              ", optimizer target environment: " + spvTargetEnvDescription(compileSettings.optimizerTargetEnvironment) +
+                              ", SPIRV-Tools: " + spvSoftwareVersionDetailsString() + ", passes:";
+    spvtools::Optimizer optimizer{compileSettings.optimizerTargetEnvironment};
+    configure(optimizer);
+    for (const char* pass: optimizer.GetPassNames()) description.append(" ").append(pass);
+    return description;
+  }();
+  return description;
+}
+
 Shader::Shader(GraphicsDevice* const device, yyjson_val* obj) : device(device) {
   // Source file path
   sourcePath = yyjson_get_str(yyjson_obj_get(obj, "source"));
@@ -88,12 +140,7 @@ Shader::Shader(GraphicsDevice* const device, yyjson_val* obj) : device(device) {
 }
 
 Shader::Shader(GraphicsDevice* const device, const std::filesystem::path& sourcePath) : device(device), sourcePath(sourcePath) {
-  /**@todo: Use one global compiler and one global optimizer.
-   *   - Switch to Slang.
-   */
-  const shaderc::Compiler compiler;
-  shaderc::CompileOptions compilerOptions;
-  compilerOptions.SetIncluder(std::make_unique<Includer>());
+  /**@todo: Switch to Slang.*/
   shaderc_shader_kind shaderKind;
   switch (Tools::hash(sourcePath.extension().string())) {
     case Tools::hash(".hlsl"):
@@ -117,42 +164,48 @@ Shader::Shader(GraphicsDevice* const device, const std::filesystem::path& source
   std::string contents;
   if (!readFile(sourcePath, contents)) GraphicsInstance::showError("failed to read file: '" + sourcePath.string() + "'");
 
-  // Compile with debug info and reflection data
-  compilerOptions.SetGenerateDebugInfo();
-  compilerOptions.SetHlsl16BitTypes(true);
-  compilerOptions.SetOptimizationLevel(shaderc_optimization_level_zero);
-  const shaderc::CompilationResult compilationResult = compiler.CompileGlslToSpv(contents.c_str(), contents.size(), shaderKind, sourcePath.string().data(), compilerOptions);
-  if (compilationResult.GetNumErrors() > 0) GraphicsInstance::showError(compilationResult.GetErrorMessage());
-  code = {compilationResult.cbegin(), compilationResult.cend()};
-  if (code.empty()) GraphicsInstance::showError("failed to compile shader '" + sourcePath.string() + "'");
+  // Which files are included is only known after compiling, so they are checked against the hashes stored with the cached code instead of being part of the key.
+  const std::uint64_t key = Tools::hash(sourcePath.string(), contents, shaderKind, getCompileDescription(), CacheHeader::Version);
+  std::vector<uint32_t> optimizedCode;
+  if (!readCache(key, optimizedCode)) {
+    // Compile with debug info and reflection data
+    includes.clear();
+    shaderc::CompileOptions compilerOptions;
+    compilerOptions.SetIncluder(std::make_unique<Includer>(includes));
+    configure(compilerOptions);
+    const shaderc::CompilationResult compilationResult = compiler.CompileGlslToSpv(contents.c_str(), contents.size(), shaderKind, sourcePath.string().data(), compilerOptions);
+    if (compilationResult.GetNumErrors() > 0) GraphicsInstance::showError(compilationResult.GetErrorMessage());
+    code = {compilationResult.cbegin(), compilationResult.cend()};
+    if (code.empty()) {
+      GraphicsInstance::showError("failed to compile shader '" + sourcePath.string() + "'");
+      return;  // Leaves <c>module</c> null
+    }
+
+    // Apply optimization passes before using in VkShaderModule
+    spvtools::Optimizer optimizer{compileSettings.optimizerTargetEnvironment};
+    optimizer.SetMessageConsumer([](const spv_message_level_t level, const char* source, const spv_position_t& position, const char* message) {
+      GraphicsInstance::showError("During shader optimization: " + std::to_string(level) + "\n\t" + source + ":" + std::to_string(position.line) + ":" + std::to_string(position.column) + "\n\t" + message);
+    });
+    configure(optimizer);
+    if (!optimizer.Run(code.data(), code.size(), &optimizedCode)) {
+      GraphicsInstance::showError("failed to optimize shader '" + sourcePath.string() + "'");
+      optimizedCode = code;  // Not cached, so that it is optimized again next time
+    } else writeCache(key, optimizedCode);
+  }
 
+  // Reflect the unoptimized code, as the optimizer strips the names that reflection reports.
   reflectionData = spv_reflect::ShaderModule(code.size() * sizeof(decltype(code)::value_type), code.data());
   stage          = static_cast<VkShaderStageFlagBits>(reflectionData.GetShaderStage());
   entryPoint     = reflectionData.GetEntryPointName();
 
-  // Apply optimization passes before using in VkShaderModule
-  const spv_message_consumer consumer = [](const spv_message_level_t level, const char* source, const spv_position_t* position, const char* message) {
-    GraphicsInstance::showError("During shader optimization: " + std::to_string(level) + "\n\t" + source + ":" + std::to_string(position->line) + ":" + std::to_string(position->column) + "\n\t" + message);
-  };
-  spv_optimizer_t* optimizer = spvOptimizerCreate(SPV_ENV_UNIVERSAL_1_0);
-  const spv_optimizer_options optimizerOptions = spvOptimizerOptionsCreate();
-  spvOptimizerRegisterSizePasses(optimizer);
-  spvOptimizerRegisterPerformancePasses(optimizer);
-  spvOptimizerSetMessageConsumer(optimizer, consumer);
-  spv_binary binary;
-  spvOptimizerRun(optimizer, code.data(), code.size(), &binary, optimizerOptions);
-  spvOptimizerDestroy(optimizer);
-  spvOptimizerOptionsDestroy(optimizerOptions);
-
   const VkShaderModuleCreateInfo shaderModuleCreateInfo {
       .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
       .pNext = nullptr,
       .flags = 0,
-      .codeSize = binary->wordCount * sizeof(std::remove_pointer_t<decltype(binary->code)>),
-      .pCode = binary->code
+      .codeSize = optimizedCode.size() * sizeof(decltype(optimizedCode)::value_type),
+      .pCode = optimizedCode.data()
   };
   if (const VkResult result = vkCreateShaderModule(device->device, &shaderModuleCreateInfo, nullptr, &module); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create shader module");
-  spvBinaryDestroy(binary);
 
 #if VK_EXT_debug_utils & BOOTANICAL_GARDENS_ENABLE_VULKAN_DEBUG_UTILS
   if (GraphicsInstance::extensionEnabled(Tools::hash(VK_EXT_DEBUG_UTILS_EXTENSION_NAME))) {
@@ -173,6 +226,86 @@ Shader::~Shader() {
   module = VK_NULL_HANDLE;
 }
 
+std::filesystem::path Shader::getCachePath(const std::uint64_t key) const {
+  return device->resourcesDirectory / "cache" / "shaders" / (std::to_string(key) + ".spv");
+}
+
+bool Shader::readCache(const std::uint64_t key, std::vector<uint32_t>& optimizedCode) {
+  std::ifstream stream{getCachePath(key), std::ios_base::binary};
+  if (!stream.is_open()) return false;
+  CacheHeader header{};
+  stream.read(reinterpret_cast<char*>(&header), sizeof(CacheHeader));
+  if (!stream || header.magic != CacheHeader::Magic || header.key != key || header.codeSize == 0 || header.optimizedCodeSize == 0) return false;
+  includes.clear();
+  for (std::uint32_t i{}; i < header.includeCount; ++i) {
+    std::uint64_t hash{};
+    std::uint32_t pathLength{};
+    stream.read(reinterpret_cast<char*>(&hash), sizeof(hash));
+    stream.read(reinterpret_cast<char*>(&pathLength), sizeof(pathLength));
+    std::string path(pathLength, '\0');
+    stream.read(path.data(), pathLength);
+    std::string contents;
+    if (!stream || !readFile(path, contents) || Tools::hash(contents) != hash) return false;
+    includes.emplace_back(std::move(path));
+  }
+  code.resize(header.codeSize);
+  optimizedCode.resize(header.optimizedCodeSize);
+  stream.read(reinterpret_cast<char*>(code.data()), static_cast<std::streamsize>(code.size() * sizeof(uint32_t)));
+  stream.read(reinterpret_cast<char*>(optimizedCode.data()), static_cast<std::streamsize>(optimizedCode.size() * sizeof(uint32_t)));
+  if (stream) return true;
+  code.clear();
+  optimizedCode.clear();
+  return false;
+}
+
+void Shader::writeCache(const std::uint64_t key, const std::span<const uint32_t> optimizedCode) const {
+  // The cache only saves time, so failing to write it is not worth reporting.
+  const std::filesystem::path path = getCachePath(key);
+  std::error_code error;
+  std::filesystem::create_directories(path.parent_path(), error);
+  std::filesystem::path temporaryPath = path;
+  temporaryPath += ".tmp";
+  std::ofstream stream{temporaryPath, std::ios_base::trunc | std::ios_base::binary};
+  const CacheHeader header {
+    .magic             = CacheHeader::Magic,
+    .includeCount      = static_cast<std::uint32_t>(includes.size()),
+    .key               = key,
+    .codeSize          = code.size(),
+    .optimizedCodeSize = optimizedCode.size()
+  };
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+  for (const std::filesystem::path& include: includes) {
+    std::string contents;
+    readFile(include, contents);
+    const std::uint64_t hash      = Tools::hash(contents);
+    const std::string includePath = include.string();
+    const auto pathLength         = static_cast<std::uint32_t>(includePath.size());
+    stream.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+    stream.write(reinterpret_cast<const char*>(&pathLength), sizeof(pathLength));
+    stream.write(includePath.data(), pathLength);
+  }
+  stream.write(reinterpret_cast<const char*>(code.data()), static_cast<std::streamsize>(code.size() * sizeof(uint32_t)));
+  stream.write(reinterpret_cast<const char*>(optimizedCode.data()), static_cast<std::streamsize>(optimizedCode.size() * sizeof(uint32_t)));
+  stream.close();
+  if (stream) std::filesystem::rename(temporaryPath, path, error);
+  else std::filesystem::remove(temporaryPath, error);
+}
+
+void Shader::swap(Shader& other) noexcept {
+  std::swap(sourcePath, other.sourcePath);
+  std::swap(includes, other.includes);
+  std::swap(code, other.code);
+  std::swap(stage, other.stage);
+  std::swap(bindPoint, other.bindPoint);
+  std::swap(module, other.module);
+  std::swap(entryPoint, other.entryPoint);
+  std::swap(reflectionData, other.reflectionData);
+}
+
+bool Shader::dependsOn(const std::filesystem::path& file) const {
+  return file == sourcePath || std::ranges::contains(includes, file);
+}
+
 void Shader::save(yyjson_mut_doc* doc, yyjson_mut_val* obj) const {
   // Start fresh
   yyjson_mut_obj_clear(obj);
@@ -194,6 +327,7 @@ void Shader::save(yyjson_mut_doc* doc, yyjson_mut_val* obj) const {
   yyjson_mut_obj_add_strcpy(doc, epObj, "name", entryPoint.c_str());
 }
 
+const std::filesystem::path& Shader::getSourcePath() const { return sourcePath; }
 VkShaderStageFlagBits Shader::getStage() const { return stage; }
 VkPipelineBindPoint Shader::getBindPoint() const { return bindPoint; }
 VkShaderModule Shader::getModule() const { return module; }
@@ -3,7 +3,10 @@
 #include "../GraphicsDevice.hpp"
 
 #include <spirv_reflect.h>
+#include <cstdint>
 #include <filesystem>
+#include <span>
+#include <string>
 
 struct yyjson_mut_doc;
 struct yyjson_mut_val;
@@ -11,11 +14,44 @@ struct yyjson_mut_val;
 class Pipeline;
 class GraphicsDevice;
 class Resource;
+namespace shaderc { class Compiler; class CompileOptions; }
+namespace spvtools { class Optimizer; }
 
 class Shader {
+  /**
+   * Precedes each compiled shader in the cache. It is followed by the included files, each as the hash of its contents, the length of
+   * its path and its path, and then by the unoptimized and the optimized code.
+   */
+  struct CacheHeader {
+    static constexpr std::uint32_t Magic   = 0x43534742;  // "BGSC"
+    static constexpr std::uint32_t Version = 2;  // Must be bumped whenever the layout of the cache files changes.
+
+    std::uint32_t magic;
+    std::uint32_t includeCount;
+    std::uint64_t key;
+    std::uint64_t codeSize;
+    std::uint64_t optimizedCodeSize;
+  };
+
+  // Every setting that shaders are compiled and optimized with, other than the optimization passes
+  struct CompileSettings;
+  static const CompileSettings compileSettings;
+
+  // Compiling with a shaderc::Compiler is thread-safe, so every Shader shares this one.
+  static const shaderc::Compiler compiler;
+
+  static void configure(shaderc::CompileOptions& options);
+  static void configure(spvtools::Optimizer& optimizer);
+  /**
+   * @return A canonical description of <c>compileSettings</c> and of the passes of the optimizer. It is part of every cache key, so
+   * changing how shaders are compiled never loads code that was compiled differently.
+   */
+  [[nodiscard]] static const std::string& getCompileDescription();
+
   GraphicsDevice* const device;
 
   std::filesystem::path sourcePath;
+  std::vector<std::filesystem::path> includes;  // Every file that the source includes, directly or through other included files
   std::vector<uint32_t> code;  /**@todo: Avoid keeping the shader code in memory.*/
   VkShaderStageFlagBits stage{};
   VkPipelineBindPoint bindPoint{};
@@ -23,13 +59,33 @@ class Shader {
   std::string entryPoint;
   spv_reflect::ShaderModule reflectionData;
 
+  [[nodiscard]] std::filesystem::path getCachePath(std::uint64_t key) const;
+  /**
+   * Loads the compiled code stored under <c>key</c> into <c>code</c> and <c>optimizedCode</c>.
+   * @return <c>false</c> if nothing is stored under <c>key</c>, or if any file that the stored code includes has changed since.
+   */
+  bool readCache(std::uint64_t key, std::vector<uint32_t>& optimizedCode);
+  void writeCache(std::uint64_t key, std::span<const uint32_t> optimizedCode) const;
+
 public:
   explicit Shader(GraphicsDevice* device, yyjson_val* obj);
   explicit Shader(GraphicsDevice* device, const std::filesystem::path& sourcePath);
   ~Shader();
 
+  /**
+   * Exchanges everything but the GraphicsDevice with <c>other</c>. This lets a recompiled Shader replace this one without moving it,
+   * so everything that points at this Shader sees the new code.
+   */
+  void swap(Shader& other) noexcept;
+  /**
+   * @param file A canonical path
+   * @return <c>true</c> if <c>file</c> is the source of this Shader or is included by it
+   */
+  [[nodiscard]] bool dependsOn(const std::filesystem::path& file) const;
+
   void save(yyjson_mut_doc* doc, yyjson_mut_val* obj) const;
 
+  [[nodiscard]] const std::filesystem::path& getSourcePath() const;
   [[nodiscard]] VkShaderStageFlagBits getStage() const;
   [[nodiscard]] VkPipelineBindPoint getBindPoint() const;
   [[nodiscard]] VkShaderModule getModule() const;
@@ -19,5 +19,8 @@ VertexProcess VertexProcess::jsonGet(GraphicsDevice* device, yyjson_val* jsonDat
   vertexProcess.cullMode = magic_enum::enum_cast<VkCullModeFlagBits>(enumValue).value_or(VK_CULL_MODE_BACK_BIT);
   yyjson_ptr_get_str(jsonData, "/frontFace", &enumValue);
   vertexProcess.frontFace = magic_enum::enum_cast<VkFrontFace>(enumValue).value_or(VK_FRONT_FACE_CLOCKWISE);
+  enumValue = nullptr;
+  yyjson_ptr_get_str(jsonData, "/vertexLayout", &enumValue);
+  vertexProcess.vertexLayout = enumValue == nullptr ? Vertex::Layout::Separate : magic_enum::enum_cast<Vertex::Layout>(enumValue).value_or(Vertex::Layout::Separate);
   return vertexProcess;
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "src/RenderEngine/MeshGroup/Vertex.hpp"
+
 #include <vulkan/vulkan_core.h>
 
 class GraphicsDevice;
@@ -14,6 +16,7 @@ struct VertexProcess {
   VkBool32 primitiveRestartEnable = VK_FALSE;
   VkCullModeFlags cullMode        = VK_CULL_MODE_BACK_BIT;
   VkFrontFace frontFace           = VK_FRONT_FACE_CLOCKWISE;
+  Vertex::Layout vertexLayout     = Vertex::Layout::Separate;
 
   static VertexProcess jsonGet(GraphicsDevice* device, yyjson_val* jsonData);
 };
\ No newline at end of file
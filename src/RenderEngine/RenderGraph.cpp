@@ -2,12 +2,14 @@
 
 #include "MeshGroup/Texture.hpp"
 #include "src/Game/Game.hpp"
+#include "src/JobSystem.hpp"
 #include "src/RenderEngine/CommandBuffer.hpp"
 #include "src/RenderEngine/GraphicsDevice.hpp"
 #include "Pipeline/Pipeline.hpp"
 #include "src/RenderEngine/RenderPass/RenderPass.hpp"
 #include "src/RenderEngine/MeshGroup/Material.hpp"
 #include "src/RenderEngine/MeshGroup/Mesh.hpp"
+#include "src/RenderEngine/Pipeline/Shader.hpp"
 #include "src/RenderEngine/Resources/Image.hpp"
 #include "src/RenderEngine/Resources/UniformBuffer.hpp"
 #include "src/RenderEngine/Window.hpp"
@@ -15,12 +17,64 @@
 
 #include <volk/volk.h>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <deque>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <ranges>
+#include <utility>
 #include <vector>
 
-RenderGraph::PerFrameData::PerFrameData(GraphicsDevice* const device, const RenderGraph& graph) : device(device), graph(graph) {
+struct RenderGraph::PerFrameData::PassData {
+  GraphicsDevice* const device;
+  VkCommandPool commandPool{VK_NULL_HANDLE};
+  std::vector<VkCommandBuffer> secondaryCommandBuffers;
+  CommandBuffer commands;
+  CommandBuffer::State state;
+
+  explicit PassData(GraphicsDevice* const device) : device(device) {
+    const VkCommandPoolCreateInfo commandPoolCreateInfo{
+        .sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .pNext            = nullptr,
+        .flags            = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = device->globalQueueFamilyIndex
+    };
+    if (const VkResult result = vkCreateCommandPool(device->device, &commandPoolCreateInfo, nullptr, &commandPool); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create command pool");
+  }
+  PassData(const PassData&) = delete;
+  PassData& operator=(const PassData&) = delete;
+  ~PassData() { vkDestroyCommandPool(device->device, commandPool, nullptr); }
+
+  /**
+   * Records, preprocesses and bakes the commands of <c>renderPass</c>. Barriers against earlier passes are deferred to the seams.
+   */
+  void record(RenderPass& renderPass) {
+    commands.clear();
+    renderPass.execute(commands);
+    state = commands.preprocess({.deferEntryBarriers=true});
+    // The fence of this frame has been waited on, so nothing recorded from this pool is still in use.
+    if (const VkResult result = vkResetCommandPool(device->device, commandPool, 0); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to reset command pool");
+    if (const std::size_t count = commands.getRenderPassCount(); count > secondaryCommandBuffers.size()) {
+      const std::size_t previousCount = secondaryCommandBuffers.size();
+      secondaryCommandBuffers.resize(count);
+      const VkCommandBufferAllocateInfo commandBufferAllocateInfo{
+          .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+          .pNext              = nullptr,
+          .commandPool        = commandPool,
+          .level              = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+          .commandBufferCount = static_cast<uint32_t>(count - previousCount)
+      };
+      if (const VkResult result = vkAllocateCommandBuffers(device->device, &commandBufferAllocateInfo, &secondaryCommandBuffers[previousCount]); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to allocate command buffers");
+    }
+    commands.bakeSecondary(secondaryCommandBuffers);
+  }
+};
+
+RenderGraph::PerFrameData::PerFrameData(GraphicsDevice* const device, const RenderGraph& graph) : device(device), graph(graph), commands(std::make_shared<CommandBuffer>()), seams(std::make_shared<CommandBuffer>()) {
   /****************************************
    * Initialize Command Recording Objects *
    ****************************************/
@@ -50,45 +104,48 @@ RenderGraph::PerFrameData::PerFrameData(GraphicsDevice* const device, const Rend
   };
   if (const VkResult result = vkCreateSemaphore(device->device, &semaphoreCreateInfo, nullptr, &frameDataSemaphore); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create semaphore");
   if (const VkResult result = vkCreateSemaphore(device->device, &semaphoreCreateInfo, nullptr, &frameFinishedSemaphore); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create semaphore");
-  constexpr VkFenceCreateInfo fenceCreateInfo {
-      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-      .pNext = nullptr,
-      .flags = VK_FENCE_CREATE_SIGNALED_BIT
-  };
-  if (const VkResult result = vkCreateFence(device->device, &fenceCreateInfo, nullptr, &renderFence); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create fence");
 }
 
+RenderGraph::PerFrameData::PerFrameData(PerFrameData&& other) noexcept
+    : device(other.device),
+      graph(other.graph),
+      commandPool(std::exchange(other.commandPool, VK_NULL_HANDLE)),
+      commandBuffer(std::exchange(other.commandBuffer, VK_NULL_HANDLE)),
+      commands(std::move(other.commands)),
+      seams(std::move(other.seams)),
+      passes(std::move(other.passes)),
+      frameFinishedSemaphore(std::exchange(other.frameFinishedSemaphore, VK_NULL_HANDLE)),
+      frameDataSemaphore(std::exchange(other.frameDataSemaphore, VK_NULL_HANDLE)),
+      timelineValue(std::exchange(other.timelineValue, 0)),
+      descriptorSet(std::move(other.descriptorSet)),
+      descriptorSetLayout(std::move(other.descriptorSetLayout)) {}
+
 RenderGraph::PerFrameData::~PerFrameData() {
+  device->waitForTimeline(device->graphicsTimeline, timelineValue);
   vkDestroyCommandPool(device->device, commandPool, nullptr);
-  vkQueueWaitIdle(device->globalQueue);
   vkDestroySemaphore(device->device, frameFinishedSemaphore, nullptr);
   vkDestroySemaphore(device->device, frameDataSemaphore, nullptr);
-  vkDestroyFence(device->device, renderFence, nullptr);
 }
 
-uint8_t RenderGraph::FRAMES_IN_FLIGHT = 2;
-
-RenderGraph::RenderGraph(GraphicsDevice* const device) : device(device) {
+RenderGraph::RenderGraph(GraphicsDevice* const device, const std::uint8_t framesInFlight) : framesInFlight(framesInFlight), device(device) {
   // Build frame data
-  frames.reserve(FRAMES_IN_FLIGHT);
-  for (uint32_t i{}; i < FRAMES_IN_FLIGHT; ++i) frames.emplace_back(device, *this);
+  frames.reserve(framesInFlight);
+  for (uint32_t i{}; i < framesInFlight; ++i) frames.emplace_back(device, *this);
 
   uniformBuffer = std::make_shared<UniformBuffer<GraphData>>(device, "RenderGraph UniformBuffer");
 }
 
 RenderGraph::~RenderGraph() {
-  // Wait for all submitted frames in this graph to finish rendering so that the resources can be freed.
-  std::vector<VkFence> fences(frames.size());
-  for (uint32_t i{}; i < frames.size(); ++i) fences[i] = frames[i].renderFence;
-  if (const VkResult result = vkWaitForFences(device->device, fences.size(), fences.data(), VK_TRUE, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::seconds(1U)).count()); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to wait for fences");
+  // Wait for all submitted frames in this graph to finish rendering so that the resources can be freed. Frames finish in order, so waiting for the last one is enough.
+  const std::uint64_t lastValue = std::ranges::max(frames | std::ranges::views::transform(&PerFrameData::timelineValue));
+  if (!device->waitForTimeline(device->graphicsTimeline, lastValue, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::seconds(1U)).count())) GraphicsInstance::showError("timed out waiting for frames to finish");
 }
 
 void RenderGraph::setResolutionGroup(const std::string_view& name, const VkExtent3D resolution, const VkSampleCountFlags sampleCount) {
   ResolutionGroupProperties& group = resolutionGroups[getResolutionGroupId(name)];
   group.resolution = resolution;
   group.sampleCount = sampleCount;
-  for (ImageID attachmentId : group.attachments) if (std::weak_ptr<Image> image = images[attachmentId].image; !image.expired()) image.lock()->rebuild(resolution, sampleCount);
-  outOfDate = true;
+  outOfDate = true;  // The images of this group are rebuilt by the next bake.
 }
 
 RenderGraph::ResolutionGroupProperties RenderGraph::getResolutionGroup(const ResolutionGroupID id) const {
@@ -132,217 +189,92 @@ bool RenderGraph::combineImageAccesses(ImageAccess& dst, const ImageAccess& src)
 
 /**
  * Guarantees that the RenderGraph is baked. If the RenderGraph is not out-of-date, then no baking will actually occur.
- *
- * @todo: Needs heavy optimization. This function's high speed will be crucial for avoiding hitches or objects popping in. This function should be heavily threaded.
+ * Baking runs in stages, each of which only rebuilds the objects whose inputs have changed since they were last baked. Resizing a
+ * resolution group only rebuilds its images and the render passes that use them, and pipelines are only rebuilt when their render
+ * pass, descriptor set layouts or shaders change. Independent objects within a stage are built on the JobSystem.
  *
  * @return <c>true</c> if baking actually happened, <c>false</c> otherwise.
  */
 bool RenderGraph::bake() {
-  if (!outOfDate) return false;
+  if (!outOfDate && bakedReloadCount == device->reloadCount) return false;
+  // Objects that are about to be replaced or rewritten may still be in use by frames in flight.
+  std::uint64_t lastValue;
+  {
+    std::lock_guard lock{device->globalQueueMutex};
+    lastValue = device->graphicsTimelineValue;
+  }
+  device->waitForTimeline(device->graphicsTimeline, lastValue);
+
   /*************************
    * Process Render Passes *
    *************************/
-  {
-    // Understand how attachments are used across RenderPasses
-    std::unordered_map<RenderPass*, std::vector<ImageID>> pass2id;
-    std::unordered_map<ImageID, std::vector<std::pair<RenderPass*, ImageAccess>>> id2decl;
-    std::unordered_map<ImageID, VkImageUsageFlags> usages {
-      {getImageId(RenderColor), VK_IMAGE_USAGE_TRANSFER_SRC_BIT}
-    };
-    for (const std::shared_ptr<RenderPass>& renderPass : renderPasses) {
-      renderPass->setup();
-      std::vector<std::pair<ImageID, ImageAccess>> accesses = renderPass->getImageAccesses();
-      std::vector<ImageID> ids;
-      for (auto& [id, access] : accesses) {
-        usages[id] |= access.usage;
-        if (!images.contains(id))
-          continue;
-        id2decl[id].emplace_back(renderPass.get(), access);
-        ids.push_back(id);
-      }
-      pass2id[renderPass.get()] = ids;
-    }
-    buildImages(usages);
-
-    // Bake RenderPasses
-    for (const std::shared_ptr<RenderPass>& renderPass : renderPasses) {
-      const std::vector<ImageID>& renderPassAttachmentIDs = pass2id.at(renderPass.get());
-      std::vector<VkAttachmentDescription> descriptions;
-      descriptions.reserve(renderPassAttachmentIDs.size());
-      std::vector<const Image*> attachments;
-      attachments.reserve(renderPassAttachmentIDs.size());
-      for (const ImageID& id: renderPassAttachmentIDs) {
-        /**@todo: Add support for aliasing attachments.*/
-        /**@todo: Add support for reordering render passes.*/
-        const Image* image = getImage(id).image.get();
-        std::vector<std::pair<RenderPass*, ImageAccess>>& attachmentDeclarations = id2decl.at(id);
-        // Find this renderpass in the declarations of this attachment.
-        const auto thisIt = std::ranges::find(attachmentDeclarations, renderPass.get(), &decltype(id2decl)::mapped_type::value_type::first);
-        /**@todo: Optimize load and store ops.*/
-        /**@todo: Log an error if the format does not include a stencil buffer, but the stencilLoadOp or stencilStoreOp are not DONT_CARE.*/
-        const ImageAccess& thisDeclaration = thisIt->second;
-        descriptions.push_back({
-            .flags = 0U,
-            .format = image->getFormat(),
-            .samples = static_cast<VkSampleCountFlagBits>(image->getSampleCount()),
-            .loadOp = thisDeclaration.loadOp,
-            .storeOp = thisDeclaration.storeOp,
-            .stencilLoadOp = thisDeclaration.stencilLoadOp,
-            .stencilStoreOp = thisDeclaration.stencilStoreOp,
-            .initialLayout = thisDeclaration.layout,
-            .finalLayout = thisDeclaration.layout
-        });
-        attachments.push_back(image);
-      }
-      renderPass->bake(descriptions, attachments);
-      if (renderPass->compatibility == -1U) GraphicsInstance::showError("`RenderPass::bake()` failed to update the RenderPass compatibility.");
-    }
-
-    for (Material& material : device->materials | std::ranges::views::values) {
-      if (std::weak_ptr<Texture> albedo = material.albedoTexture; !albedo.expired()) {
-        std::shared_ptr<Texture> tex = albedo.lock();
-        images[Tools::hash(tex.get())] = {
-          .resolutionGroup = getResolutionGroupId(VoidResolutionGroup),
-          .format = tex->getFormat(),
-          .inheritSampleCount = false,
-          .image = tex,
-          .name = material.name + " | Albedo Texture"
-        };
-      }
-      if (std::weak_ptr<Texture> const normal = material.normalTexture; !normal.expired()) {
-        std::shared_ptr<Texture> tex = normal.lock();
-        images[Tools::hash(tex.get())] = {
-          .resolutionGroup = getResolutionGroupId(VoidResolutionGroup),
-          .format = tex->getFormat(),
-          .inheritSampleCount = false,
-          .image = tex,
-          .name = material.name + " | Normal Texture"
-        };
-      }
-    }
-  }
+  const AttachmentDeclarations declarations = setupRenderPasses();
+  buildImages(declarations);
+  bakeRenderPasses(declarations);
+  registerMaterialTextures();
 
   /***************************
    * Process Descriptor Sets *
    ***************************/
-  // Compute the descriptor set requirements
+  // Compute the descriptor set requirements. Materials record their bindings while doing so, so this is not threaded.
   std::map<DescriptorSetRequirer*, std::vector<VkDescriptorSetLayoutBinding>> requirements;
   for (const std::shared_ptr<RenderPass>& renderPass: renderPasses) {
     for (Pipeline* pipeline: renderPass->getPipelines() | std::ranges::views::values) {
       pipeline->getMaterial()->computeDescriptorSetRequirements(requirements, renderPass.get(), pipeline);
     }
   }
-  std::size_t i = std::numeric_limits<std::size_t>::max();
-  std::map<DescriptorSetRequirer*, std::size_t> requirementIndices;
-  for (DescriptorSetRequirer* requirer: requirements | std::ranges::views::keys) requirementIndices[requirer] = ++i;
-  auto perSetDescriptorBindings = requirements | std::ranges::views::values;
-
-  // Create VkDescriptorSetLayout objects
-  std::vector<VkDescriptorSetLayout> layouts(perSetDescriptorBindings.size());
-  VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo {
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-      .pNext = nullptr,
-      .flags = 0
-  };
-  i = std::numeric_limits<std::size_t>::max();
-  for (const std::vector<VkDescriptorSetLayoutBinding>& bindings: perSetDescriptorBindings) {
-    descriptorSetLayoutCreateInfo.bindingCount = bindings.size();
-    descriptorSetLayoutCreateInfo.pBindings = bindings.data();
-    if (const VkResult result = vkCreateDescriptorSetLayout(device->device, &descriptorSetLayoutCreateInfo, nullptr, &layouts[++i]); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create descriptor set layout");
-  }
+  std::vector<DescriptorSetRequirer*> changed;
+  const std::map<DescriptorSetRequirer*, VkDescriptorSetLayout> layouts = bakeDescriptorSetLayouts(requirements, changed);
 
   /*****************************************
    * Process Materials and Their Pipelines *
    * ***************************************/
-  std::deque<std::tuple<void*, std::function<void(void*)>>> miscMemoryPool;
-  VkDescriptorSetLayout frameDataLayout = requirementIndices.contains(nullptr) ? layouts.at(requirementIndices.at(nullptr)) : VK_NULL_HANDLE;
-  {  // Bake pipelines
-    std::vector<VkGraphicsPipelineCreateInfo> pipelineCreateInfos;
-    std::vector<VkPipeline*> pipelines;
-    std::vector<VkDescriptorSetLayout> setLayouts;
-    setLayouts.reserve(3);
-    for (const std::shared_ptr<RenderPass>& renderPass : renderPasses) {
-      for (Pipeline* pipeline : renderPass->getPipelines() | std::views::values) {
-        setLayouts.clear();
-        if (frameDataLayout) setLayouts.emplace_back(frameDataLayout);
-        if (requirementIndices.contains(renderPass.get())) setLayouts.emplace_back(layouts.at(requirementIndices.at(renderPass.get())));
-        if (requirementIndices.contains(pipeline)) setLayouts.emplace_back(layouts.at(requirementIndices.at(pipeline)));
-        pipeline->bake(renderPass, 0, setLayouts, miscMemoryPool, pipelineCreateInfos, pipelines);
-      }
-    }
-    std::vector<VkPipeline> tempPipelines(pipelines.size());
-    if (!pipelines.empty())
-      if (const VkResult result = vkCreateGraphicsPipelines(device->device, VK_NULL_HANDLE, pipelineCreateInfos.size(), pipelineCreateInfos.data(), nullptr, tempPipelines.data()); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create graphics pipelines");
-    for (uint32_t j{}; j < tempPipelines.size(); ++j) *pipelines.at(j) = tempPipelines.at(j);
-    for (const auto& [mem, deleter]: miscMemoryPool) deleter(mem);
-    miscMemoryPool.clear();
-  }
+  bakePipelines(layouts);
 
   /*****************************
    * Build the Descriptor Sets *
    *****************************/
-  std::vector<std::shared_ptr<VkDescriptorSet>> descriptorSets;
-  {  // Allocate descriptor sets
-    std::vector<VkDescriptorSetLayout> framesInFlightLayouts;
-    framesInFlightLayouts.reserve(layouts.size() * FRAMES_IN_FLIGHT);  // One layout for each descriptor set for each frame in flight
-    for (const VkDescriptorSetLayout& layout : layouts) for (int j = 0; j < FRAMES_IN_FLIGHT; ++j) framesInFlightLayouts.push_back(layout);
-    std::vector<std::vector<VkDescriptorSetLayoutBinding>> framesInFlightBindings;
-    framesInFlightBindings.reserve(layouts.size() * FRAMES_IN_FLIGHT);
-    for (const std::vector<VkDescriptorSetLayoutBinding>& bindings : perSetDescriptorBindings) for (int j = 0; j < FRAMES_IN_FLIGHT; ++j) framesInFlightBindings.push_back(bindings);
-    descriptorSets = device->descriptorSetAllocator.allocate(framesInFlightBindings, framesInFlightLayouts);
-  }
-
-  {  // Assign descriptor sets
-    std::vector<VkWriteDescriptorSet> writes;
-    for (auto& [descriptorSetRequirer, index]: requirementIndices) {
-      auto start = static_cast<decltype(descriptorSets)::difference_type>(index) * FRAMES_IN_FLIGHT + descriptorSets.begin();
-      if (descriptorSetRequirer) {
-        descriptorSetRequirer->setDescriptorSets(std::span{start, start + FRAMES_IN_FLIGHT}, layouts[index]);
-        descriptorSetRequirer->writeDescriptorSets(miscMemoryPool, writes, *this);
-      }
-      else if (frameDataLayout) {
-        auto layout = std::shared_ptr<VkDescriptorSetLayout>(new VkDescriptorSetLayout(frameDataLayout), [this](const VkDescriptorSetLayout* layout) {
-          vkDestroyDescriptorSetLayout(device->device, *layout, nullptr);
-          delete layout;
-        });
-        for (uint32_t j{}; j < frames.size(); ++j) {
-          frames.at(j).descriptorSet = *(start + j);
-          frames.at(j).descriptorSetLayout = layout;
-        }
-      }
-    }
-    vkUpdateDescriptorSets(device->device, writes.size(), writes.data(), 0, nullptr);
-    for (const auto& [mem, deleter]: miscMemoryPool) deleter(mem);
-    miscMemoryPool.clear();
-  }
+  buildDescriptorSets(requirements, layouts, changed);
 
-  outOfDate = false;
+  outOfDate        = false;
+  bakedReloadCount = device->reloadCount;
   return true;
 }
 
 VkSemaphore RenderGraph::waitForNextFrameData() const {
   const PerFrameData& frameData = getPerFrameData();
-  if (const VkResult result = vkWaitForFences(device->device, 1, &frameData.renderFence, true, UINT64_MAX); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to wait for fence");
-  if (const VkResult result = vkResetFences(device->device, 1, &frameData.renderFence); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to reset fence");
+  device->waitForTimeline(device->graphicsTimeline, frameData.timelineValue);
   return frameData.frameDataSemaphore;
 }
 
 void RenderGraph::update() const {
+  // This frame's last use of the instance buffers has been waited for, so they are free to be written.
+  auto commandBuffer = std::make_unique<CommandBuffer>();
+  for (Mesh& mesh: device->meshes | std::ranges::views::values) mesh.update(*commandBuffer, getFrameIndex(), framesInFlight);
+  if (!commandBuffer->empty()) device->upload(std::move(commandBuffer));
   for (const std::shared_ptr<RenderPass>& renderPass : renderPasses)
     renderPass->update();
   uniformBuffer->update({static_cast<uint32_t>(frameNumber), static_cast<float>(Game::getTime())});
 }
 
 void RenderGraph::execute(const std::shared_ptr<Image>& swapchainImage, VkSemaphore semaphore) {
-  CommandBuffer commandBuffer;
-  for (const std::shared_ptr<RenderPass>& renderPass: renderPasses) renderPass->execute(commandBuffer);
+  PerFrameData& frameData = getPerFrameData();
+  while (frameData.passes.size() < renderPasses.size()) frameData.passes.push_back(std::make_shared<PerFrameData::PassData>(device));
+  JobSystem::parallelFor(renderPasses.size(), 1, [this, &frameData](const std::size_t begin, const std::size_t end) {
+    for (std::size_t i{begin}; i < end; ++i) frameData.passes[i]->record(*renderPasses[i]);
+  });
+
+  CommandBuffer& commandBuffer = *frameData.commands;
+  commandBuffer.clear();
   commandBuffer.record<CommandBuffer::BlitImageToImage>(getImage(getImageId(RenderColor)).image.get(), swapchainImage.get());
   std::vector<CommandBuffer::PipelineBarrier::ImageMemoryBarrier> imageBarriers = {
     {
-      .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
       .pNext               = nullptr,
-      .srcAccessMask       = VK_ACCESS_MEMORY_READ_BIT,
-      .dstAccessMask       = VK_ACCESS_MEMORY_READ_BIT,
+      .srcStageMask        = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+      .srcAccessMask       = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .dstStageMask        = VK_PIPELINE_STAGE_2_NONE,  // Presentation waits on the semaphore that is signalled after every command, so nothing later needs to wait on this barrier.
+      .dstAccessMask       = VK_ACCESS_2_NONE,
       .oldLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
       .newLayout           = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
       .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
@@ -351,10 +283,9 @@ void RenderGraph::execute(const std::shared_ptr<Image>& swapchainImage, VkSemaph
       .subresourceRange    = swapchainImage->getWholeRange()
     }
   };
-  commandBuffer.record<CommandBuffer::PipelineBarrier>(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, std::span<CommandBuffer::PipelineBarrier::MemoryBarrier>{}, std::span<CommandBuffer::PipelineBarrier::BufferMemoryBarrier>{}, imageBarriers);
-  commandBuffer.preprocess();
+  commandBuffer.record<CommandBuffer::PipelineBarrier>(0, std::span<CommandBuffer::PipelineBarrier::MemoryBarrier>{}, std::span<CommandBuffer::PipelineBarrier::BufferMemoryBarrier>{}, imageBarriers);
+  const CommandBuffer::State presentState = commandBuffer.preprocess({.deferEntryBarriers=true});
 
-  const PerFrameData& frameData = getPerFrameData();
   constexpr VkCommandBufferBeginInfo beginInfo {
       .sType            = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
       .pNext            = nullptr,
@@ -362,29 +293,369 @@ void RenderGraph::execute(const std::shared_ptr<Image>& swapchainImage, VkSemaph
       .pInheritanceInfo = nullptr
   };
   vkBeginCommandBuffer(frameData.commandBuffer, &beginInfo);
+  // Uploads run on the transfer queue, so the graphics queue takes ownership of what they wrote before any pass can use it.
+  const std::uint64_t uploadValue = device->acquireUploads(frameData.commandBuffer);
+  // Passes were preprocessed without knowing what came before them, so the barriers between them are added as they are joined.
+  CommandBuffer& seams = *frameData.seams;
+  CommandBuffer::State state{};
+  for (std::size_t i{}; i < renderPasses.size(); ++i) {
+    const PerFrameData::PassData& pass = *frameData.passes[i];
+    seams.clear();
+    seams.recordSeam(state, pass.state);
+    seams.bake(frameData.commandBuffer);
+    pass.commands.bakePrimary(frameData.commandBuffer, pass.secondaryCommandBuffers);
+  }
+  seams.clear();
+  seams.recordSeam(state, presentState);
+  seams.bake(frameData.commandBuffer);
   commandBuffer.bake(frameData.commandBuffer);
   vkEndCommandBuffer(frameData.commandBuffer);
-  constexpr std::array<VkPipelineStageFlags, 1> stageMasks{VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT};
-  const VkSubmitInfo submitInfo {
-      .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-      .pNext                = nullptr,
-      .waitSemaphoreCount   = 1,
-      .pWaitSemaphores      = &frameData.frameDataSemaphore,
-      .pWaitDstStageMask    = stageMasks.data(),
-      .commandBufferCount   = 1,
-      .pCommandBuffers      = &frameData.commandBuffer,
-      .signalSemaphoreCount = 1,
-      .pSignalSemaphores    = &semaphore
+  // Wait for the swapchain image, and for the uploads that were just acquired. Waiting for a value that has already been reached costs nothing.
+  const std::array waitInfos{
+    VkSemaphoreSubmitInfo{VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO, nullptr, frameData.frameDataSemaphore, 0, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, 0},
+    VkSemaphoreSubmitInfo{VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO, nullptr, device->transferTimeline, uploadValue, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, 0}
+  };
+  const VkCommandBufferSubmitInfo commandBufferInfo {
+      .sType         = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+      .pNext         = nullptr,
+      .commandBuffer = frameData.commandBuffer,
+      .deviceMask    = 0
   };
-  if (const VkResult result = vkQueueSubmit(device->globalQueue, 1, &submitInfo, frameData.renderFence); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to submit recorded command buffer to queue");
+  std::lock_guard lock{device->globalQueueMutex};
+  frameData.timelineValue = ++device->graphicsTimelineValue;
+  const std::array signalInfos{
+    VkSemaphoreSubmitInfo{VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO, nullptr, semaphore, 0, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, 0},
+    VkSemaphoreSubmitInfo{VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO, nullptr, device->graphicsTimeline, frameData.timelineValue, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, 0}
+  };
+  const VkSubmitInfo2 submitInfo {
+      .sType                    = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+      .pNext                    = nullptr,
+      .flags                    = 0,
+      .waitSemaphoreInfoCount   = static_cast<uint32_t>(waitInfos.size()),
+      .pWaitSemaphoreInfos      = waitInfos.data(),
+      .commandBufferInfoCount   = 1,
+      .pCommandBufferInfos      = &commandBufferInfo,
+      .signalSemaphoreInfoCount = static_cast<uint32_t>(signalInfos.size()),
+      .pSignalSemaphoreInfos    = signalInfos.data()
+  };
+  if (const VkResult result = vkQueueSubmit2(device->globalQueue, 1, &submitInfo, VK_NULL_HANDLE); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to submit recorded command buffer to queue");
   ++frameNumber;
 }
 
-void RenderGraph::buildImages(const std::unordered_map<ImageID, VkImageUsageFlags>& usages) {
+RenderGraph::AttachmentDeclarations RenderGraph::setupRenderPasses() {
+  // Understand how attachments are used across RenderPasses. Setting up a RenderPass may create Materials, so this is not threaded.
+  AttachmentDeclarations declarations{
+    .usages = {{getImageId(RenderColor), VK_IMAGE_USAGE_TRANSFER_SRC_BIT}}
+  };
+  constexpr VkAccessFlags WriteAccesses = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  for (std::size_t passIndex{}; passIndex < renderPasses.size(); ++passIndex) {
+    RenderPass* renderPass = renderPasses[passIndex].get();
+    renderPass->setup();
+    std::vector<std::pair<ImageID, ImageAccess>> accesses = renderPass->getImageAccesses();
+    std::vector<ImageID> ids;
+    for (auto& [id, access] : accesses) {
+      declarations.usages[id] |= access.usage;
+      // Textures are registered as images too, but they are bound to descriptor sets rather than attached to render passes.
+      if (const auto it = images.find(id); it == images.end() || it->second.resolutionGroup == getResolutionGroupId(VoidResolutionGroup))
+        continue;
+      declarations.id2decl[id].emplace_back(renderPass, access);
+      ids.push_back(id);
+      const bool discardsContents = access.loadOp != VK_ATTACHMENT_LOAD_OP_LOAD && access.stencilLoadOp != VK_ATTACHMENT_LOAD_OP_LOAD && (access.access & WriteAccesses) != 0;
+      if (const auto [it, inserted] = declarations.lifetimes.try_emplace(id, passIndex, passIndex, discardsContents); !inserted) it->second.lastPass = passIndex;
+    }
+    declarations.pass2id[renderPass] = ids;
+  }
+  // The final color is blitted to the swapchain after the last pass.
+  if (const auto it = declarations.lifetimes.find(getImageId(RenderColor)); it != declarations.lifetimes.end()) it->second.lastPass = renderPasses.size();
+  return declarations;
+}
+
+void RenderGraph::buildImages(const AttachmentDeclarations& declarations) {
+  struct ImageBuild {
+    ImageProperties* properties;
+    VkExtent3D resolution;
+    VkImageUsageFlags usage;
+    VkSampleCountFlags sampleCount;
+    const AttachmentDeclarations::Lifetime* lifetime;  // Set if this image may share memory with others
+    VkMemoryRequirements requirements{};
+    std::shared_ptr<VmaAllocation_T> memory{};
+  };
+  constexpr VkImageUsageFlags AttachmentUsages = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+  std::vector<ImageBuild> builds;
+  std::vector<ImageBuild> aliasable;  // Images that may share memory, but whose inputs have not changed
+  bool repack = false;
   for (auto& [id, properties]: images) {
-    const auto& resolutionGroup = resolutionGroups[properties.resolutionGroup];
-    properties.image = std::make_shared<Image>(device, properties.name, properties.format, resolutionGroup.resolution, usages.at(id), 1, properties.inheritSampleCount ? resolutionGroup.sampleCount : VK_SAMPLE_COUNT_1_BIT);
+    if (properties.resolutionGroup == getResolutionGroupId(VoidResolutionGroup)) continue;  // Textures are built by their Materials
+    const auto& resolutionGroup          = resolutionGroups[properties.resolutionGroup];
+    const VkSampleCountFlags sampleCount = properties.inheritSampleCount ? resolutionGroup.sampleCount : VK_SAMPLE_COUNT_1_BIT;
+    VkImageUsageFlags usage              = declarations.usages.at(id);
+    const auto lifetime                  = declarations.lifetimes.find(id);
+    const bool discardsContents          = lifetime != declarations.lifetimes.end() && lifetime->second.discardsContents;
+    // An attachment that is overwritten, used and discarded within a single render pass never has to reach memory.
+    if (discardsContents && lifetime->second.firstPass == lifetime->second.lastPass && (usage & ~AttachmentUsages) == 0) usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    const bool aliased       = discardsContents && !(usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
+    const std::uint64_t hash = Tools::hash(properties.format, resolutionGroup.resolution.width, resolutionGroup.resolution.height, resolutionGroup.resolution.depth, usage, sampleCount, aliased ? lifetime->second.firstPass : -1UZ, aliased ? lifetime->second.lastPass : -1UZ);
+    ImageBuild build{&properties, resolutionGroup.resolution, usage, sampleCount, aliased ? &lifetime->second : nullptr};
+    std::uint64_t& bakedHash = bakedImages[id];
+    if (properties.image != nullptr && bakedHash == hash) {
+      if (aliased) aliasable.push_back(std::move(build));
+      continue;
+    }
+    bakedHash = hash;
+    repack   |= aliased;
+    builds.push_back(std::move(build));
+  }
+  // Changing any image that shares memory may change how all of them are best packed.
+  if (repack) builds.insert(builds.end(), std::make_move_iterator(aliasable.begin()), std::make_move_iterator(aliasable.end()));
+
+  // Place the largest images first. Each goes into the first block of memory that nothing alive at the same time as it uses.
+  struct Block {
+    VkMemoryRequirements requirements;
+    std::vector<ImageBuild*> images;
+  };
+  std::vector<Block> blocks;
+  std::vector<ImageBuild*> aliasedBuilds;
+  for (ImageBuild& build: builds) {
+    if (build.lifetime == nullptr) continue;
+    build.requirements = Image::getMemoryRequirements(device, build.properties->format, build.resolution, build.usage, 1, build.sampleCount);
+    aliasedBuilds.push_back(&build);
+  }
+  std::ranges::stable_sort(aliasedBuilds, std::ranges::greater{}, [](const ImageBuild* build) { return build->requirements.size; });
+  for (ImageBuild* build: aliasedBuilds) {
+    const auto fits = [build](const Block& block) {
+      return (block.requirements.memoryTypeBits & build->requirements.memoryTypeBits) != 0 && std::ranges::none_of(block.images, [build](const ImageBuild* other) { return other->lifetime->overlaps(*build->lifetime); });
+    };
+    if (const auto block = std::ranges::find_if(blocks, fits); block == blocks.end()) blocks.push_back({build->requirements, {build}});
+    else {
+      block->requirements.size            = std::max(block->requirements.size, build->requirements.size);
+      block->requirements.alignment       = std::max(block->requirements.alignment, build->requirements.alignment);
+      block->requirements.memoryTypeBits &= build->requirements.memoryTypeBits;
+      block->images.push_back(build);
+    }
   }
+  for (const Block& block: blocks) {
+    if (block.images.size() < 2) continue;  // An image that shares its block with nothing gets an allocation of its own.
+    constexpr VmaAllocationCreateInfo allocationCreateInfo {
+      .usage = VMA_MEMORY_USAGE_GPU_ONLY
+    };
+    VmaAllocation allocation;
+    if (const VkResult result = vmaAllocateMemory(device->allocator, &block.requirements, &allocationCreateInfo, &allocation, nullptr); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to allocate memory for aliased images");
+    const std::shared_ptr<VmaAllocation_T> memory(allocation, [allocator = device->allocator](const VmaAllocation memory) { vmaFreeMemory(allocator, memory); });
+    for (ImageBuild* build: block.images) build->memory = memory;
+  }
+
+  JobSystem::parallelFor(builds.size(), 1, [this, &builds](const std::size_t begin, const std::size_t end) {
+    for (std::size_t i{begin}; i < end; ++i) {
+      const ImageBuild& build = builds[i];
+      build.properties->image = std::make_shared<Image>(device, build.properties->name, build.properties->format, build.resolution, build.usage, 1, build.sampleCount, build.memory);
+    }
+  });
+}
+
+void RenderGraph::bakeRenderPasses(const AttachmentDeclarations& declarations) {
+  struct RenderPassBake {
+    RenderPass* renderPass;
+    std::vector<VkAttachmentDescription> descriptions;
+    std::vector<const Image*> attachments;
+  };
+  std::vector<RenderPassBake> bakes;
+  std::unordered_map<const RenderPass*, std::uint64_t> hashes;
+  for (std::size_t passIndex{}; passIndex < renderPasses.size(); ++passIndex) {
+    const std::shared_ptr<RenderPass>& renderPass = renderPasses[passIndex];
+    const std::vector<ImageID>& renderPassAttachmentIDs = declarations.pass2id.at(renderPass.get());
+    RenderPassBake renderPassBake{.renderPass = renderPass.get()};
+    renderPassBake.descriptions.reserve(renderPassAttachmentIDs.size());
+    renderPassBake.attachments.reserve(renderPassAttachmentIDs.size());
+    std::uint64_t hash{};
+    for (const ImageID& id: renderPassAttachmentIDs) {
+      /**@todo: Add support for reordering render passes.*/
+      const Image* image = getImage(id).image.get();
+      const std::vector<std::pair<RenderPass*, ImageAccess>>& attachmentDeclarations = declarations.id2decl.at(id);
+      // Find this renderpass in the declarations of this attachment.
+      const auto thisIt = std::ranges::find(attachmentDeclarations, renderPass.get(), &std::pair<RenderPass*, ImageAccess>::first);
+      /**@todo: Optimize load ops.*/
+      /**@todo: Log an error if the format does not include a stencil buffer, but the stencilLoadOp or stencilStoreOp are not DONT_CARE.*/
+      const ImageAccess& thisDeclaration = thisIt->second;
+      // Nothing reads an attachment after its last pass if the next frame overwrites it, so its contents need not be stored.
+      const AttachmentDeclarations::Lifetime& lifetime = declarations.lifetimes.at(id);
+      const bool contentsDead = lifetime.discardsContents && lifetime.lastPass == passIndex;
+      const VkAttachmentDescription& description = renderPassBake.descriptions.emplace_back(VkAttachmentDescription{
+          .flags = 0U,
+          .format = image->getFormat(),
+          .samples = static_cast<VkSampleCountFlagBits>(image->getSampleCount()),
+          .loadOp = thisDeclaration.loadOp,
+          .storeOp = contentsDead ? VK_ATTACHMENT_STORE_OP_DONT_CARE : thisDeclaration.storeOp,
+          .stencilLoadOp = thisDeclaration.stencilLoadOp,
+          .stencilStoreOp = contentsDead ? VK_ATTACHMENT_STORE_OP_DONT_CARE : thisDeclaration.stencilStoreOp,
+          .initialLayout = thisDeclaration.layout,
+          .finalLayout = thisDeclaration.layout
+      });
+      renderPassBake.attachments.push_back(image);
+      // The image handles change whenever the image is rebuilt, so they also stand in for its format, extent and sample count.
+      hash = Tools::combine(hash, Tools::hash(image->getImage(), image->getImageView(), description.layout, description.loadOp, description.storeOp, description.stencilLoadOp, description.stencilStoreOp));
+    }
+    hashes.emplace(renderPass.get(), hash);
+    if (const auto it = bakedRenderPasses.find(renderPass.get()); it != bakedRenderPasses.end() && it->second == hash && renderPass->getRenderPass() != VK_NULL_HANDLE) continue;
+    bakes.push_back(std::move(renderPassBake));
+  }
+  bakedRenderPasses = std::move(hashes);
+
+  // Bake RenderPasses
+  JobSystem::parallelFor(bakes.size(), 1, [&bakes](const std::size_t begin, const std::size_t end) {
+    for (std::size_t i{begin}; i < end; ++i) {
+      auto& [renderPass, descriptions, attachments] = bakes[i];
+      renderPass->bake(descriptions, attachments);
+      if (renderPass->compatibility == -1U) GraphicsInstance::showError("`RenderPass::bake()` failed to update the RenderPass compatibility.");
+    }
+  });
+  // Setting up a RenderPass forgets its Pipelines, so they are looked up again even if the RenderPass was not rebaked.
+  for (const std::shared_ptr<RenderPass>& renderPass : renderPasses) renderPass->assignPipelines();
+}
+
+void RenderGraph::registerMaterialTextures() {
+  std::unordered_map<ImageID, ImageProperties> textures;
+  for (Material& material : device->materials | std::ranges::views::values) {
+    if (std::weak_ptr<Texture> albedo = material.albedoTexture; !albedo.expired()) {
+      std::shared_ptr<Texture> tex = albedo.lock();
+      textures.try_emplace(Tools::hash(tex.get()), ImageProperties{
+        .resolutionGroup = getResolutionGroupId(VoidResolutionGroup),
+        .format = tex->getFormat(),
+        .inheritSampleCount = false,
+        .image = tex,
+        .name = material.name + " | Albedo Texture"
+      });
+    }
+    if (std::weak_ptr<Texture> const normal = material.normalTexture; !normal.expired()) {
+      std::shared_ptr<Texture> tex = normal.lock();
+      textures.try_emplace(Tools::hash(tex.get()), ImageProperties{
+        .resolutionGroup = getResolutionGroupId(VoidResolutionGroup),
+        .format = tex->getFormat(),
+        .inheritSampleCount = false,
+        .image = tex,
+        .name = material.name + " | Normal Texture"
+      });
+    }
+  }
+  // Forget the textures that are no longer used by any Material, so that they can be freed.
+  std::erase_if(images, [&textures](const auto& entry) { return entry.second.resolutionGroup == getResolutionGroupId(VoidResolutionGroup) && !textures.contains(entry.first); });
+  images.merge(textures);
+}
+
+std::map<DescriptorSetRequirer*, VkDescriptorSetLayout> RenderGraph::bakeDescriptorSetLayouts(const std::map<DescriptorSetRequirer*, std::vector<VkDescriptorSetLayoutBinding>>& requirements, std::vector<DescriptorSetRequirer*>& changed) {
+  std::map<DescriptorSetRequirer*, VkDescriptorSetLayout> layouts;
+  std::unordered_map<const DescriptorSetRequirer*, std::uint64_t> hashes;
+  VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .pNext = nullptr,
+      .flags = 0
+  };
+  for (const auto& [requirer, bindings]: requirements) {
+    std::uint64_t hash{};
+    for (const VkDescriptorSetLayoutBinding& binding: bindings) hash = Tools::combine(hash, Tools::hash(binding.binding, binding.descriptorType, binding.descriptorCount, binding.stageFlags));
+    hashes.emplace(requirer, hash);
+    if (const auto it = bakedDescriptorSetLayouts.find(requirer); it != bakedDescriptorSetLayouts.end() && it->second == hash) {
+      layouts.emplace(requirer, requirer ? requirer->getDescriptorSetLayout() : *frames.front().descriptorSetLayout);
+      continue;
+    }
+    descriptorSetLayoutCreateInfo.bindingCount = bindings.size();
+    descriptorSetLayoutCreateInfo.pBindings = bindings.data();
+    VkDescriptorSetLayout& layout = layouts[requirer];
+    if (const VkResult result = vkCreateDescriptorSetLayout(device->device, &descriptorSetLayoutCreateInfo, nullptr, &layout); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create descriptor set layout");
+    changed.push_back(requirer);
+  }
+  bakedDescriptorSetLayouts = std::move(hashes);
+  return layouts;
+}
+
+void RenderGraph::bakePipelines(const std::map<DescriptorSetRequirer*, VkDescriptorSetLayout>& layouts) {
+  struct PipelineBake {
+    Pipeline* pipeline;
+    std::shared_ptr<RenderPass> renderPass;
+    std::vector<VkDescriptorSetLayout> setLayouts;
+  };
+  std::vector<PipelineBake> bakes;
+  std::unordered_map<const Pipeline*, std::uint64_t> hashes;
+  const auto frameDataLayout = layouts.find(nullptr);
+  for (const std::shared_ptr<RenderPass>& renderPass : renderPasses) {
+    for (Pipeline* pipeline : renderPass->getPipelines() | std::views::values) {
+      if (hashes.contains(pipeline)) continue;  // Pipelines are shared by compatible RenderPasses, so they only need baking once.
+      PipelineBake pipelineBake{pipeline, renderPass};
+      pipelineBake.setLayouts.reserve(3);
+      if (frameDataLayout != layouts.end()) pipelineBake.setLayouts.emplace_back(frameDataLayout->second);
+      if (const auto it = layouts.find(renderPass.get()); it != layouts.end()) pipelineBake.setLayouts.emplace_back(it->second);
+      if (const auto it = layouts.find(pipeline); it != layouts.end()) pipelineBake.setLayouts.emplace_back(it->second);
+      // Shader modules are replaced when their shaders are reloaded, so they stand in for the contents of the Material. Reloaded
+      // processes are not told apart, so every pipeline is rebaked when they are.
+      const Material* material = pipeline->getMaterial();
+      std::uint64_t hash = Tools::hash(renderPass->getRenderPass(), material->vertexProcess->shader->getModule(), material->fragmentProcess->shader->getModule(), device->processReloadCount);
+      for (const VkDescriptorSetLayout& setLayout: pipelineBake.setLayouts) hash = Tools::combine(hash, Tools::hash(setLayout));
+      hashes.emplace(pipeline, hash);
+      if (const auto it = bakedPipelines.find(pipeline); it != bakedPipelines.end() && it->second == hash && pipeline->getPipeline() != VK_NULL_HANDLE) continue;
+      bakes.push_back(std::move(pipelineBake));
+    }
+  }
+  bakedPipelines = std::move(hashes);
+
+  // Each Job creates its share of the pipelines with a single call, so the driver can still batch the work within each share.
+  // Each share also gets a pipeline cache of its own, so that the Jobs never contend for one.
+  const std::size_t chunkSize = (bakes.size() + JobSystem::getConcurrency() - 1) / JobSystem::getConcurrency();
+  std::vector<VkPipelineCache> pipelineCaches(chunkSize == 0 ? 0 : (bakes.size() + chunkSize - 1) / chunkSize);
+  JobSystem::parallelFor(bakes.size(), chunkSize, [this, &bakes, &pipelineCaches, chunkSize](const std::size_t begin, const std::size_t end) {
+    VkPipelineCache& pipelineCache = pipelineCaches[begin / chunkSize];
+    pipelineCache = device->createPipelineCache();
+    std::deque<std::tuple<void*, std::function<void(void*)>>> miscMemoryPool;
+    std::vector<VkGraphicsPipelineCreateInfo> pipelineCreateInfos;
+    std::vector<VkPipeline*> pipelines;
+    for (std::size_t i{begin}; i < end; ++i) bakes[i].pipeline->bake(bakes[i].renderPass, 0, bakes[i].setLayouts, miscMemoryPool, pipelineCreateInfos, pipelines);
+    std::vector<VkPipeline> tempPipelines(pipelines.size());
+    if (const VkResult result = vkCreateGraphicsPipelines(device->device, pipelineCache, pipelineCreateInfos.size(), pipelineCreateInfos.data(), nullptr, tempPipelines.data()); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to create graphics pipelines");
+    for (uint32_t j{}; j < tempPipelines.size(); ++j) {
+      vkDestroyPipeline(device->device, *pipelines.at(j), nullptr);
+      *pipelines.at(j) = tempPipelines.at(j);
+    }
+    for (const auto& [mem, deleter]: miscMemoryPool) deleter(mem);
+  });
+  device->mergePipelineCaches(pipelineCaches);
+}
+
+void RenderGraph::buildDescriptorSets(const std::map<DescriptorSetRequirer*, std::vector<VkDescriptorSetLayoutBinding>>& requirements, const std::map<DescriptorSetRequirer*, VkDescriptorSetLayout>& layouts, const std::vector<DescriptorSetRequirer*>& changed) {
+  // Allocate descriptor sets for the DescriptorSetRequirers whose layouts changed. The rest keep the descriptor sets they have.
+  if (!changed.empty()) {
+    std::vector<VkDescriptorSetLayout> framesInFlightLayouts;
+    framesInFlightLayouts.reserve(changed.size() * framesInFlight);  // One layout for each descriptor set for each frame in flight
+    std::vector<std::vector<VkDescriptorSetLayoutBinding>> framesInFlightBindings;
+    framesInFlightBindings.reserve(changed.size() * framesInFlight);
+    for (DescriptorSetRequirer* requirer: changed) {
+      for (int j = 0; j < framesInFlight; ++j) {
+        framesInFlightLayouts.push_back(layouts.at(requirer));
+        framesInFlightBindings.push_back(requirements.at(requirer));
+      }
+    }
+    const std::vector<std::shared_ptr<VkDescriptorSet>> descriptorSets = device->descriptorSetAllocator.allocate(framesInFlightBindings, framesInFlightLayouts);
+    for (std::size_t i{}; i < changed.size(); ++i) {
+      auto start = static_cast<std::ptrdiff_t>(i) * framesInFlight + descriptorSets.begin();
+      if (DescriptorSetRequirer* descriptorSetRequirer = changed[i]) descriptorSetRequirer->setDescriptorSets(std::span{start, start + framesInFlight}, layouts.at(descriptorSetRequirer));
+      else {
+        auto layout = std::shared_ptr<VkDescriptorSetLayout>(new VkDescriptorSetLayout(layouts.at(nullptr)), [this](const VkDescriptorSetLayout* layout) {
+          vkDestroyDescriptorSetLayout(device->device, *layout, nullptr);
+          delete layout;
+        });
+        for (uint32_t j{}; j < frames.size(); ++j) {
+          frames.at(j).descriptorSet = *(start + j);
+          frames.at(j).descriptorSetLayout = layout;
+        }
+      }
+    }
+  }
+
+  // Assign descriptor sets. Every set is rewritten, as the images and buffers that they point to may have been rebuilt.
+  std::deque<std::tuple<void*, std::function<void(void*)>>> miscMemoryPool;
+  std::vector<VkWriteDescriptorSet> writes;
+  for (DescriptorSetRequirer* descriptorSetRequirer: requirements | std::ranges::views::keys)
+    if (descriptorSetRequirer) descriptorSetRequirer->writeDescriptorSets(miscMemoryPool, writes, *this);
+  vkUpdateDescriptorSets(device->device, writes.size(), writes.data(), 0, nullptr);
+  for (const auto& [mem, deleter]: miscMemoryPool) deleter(mem);
 }
 
-const RenderGraph::PerFrameData& RenderGraph::getPerFrameData(const uint64_t frameIndex) const { return frames[frameIndex == static_cast<decltype(frameIndex)>(-1) ? getFrameIndex() : frameIndex]; }
\ No newline at end of file
+const RenderGraph::PerFrameData& RenderGraph::getPerFrameData(const uint64_t frameIndex) const { return frames[frameIndex == static_cast<decltype(frameIndex)>(-1) ? getFrameIndex() : frameIndex]; }
+RenderGraph::PerFrameData& RenderGraph::getPerFrameData(const uint64_t frameIndex) { return frames[frameIndex == static_cast<decltype(frameIndex)>(-1) ? getFrameIndex() : frameIndex]; }
\ No newline at end of file
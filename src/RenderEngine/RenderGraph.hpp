@@ -7,7 +7,9 @@
 
 #include <vulkan/vulkan.h>
 
+#include <cstddef>
 #include <functional>
+#include <map>
 #include <memory>
 #include <unordered_map>
 #include <vector>
@@ -37,18 +39,29 @@ class RenderGraph {
     const RenderGraph& graph;
 
   public:
+    struct PassData;
+
     VkCommandPool commandPool{VK_NULL_HANDLE};
     VkCommandBuffer commandBuffer{VK_NULL_HANDLE};
+    std::shared_ptr<CommandBuffer> commands;  // Kept across frames so that its memory is reused instead of reallocated every frame.
+    std::shared_ptr<CommandBuffer> seams;     // Holds the barriers between passes while they are being joined
+    std::vector<std::shared_ptr<PassData>> passes;  // One for each render pass. Each has its own command pool so that passes can be recorded on different threads.
     VkSemaphore frameFinishedSemaphore{VK_NULL_HANDLE};
     VkSemaphore frameDataSemaphore{VK_NULL_HANDLE};
-    VkFence renderFence{VK_NULL_HANDLE};
+    std::uint64_t timelineValue{};  // The value of <c>GraphicsDevice::graphicsTimeline</c> signalled by this frame's last submission
     std::shared_ptr<VkDescriptorSet> descriptorSet{VK_NULL_HANDLE};
     std::shared_ptr<VkDescriptorSetLayout> descriptorSetLayout{VK_NULL_HANDLE};
 
     PerFrameData(GraphicsDevice* device, const RenderGraph& graph);
+    // PerFrameData owns its Vulkan objects, so it may only be moved. A moved from PerFrameData destroys nothing.
+    PerFrameData(const PerFrameData&)            = delete;
+    PerFrameData(PerFrameData&& other) noexcept;
+    PerFrameData& operator=(const PerFrameData&) = delete;
+    PerFrameData& operator=(PerFrameData&&)      = delete;
     ~PerFrameData();
   };
   
+  const std::uint8_t framesInFlight;
   std::vector<PerFrameData> frames;
 
   std::uint64_t frameNumber{};
@@ -56,6 +69,7 @@ class RenderGraph {
 
   std::vector<std::shared_ptr<RenderPass>> renderPasses;
   bool outOfDate = false;
+  std::uint64_t bakedReloadCount{};  // The <c>GraphicsDevice::reloadCount</c> as of the last bake
 
 public:
   GraphicsDevice* const device;
@@ -82,8 +96,6 @@ private:
   std::unordered_map<ImageID, ImageProperties> images;
 
 public:
-  static uint8_t FRAMES_IN_FLIGHT;
-  
   struct ImageAccess {
     VkImageLayout layout{};
     VkImageUsageFlags usage{};
@@ -109,10 +121,15 @@ public:
   [[nodiscard]] const_reverse_iterator crbegin() const { return renderPasses.crbegin(); }
   [[nodiscard]] const_reverse_iterator crend() const { return renderPasses.crend(); }
 
-  explicit RenderGraph(GraphicsDevice* device);
+  /**
+   * @param device The GraphicsDevice to render with
+   * @param framesInFlight How many frames the CPU may record ahead of the GPU
+   */
+  explicit RenderGraph(GraphicsDevice* device, std::uint8_t framesInFlight=2);
   ~RenderGraph();
 
-  [[nodiscard]] uint64_t getFrameIndex() const { return frameNumber % FRAMES_IN_FLIGHT; }
+  [[nodiscard]] uint64_t getFrameIndex() const { return frameNumber % framesInFlight; }
+  [[nodiscard]] std::uint8_t getFramesInFlight() const { return framesInFlight; }
   static constexpr ResolutionGroupID getResolutionGroupId(const std::string_view name) { return Tools::hash(name); }
   void setResolutionGroup(const std::string_view& name, VkExtent3D resolution, VkSampleCountFlags sampleCount);
   [[nodiscard]] ResolutionGroupProperties getResolutionGroup(ResolutionGroupID id) const;
@@ -135,13 +152,25 @@ public:
 
   template<typename T, typename... Args> requires std::constructible_from<T, RenderGraph&, Args...> && std::derived_from<T, RenderPass> && (!std::is_same_v<T, RenderPass>) const_iterator insert(const const_iterator iterator, Args&&... args) { outOfDate = true; return renderPasses.insert(iterator, std::make_unique<T>(*this, std::forward<Args&&>(args)...)); }
   template<typename T, typename... Args> requires std::constructible_from<T, RenderGraph&, Args...> && std::derived_from<T, RenderPass> && (!std::is_same_v<T, RenderPass>) const_iterator insert(Args&&... args) { outOfDate = true; return insert<T>(cend(), std::forward<Args&&>(args)...); }
+  /**
+   * Builds everything that has changed since the last bake, including the pipelines of shaders and processes that the GraphicsDevice
+   * has reloaded since. Waits for the GPU to become idle first, but only if there is anything to build.
+   * @return <c>true</c> if anything was out of date
+   */
   bool bake();
 
   [[nodiscard]] const PerFrameData& getPerFrameData(uint64_t frameIndex=-1) const;
+  [[nodiscard]] PerFrameData& getPerFrameData(uint64_t frameIndex=-1);
   [[nodiscard]] VkSemaphore waitForNextFrameData() const;
+  /**
+   * Uploads the changed instances of every Mesh to the buffers of this frame, then updates every render pass. Must be called
+   * after <c>waitForNextFrameData</c>, as this frame's buffers are written in place.
+   */
   void update() const;
   /**
    * Executes this RenderGraph then blits the GBufferAlbdeo attachment onto the <c>swapchainImage</c>.
+   * Every render pass records, preprocesses and bakes its commands on its own thread, into secondary command buffers. Only joining
+   * those together, and resolving the barriers between them, happens on the calling thread.
    * @param swapchainImage The image to put the color output onto (usually the swapchain image).
    * @param semaphore The semaphore to signal when the GPU has finished rendering.
    */
@@ -161,7 +190,48 @@ public:
 
 private:
   /**
-   * Builds the images stored in <c>backingImages</c> from <c>attachmentProperties</c>
+   * How the render passes use attachments. This is the output of <c>setupRenderPasses</c>, and the input of the stages that follow it.
+   */
+  struct AttachmentDeclarations {
+    /**
+     * The span of render passes that use an attachment within a frame.
+     */
+    struct Lifetime {
+      std::size_t firstPass;
+      std::size_t lastPass;    // <c>renderPasses.size()</c> stands for the commands that <c>execute</c> records after the last pass
+      bool discardsContents;  // The first pass overwrites the attachment without reading it, so its contents do not need to survive between frames.
+
+      [[nodiscard]] bool overlaps(const Lifetime& other) const { return firstPass <= other.lastPass && other.firstPass <= lastPass; }
+    };
+
+    std::unordered_map<RenderPass*, std::vector<ImageID>> pass2id;
+    std::unordered_map<ImageID, std::vector<std::pair<RenderPass*, ImageAccess>>> id2decl;
+    std::unordered_map<ImageID, VkImageUsageFlags> usages;
+    std::unordered_map<ImageID, Lifetime> lifetimes;
+  };
+
+  // The hash of the inputs that each object was last baked from. Objects whose inputs hash the same are not baked again.
+  std::unordered_map<ImageID, std::uint64_t> bakedImages;
+  std::unordered_map<const RenderPass*, std::uint64_t> bakedRenderPasses;
+  std::unordered_map<const DescriptorSetRequirer*, std::uint64_t> bakedDescriptorSetLayouts;
+  std::unordered_map<const Pipeline*, std::uint64_t> bakedPipelines;
+
+  AttachmentDeclarations setupRenderPasses();
+  /**
+   * Builds the images of every attachment whose format, resolution, sample count, usage or lifetime has changed since it was last
+   * built. Attachments that discard their contents each frame and whose lifetimes do not overlap are placed in the same memory.
+   * Attachments that never leave the one render pass that uses them are made transient.
+   */
+  void buildImages(const AttachmentDeclarations& declarations);
+  void bakeRenderPasses(const AttachmentDeclarations& declarations);
+  void registerMaterialTextures();
+  /**
+   * Creates a descriptor set layout for each DescriptorSetRequirer whose bindings have changed since its layout was last created.
+   * @param requirements The bindings required by each DescriptorSetRequirer. <c>nullptr</c> stands for the per-frame data of this RenderGraph.
+   * @param changed Filled with the DescriptorSetRequirers that were given a new layout, and so need new descriptor sets.
+   * @return The layout of every DescriptorSetRequirer in <c>requirements</c>.
    */
-  void buildImages(const std::unordered_map<ImageID, VkImageUsageFlags>& usages);
+  std::map<DescriptorSetRequirer*, VkDescriptorSetLayout> bakeDescriptorSetLayouts(const std::map<DescriptorSetRequirer*, std::vector<VkDescriptorSetLayoutBinding>>& requirements, std::vector<DescriptorSetRequirer*>& changed);
+  void bakePipelines(const std::map<DescriptorSetRequirer*, VkDescriptorSetLayout>& layouts);
+  void buildDescriptorSets(const std::map<DescriptorSetRequirer*, std::vector<VkDescriptorSetLayoutBinding>>& requirements, const std::map<DescriptorSetRequirer*, VkDescriptorSetLayout>& layouts, const std::vector<DescriptorSetRequirer*>& changed);
 };
\ No newline at end of file
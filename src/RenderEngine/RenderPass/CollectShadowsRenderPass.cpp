@@ -21,6 +21,8 @@ CollectShadowsRenderPass::CollectShadowsRenderPass(RenderGraph& graph) : RenderP
 }
 
 void CollectShadowsRenderPass::setup() {
+  pipelines.clear();
+  materialRemap.clear();
   for (Material& material: graph.device->materials | std::ranges::views::values) {
     Material* overriddenMaterial = material.getVertexVariation(vertexProcessOverride);
     pipelines.emplace(overriddenMaterial, nullptr);
@@ -84,8 +86,6 @@ void CollectShadowsRenderPass::bake(const std::vector<VkAttachmentDescription>&
   }
 #endif
 
-  for (auto& [material, pipeline]: pipelines) pipeline = graph.device->getPipeline(material, compatibility);
-
   framebuffer = std::make_unique<Framebuffer>(graph.device, images, renderPass);
   uniformBuffer = std::make_unique<UniformBuffer<PassData>>(graph.device, (std::string(PassName) + " | Uniform Buffer").c_str());
   const auto image = graph.getImage(RenderGraph::getImageId(RenderGraph::GBufferMaterialID));
@@ -24,7 +24,7 @@ void GBufferRenderPass::setup() {
   pipelines.clear();
   materialRemap.clear();
   for (const Mesh& mesh: graph.device->meshes | std::ranges::views::values) {
-    for (Material* material : mesh.instances | std::ranges::views::keys) {
+    for (Material* material : mesh.materialSlots | std::views::transform(&Mesh::MaterialSlot::instances) | std::views::join | std::ranges::views::keys) {
       Material* overriddenMaterial = material->getFragmentVariation(fragmentProcessOverride);
       pipelines.emplace(overriddenMaterial, nullptr);
       materialRemap.emplace(material, overriddenMaterial);
@@ -81,8 +81,6 @@ void GBufferRenderPass::bake(const std::vector<VkAttachmentDescription>& attachm
   }
 #endif
 
-  for (auto& [material, pipeline]: pipelines) pipeline = graph.device->getPipeline(material, compatibility);
-
   framebuffer = std::make_unique<Framebuffer>(graph.device, images, renderPass);
   uniformBuffer = std::make_unique<UniformBuffer<PassData>>(graph.device, "G-Buffer Render Pass | Uniform Buffer");
 }
@@ -134,14 +132,21 @@ void GBufferRenderPass::execute(CommandBuffer& commandBuffer) {
   const uint64_t frameIndex = graph.getFrameIndex();
   commandBuffer.record<CommandBuffer::BeginRenderPass>(this, clearValues);
   for (const Mesh& mesh : graph.device->meshes | std::ranges::views::values) {
-    commandBuffer.record<CommandBuffer::BindVertexBuffers>(std::array{mesh.positionsVertexBuffer.get(), mesh.textureCoordinatesVertexBuffer.get(), mesh.normalsVertexBuffer.get(), mesh.tangentsVertexBuffer.get()});
+    commandBuffer.record<CommandBuffer::BindVertexBuffers>(mesh.vertexBuffers | std::views::transform([](const std::unique_ptr<Buffer>& buffer) { return buffer.get(); }));
     commandBuffer.record<CommandBuffer::BindIndexBuffer>(mesh.indexBuffer.get());
-    for (auto& [material, instanceData]: mesh.instances) {
-      Pipeline* pipeline = pipelines.at(materialRemap.at(material));
-      commandBuffer.record<CommandBuffer::BindPipeline>(pipeline);
-      commandBuffer.record<CommandBuffer::BindDescriptorSets>(std::array{*getDescriptorSet(graph.getFrameIndex()), *pipeline->getDescriptorSet(frameIndex)}, 1);
-      commandBuffer.record<CommandBuffer::BindVertexBuffers>(std::array{instanceData.modelInstanceBuffer.get(), instanceData.materialInstanceBuffer.get()}, 4);
-      commandBuffer.record<CommandBuffer::DrawIndexed>(instanceData.perInstanceData.size());
+    for (const Mesh::MaterialSlot& materialSlot: mesh.materialSlots) {
+      for (auto& [material, instanceData]: materialSlot.instances) {
+        if (instanceData.perInstanceData.empty()) continue;
+        const Mesh::InstanceCollection::FrameBuffers& instanceBuffers = instanceData.frames[frameIndex];
+        Pipeline* pipeline = pipelines.at(materialRemap.at(material));
+        commandBuffer.record<CommandBuffer::BindPipeline>(pipeline);
+        commandBuffer.record<CommandBuffer::BindDescriptorSets>(std::array{*getDescriptorSet(graph.getFrameIndex()), *pipeline->getDescriptorSet(frameIndex)}, 1);
+        commandBuffer.record<CommandBuffer::BindVertexBuffers>(std::array{instanceBuffers.modelInstanceBuffer.get(), instanceBuffers.materialInstanceBuffer.get()}, static_cast<uint32_t>(mesh.vertexBuffers.size()));
+        // The pipeline assembles every primitive in its own topology, so primitives stored in any other would be drawn wrong.
+        const VkPrimitiveTopology topology = pipeline->getMaterial()->vertexProcess->topology;
+        for (const Mesh::Primitive& primitive: materialSlot.primitives)
+          if (primitive.topology == topology) commandBuffer.record<CommandBuffer::DrawIndexed>(instanceData.perInstanceData.size(), primitive.indexCount, primitive.firstIndex, primitive.vertexOffset);
+      }
     }
   }
   commandBuffer.record<CommandBuffer::EndRenderPass>();
@@ -9,6 +9,10 @@
 
 /**@todo: Thread this function.*/
 void RenderPass::setRenderPassInfo(const VkRenderPassCreateInfo& createInfo, const std::vector<const Image*>&images) {
+  // This RenderPass is being rebaked, so the render pass from the previous bake is about to be replaced.
+  if (renderPass != VK_NULL_HANDLE) vkDestroyRenderPass(graph.device->device, renderPass, nullptr);
+  renderPass = VK_NULL_HANDLE;
+
   // Compute the render pass's compatibility. This is given as the hash of the attributes of the render pass that determine compatibility.
   uint32_t index{};
   compatibility = 0;
@@ -91,4 +95,5 @@ RenderPass::~RenderPass() {
 VkRenderPass RenderPass::getRenderPass() const { return renderPass; }
 Framebuffer* RenderPass::getFramebuffer() const { return framebuffer.get(); }
 std::unordered_map<Material*, Pipeline*> RenderPass::getPipelines() { return pipelines; }
+void RenderPass::assignPipelines() { for (auto& [material, pipeline]: pipelines) pipeline = graph.device->getPipeline(material, compatibility); }
 const RenderGraph& RenderPass::getGraph() const { return graph; }
\ No newline at end of file
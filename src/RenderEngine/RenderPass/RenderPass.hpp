@@ -66,6 +66,11 @@ public:
   requires std::ranges::range<Materials> && std::same_as<std::ranges::range_value_t<Materials>, Material*>
   std::vector<VkClearValue> setup(Materials&& materials, const VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR, const VkClearColorValue color = {0, 0, 0, 1}, const VkClearDepthStencilValue depth = {1, 0}) {
     imageAccesses.clear();
+    clearValues.clear();
+    depthStencilAttachmentOffset = ~0U;
+    colorAttachmentCount         = 0;
+    inputAttachmentCount         = 0;
+    boundImageCount              = 0;
     // Prepare data for this render pass
     if (const std::optional<std::pair<RenderGraph::ImageID, RenderGraph::ImageAccess>> optionalDepthStencilAttachmentAccess = getDepthStencilAttachmentAccess(); optionalDepthStencilAttachmentAccess.has_value()) {
       clearValues.push_back(VkClearValue{.depthStencil=depth});
@@ -124,6 +129,10 @@ public:
   [[nodiscard]] VkRenderPass getRenderPass() const;
   [[nodiscard]] Framebuffer* getFramebuffer() const;
   [[nodiscard]] std::unordered_map<Material*, Pipeline*> getPipelines();
+  /**
+   * Looks up the Pipeline of each Material of this RenderPass. Called by the RenderGraph after this RenderPass has been baked.
+   */
+  void assignPipelines();
   [[nodiscard]] const RenderGraph& getGraph() const;
 };
 
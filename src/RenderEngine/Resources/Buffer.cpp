@@ -7,6 +7,10 @@
 
 #include <volk/volk.h>
 
+#include <algorithm>
+#include <ranges>
+#include <vector>
+
 Buffer::BufferMapping::BufferMapping(GraphicsDevice* const device, Buffer* buffer) : device(device), buffer(buffer){
   if (const VkResult result = vmaMapMemory(device->allocator, buffer->allocation, &data); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to map buffer memory");
 }
@@ -22,19 +26,24 @@ Buffer::Buffer(GraphicsDevice* const device,
                const VkMemoryPropertyFlags required,
                const VkMemoryPropertyFlags preferred,
                const VmaMemoryUsage memoryUsage, const
-               VmaAllocationCreateFlags flags
+               VmaAllocationCreateFlags flags,
+               const std::span<const uint32_t> queueFamilies
               ) :
     Resource(Resource::Buffer, device),
     size(bufferSize) {
+  std::vector<uint32_t> distinctQueueFamilies = std::ranges::to<std::vector>(queueFamilies);
+  std::ranges::sort(distinctQueueFamilies);
+  distinctQueueFamilies.erase(std::ranges::unique(distinctQueueFamilies).begin(), distinctQueueFamilies.end());
+  concurrent = distinctQueueFamilies.size() > 1;
   const VkBufferCreateInfo bufferCreateInfo{
       .sType                 = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext                 = nullptr,
       .flags                 = 0,
       .size                  = bufferSize,
       .usage                 = usage,
-      .sharingMode           = VK_SHARING_MODE_EXCLUSIVE,
-      .queueFamilyIndexCount = 0,
-      .pQueueFamilyIndices   = nullptr
+      .sharingMode           = concurrent ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = concurrent ? static_cast<uint32_t>(distinctQueueFamilies.size()) : 0,
+      .pQueueFamilyIndices   = concurrent ? distinctQueueFamilies.data() : nullptr
   };
   const VmaAllocationCreateInfo allocationCreateInfo {
       .flags = VMA_ALLOCATION_CREATE_WITHIN_BUDGET_BIT | flags,
@@ -85,6 +94,18 @@ std::shared_ptr<Buffer::BufferMapping> Buffer::map() {
   return newMapping;
 }
 
+void* Buffer::getMappedData() const {
+  return allocationInfo.pMappedData;
+}
+
+void Buffer::flush(const VkDeviceSize offset, const VkDeviceSize size) const {
+  if (const VkResult result = vmaFlushAllocation(device->allocator, allocation, offset, size); result != VK_SUCCESS) GraphicsInstance::showError(result, "failed to flush buffer memory");
+}
+
+bool Buffer::isConcurrent() const {
+  return concurrent;
+}
+
 void* Buffer::getObject() const {
   return reinterpret_cast<void *>(buffer);
 }
@@ -4,7 +4,9 @@
 
 #include <vma/vk_mem_alloc.h>
 
+#include <cstdint>
 #include <memory>
+#include <span>
 
 class Image;
 class GraphicsDevice;
@@ -22,6 +24,7 @@ protected:
   VmaAllocation allocation{VK_NULL_HANDLE};
   VkDeviceSize size;
   VmaAllocationInfo allocationInfo{};
+  bool concurrent{false};
 
 public:
   struct BufferMapping {
@@ -42,13 +45,26 @@ public:
    * @param preferred
    * @param memoryUsage
    * @param flags
+   * @param queueFamilies The queue families that use this buffer. When there is more than one distinct family, they share the buffer concurrently, and its contents never have to change ownership.
    */
-  explicit Buffer(GraphicsDevice* device, const char* name, VkDeviceSize bufferSize, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, VmaMemoryUsage memoryUsage, VmaAllocationCreateFlags flags);
+  explicit Buffer(GraphicsDevice* device, const char* name, VkDeviceSize bufferSize, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, VmaMemoryUsage memoryUsage, VmaAllocationCreateFlags flags, std::span<const uint32_t> queueFamilies={});
   ~Buffer() override;
 
   [[nodiscard]] VkBuffer getBuffer() const;
   [[nodiscard]] VkDeviceSize getSize() const;
   [[nodiscard]] std::shared_ptr<BufferMapping> map();
+  /**
+   * @return The persistent mapping of this buffer, or <c>nullptr</c> if it was not created with <c>VMA_ALLOCATION_CREATE_MAPPED_BIT</c>.
+   */
+  [[nodiscard]] void* getMappedData() const;
+  /**
+   * Makes host writes to part of the persistent mapping visible to the device. Does nothing for host coherent memory.
+   */
+  void flush(VkDeviceSize offset, VkDeviceSize size) const;
+  /**
+   * @return Whether this buffer is shared between queue families concurrently, rather than owned by one family at a time
+   */
+  [[nodiscard]] bool isConcurrent() const;
 
 private:
   [[nodiscard]] void* getObject() const override;
@@ -30,29 +30,20 @@ Image::Image(GraphicsDevice* const device, std::string name, VkImage image, cons
 #endif
 }
 
-Image::Image(GraphicsDevice* const device, std::string name, const VkFormat format, const VkExtent3D extent, const VkImageUsageFlags usage, const uint32_t mipLevels, const VkSampleCountFlags sampleCount) : Resource(Resource::Image, device), _name(std::move(name)), _format(format), _aspect(aspectFromFormat(format)), _extent(extent), _usage(usage), _view(VK_NULL_HANDLE), _mipLevels(mipLevels), _sampleCount(sampleCount) {
-  const VkImageCreateInfo imageCreateInfo {
-    .sType         = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-    .pNext         = nullptr,
-    .flags         = 0,
-    .imageType     = VK_IMAGE_TYPE_2D,
-    .format        = _format,
-    .extent        = _extent,
-    .mipLevels     = _mipLevels,
-    .arrayLayers   = 1,
-    .samples       = static_cast<VkSampleCountFlagBits>(_sampleCount),
-    .tiling        = VK_IMAGE_TILING_OPTIMAL,
-    .usage         = _usage,
-    .sharingMode   = VK_SHARING_MODE_EXCLUSIVE,
-    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-  };
-  const VmaAllocationCreateInfo allocationCreateInfo {
-    .usage     = VMA_MEMORY_USAGE_GPU_ONLY,
-    .pUserData = this,
-  };
-  if (const VkResult result = vmaCreateImage(device->allocator, &imageCreateInfo, &allocationCreateInfo, &_image, &allocation, nullptr); result != VK_SUCCESS) GraphicsInstance::showError(result, "Failed to create image");
+Image::Image(GraphicsDevice* const device, std::string name, const VkFormat format, const VkExtent3D extent, const VkImageUsageFlags usage, const uint32_t mipLevels, const VkSampleCountFlags sampleCount, std::shared_ptr<VmaAllocation_T> memory) : Resource(Resource::Image, device), _memory(std::move(memory)), _name(std::move(name)), _format(format), _aspect(aspectFromFormat(format)), _extent(extent), _usage(usage), _view(VK_NULL_HANDLE), _mipLevels(mipLevels), _sampleCount(sampleCount) {
+  const VkImageCreateInfo imageCreateInfo = makeCreateInfo(_format, _extent, _usage, _mipLevels, _sampleCount);
+  if (_memory != nullptr) {
+    if (const VkResult result = vmaCreateAliasingImage(device->allocator, _memory.get(), &imageCreateInfo, &_image); result != VK_SUCCESS) GraphicsInstance::showError(result, "Failed to create aliasing image");
+  } else {
+    const VmaAllocationCreateInfo allocationCreateInfo {
+      .usage          = VMA_MEMORY_USAGE_GPU_ONLY,
+      .preferredFlags = _usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : 0U,  // Tiled GPUs never have to back transient attachments with real memory
+      .pUserData      = this,
+    };
+    if (const VkResult result = vmaCreateImage(device->allocator, &imageCreateInfo, &allocationCreateInfo, &_image, &allocation, nullptr); result != VK_SUCCESS) GraphicsInstance::showError(result, "Failed to create image");
+  }
   if (_image == VK_NULL_HANDLE) return;  /**@todo: Find out why (check device supported formats and limits), then report the error.**/
-  if (!_name.empty()) vmaSetAllocationName(device->allocator, allocation, _name.c_str());
+  if (!_name.empty() && allocation != VK_NULL_HANDLE) vmaSetAllocationName(device->allocator, allocation, _name.c_str());
 #if VK_EXT_debug_utils & BOOTANICAL_GARDENS_ENABLE_VULKAN_DEBUG_UTILS
   if (GraphicsInstance::extensionEnabled(Tools::hash(VK_EXT_DEBUG_UTILS_EXTENSION_NAME))) {
     const VkDebugUtilsObjectNameInfoEXT nameInfo {
@@ -105,7 +96,8 @@ Image::Image(GraphicsDevice* const device, std::string name, const VkFormat form
 Image::~Image() {
   vkDestroyImageView(device->device, _view, nullptr);
   _view = VK_NULL_HANDLE;
-  if (_shouldDestroy) vmaDestroyImage(device->allocator, _image, allocation);
+  if (_shouldDestroy && _memory != nullptr) vkDestroyImage(device->device, _image, nullptr);  // The memory is freed along with the last Image placed in it
+  else if (_shouldDestroy) vmaDestroyImage(device->allocator, _image, allocation);
   _image     = VK_NULL_HANDLE;
   allocation = VK_NULL_HANDLE;
 }
@@ -121,6 +113,22 @@ void Image::rebuild(const VkExtent3D newExtent, const VkSampleCountFlags newSamp
   std::construct_at(this, device, name, format, extent, usage, mipLevels, sampleCount);
 }
 
+VkMemoryRequirements Image::getMemoryRequirements(GraphicsDevice* const device, const VkFormat format, const VkExtent3D extent, const VkImageUsageFlags usage, const uint32_t mipLevels, const VkSampleCountFlags sampleCount) {
+  const VkImageCreateInfo imageCreateInfo = makeCreateInfo(format, extent, usage, mipLevels, sampleCount);
+  const VkDeviceImageMemoryRequirements requirementsInfo {
+    .sType       = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS,
+    .pNext       = nullptr,
+    .pCreateInfo = &imageCreateInfo,
+    .planeAspect = VK_IMAGE_ASPECT_NONE
+  };
+  VkMemoryRequirements2 requirements {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+    .pNext = nullptr
+  };
+  vkGetDeviceImageMemoryRequirements(device->device, &requirementsInfo, &requirements);
+  return requirements.memoryRequirements;
+}
+
 VkImage Image::getImage() const {
   return _image;
 }
@@ -179,6 +187,24 @@ VkImageSubresourceRange Image::getWholeRange() const {
   };
 }
 
+VkImageCreateInfo Image::makeCreateInfo(const VkFormat format, const VkExtent3D extent, const VkImageUsageFlags usage, const uint32_t mipLevels, const VkSampleCountFlags sampleCount) {
+  return {
+    .sType         = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .pNext         = nullptr,
+    .flags         = 0,
+    .imageType     = VK_IMAGE_TYPE_2D,
+    .format        = format,
+    .extent        = extent,
+    .mipLevels     = mipLevels,
+    .arrayLayers   = 1,
+    .samples       = static_cast<VkSampleCountFlagBits>(sampleCount),
+    .tiling        = VK_IMAGE_TILING_OPTIMAL,
+    .usage         = usage,
+    .sharingMode   = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+}
+
 void* Image::getObject() const {
   return reinterpret_cast<void*>(_image);
 }
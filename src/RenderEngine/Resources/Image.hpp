@@ -4,6 +4,7 @@
 
 #include <vma/vk_mem_alloc.h>
 
+#include <memory>
 #include <string>
 #include <vulkan/utility/vk_format_utils.h>
 
@@ -12,6 +13,7 @@ class Buffer;
 
 class Image : public Resource {
   VmaAllocation allocation{VK_NULL_HANDLE};
+  std::shared_ptr<VmaAllocation_T> _memory;  // Memory shared with other Images that this Image is placed in, if any
 
   std::string _name;
   bool _shouldDestroy{true};
@@ -32,11 +34,21 @@ public:
   };
 
   Image(GraphicsDevice* device, std::string name, VkImage image, VkFormat format, VkExtent3D extent, VkImageUsageFlags usage=0, uint32_t mipLevels=1, VkSampleCountFlags sampleCount=VK_SAMPLE_COUNT_1_BIT, VkImageView view=VK_NULL_HANDLE);
-  Image(GraphicsDevice* device, std::string name, VkFormat format, VkExtent3D extent, VkImageUsageFlags usage, uint32_t mipLevels=1, VkSampleCountFlags sampleCount=VK_SAMPLE_COUNT_1_BIT);
+  /**
+   * Creates an image. Transient attachments are placed in lazily allocated memory where the device has any.
+   * @param memory Memory to place this image at the start of instead of giving it its own allocation. Other Images may be placed in
+   * the same memory, in which case only one of them holds valid contents at any time. Must satisfy <c>getMemoryRequirements</c>.
+   */
+  Image(GraphicsDevice* device, std::string name, VkFormat format, VkExtent3D extent, VkImageUsageFlags usage, uint32_t mipLevels=1, VkSampleCountFlags sampleCount=VK_SAMPLE_COUNT_1_BIT, std::shared_ptr<VmaAllocation_T> memory=nullptr);
   ~Image() override;
 
   void rebuild(VkExtent3D newExtent={}, VkSampleCountFlags newSampleCount=VK_SAMPLE_COUNT_FLAG_BITS_MAX_ENUM);
 
+  /**
+   * @return The memory requirements of an image created with the same arguments, without creating one.
+   */
+  [[nodiscard]] static VkMemoryRequirements getMemoryRequirements(GraphicsDevice* device, VkFormat format, VkExtent3D extent, VkImageUsageFlags usage, uint32_t mipLevels=1, VkSampleCountFlags sampleCount=VK_SAMPLE_COUNT_1_BIT);
+
   [[nodiscard]] VkImage getImage() const;
   [[nodiscard]] VkExtent3D getExtent() const;
   [[nodiscard]] VkImageView getImageView() const;
@@ -47,11 +59,21 @@ public:
   [[nodiscard]] uint32_t getLayerCount() const;
   [[nodiscard]] VkSampleCountFlags getSampleCount() const;
   [[nodiscard]] VkImageSubresourceRange getWholeRange() const;
+  /**
+   * @return <c>true</c> if this Image shares memory with other Images
+   */
+  [[nodiscard]] bool isAliased() const { return _memory != nullptr; }
+  /**
+   * @return <c>true</c> if this Image and <c>other</c> are placed in the same memory, so that writing one destroys the contents of the other
+   */
+  [[nodiscard]] bool aliases(const Image& other) const { return _memory != nullptr && _memory == other._memory; }
 
 private:
   [[nodiscard]] void* getObject() const override;
   [[nodiscard]] void* getView() const override;
 
+  static VkImageCreateInfo makeCreateInfo(VkFormat format, VkExtent3D extent, VkImageUsageFlags usage, uint32_t mipLevels, VkSampleCountFlags sampleCount);
+
   static VkImageAspectFlags aspectFromFormat(const VkFormat format) {
     return (vkuFormatIsDepthOnly(format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_NONE) |
            (vkuFormatIsDepthAndStencil(format) ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_NONE) |
@@ -0,0 +1,42 @@
+#include "StagingRing.hpp"
+
+#include "src/RenderEngine/CommandBuffer.hpp"
+
+StagingRing::StagingRing(GraphicsDevice* const device, const VkDeviceSize capacity) :
+    device(device),
+    buffer(std::make_unique<Buffer>(device, "Staging Ring", capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, VMA_MEMORY_USAGE_AUTO_PREFER_HOST, VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT)),
+    data(static_cast<std::byte*>(buffer->getMappedData())),
+    capacity(capacity) {}
+
+StagingRing::Allocation StagingRing::allocate(CommandBuffer& commandBuffer, const VkDeviceSize size, const VkDeviceSize alignment) {
+  std::uint64_t begin = head.load(std::memory_order_relaxed);
+  std::uint64_t start;
+  std::uint64_t end;
+  do {
+    start = (begin + alignment - 1) & ~(alignment - 1);
+    // Slices never wrap around the end of the buffer. One that would is moved to the start of the next lap instead.
+    if (start % capacity + size > capacity) start = (start / capacity + 1) * capacity;
+    end = start + size;
+    if (end - tail.load(std::memory_order_acquire) > capacity) {
+      // Callers write straight through the returned pointer and never flush, so like the ring this must be host coherent.
+      auto* overflowBuffer = new Buffer(device, "Staging Ring Overflow Buffer", size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, VMA_MEMORY_USAGE_AUTO_PREFER_HOST, VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_STRATEGY_MIN_TIME_BIT);
+      commandBuffer.addCleanupResource(overflowBuffer);
+      return {overflowBuffer, 0, size, overflowBuffer->getMappedData()};
+    }
+  } while (!head.compare_exchange_weak(begin, end, std::memory_order_relaxed));
+  // The slice also covers the padding in front of it, so that the slices cover the ring without gaps.
+  commandBuffer.addCleanupFunction([this, begin, end] { release(begin, end); });
+  return {buffer.get(), start % capacity, size, data + start % capacity};
+}
+
+void StagingRing::release(const std::uint64_t begin, std::uint64_t end) {
+  if (begin != tail.load(std::memory_order_relaxed)) {
+    released.emplace(begin, end);
+    return;
+  }
+  for (auto it = released.find(end); it != released.end(); it = released.find(end)) {
+    end = it->second;
+    released.erase(it);
+  }
+  tail.store(end, std::memory_order_release);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "src/RenderEngine/Resources/Buffer.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <ranges>
+
+class CommandBuffer;
+class GraphicsDevice;
+
+/**
+ * A persistently mapped ring of host visible memory that uploads are staged through, so that staging data neither allocates nor
+ * maps memory. Slices are taken from the head of the ring without locking. Each slice is given back when the CommandBuffer that it
+ * was taken for is cleaned up, which for uploads is once the transfer queue has finished reading from it. Data that does not fit
+ * in the free part of the ring is staged through a host coherent buffer of its own instead.
+ */
+class StagingRing {
+  GraphicsDevice* const device;
+  std::unique_ptr<Buffer> buffer;
+  std::byte* data;
+  VkDeviceSize capacity;
+  // Positions only ever grow. The offset of a position into the buffer is its remainder modulo the capacity.
+  std::atomic<std::uint64_t> head{};
+  std::atomic<std::uint64_t> tail{};
+  std::map<std::uint64_t, std::uint64_t> released;  // Slices that were given back before the slices in front of them, keyed by where they begin
+
+  /**
+   * Gives the slice from <c>begin</c> to <c>end</c> back to the ring. Slices are only given back on the thread that reclaims uploads.
+   */
+  void release(std::uint64_t begin, std::uint64_t end);
+
+public:
+  struct Allocation {
+    const Buffer* buffer;  // The buffer to copy from
+    VkDeviceSize offset;   // Where the allocation begins in <c>buffer</c>
+    VkDeviceSize size;
+    void* data;            // Where to write the data to be uploaded
+  };
+
+  /**
+   * @param device The GraphicsDevice that uploads are submitted to
+   * @param capacity The size of the ring in bytes. A power of two, so that every alignment divides it.
+   */
+  StagingRing(GraphicsDevice* device, VkDeviceSize capacity);
+  StagingRing(const StagingRing&) = delete;
+  StagingRing& operator=(const StagingRing&) = delete;
+
+  /**
+   * Takes <c>size</c> bytes of staging memory. This may be called from any thread, as long as each CommandBuffer is only recorded
+   * on one thread at a time.
+   * @param commandBuffer The CommandBuffer that will copy from the allocation. The allocation lasts until it is cleaned up.
+   * @param size The size of the allocation in bytes
+   * @param alignment The alignment of the allocation's offset. A power of two.
+   * @return The allocation, ready to be written to
+   */
+  [[nodiscard]] Allocation allocate(CommandBuffer& commandBuffer, VkDeviceSize size, VkDeviceSize alignment=16);
+
+  /**
+   * Allocates staging memory for <c>data</c>, then copies <c>data</c> into it.
+   * @see allocate
+   */
+  [[nodiscard]] Allocation stage(CommandBuffer& commandBuffer, const std::ranges::contiguous_range auto& data, const VkDeviceSize alignment=16) {
+    const VkDeviceSize size     = std::ranges::size(data) * sizeof(std::ranges::range_value_t<decltype(data)>);
+    const Allocation allocation = allocate(commandBuffer, size, alignment);
+    std::memcpy(allocation.data, std::ranges::data(data), size);
+    return allocation;
+  }
+};
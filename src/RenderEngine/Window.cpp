@@ -11,6 +11,7 @@
 #include <volk/volk.h>
 
 #include <chrono>
+#include <mutex>
 
 Window::Window(GraphicsDevice* const device) : device{device} {
   window = SDL_CreateWindow("Bootanical Gardens", 800, 600, SDL_WINDOW_VULKAN | SDL_WINDOW_MOUSE_CAPTURE);
@@ -99,6 +100,7 @@ void Window::present() const {
       .pImageIndices      = &swapchainIndex,
       .pResults           = nullptr
   };
+  std::lock_guard lock{device->globalQueueMutex};
   if (const VkResult result = vkQueuePresentKHR(device->globalQueue, &presentInfo); result != VK_SUCCESS) return GraphicsInstance::showError(result, "failed to present");
 }
 
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+namespace Tools {
+/**
+ * A linear allocator. Allocations are carved out of large blocks by bumping an offset, and are all released at once by <c>reset</c>.
+ * Deallocation does nothing, and the Arena never runs the destructors of the objects that live in it.
+ */
+class Arena final : public std::pmr::memory_resource {
+  struct Block {
+    std::unique_ptr<std::byte[]> data;
+    std::size_t size;
+  };
+
+  std::vector<Block> blocks;
+  std::size_t blockSize;
+  std::size_t blockIndex{};
+  std::size_t offset{};
+
+public:
+  explicit Arena(const std::size_t blockSize=64 * 1024) : blockSize(blockSize) {}
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  template<typename T, typename... Args> T* create(Args&&... args) { return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...); }
+
+  /**
+   * Release every allocation in constant time. The blocks are kept, so an Arena that is reset every frame stops allocating once it
+   * has grown to fit a frame.
+   */
+  void reset() {
+    blockIndex = 0;
+    offset     = 0;
+  }
+
+private:
+  void* do_allocate(const std::size_t bytes, const std::size_t alignment) override {
+    for (; blockIndex < blocks.size(); ++blockIndex, offset = 0) {
+      Block& block      = blocks[blockIndex];
+      void* pointer     = block.data.get() + offset;
+      std::size_t space = block.size - offset;
+      if (std::align(alignment, bytes, pointer, space) == nullptr) continue;
+      offset = static_cast<std::byte*>(pointer) - block.data.get() + bytes;
+      return pointer;
+    }
+    const std::size_t size = std::max(blockSize, bytes + alignment);
+    blocks.push_back({std::make_unique_for_overwrite<std::byte[]>(size), size});
+    return do_allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+  [[nodiscard]] bool do_is_equal(const memory_resource& other) const noexcept override { return this == &other; }
+};
+}
@@ -0,0 +1,142 @@
+#include "TransformHierarchy.hpp"
+
+#include "src/JobSystem.hpp"
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/matrix_decompose.hpp>
+
+#include <algorithm>
+
+std::vector<glm::vec3> TransformHierarchy::positions{};
+std::vector<glm::quat> TransformHierarchy::rotations{};
+std::vector<glm::vec3> TransformHierarchy::scales{};
+std::vector<glm::mat4> TransformHierarchy::localMatrices{};
+std::vector<glm::mat4> TransformHierarchy::worldMatrices{};
+std::vector<TransformHierarchy::Handle> TransformHierarchy::parents{};
+std::vector<Entity*> TransformHierarchy::entities{};
+std::vector<std::uint8_t> TransformHierarchy::dirty{};
+std::vector<TransformHierarchy::Handle> TransformHierarchy::changed{};
+std::vector<TransformHierarchy::Handle> TransformHierarchy::freeHandles{};
+TransformHierarchy::Handle TransformHierarchy::firstDirty{None};
+
+void TransformHierarchy::markDirty(const Handle handle) {
+  dirty[handle] = true;
+  firstDirty    = std::min(firstDirty, handle);
+}
+
+TransformHierarchy::Handle TransformHierarchy::create(Entity* entity, const glm::vec3 position, const glm::quat& rotation, const glm::vec3 scale, const Handle parent) {
+  // A freed slot may only be reused if it comes after the parent, otherwise the single forward pass in update would break.
+  if (const auto it = std::ranges::find_if(freeHandles, [parent](const Handle handle) { return parent == None || handle > parent; }); it != freeHandles.end()) {
+    const Handle handle = *it;
+    freeHandles.erase(it);
+    positions[handle] = position;
+    rotations[handle] = rotation;
+    scales[handle]    = scale;
+    parents[handle]   = parent;
+    entities[handle]  = entity;
+    markDirty(handle);
+    return handle;
+  }
+  const auto handle = static_cast<Handle>(parents.size());
+  positions.push_back(position);
+  rotations.push_back(rotation);
+  scales.push_back(scale);
+  localMatrices.emplace_back(1);
+  worldMatrices.emplace_back(1);
+  parents.push_back(parent);
+  entities.push_back(entity);
+  dirty.push_back(true);
+  firstDirty = std::min(firstDirty, handle);
+  return handle;
+}
+
+void TransformHierarchy::destroy(const Handle handle) {
+  // Children always come after their parents, so only later slots need to be searched.
+  const auto count = static_cast<Handle>(parents.size());
+  for (Handle i{handle + 1}; i < count; ++i) {
+    if (parents[i] != handle) continue;
+    glm::vec3 skew;
+    glm::vec4 perspective;
+    glm::decompose(worldMatrices[i], scales[i], rotations[i], positions[i], skew, perspective);
+    parents[i] = None;
+    markDirty(i);
+  }
+  parents[handle]  = None;
+  entities[handle] = nullptr;
+  dirty[handle]    = false;
+  freeHandles.push_back(handle);
+}
+
+glm::vec3 TransformHierarchy::getPosition(const Handle handle) {
+  return positions[handle];
+}
+
+glm::quat TransformHierarchy::getRotation(const Handle handle) {
+  return rotations[handle];
+}
+
+glm::vec3 TransformHierarchy::getScale(const Handle handle) {
+  return scales[handle];
+}
+
+TransformHierarchy::Handle TransformHierarchy::getParent(const Handle handle) {
+  return parents[handle];
+}
+
+Entity* TransformHierarchy::getEntity(const Handle handle) {
+  return entities[handle];
+}
+
+const glm::mat4& TransformHierarchy::getWorldMatrix(const Handle handle) {
+  return worldMatrices[handle];
+}
+
+void TransformHierarchy::setPosition(const Handle handle, const glm::vec3 position) {
+  if (positions[handle] == position) return;
+  positions[handle] = position;
+  markDirty(handle);
+}
+
+void TransformHierarchy::setRotation(const Handle handle, const glm::quat& rotation) {
+  if (rotations[handle] == rotation) return;
+  rotations[handle] = rotation;
+  markDirty(handle);
+}
+
+void TransformHierarchy::setScale(const Handle handle, const glm::vec3 scale) {
+  if (scales[handle] == scale) return;
+  scales[handle] = scale;
+  markDirty(handle);
+}
+
+void TransformHierarchy::update() {
+  changed.clear();
+  if (firstDirty == None) return;
+
+  // Children always come after their parents, so a single forward pass carries dirtiness down every modified subtree.
+  const auto count = static_cast<Handle>(parents.size());
+  for (Handle i{firstDirty}; i < count; ++i) {
+    if (!dirty[i] && parents[i] != None && dirty[parents[i]]) dirty[i] = true;
+    if (dirty[i]) changed.push_back(i);
+  }
+
+  // Local matrices are independent of each other, so they are composed in parallel batches straight from the SoA arrays.
+  JobSystem::parallelFor(changed.size(), 1024, [](const std::size_t begin, const std::size_t end) {
+    for (std::size_t i{begin}; i < end; ++i) {
+      const Handle handle      = changed[i];
+      const glm::mat3 rotation = glm::mat3_cast(rotations[handle]);
+      localMatrices[handle]    = glm::mat4(glm::vec4(rotation[0] * scales[handle].x, 0), glm::vec4(rotation[1] * scales[handle].y, 0), glm::vec4(rotation[2] * scales[handle].z, 0), glm::vec4(positions[handle], 1));
+    }
+  });
+
+  // World matrices depend on those of their parents, which always come earlier in the list of changes if they were modified too.
+  for (const Handle handle: changed) {
+    worldMatrices[handle] = parents[handle] == None ? localMatrices[handle] : worldMatrices[parents[handle]] * localMatrices[handle];
+    dirty[handle]         = false;
+  }
+  firstDirty = None;
+}
+
+const std::vector<TransformHierarchy::Handle>& TransformHierarchy::getChanged() {
+  return changed;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "src/Game/System.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class Entity;
+
+/**
+ * Stores the transform of every Entity in structure-of-arrays form. Transforms may have a parent, in which case their world matrix
+ * is relative to that of their parent. Parents are always created before their children, so walking the arrays in order visits
+ * every parent before any of its children.
+ * Only transforms that have been modified, and their descendants, are recomputed by <c>update</c>. When nothing has moved,
+ * <c>update</c> does no work.
+ */
+class TransformHierarchy {
+public:
+  using Handle = std::uint32_t;
+  static constexpr Handle None = UINT32_MAX;
+
+private:
+  static std::vector<glm::vec3> positions;
+  static std::vector<glm::quat> rotations;
+  static std::vector<glm::vec3> scales;
+  static std::vector<glm::mat4> localMatrices;
+  static std::vector<glm::mat4> worldMatrices;
+  static std::vector<Handle> parents;
+  static std::vector<Entity*> entities;
+  static std::vector<std::uint8_t> dirty;
+  static std::vector<Handle> changed;
+  static std::vector<Handle> freeHandles;
+  static Handle firstDirty;
+
+  static void markDirty(Handle handle);
+
+public:
+  TransformHierarchy() = delete;
+
+  /**
+   * Add a new transform to the hierarchy.
+   * @param entity The Entity that this transform belongs to
+   * @param position The position relative to <c>parent</c>
+   * @param rotation The rotation relative to <c>parent</c>
+   * @param scale The scale relative to <c>parent</c>
+   * @param parent The transform that this transform is relative to, or <c>None</c>
+   * @return A handle to the new transform
+   */
+  static Handle create(Entity* entity, glm::vec3 position, const glm::quat& rotation, glm::vec3 scale, Handle parent = None);
+
+  /**
+   * Remove a transform from the hierarchy so that its slot may be reused. Its children are detached, keeping their current world
+   * matrices as their new local transforms.
+   * @param handle The transform to remove. It must not be used afterward.
+   */
+  static void destroy(Handle handle);
+
+  [[nodiscard]] static glm::vec3 getPosition(Handle handle);
+  [[nodiscard]] static glm::quat getRotation(Handle handle);
+  [[nodiscard]] static glm::vec3 getScale(Handle handle);
+  [[nodiscard]] static Handle getParent(Handle handle);
+  [[nodiscard]] static Entity* getEntity(Handle handle);
+
+  /**
+   * @param handle The transform to query
+   * @return The world matrix of <c>handle</c> as of the last call to <c>update</c>
+   */
+  [[nodiscard]] static const glm::mat4& getWorldMatrix(Handle handle);
+
+  static void setPosition(Handle handle, glm::vec3 position);
+  static void setRotation(Handle handle, const glm::quat& rotation);
+  static void setScale(Handle handle, glm::vec3 scale);
+
+  /**
+   * Recompute the world matrices of all modified transforms and their descendants.
+   */
+  static void update();
+
+  /**
+   * @return The transforms whose world matrices were recomputed by the last call to <c>update</c>, in hierarchy order.
+   */
+  [[nodiscard]] static const std::vector<Handle>& getChanged();
+};
+
+/**
+ * Propagates modified transforms through the <c>TransformHierarchy</c>. Systems that move Entities must run before this System,
+ * and Systems that consume world matrices after it. Both orders follow from declaring access to <c>TransformHierarchy</c>.
+ */
+class TransformSystem final : public System {
+public:
+  TransformSystem() : System({}, {ECS::typeId<TransformHierarchy>()}) {}
+
+  void run() override { TransformHierarchy::update(); }
+};